@@ -10,7 +10,7 @@
 /************/
 /* Keyboard */
 /************/
-#define LAYER_NUM               1       /* Number of keymap layers. */
+#define LAYER_NUM               1       /* Number of keymap layers, up to 32. */
 #define ADVANCED_KEY_NUM        1       /* Number of analog/advanced keys. */
 #define KEY_NUM                 0       /* Number of ordinary digital keys. */
 #define POLLING_RATE            1000    /* USB report rate and keyboard tick rate. */
@@ -39,8 +39,12 @@
 // #define KEY_CALLBACK_ENABLE           /* Enable per-key press/release callbacks. */
 #define OPTIMIZE_KEY_BITMAP           /* Use the compact key bitmap update path. */
 #define OPTIMIZE_MOVING_AVERAGE_FOR_RINGBUF /* Keep a running analog-buffer sum. */
-// #define EVENT_BUFFER_LENGTH 32        /* Queued keyboard-event capacity. */
+// #define EVENT_BUFFER_LENGTH 32        /* Queued keyboard-event capacity, a power of two. */
+// #define EVENT_BUFFER_POLICY EVENT_LOOP_QUEUE_DROP_NEWEST /* Overflow policy: DROP_NEWEST or DROP_OLDEST. */
+// #define KEYBOARD_EVENT_SUBSCRIBER_NUM 8 /* Event handler/poller subscriptions per chain. */
+// #define EVENT_TIMESTAMP_ENABLE        /* Stamp events with keyboard_get_timestamp_us() at scan time. */
 // #define EVENT_CACHE_LENGTH 16         /* Cached-event entry capacity. */
+// #define EVENT_CACHE_SLOT_NUM 32       /* Cached-event hash slots, a power of two >= 2x capacity. */
 // #define EVENT_CACHE_BUFFER_LENGTH 4   /* Cached-event queue capacity. */
 
 /****************/
@@ -79,6 +83,8 @@
 #define RING_BUF_LEN             8       /* Samples retained by each ring buffer. */
 #define ANALOG_BUFFER_LENGTH     1       /* Number of libamp analog ring buffers. */
 // #define CALIBRATION_LPF_ENABLE         /* Low-pass raw values during calibration. */
+// #define ANALOG_CURVE_ENABLE            /* Per-key response curves, e.g. from Keyboard.setCurve(). */
+// #define ANALOG_CURVE_POINT_NUM 8       /* Points per response curve. */
 
 /*************/
 /* Filtering */
@@ -169,9 +175,20 @@
 // #define DYNAMICKEY_ENABLE               /* Enable dynamic-key behaviors. */
 // #define DYNAMIC_KEY_NUM 32              /* Number of dynamic-key definitions. */
 // #define DYNAMIC_KEY_HYSTERESIS A_ANTI_NORM(0.005f) /* Dynamic-key hysteresis. */
+// #define DYNAMIC_KEY_SOCD_KEY_NUM 8      /* Members per SOCD group, at most 8. */
+// #define DYNAMIC_KEY_POOL_SIZE 1024     /* Dynamic-key pool in bytes, defaults to DYNAMIC_KEY_NUM full entries. */
 // #define MACRO_ENABLE                    /* Enable macro recording and playback. */
-// #define MACRO_NUM 4                     /* Number of macro slots. */
-// #define MACRO_MAX_ACTIONS 128           /* Maximum actions per macro. */
+// #define MACRO_NUM 4                     /* Number of macro slots, at most 16. */
+// #define MACRO_BUFFER_SIZE 32            /* Macro read-ahead/write-behind buffer in bytes. */
+// #define MACRO_STREAM_SIZE 512           /* Per-macro RAM stream size without littlefs. */
+// #define COMBO_ENABLE                    /* Enable key combos (chords). */
+// #define COMBO_NUM 16                    /* Number of combo slots, at most 32. */
+// #define COMBO_KEY_NUM 4                 /* Maximum keys per combo. */
+// #define COMBO_DEFAULT_TERM KEYBOARD_TIME_TO_TICK(50) /* Default combo window. */
+// #define TAP_DANCE_ENABLE                /* Enable tap dance and hold-tap keys. */
+// #define TAP_DANCE_NUM 16                /* Number of tap dance slots, at most 32. */
+// #define TAP_DANCE_TAP_NUM 4             /* Maximum taps per tap dance. */
+// #define TAP_DANCE_DEFAULT_TERM KEYBOARD_TIME_TO_TICK(200) /* Default tapping term. */
 
 /* SCRIPT_ENABLE requires STORAGE_ENABLE and LFS_ENABLE. */
 /* SCRIPT_AOT executes stored bytecode; SCRIPT_JIT compiles stored source. */
@@ -182,6 +199,13 @@
 // #define SCRIPT_BYTECODE_BUFFER_SIZE (1 * 1024) /* Script-bytecode buffer size. */
 // #define SCRIPT_MEMORY_SIZE (4 * 1024)   /* Script runtime memory budget. */
 // #define SCRIPT_MAX_TIMERS 16            /* Maximum script timers. */
+// #define SCRIPT_TIMER_BUDGET 8           /* Expired timers run per script pass. */
+// #define SCRIPT_HOOK_BUDGET 16           /* Interrupt polls allowed per hook call. */
+// #define SCRIPT_HOOK_MAX_OVERRUNS 3      /* Aborted calls in a row before suspending. */
+// #define SCRIPT_XIP_ENABLE               /* Run AOT bytecode in place from script_flash_map(). */
+// #define SCRIPT_PROFILE_ENABLE           /* Per-hook timing and heap stats over PACKET_DATA_SCRIPT_PROFILE. */
+// #define SCRIPT_BYTECODE_CACHE_ENABLE    /* Cache JIT bytecode in littlefs, keyed by source hash. */
+// #define SCRIPT_ENGINE_VERSION 1         /* Bump after updating the engine to rebuild the cache. */
 
 /********************/
 /* Diagnostics data */
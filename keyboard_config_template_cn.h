@@ -9,7 +9,7 @@
 /************/
 /* 键盘 */
 /************/
-#define LAYER_NUM               1       /* 键位表层数。 */
+#define LAYER_NUM               1       /* 键位表层数，最多 32 层。 */
 #define ADVANCED_KEY_NUM        1       /* 模拟/高级按键数量。 */
 #define KEY_NUM                 0       /* 普通数字按键数量。 */
 #define POLLING_RATE            1000    /* USB 报告率和键盘时钟频率。 */
@@ -38,8 +38,12 @@
 // #define KEY_CALLBACK_ENABLE           /* 启用每个按键的按下/释放回调。 */
 #define OPTIMIZE_KEY_BITMAP           /* 使用紧凑的按键位图更新路径。 */
 #define OPTIMIZE_MOVING_AVERAGE_FOR_RINGBUF /* 为模拟缓冲区维护滑动求和。 */
-// #define EVENT_BUFFER_LENGTH 32        /* 键盘事件队列容量。 */
+// #define EVENT_BUFFER_LENGTH 32        /* 键盘事件队列容量，须为 2 的幂。 */
+// #define EVENT_BUFFER_POLICY EVENT_LOOP_QUEUE_DROP_NEWEST /* 溢出策略：DROP_NEWEST 或 DROP_OLDEST。 */
+// #define KEYBOARD_EVENT_SUBSCRIBER_NUM 8 /* 每条事件处理/轮询链的订阅者数量。 */
+// #define EVENT_TIMESTAMP_ENABLE        /* 扫描时用 keyboard_get_timestamp_us() 为事件打上时间戳。 */
 // #define EVENT_CACHE_LENGTH 16         /* 事件缓存条目容量。 */
+// #define EVENT_CACHE_SLOT_NUM 32       /* 事件缓存哈希槽数，须为 2 的幂且不小于容量的两倍。 */
 // #define EVENT_CACHE_BUFFER_LENGTH 4   /* 事件缓存队列容量。 */
 
 /************/
@@ -78,6 +82,8 @@
 #define RING_BUF_LEN             8       /* 每个环形缓冲区保留的采样数。 */
 #define ANALOG_BUFFER_LENGTH     1       /* libamp 模拟量环形缓冲区数量。 */
 // #define CALIBRATION_LPF_ENABLE         /* 校准时对原始值进行低通滤波。 */
+// #define ANALOG_CURVE_ENABLE            /* 按键响应曲线，例如由 Keyboard.setCurve() 设置。 */
+// #define ANALOG_CURVE_POINT_NUM 8       /* 每条响应曲线的点数。 */
 
 /********/
 /* 滤波 */
@@ -168,9 +174,20 @@
 // #define DYNAMICKEY_ENABLE               /* 启用动态按键行为。 */
 // #define DYNAMIC_KEY_NUM 32              /* 动态按键定义数量。 */
 // #define DYNAMIC_KEY_HYSTERESIS A_ANTI_NORM(0.005f) /* 动态按键迟滞量。 */
+// #define DYNAMIC_KEY_SOCD_KEY_NUM 8      /* 每个 SOCD 组的成员数，最多 8 个。 */
+// #define DYNAMIC_KEY_POOL_SIZE 1024     /* 动态按键存储池字节数，默认可容纳 DYNAMIC_KEY_NUM 个最大条目。 */
 // #define MACRO_ENABLE                    /* 启用宏录制和回放。 */
-// #define MACRO_NUM 4                     /* 宏槽数量。 */
-// #define MACRO_MAX_ACTIONS 128           /* 每个宏的最大动作数。 */
+// #define MACRO_NUM 4                     /* 宏槽数量，最多 16 个。 */
+// #define MACRO_BUFFER_SIZE 32            /* 宏预读/写回缓冲区字节数。 */
+// #define MACRO_STREAM_SIZE 512           /* 未启用 littlefs 时每个宏的 RAM 流大小。 */
+// #define COMBO_ENABLE                    /* 启用组合键（和弦）。 */
+// #define COMBO_NUM 16                    /* 组合键槽数量，最多 32。 */
+// #define COMBO_KEY_NUM 4                 /* 每个组合键的最大按键数。 */
+// #define COMBO_DEFAULT_TERM KEYBOARD_TIME_TO_TICK(50) /* 默认组合键时间窗口。 */
+// #define TAP_DANCE_ENABLE                /* 启用多击（Tap Dance）与长按/轻击键。 */
+// #define TAP_DANCE_NUM 16                /* 多击槽数量，最多 32。 */
+// #define TAP_DANCE_TAP_NUM 4             /* 每个多击的最大击键次数。 */
+// #define TAP_DANCE_DEFAULT_TERM KEYBOARD_TIME_TO_TICK(200) /* 默认轻击判定时间。 */
 /* SCRIPT_ENABLE 依赖 STORAGE_ENABLE 和 LFS_ENABLE。 */
 /* SCRIPT_AOT 执行保存的字节码；SCRIPT_JIT 编译保存的源码。 */
 // #define SCRIPT_ENABLE                   /* 启用 JavaScript 运行时。 */
@@ -180,6 +197,13 @@
 // #define SCRIPT_BYTECODE_BUFFER_SIZE (1 * 1024) /* 脚本字节码缓冲区大小。 */
 // #define SCRIPT_MEMORY_SIZE (4 * 1024)   /* 脚本运行时内存预算。 */
 // #define SCRIPT_MAX_TIMERS 16            /* 脚本定时器数量上限。 */
+// #define SCRIPT_TIMER_BUDGET 8           /* 每次脚本处理执行的到期定时器数。 */
+// #define SCRIPT_HOOK_BUDGET 16           /* 每次钩子调用允许的中断检查次数。 */
+// #define SCRIPT_HOOK_MAX_OVERRUNS 3      /* 连续超时多少次后挂起脚本。 */
+// #define SCRIPT_XIP_ENABLE               /* 通过 script_flash_map() 原地执行 AOT 字节码。 */
+// #define SCRIPT_PROFILE_ENABLE           /* 按钩子统计耗时与堆使用，通过 PACKET_DATA_SCRIPT_PROFILE 读取。 */
+// #define SCRIPT_BYTECODE_CACHE_ENABLE    /* 将 JIT 编译后的字节码按源码哈希缓存到 littlefs。 */
+// #define SCRIPT_ENGINE_VERSION 1         /* 更新引擎后递增，使缓存重新生成。 */
 
 /************/
 /* 诊断数据 */
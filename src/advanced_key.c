@@ -6,6 +6,11 @@
 #include "advanced_key.h"
 #include "keyboard_def.h"
 #include "analog.h"
+#include "string.h"
+
+#ifdef ANALOG_CURVE_ENABLE
+AnalogCurve g_advanced_key_curves[ADVANCED_KEY_NUM];
+#endif
 
 static inline bool advanced_key_update_digital_mode(AdvancedKey* advanced_key)
 {
@@ -97,6 +102,12 @@ bool advanced_key_update(AdvancedKey* advanced_key, AnalogValue value)
 #endif
 #if defined(FILTER_HYSTERESIS_ENABLE) && FILTER_DOMAIN == FILTER_DOMAIN_NORMALIZED
     value = hysteresis_filter(&g_analog_hysteresis_filters[advanced_key->key.id], value, FILTER_HYSTERESIS);
+#endif
+#ifdef ANALOG_CURVE_ENABLE
+    if (g_advanced_key_curves[advanced_key->key.id].length)
+    {
+        value = advanced_key_apply_curve(&g_advanced_key_curves[advanced_key->key.id], value);
+    }
 #endif
     advanced_key->difference = value - advanced_key->value;
     advanced_key->value = value;
@@ -253,3 +264,66 @@ AnalogValue advanced_key_get_effective_value(AdvancedKey *advanced_key)
 
     return (AnalogValue)mapped_val + ANALOG_VALUE_MIN;
 }
+
+#ifdef ANALOG_CURVE_ENABLE
+bool advanced_key_set_curve(uint16_t id, const AnalogCurvePoint *points, uint8_t length)
+{
+    if (id >= ADVANCED_KEY_NUM || length > ANALOG_CURVE_POINT_NUM)
+    {
+        return false;
+    }
+    for (uint8_t i = 1; i < length; i++)
+    {
+        if (points[i].x < points[i - 1].x)
+        {
+            return false;
+        }
+    }
+    AnalogCurve *curve = &g_advanced_key_curves[id];
+    curve->length = 0;
+    memcpy(curve->points, points, length * sizeof(AnalogCurvePoint));
+    for (uint8_t i = 0; i + 1 < length; i++)
+    {
+        int32_t dx = (int32_t)points[i + 1].x - (int32_t)points[i].x;
+        int32_t dy = (int32_t)points[i + 1].y - (int32_t)points[i].y;
+        int64_t scaled = (int64_t)dy << 16;
+        curve->slopes[i] = dx ? (int32_t)((scaled + (dy < 0 ? -dx : dx) / 2) / dx) : 0;
+    }
+    curve->length = length;
+    return true;
+}
+
+void advanced_key_reset_curves(void)
+{
+    memset(g_advanced_key_curves, 0, sizeof(g_advanced_key_curves));
+}
+
+AnalogValue advanced_key_apply_curve(const AnalogCurve *curve, AnalogValue value)
+{
+    const AnalogCurvePoint *points = curve->points;
+    if (value <= points[0].x)
+    {
+        return points[0].y;
+    }
+    uint8_t i = 1;
+    while (i < curve->length && value >= points[i].x)
+    {
+        i++;
+    }
+    if (i == curve->length)
+    {
+        return points[i - 1].y;
+    }
+    i--;
+    int32_t y = points[i].y + (int32_t)(((int64_t)(value - points[i].x) * curve->slopes[i] + 0x8000) >> 16);
+    if (y < ANALOG_VALUE_MIN)
+    {
+        return ANALOG_VALUE_MIN;
+    }
+    if (y > ANALOG_VALUE_MAX)
+    {
+        return ANALOG_VALUE_MAX;
+    }
+    return (AnalogValue)y;
+}
+#endif
@@ -81,6 +81,36 @@ typedef struct __AdvancedKey
 
 } AdvancedKey;
 
+#ifdef ANALOG_CURVE_ENABLE
+#ifndef ANALOG_CURVE_POINT_NUM
+#define ANALOG_CURVE_POINT_NUM 8
+#endif
+
+typedef struct __AnalogCurvePoint
+{
+    AnalogValue x;
+    AnalogValue y;
+} AnalogCurvePoint;
+
+/*
+ * Piecewise-linear response applied to the normalized value of analog keys.
+ * Points are sorted by x, values outside the table clamp to the end points
+ * and repeating an x makes a step, so threshold tables use the same form.
+ */
+typedef struct __AnalogCurve
+{
+    uint8_t length;
+    AnalogCurvePoint points[ANALOG_CURVE_POINT_NUM];
+    int32_t slopes[ANALOG_CURVE_POINT_NUM]; // Q16, slopes[i] spans points[i] to points[i + 1]
+} AnalogCurve;
+
+extern AnalogCurve g_advanced_key_curves[ADVANCED_KEY_NUM];
+
+bool advanced_key_set_curve(uint16_t id, const AnalogCurvePoint *points, uint8_t length);
+void advanced_key_reset_curves(void);
+AnalogValue advanced_key_apply_curve(const AnalogCurve *curve, AnalogValue value);
+#endif
+
 void advanced_key_init(AdvancedKey *advanced_key);
 bool advanced_key_update(AdvancedKey *advanced_key, AnalogValue value);
 bool advanced_key_update_raw(AdvancedKey *advanced_key, AnalogValue value);
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2026 Zhangqi Li (@zhangqili)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "combo.h"
+#include "layer.h"
+
+#include "string.h"
+
+typedef enum __ComboKeyState
+{
+    COMBO_KEY_IDLE,
+    COMBO_KEY_HELD,
+    COMBO_KEY_CONSUMED,
+    COMBO_KEY_TAPPED,
+} ComboKeyState;
+
+Combo g_combos[COMBO_NUM];
+uint16_t g_combo_hold_off[TOTAL_KEY_NUM];
+uint32_t g_combo_hold_bitmap[KEY_BITMAP_SIZE];
+
+static uint32_t combo_masks[COMBO_NUM][KEY_BITMAP_SIZE];
+static uint32_t combo_index[TOTAL_KEY_NUM];
+static uint16_t combo_key_hold_off[TOTAL_KEY_NUM];
+static uint8_t combo_key_state[TOTAL_KEY_NUM];
+static uint32_t combo_key_tick[TOTAL_KEY_NUM];
+static uint8_t combo_key_count[COMBO_NUM];
+static uint16_t combo_trigger_key[COMBO_NUM];
+static uint32_t combo_trigger_tick[COMBO_NUM];
+static uint32_t combo_active;
+static uint32_t combo_tapped;
+
+static inline uint8_t combo_ctz(uint32_t value)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(value);
+#else
+    uint8_t bit = 0;
+    while (!(value & 1))
+    {
+        value >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static inline void combo_set_held(uint16_t id, bool held)
+{
+    if (held)
+    {
+        g_combo_hold_bitmap[id / 32] |= BIT(id % 32);
+    }
+    else
+    {
+        g_combo_hold_bitmap[id / 32] &= ~BIT(id % 32);
+    }
+}
+
+static void combo_flush_key(uint16_t id)
+{
+    combo_key_state[id] = COMBO_KEY_IDLE;
+    combo_set_held(id, false);
+    keyboard_event_handler(MK_EVENT(layer_cache_get_keycode(id), KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(id)));
+}
+
+static bool combo_is_complete(uint8_t index)
+{
+    const Combo *combo = &g_combos[index];
+    for (uint16_t i = 0; i < KEY_BITMAP_SIZE; i++)
+    {
+        if (combo_masks[index][i] & ~g_combo_hold_bitmap[i])
+        {
+            return false;
+        }
+    }
+    uint32_t first = combo_key_tick[combo->key_id[0]];
+    uint32_t last = first;
+    for (uint8_t i = 0; i < combo_key_count[index]; i++)
+    {
+        const uint16_t id = combo->key_id[i];
+        if (combo_key_state[id] != COMBO_KEY_HELD)
+        {
+            return false;
+        }
+        if ((int32_t)(combo_key_tick[id] - first) < 0)
+        {
+            first = combo_key_tick[id];
+        }
+        if ((int32_t)(combo_key_tick[id] - last) > 0)
+        {
+            last = combo_key_tick[id];
+        }
+    }
+    return last - first <= combo->term;
+}
+
+static bool combo_is_possible(uint8_t index)
+{
+    const Combo *combo = &g_combos[index];
+    for (uint8_t i = 0; i < combo_key_count[index]; i++)
+    {
+        const uint16_t id = combo->key_id[i];
+        switch (combo_key_state[id])
+        {
+        case COMBO_KEY_HELD:
+            if (g_keyboard_tick - combo_key_tick[id] > combo->term)
+            {
+                return false;
+            }
+            break;
+        case COMBO_KEY_IDLE:
+            if (g_keyboard_bitmap[id / 32] & BIT(id % 32))
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// a longer combo sharing every key of this one may still complete
+static bool combo_has_pending_superset(uint8_t matched)
+{
+    const Combo *combo = &g_combos[matched];
+    uint32_t candidates = ~(combo_active | BIT(matched));
+    for (uint8_t i = 0; i < combo_key_count[matched]; i++)
+    {
+        candidates &= combo_index[combo->key_id[i]];
+    }
+    while (candidates)
+    {
+        uint8_t index = combo_ctz(candidates);
+        BIT_RESET(candidates, index);
+        if (combo_key_count[index] > combo_key_count[matched] && combo_is_possible(index))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool combo_match(uint16_t id, bool defer)
+{
+    uint32_t candidates = combo_index[id] & ~combo_active;
+    int8_t matched = -1;
+    while (candidates)
+    {
+        uint8_t index = combo_ctz(candidates);
+        BIT_RESET(candidates, index);
+        if ((matched < 0 || combo_key_count[index] > combo_key_count[matched]) && combo_is_complete(index))
+        {
+            matched = index;
+        }
+    }
+    if (matched < 0 || (defer && combo_has_pending_superset(matched)))
+    {
+        return false;
+    }
+    const Combo *combo = &g_combos[matched];
+    for (uint8_t i = 0; i < combo_key_count[matched]; i++)
+    {
+        combo_key_state[combo->key_id[i]] = COMBO_KEY_CONSUMED;
+    }
+    BIT_SET(combo_active, matched);
+    combo_trigger_key[matched] = id;
+    combo_trigger_tick[matched] = g_keyboard_tick;
+    keyboard_event_handler(MK_VIRTUAL_EVENT(combo->keycode, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(id)));
+    return true;
+}
+
+static void combo_flush_unrelated(uint16_t id)
+{
+    for (uint16_t i = 0; i < KEY_BITMAP_SIZE; i++)
+    {
+        uint32_t block = g_combo_hold_bitmap[i];
+        while (block)
+        {
+            uint8_t bit_index = combo_ctz(block);
+            BIT_RESET(block, bit_index);
+            uint16_t held_id = i * 32 + bit_index;
+            if (combo_key_state[held_id] == COMBO_KEY_HELD && !(combo_index[held_id] & combo_index[id]) &&
+                !combo_match(held_id, false))
+            {
+                combo_flush_key(held_id);
+            }
+        }
+    }
+}
+
+static void combo_send_release(uint8_t index)
+{
+    BIT_RESET(combo_active, index);
+    BIT_RESET(combo_tapped, index);
+    keyboard_event_handler(MK_VIRTUAL_EVENT(g_combos[index].keycode, KEYBOARD_EVENT_KEY_UP, keyboard_get_key(combo_trigger_key[index])));
+}
+
+static void combo_release(uint16_t id)
+{
+    uint32_t released = combo_index[id] & combo_active & ~combo_tapped;
+    while (released)
+    {
+        uint8_t index = combo_ctz(released);
+        BIT_RESET(released, index);
+        if (combo_trigger_tick[index] == g_keyboard_tick)
+        {
+            // fired and released in the same tick: keep it for one report
+            BIT_SET(combo_tapped, index);
+            continue;
+        }
+        combo_send_release(index);
+    }
+}
+
+void combo_init(void)
+{
+    while (combo_active)
+    {
+        combo_send_release(combo_ctz(combo_active));
+    }
+    for (uint16_t i = 0; i < KEY_BITMAP_SIZE; i++)
+    {
+        uint32_t block = g_combo_hold_bitmap[i];
+        while (block)
+        {
+            uint8_t bit_index = combo_ctz(block);
+            BIT_RESET(block, bit_index);
+            uint16_t id = i * 32 + bit_index;
+            if (combo_key_state[id] == COMBO_KEY_TAPPED)
+            {
+                keyboard_event_handler(MK_EVENT(layer_cache_get_keycode(id), KEYBOARD_EVENT_KEY_UP, keyboard_get_key(id)));
+            }
+        }
+    }
+    memset(combo_masks, 0, sizeof(combo_masks));
+    memset(combo_index, 0, sizeof(combo_index));
+    memset(combo_key_hold_off, 0, sizeof(combo_key_hold_off));
+    memset(combo_key_state, 0, sizeof(combo_key_state));
+    memset(combo_key_count, 0, sizeof(combo_key_count));
+    memset(g_combo_hold_bitmap, 0, sizeof(g_combo_hold_bitmap));
+    combo_active = 0;
+    for (uint8_t i = 0; i < COMBO_NUM; i++)
+    {
+        Combo *combo = &g_combos[i];
+        uint8_t count = 0;
+        while (count < COMBO_KEY_NUM && combo->key_id[count] < TOTAL_KEY_NUM)
+        {
+            count++;
+        }
+        if (combo->keycode == KEY_NO_EVENT || count < 2)
+        {
+            continue;
+        }
+        combo_key_count[i] = count;
+        for (uint8_t j = 0; j < count; j++)
+        {
+            const uint16_t id = combo->key_id[j];
+            combo_masks[i][id / 32] |= BIT(id % 32);
+            BIT_SET(combo_index[id], i);
+            if (combo->term > combo_key_hold_off[id])
+            {
+                combo_key_hold_off[id] = combo->term;
+            }
+        }
+    }
+    for (uint16_t i = 0; i < TOTAL_KEY_NUM; i++)
+    {
+        if (g_combo_hold_off[i] && combo_index[i])
+        {
+            combo_key_hold_off[i] = g_combo_hold_off[i];
+        }
+    }
+}
+
+void combo_reset(void)
+{
+    memset(g_combo_hold_off, 0, sizeof(g_combo_hold_off));
+    for (uint8_t i = 0; i < COMBO_NUM; i++)
+    {
+        g_combos[i].keycode = KEY_NO_EVENT;
+        g_combos[i].term = COMBO_DEFAULT_TERM;
+        for (uint8_t j = 0; j < COMBO_KEY_NUM; j++)
+        {
+            g_combos[i].key_id[j] = COMBO_KEY_NONE;
+        }
+    }
+    combo_init();
+}
+
+bool combo_key_event_handler(KeyboardEvent event)
+{
+    const uint16_t id = ((Key*)event.key)->id;
+    switch (event.event)
+    {
+    case KEYBOARD_EVENT_KEY_DOWN:
+        if (combo_key_state[id] == COMBO_KEY_TAPPED)
+        {
+            keyboard_event_handler(MK_EVENT(layer_cache_get_keycode(id), KEYBOARD_EVENT_KEY_UP, event.key));
+            combo_key_state[id] = COMBO_KEY_IDLE;
+            combo_set_held(id, false);
+        }
+        combo_flush_unrelated(id);
+        if (!combo_index[id])
+        {
+            return false;
+        }
+        combo_key_state[id] = COMBO_KEY_HELD;
+        combo_key_tick[id] = g_keyboard_tick;
+        combo_set_held(id, true);
+        combo_match(id, true);
+        return true;
+    case KEYBOARD_EVENT_KEY_UP:
+        if (combo_key_state[id] == COMBO_KEY_HELD)
+        {
+            combo_match(id, false);
+        }
+        switch (combo_key_state[id])
+        {
+        case COMBO_KEY_HELD:
+            // released within the hold-off: emit it as a tap, the release follows next tick
+            combo_flush_key(id);
+            combo_key_state[id] = COMBO_KEY_TAPPED;
+            combo_key_tick[id] = g_keyboard_tick;
+            combo_set_held(id, true);
+            return true;
+        case COMBO_KEY_CONSUMED:
+            combo_key_state[id] = COMBO_KEY_IDLE;
+            combo_set_held(id, false);
+            combo_release(id);
+            return true;
+        default:
+            return false;
+        }
+    default:
+        return combo_key_state[id] != COMBO_KEY_IDLE;
+    }
+}
+
+void combo_process(void)
+{
+    uint32_t tapped = combo_tapped;
+    while (tapped)
+    {
+        uint8_t index = combo_ctz(tapped);
+        BIT_RESET(tapped, index);
+        if (g_keyboard_tick != combo_trigger_tick[index])
+        {
+            combo_send_release(index);
+        }
+    }
+    for (uint16_t i = 0; i < KEY_BITMAP_SIZE; i++)
+    {
+        uint32_t block = g_combo_hold_bitmap[i];
+        while (block)
+        {
+            uint8_t bit_index = combo_ctz(block);
+            BIT_RESET(block, bit_index);
+            uint16_t id = i * 32 + bit_index;
+            switch (combo_key_state[id])
+            {
+            case COMBO_KEY_HELD:
+                if (combo_match(id, true))
+                {
+                    break;
+                }
+                if (g_keyboard_tick - combo_key_tick[id] >= combo_key_hold_off[id] && !combo_match(id, false))
+                {
+                    combo_flush_key(id);
+                }
+                break;
+            case COMBO_KEY_TAPPED:
+                if (g_keyboard_tick != combo_key_tick[id])
+                {
+                    combo_key_state[id] = COMBO_KEY_IDLE;
+                    combo_set_held(id, false);
+                    keyboard_event_handler(MK_EVENT(layer_cache_get_keycode(id), KEYBOARD_EVENT_KEY_UP, keyboard_get_key(id)));
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+void combo_add_buffer(void)
+{
+    uint32_t active = combo_active;
+    while (active)
+    {
+        uint8_t index = combo_ctz(active);
+        BIT_RESET(active, index);
+        keyboard_add_buffer(MK_EVENT(g_combos[index].keycode, KEYBOARD_EVENT_NO_EVENT, keyboard_get_key(combo_trigger_key[index])));
+    }
+    for (uint16_t i = 0; i < KEY_BITMAP_SIZE; i++)
+    {
+        uint32_t block = g_combo_hold_bitmap[i];
+        while (block)
+        {
+            uint8_t bit_index = combo_ctz(block);
+            BIT_RESET(block, bit_index);
+            uint16_t id = i * 32 + bit_index;
+            if (combo_key_state[id] == COMBO_KEY_TAPPED)
+            {
+                keyboard_add_buffer(MK_EVENT(layer_cache_get_keycode(id), KEYBOARD_EVENT_NO_EVENT, keyboard_get_key(id)));
+            }
+        }
+    }
+}
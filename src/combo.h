@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2026 Zhangqi Li (@zhangqili)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef COMBO_H_
+#define COMBO_H_
+
+#include "keyboard.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef COMBO_NUM
+#define COMBO_NUM 16
+#endif
+
+#if COMBO_NUM > 32
+#error "COMBO_NUM must not exceed 32"
+#endif
+
+#ifndef COMBO_KEY_NUM
+#define COMBO_KEY_NUM 4
+#endif
+
+#ifndef COMBO_DEFAULT_TERM
+#define COMBO_DEFAULT_TERM KEYBOARD_TIME_TO_TICK(50)
+#endif
+
+#define COMBO_KEY_NONE 0xFFFF
+
+typedef struct __Combo
+{
+    Keycode keycode;
+    uint16_t term;
+    uint16_t key_id[COMBO_KEY_NUM];
+} Combo;
+
+extern Combo g_combos[COMBO_NUM];
+extern uint16_t g_combo_hold_off[TOTAL_KEY_NUM];
+extern uint32_t g_combo_hold_bitmap[KEY_BITMAP_SIZE];
+
+void combo_init(void);
+void combo_reset(void);
+bool combo_key_event_handler(KeyboardEvent event);
+void combo_process(void);
+void combo_add_buffer(void);
+
+static inline bool combo_key_is_held(uint16_t id)
+{
+    return g_combo_hold_bitmap[id / 32] & BIT(id % 32);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMBO_H_ */
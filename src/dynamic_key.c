@@ -6,35 +6,337 @@
 
 #include "dynamic_key.h"
 #include "layer.h"
+#include "timer_wheel.h"
+
+#include "string.h"
 
 #define DK_TAP_DURATION KEYBOARD_TIME_TO_TICK(5)
 
 #define DYNAMIC_KEY_NOT_MATCH(dynamic_key, key) (KEYCODE_GET_MAIN(layer_cache_get_keycode((key)->id)) != DYNAMIC_KEY || \
-        &g_dynamic_keys[KEYCODE_GET_SUB(layer_cache_get_keycode((key)->id))] != ((DynamicKey*)(dynamic_key)))
+        dynamic_key_get(KEYCODE_GET_SUB(layer_cache_get_keycode((key)->id))) != ((DynamicKey*)(dynamic_key)))
+
+typedef struct __DynamicKeyInput
+{
+    AnalogValue value;
+    bool state;
+    bool report_state;
+} DynamicKeyInput;
+
+uint32_t g_dynamic_key_pool[(DYNAMIC_KEY_POOL_SIZE + 3) / 4];
+uint16_t g_dynamic_key_offsets[DYNAMIC_KEY_NUM + 1];
+// offsets are 16 bits wide
+typedef char dynamic_key_pool_size_check[DYNAMIC_KEY_POOL_SIZE <= 0xFFFF ? 1 : -1];
+
+static const uint8_t dynamic_key_type_sizes[DYNAMIC_KEY_TYPE_NUM] = {
+    [DYNAMIC_KEY_NONE] = 0,
+    [DYNAMIC_KEY_STROKE] = sizeof(DynamicKeyStroke4x4),
+    [DYNAMIC_KEY_MOD_TAP] = sizeof(DynamicKeyModTap),
+    [DYNAMIC_KEY_TOGGLE_KEY] = sizeof(DynamicKeyToggleKey),
+    [DYNAMIC_KEY_MUTEX] = sizeof(DynamicKeyMutex),
+    [DYNAMIC_KEY_SOCD] = sizeof(DynamicKeySOCD),
+};
+
+// pending: an input changed since the last pass, active: needs a pass every tick
+static uint32_t dynamic_key_pending[DYNAMIC_KEY_BITMAP_SIZE];
+static uint32_t dynamic_key_active[DYNAMIC_KEY_BITMAP_SIZE];
+static DynamicKeyInput dynamic_key_inputs[TOTAL_KEY_NUM];
+// time based entries share one wheel timer armed for the earliest deadline
+static TimerWheelNode dynamic_key_timer;
+static uint32_t dynamic_key_deadlines[DYNAMIC_KEY_NUM];
+static uint32_t dynamic_key_armed[DYNAMIC_KEY_BITMAP_SIZE];
+
+static inline uint8_t dynamic_key_ctz(uint32_t value)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(value);
+#else
+    uint8_t bit = 0;
+    while (!(value & 1))
+    {
+        value >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static inline void dynamic_key_sync_input(uint16_t id)
+{
+    Key *key = keyboard_get_key(id);
+    dynamic_key_inputs[id].value = keyboard_get_key_analog_value(key);
+    dynamic_key_inputs[id].state = key->state;
+    dynamic_key_inputs[id].report_state = key->report_state;
+}
+
+static inline void dynamic_key_timer_schedule(uint32_t tick)
+{
+    const int32_t delay = tick - g_keyboard_tick;
+    timer_wheel_schedule(&dynamic_key_timer, delay > 0 ? delay : 0);
+}
+
+static void dynamic_key_arm(uint8_t index, uint32_t tick)
+{
+    dynamic_key_deadlines[index] = tick;
+    BIT_SET(dynamic_key_armed[index / 32], index % 32);
+    if (!timer_wheel_is_pending(&dynamic_key_timer) || (int32_t)(tick - dynamic_key_timer.expire_tick) < 0)
+    {
+        dynamic_key_timer_schedule(tick);
+    }
+}
+
+static void dynamic_key_timer_callback(void *context)
+{
+    UNUSED(context);
+    bool armed = false;
+    uint32_t next = 0;
+    for (uint8_t i = 0; i < DYNAMIC_KEY_BITMAP_SIZE; i++)
+    {
+        uint32_t block = dynamic_key_armed[i];
+        while (block)
+        {
+            const uint8_t bit_index = dynamic_key_ctz(block);
+            const uint8_t index = i * 32 + bit_index;
+            BIT_RESET(block, bit_index);
+            if ((int32_t)(dynamic_key_deadlines[index] - g_keyboard_tick) <= 0)
+            {
+                BIT_RESET(dynamic_key_armed[i], bit_index);
+                dynamic_key_mark(index);
+            }
+            else if (!armed || (int32_t)(dynamic_key_deadlines[index] - next) < 0)
+            {
+                next = dynamic_key_deadlines[index];
+                armed = true;
+            }
+        }
+    }
+    if (armed)
+    {
+        dynamic_key_timer_schedule(next);
+    }
+}
 
-DynamicKey g_dynamic_keys[DYNAMIC_KEY_NUM];
+static void dynamic_key_s_arm(uint8_t index, const DynamicKeyStroke4x4 *dynamic_key_s)
+{
+    bool armed = false;
+    uint32_t next = 0;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        if (BIT_GET(dynamic_key_s->key_state, i) && dynamic_key_s->key_end_tick[i] != 0xFFFFFFFF &&
+            (!armed || dynamic_key_s->key_end_tick[i] < next))
+        {
+            next = dynamic_key_s->key_end_tick[i];
+            armed = true;
+        }
+    }
+    if (armed)
+    {
+        // a tap is released on the first tick past its end tick
+        dynamic_key_arm(index, next + 1);
+    }
+}
+
+static void dynamic_key_mt_arm(uint8_t index, const DynamicKeyModTap *dynamic_key_mt)
+{
+    if (keyboard_get_key(dynamic_key_mt->key_id)->state && !dynamic_key_mt->key_report_state)
+    {
+        dynamic_key_arm(index, dynamic_key_mt->begin_tick + dynamic_key_mt->duration + 1);
+    }
+    else if (dynamic_key_mt->key_report_state && dynamic_key_mt->end_tick != 0xFFFFFFFF)
+    {
+        dynamic_key_arm(index, dynamic_key_mt->end_tick + 1);
+    }
+}
+
+static bool dynamic_key_dispatch(uint8_t index, DynamicKey *dynamic_key)
+{
+    BIT_RESET(dynamic_key_armed[index / 32], index % 32);
+    switch (dynamic_key->type)
+    {
+    case DYNAMIC_KEY_STROKE:
+        dynamic_key_s_process(&dynamic_key->dks);
+        dynamic_key_sync_input(dynamic_key->dks.key_id);
+        dynamic_key_s_arm(index, &dynamic_key->dks);
+        return false;
+    case DYNAMIC_KEY_MOD_TAP:
+        dynamic_key_mt_process(&dynamic_key->mt);
+        dynamic_key_sync_input(dynamic_key->mt.key_id);
+        dynamic_key_mt_arm(index, &dynamic_key->mt);
+        return false;
+    case DYNAMIC_KEY_TOGGLE_KEY:
+        dynamic_key_tk_process(&dynamic_key->tk);
+        dynamic_key_sync_input(dynamic_key->tk.key_id);
+        return dynamic_key->tk.state;
+    case DYNAMIC_KEY_MUTEX:
+        dynamic_key_m_process(&dynamic_key->m);
+        dynamic_key_sync_input(dynamic_key->m.key_id[0]);
+        dynamic_key_sync_input(dynamic_key->m.key_id[1]);
+        return dynamic_key->m.key_report_state[0] || dynamic_key->m.key_report_state[1];
+    case DYNAMIC_KEY_SOCD:
+        dynamic_key_socd_process(&dynamic_key->socd);
+        for (uint8_t i = 0; i < dynamic_key->socd.key_num && i < DYNAMIC_KEY_SOCD_KEY_NUM; i++)
+        {
+            dynamic_key_sync_input(dynamic_key->socd.key_id[i]);
+        }
+        return dynamic_key->socd.key_report_state;
+    default:
+        return false;
+    }
+}
+
+size_t dynamic_key_type_size(uint32_t type)
+{
+    return type < DYNAMIC_KEY_TYPE_NUM ? dynamic_key_type_sizes[type] : 0;
+}
+
+static bool dynamic_key_resize(uint16_t index, uint16_t size)
+{
+    const uint16_t begin = g_dynamic_key_offsets[index];
+    const uint16_t end = g_dynamic_key_offsets[index + 1];
+    const uint16_t used = g_dynamic_key_offsets[DYNAMIC_KEY_NUM];
+    if ((size_t)used - (end - begin) + size > DYNAMIC_KEY_POOL_SIZE)
+    {
+        return false;
+    }
+    uint8_t *pool = (uint8_t *)g_dynamic_key_pool;
+    memmove(pool + begin + size, pool + end, used - end);
+    for (uint16_t i = index + 1; i <= DYNAMIC_KEY_NUM; i++)
+    {
+        g_dynamic_key_offsets[i] = g_dynamic_key_offsets[i] - (end - begin) + size;
+    }
+    return true;
+}
+
+DynamicKey *dynamic_key_emplace(uint16_t index, uint32_t type)
+{
+    const size_t size = dynamic_key_type_size(type);
+    if (index >= DYNAMIC_KEY_NUM || !dynamic_key_resize(index, size))
+    {
+        return NULL;
+    }
+    dynamic_key_mark(index);
+    DynamicKey *dynamic_key = dynamic_key_get(index);
+    if (dynamic_key)
+    {
+        memset(dynamic_key, 0, size);
+        dynamic_key->type = type;
+    }
+    return dynamic_key;
+}
+
+bool dynamic_key_set(uint16_t index, const void *dynamic_key)
+{
+    uint32_t type;
+    memcpy(&type, dynamic_key, sizeof(type));
+    if (type != DYNAMIC_KEY_NONE && !dynamic_key_type_size(type))
+    {
+        return false;
+    }
+    DynamicKey *slot = dynamic_key_emplace(index, type);
+    if (slot)
+    {
+        memcpy(slot, dynamic_key, dynamic_key_type_size(type));
+    }
+    return slot || (type == DYNAMIC_KEY_NONE && index < DYNAMIC_KEY_NUM);
+}
+
+void dynamic_key_init(void)
+{
+    timer_wheel_node_init(&dynamic_key_timer, dynamic_key_timer_callback, NULL);
+    memset(dynamic_key_armed, 0, sizeof(dynamic_key_armed));
+}
+
+void dynamic_key_clear(void)
+{
+    memset(g_dynamic_key_offsets, 0, sizeof(g_dynamic_key_offsets));
+    timer_wheel_cancel(&dynamic_key_timer);
+    memset(dynamic_key_armed, 0, sizeof(dynamic_key_armed));
+    dynamic_key_invalidate();
+}
+
+size_t dynamic_key_encode(DynamicKeyWriter writer, void *context)
+{
+    size_t size = 0;
+    for (uint16_t i = 0; i < DYNAMIC_KEY_NUM; i++)
+    {
+        const DynamicKey *dynamic_key = dynamic_key_get(i);
+        if (!dynamic_key)
+        {
+            continue;
+        }
+        const uint8_t index = i;
+        const size_t length = g_dynamic_key_offsets[i + 1] - g_dynamic_key_offsets[i];
+        if (writer)
+        {
+            writer(context, &index, sizeof(index));
+            writer(context, dynamic_key, length);
+        }
+        size += sizeof(index) + length;
+    }
+    return size;
+}
+
+void dynamic_key_invalidate(void)
+{
+    memset(dynamic_key_pending, 0xFF, sizeof(dynamic_key_pending));
+}
+
+void dynamic_key_mark(uint8_t index)
+{
+    if (index < DYNAMIC_KEY_NUM)
+    {
+        BIT_SET(dynamic_key_pending[index / 32], index % 32);
+    }
+}
+
+void dynamic_key_key_update(Key *key)
+{
+    const DynamicKeyInput *input = &dynamic_key_inputs[key->id];
+    if (input->state != key->state ||
+        input->report_state != key->report_state ||
+        input->value != keyboard_get_key_analog_value(key))
+    {
+        dynamic_key_mark(KEYCODE_GET_SUB(layer_cache_get_keycode(key->id)));
+    }
+}
 
 void dynamic_key_process(void)
 {
-    for (int i = 0; i < DYNAMIC_KEY_NUM && g_dynamic_keys[i].type != DYNAMIC_KEY_NONE; i++)
+    uint8_t num = DYNAMIC_KEY_NUM;
+    bool counted = false;
+    for (uint8_t i = 0; i < DYNAMIC_KEY_BITMAP_SIZE; i++)
     {
-        DynamicKey * dynamic_key = &g_dynamic_keys[i];
-        switch (dynamic_key->type)
+        uint32_t remaining = 0xFFFFFFFF;
+        uint32_t block;
+        // re-read the masks after every entry, processing may mark later ones
+        while ((block = (dynamic_key_pending[i] | dynamic_key_active[i]) & remaining))
         {
-        case DYNAMIC_KEY_STROKE:
-            dynamic_key_s_process((DynamicKeyStroke4x4*)dynamic_key);
-            break;
-        case DYNAMIC_KEY_MOD_TAP:
-            dynamic_key_mt_process((DynamicKeyModTap*)dynamic_key);
-            break;
-        case DYNAMIC_KEY_TOGGLE_KEY:
-            dynamic_key_tk_process((DynamicKeyToggleKey*)dynamic_key);
-            break;
-        case DYNAMIC_KEY_MUTEX:
-            dynamic_key_m_process((DynamicKeyMutex*)dynamic_key);
-            break;
-        default:
-            break;
+            const uint8_t bit_index = dynamic_key_ctz(block);
+            const uint8_t index = i * 32 + bit_index;
+            remaining = bit_index < 31 ? 0xFFFFFFFF << (bit_index + 1) : 0;
+            if (!counted)
+            {
+                // entries after the first empty slot are not in use
+                num = 0;
+                while (num < DYNAMIC_KEY_NUM && dynamic_key_get(num))
+                {
+                    num++;
+                }
+                counted = true;
+            }
+            if (index >= num)
+            {
+                memset(dynamic_key_pending, 0, sizeof(dynamic_key_pending));
+                return;
+            }
+            BIT_RESET(dynamic_key_pending[i], bit_index);
+            if (dynamic_key_dispatch(index, dynamic_key_get(index)))
+            {
+                BIT_SET(dynamic_key_active[i], bit_index);
+            }
+            else
+            {
+                BIT_RESET(dynamic_key_active[i], bit_index);
+            }
         }
     }
 }
@@ -80,6 +382,18 @@ void _dynamic_key_add_buffer(DynamicKey*dynamic_key)
             keyboard_add_buffer(MK_EVENT(dynamic_key_m->key_binding[1], KEYBOARD_EVENT_NO_EVENT,  keyboard_get_key(dynamic_key_m->key_id[1])));
         break;
     }
+    case DYNAMIC_KEY_SOCD:
+    {
+        DynamicKeySOCD*dynamic_key_socd=(DynamicKeySOCD*)dynamic_key;
+        uint8_t report = dynamic_key_socd->key_report_state;
+        while (report)
+        {
+            uint8_t i = dynamic_key_ctz(report);
+            BIT_RESET(report, i);
+            keyboard_add_buffer(MK_EVENT(dynamic_key_socd->key_binding[i], KEYBOARD_EVENT_NO_EVENT, keyboard_get_key(dynamic_key_socd->key_id[i])));
+        }
+        break;
+    }
     default:
         break;
     }
@@ -87,9 +401,9 @@ void _dynamic_key_add_buffer(DynamicKey*dynamic_key)
 
 void dynamic_key_add_buffer(void)
 {
-    for (int i = 0; i < DYNAMIC_KEY_NUM && g_dynamic_keys[i].type != DYNAMIC_KEY_NONE; i++)
+    DynamicKey*dynamic_key;
+    for (int i = 0; i < DYNAMIC_KEY_NUM && (dynamic_key = dynamic_key_get(i)); i++)
     {
-        DynamicKey*dynamic_key = &g_dynamic_keys[i];
         _dynamic_key_add_buffer(dynamic_key);
     }
 }
@@ -339,3 +653,117 @@ void dynamic_key_m_process(DynamicKeyMutex*dynamic_key)
     dynamic_key_m->key_report_state[0] = next_key0_report_state;
     dynamic_key_m->key_report_state[1] = next_key1_report_state;
 }
+
+static uint8_t dynamic_key_socd_deepest(DynamicKeySOCD*dynamic_key, uint8_t state, uint8_t winner)
+{
+    // the current winner keeps the key until another member is deeper by the hysteresis
+    AnalogValue best_value = 0;
+    uint8_t best = winner;
+    if (winner)
+    {
+        const AnalogValue value = keyboard_get_key_analog_value(keyboard_get_key(dynamic_key->key_id[dynamic_key_ctz(winner)]));
+        best_value = value > ANALOG_VALUE_MAX - DYNAMIC_KEY_HYSTERESIS ? ANALOG_VALUE_MAX : value + DYNAMIC_KEY_HYSTERESIS;
+    }
+    uint8_t candidates = state & ~winner;
+    while (candidates)
+    {
+        const uint8_t i = dynamic_key_ctz(candidates);
+        BIT_RESET(candidates, i);
+        const AnalogValue value = keyboard_get_key_analog_value(keyboard_get_key(dynamic_key->key_id[i]));
+        if (!best || value > best_value)
+        {
+            best = BIT(i);
+            best_value = value;
+        }
+    }
+    return best;
+}
+
+void dynamic_key_socd_process(DynamicKeySOCD*dynamic_key)
+{
+    const uint8_t num = dynamic_key->key_num < DYNAMIC_KEY_SOCD_KEY_NUM ? dynamic_key->key_num : DYNAMIC_KEY_SOCD_KEY_NUM;
+    uint8_t state = 0;
+    bool value_changed = false;
+    for (uint8_t i = 0; i < num; i++)
+    {
+        Key *key = keyboard_get_key(dynamic_key->key_id[i]);
+        if (DYNAMIC_KEY_NOT_MATCH(dynamic_key, key))
+        {
+            return;
+        }
+        if (key->state)
+        {
+            state |= BIT(i);
+            value_changed |= dynamic_key_inputs[key->id].value != keyboard_get_key_analog_value(key);
+        }
+    }
+    const uint8_t released = dynamic_key->key_state & ~state;
+    uint8_t pressed = state & ~dynamic_key->key_state;
+    if (released)
+    {
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < dynamic_key->order_num; i++)
+        {
+            if (!(released & BIT(dynamic_key->order[i])))
+            {
+                dynamic_key->order[count++] = dynamic_key->order[i];
+            }
+        }
+        dynamic_key->order_num = count;
+    }
+    while (pressed && dynamic_key->order_num < DYNAMIC_KEY_SOCD_KEY_NUM)
+    {
+        const uint8_t i = dynamic_key_ctz(pressed);
+        BIT_RESET(pressed, i);
+        dynamic_key->order[dynamic_key->order_num++] = i;
+    }
+
+    const uint8_t last_report = dynamic_key->key_report_state;
+    uint8_t next_report = 0;
+    switch (dynamic_key->mode)
+    {
+    case DK_SOCD_LAST_PRIORITY:
+        if (dynamic_key->order_num)
+        {
+            next_report = BIT(dynamic_key->order[dynamic_key->order_num - 1]);
+        }
+        break;
+    case DK_SOCD_FIRST_PRIORITY:
+        if (dynamic_key->order_num)
+        {
+            next_report = BIT(dynamic_key->order[0]);
+        }
+        break;
+    case DK_SOCD_DISTANCE_PRIORITY:
+        next_report = last_report & state;
+        if (state != dynamic_key->key_state || value_changed || !next_report)
+        {
+            next_report = dynamic_key_socd_deepest(dynamic_key, state, next_report);
+        }
+        break;
+    case DK_SOCD_NEUTRAL:
+        if (!(state & (state - 1)))
+        {
+            next_report = state;
+        }
+        break;
+    case DK_SOCD_ORDER_PRIORITY:
+        next_report = state & (uint8_t)(~state + 1);
+        break;
+    default:
+        break;
+    }
+
+    // only members that are held or were reported can need an event or a report state override
+    uint8_t members = state | last_report | next_report;
+    while (members)
+    {
+        const uint8_t i = dynamic_key_ctz(members);
+        BIT_RESET(members, i);
+        Key *key = keyboard_get_key(dynamic_key->key_id[i]);
+        keyboard_event_handler(MK_EVENT(dynamic_key->key_binding[i], CALC_EVENT(BIT_GET(last_report, i), BIT_GET(next_report, i)), key));
+        keyboard_key_set_report_state(key, BIT_GET(next_report, i));
+    }
+    dynamic_key->key_state = state;
+    dynamic_key->key_report_state = next_report;
+}
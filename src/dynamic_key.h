@@ -17,6 +17,20 @@ extern "C" {
 #define DYNAMIC_KEY_NUM 32
 #endif
 
+#if DYNAMIC_KEY_NUM > 256
+#error "DYNAMIC_KEY_NUM must not exceed 256"
+#endif
+
+#define DYNAMIC_KEY_BITMAP_SIZE ((DYNAMIC_KEY_NUM + 31) / 32)
+
+#ifndef DYNAMIC_KEY_SOCD_KEY_NUM
+#define DYNAMIC_KEY_SOCD_KEY_NUM 8
+#endif
+
+#if DYNAMIC_KEY_SOCD_KEY_NUM > 8
+#error "DYNAMIC_KEY_SOCD_KEY_NUM must not exceed 8"
+#endif
+
 #ifndef DYNAMIC_KEY_HYSTERESIS
 #define DYNAMIC_KEY_HYSTERESIS A_ANTI_NORM(0.005f)
 #endif
@@ -28,6 +42,7 @@ typedef enum __DynamicKeyType
     DYNAMIC_KEY_MOD_TAP,
     DYNAMIC_KEY_TOGGLE_KEY,
     DYNAMIC_KEY_MUTEX,
+    DYNAMIC_KEY_SOCD,
     DYNAMIC_KEY_TYPE_NUM
 } DynamicKeyType;
 
@@ -104,6 +119,29 @@ typedef struct __DynamicKeyMutex
     HysteresisFilter filtered_value[2];
 } DynamicKeyMutex;
 
+typedef enum __DynamicKeySOCDMode
+{
+    DK_SOCD_LAST_PRIORITY,
+    DK_SOCD_FIRST_PRIORITY,
+    DK_SOCD_DISTANCE_PRIORITY,
+    DK_SOCD_NEUTRAL,
+    DK_SOCD_ORDER_PRIORITY,
+} DynamicKeySOCDMode;
+
+typedef struct __DynamicKeySOCD
+{
+    uint32_t type;
+    Keycode key_binding[DYNAMIC_KEY_SOCD_KEY_NUM];
+    uint16_t key_id[DYNAMIC_KEY_SOCD_KEY_NUM];
+    uint8_t mode;
+    uint8_t key_num;
+    uint8_t key_state;
+    uint8_t key_report_state;
+    // held members, oldest press first
+    uint8_t order[DYNAMIC_KEY_SOCD_KEY_NUM];
+    uint8_t order_num;
+} DynamicKeySOCD;
+
 typedef union __DynamicKey
 {
     uint32_t type;
@@ -111,17 +149,55 @@ typedef union __DynamicKey
     DynamicKeyModTap mt;
     DynamicKeyToggleKey tk;
     DynamicKeyMutex m;
+    DynamicKeySOCD socd;
     uint32_t aligned_buffer[14];
 } DynamicKey;
 
-extern DynamicKey g_dynamic_keys[DYNAMIC_KEY_NUM];
+/*
+ * Dynamic keys are packed back to back in slot order, each taking only the
+ * size of its own type. Slot i spans [g_dynamic_key_offsets[i], g_dynamic_key_offsets[i + 1]),
+ * an empty slot spans nothing.
+ */
+#ifndef DYNAMIC_KEY_POOL_SIZE
+#define DYNAMIC_KEY_POOL_SIZE (DYNAMIC_KEY_NUM * sizeof(DynamicKey))
+#endif
+
+typedef size_t (*DynamicKeyWriter)(void *context, const void *data, size_t size);
+
+extern uint32_t g_dynamic_key_pool[(DYNAMIC_KEY_POOL_SIZE + 3) / 4];
+extern uint16_t g_dynamic_key_offsets[DYNAMIC_KEY_NUM + 1];
+
+static inline DynamicKey *dynamic_key_get(uint16_t index)
+{
+    if (index >= DYNAMIC_KEY_NUM || g_dynamic_key_offsets[index] == g_dynamic_key_offsets[index + 1])
+    {
+        return NULL;
+    }
+    return (DynamicKey *)((uint8_t *)g_dynamic_key_pool + g_dynamic_key_offsets[index]);
+}
+
+static inline size_t dynamic_key_pool_used(void)
+{
+    return g_dynamic_key_offsets[DYNAMIC_KEY_NUM];
+}
+
+void dynamic_key_init(void);
+size_t dynamic_key_type_size(uint32_t type);
+DynamicKey *dynamic_key_emplace(uint16_t index, uint32_t type);
+bool dynamic_key_set(uint16_t index, const void *dynamic_key);
+void dynamic_key_clear(void);
+size_t dynamic_key_encode(DynamicKeyWriter writer, void *context);
 
+void dynamic_key_invalidate(void);
+void dynamic_key_mark(uint8_t index);
+void dynamic_key_key_update(Key *key);
 void dynamic_key_process(void);
 void dynamic_key_add_buffer(void);
 void dynamic_key_s_process (DynamicKeyStroke4x4*dynamic_key);
 void dynamic_key_mt_process(DynamicKeyModTap*dynamic_key);
 void dynamic_key_tk_process(DynamicKeyToggleKey*dynamic_key);
 void dynamic_key_m_process (DynamicKeyMutex*dynamic_key);
+void dynamic_key_socd_process(DynamicKeySOCD*dynamic_key);
 
 #ifdef __cplusplus
 }
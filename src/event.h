@@ -6,8 +6,13 @@
 #ifndef EVENT_H
 #define EVENT_H
 #include "stdint.h"
+#include "keyboard_config.h"
 #include "keycode.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef enum
 {
     KEYBOARD_EVENT_NO_EVENT  = 0x00,
@@ -24,11 +29,25 @@ typedef struct
     uint8_t event;
     uint8_t is_virtual;
     void* key;
+#ifdef EVENT_TIMESTAMP_ENABLE
+    uint32_t timestamp;
+#endif
 } KeyboardEvent;
+#ifdef EVENT_TIMESTAMP_ENABLE
+// microseconds, latched once per scan so every event of that scan shares it
+extern uint32_t g_keyboard_event_timestamp;
+#define MK_EVENT(keycode, event, key) ((KeyboardEvent){(keycode), (event), false, (key), g_keyboard_event_timestamp})
+#define MK_VIRTUAL_EVENT(keycode, event, key) ((KeyboardEvent){(keycode), (event), true, (key), g_keyboard_event_timestamp})
+#else
 #define MK_EVENT(keycode, event, key) ((KeyboardEvent){(keycode), (event), false, (key)})
 #define MK_VIRTUAL_EVENT(keycode, event, key) ((KeyboardEvent){(keycode), (event), true, (key)})
+#endif
 #define CALC_EVENT(state, next_state) ((((bool)(state)) != ((bool)(next_state))) | (((bool)(next_state)) << 1))
 #define EVENT_CHANGED(event) ((event) & 0x01)
 #define EVENT_STATE(event) (((event) >> 1) & 0x01)
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif //EVENT_H
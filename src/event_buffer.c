@@ -5,27 +5,148 @@
  */
 #include "event_buffer.h"
 
+#if defined(__GNUC__)
+#define EVENT_LOOP_QUEUE_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define EVENT_LOOP_QUEUE_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_2)
+#define EVENT_LOOP_QUEUE_CAS(p, expected, desired) \
+    __atomic_compare_exchange_n((p), (expected), (desired), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#endif
+#else
+#ifndef EVENT_LOOP_QUEUE_BARRIER
+#define EVENT_LOOP_QUEUE_BARRIER()
+#endif
+static inline uint16_t event_loop_queue_load(const uint16_t *p)
+{
+    uint16_t value = *(const volatile uint16_t *)p;
+    EVENT_LOOP_QUEUE_BARRIER();
+    return value;
+}
+static inline void event_loop_queue_store(uint16_t *p, uint16_t value)
+{
+    EVENT_LOOP_QUEUE_BARRIER();
+    *(volatile uint16_t *)p = value;
+}
+#define EVENT_LOOP_QUEUE_LOAD(p) event_loop_queue_load(p)
+#define EVENT_LOOP_QUEUE_STORE(p, v) event_loop_queue_store((p), (v))
+#endif
+
 void event_loop_queue_init(EventLoopQueue *q, EventLoopQueueElm *data, uint16_t len)
 {
+    // round down to a power of two so indices can be masked
+    while (len & (len - 1))
+    {
+        len &= len - 1;
+    }
     q->data = data;
     q->front = 0;
     q->rear = 0;
-    q->len = len;
+    q->mask = len - 1;
+    q->policy = EVENT_BUFFER_POLICY;
+    q->high_water = 0;
+    q->dropped = 0;
+    q->stats_request = 0;
+    q->stats_ack = 0;
+}
+
+void event_loop_queue_set_policy(EventLoopQueue *q, uint8_t policy)
+{
+    if (policy >= EVENT_LOOP_QUEUE_POLICY_NUM)
+    {
+        return;
+    }
+#ifndef EVENT_LOOP_QUEUE_CAS
+    // dropping the oldest element races with the consumer without a CAS
+    if (policy == EVENT_LOOP_QUEUE_DROP_OLDEST)
+    {
+        policy = EVENT_LOOP_QUEUE_DROP_NEWEST;
+    }
+#endif
+    q->policy = policy;
+}
+
+void event_loop_queue_reset_stats(EventLoopQueue *q)
+{
+    EVENT_LOOP_QUEUE_STORE(&q->stats_request, (uint16_t)(q->stats_request + 1));
+}
+
+static inline void event_loop_queue_sync_stats(EventLoopQueue *q)
+{
+    const uint16_t request = EVENT_LOOP_QUEUE_LOAD(&q->stats_request);
+    if (request != q->stats_ack)
+    {
+        q->high_water = 0;
+        q->dropped = 0;
+        EVENT_LOOP_QUEUE_STORE(&q->stats_ack, request);
+    }
+}
+
+bool event_loop_queue_try_pop(EventLoopQueue *q, EventLoopQueueElm *t)
+{
+    uint16_t front = EVENT_LOOP_QUEUE_LOAD(&q->front);
+#ifdef EVENT_LOOP_QUEUE_CAS
+    // the producer may advance front under DROP_OLDEST, a stale copy is discarded
+    do
+    {
+        if (front == EVENT_LOOP_QUEUE_LOAD(&q->rear))
+        {
+            return false;
+        }
+        *t = q->data[front & q->mask];
+    } while (!EVENT_LOOP_QUEUE_CAS(&q->front, &front, (uint16_t)(front + 1)));
+#else
+    if (front == EVENT_LOOP_QUEUE_LOAD(&q->rear))
+    {
+        return false;
+    }
+    *t = q->data[front & q->mask];
+    EVENT_LOOP_QUEUE_STORE(&q->front, (uint16_t)(front + 1));
+#endif
+    return true;
 }
 
 EventLoopQueueElm event_loop_queue_pop(EventLoopQueue *q)
 {
     EventLoopQueueElm a = {{0}, 0};
-    if (q->front == q->rear)
-        return a;
-    q->front = (q->front + 1) % (q->len);
-    return q->data[(q->front + q->len - 1) % (q->len)];
+    event_loop_queue_try_pop(q, &a);
+    return a;
 }
 
-void event_loop_queue_push(EventLoopQueue *q, EventLoopQueueElm t)
+bool event_loop_queue_push(EventLoopQueue *q, EventLoopQueueElm t)
 {
-    if (((q->rear + 1) % (q->len)) == q->front)
-        return;
-    q->data[q->rear] = t;
-    q->rear = (q->rear + 1) % (q->len);
+    event_loop_queue_sync_stats(q);
+    const uint16_t rear = q->rear;
+    uint16_t front = EVENT_LOOP_QUEUE_LOAD(&q->front);
+    uint16_t size = rear - front;
+    if (size > q->mask)
+    {
+#ifdef EVENT_LOOP_QUEUE_CAS
+        if (q->policy != EVENT_LOOP_QUEUE_DROP_OLDEST)
+        {
+            q->dropped++;
+            return false;
+        }
+        if (EVENT_LOOP_QUEUE_CAS(&q->front, &front, (uint16_t)(front + 1)))
+        {
+            front++;
+            q->dropped++;
+        }
+        size = rear - front;
+        if (size > q->mask)
+        {
+            q->dropped++;
+            return false;
+        }
+#else
+        q->dropped++;
+        return false;
+#endif
+    }
+    q->data[rear & q->mask] = t;
+    EVENT_LOOP_QUEUE_STORE(&q->rear, (uint16_t)(rear + 1));
+    if (size + 1 > q->high_water)
+    {
+        q->high_water = size + 1;
+    }
+    return true;
 }
@@ -16,8 +16,29 @@ extern "C" {
 #define EVENT_BUFFER_LENGTH 32
 #endif
 
-#define event_loop_queue_foreach(q, type, item) for (uint16_t __index = (q)->front; __index != (q)->rear; __index = (__index + 1) % (q)->len)\
-                                              for (type *item = &((q)->data[__index]); item; item = NULL)
+#if (EVENT_BUFFER_LENGTH & (EVENT_BUFFER_LENGTH - 1)) != 0
+#error "EVENT_BUFFER_LENGTH must be a power of two"
+#endif
+
+#ifndef EVENT_BUFFER_POLICY
+#define EVENT_BUFFER_POLICY EVENT_LOOP_QUEUE_DROP_NEWEST
+#endif
+
+/*
+ * Single-producer/single-consumer ring. rear is only written by the producer,
+ * front by the consumer and, under DROP_OLDEST, by a producer CAS; both run
+ * freely and are masked on access. Statistics belong to the producer, the
+ * consumer only requests a reset through stats_request.
+ */
+#define event_loop_queue_foreach(q, type, item) for (uint16_t __index = (q)->front; __index != (q)->rear; __index++)\
+                                              for (type *item = &((q)->data[__index & (q)->mask]); item; item = NULL)
+
+typedef enum __EventLoopQueuePolicy
+{
+    EVENT_LOOP_QUEUE_DROP_NEWEST,
+    EVENT_LOOP_QUEUE_DROP_OLDEST,
+    EVENT_LOOP_QUEUE_POLICY_NUM
+} EventLoopQueuePolicy;
 
 typedef struct __EventArgument
 {
@@ -30,16 +51,46 @@ typedef EventArgument EventLoopQueueElm;
 typedef struct __EventLoopQueue
 {
     EventLoopQueueElm *data;
-    int16_t front;
-    int16_t rear;
-    int16_t len;
+    uint16_t front;
+    uint16_t rear;
+    uint16_t mask;
+    uint16_t high_water;
+    uint32_t dropped;
+    uint16_t stats_request;
+    uint16_t stats_ack;
+    uint8_t policy;
 } EventLoopQueue;
 
 typedef EventLoopQueue EventBuffer;
 
+extern EventLoopQueue g_keyboard_event_buffer;
+
 void event_loop_queue_init(EventLoopQueue* q, EventLoopQueueElm*data, uint16_t len);
+void event_loop_queue_set_policy(EventLoopQueue* q, uint8_t policy);
+void event_loop_queue_reset_stats(EventLoopQueue* q);
+bool event_loop_queue_try_pop(EventLoopQueue* q, EventLoopQueueElm *t);
 EventLoopQueueElm event_loop_queue_pop(EventLoopQueue* q);
-void event_loop_queue_push(EventLoopQueue* q, EventLoopQueueElm t);
+bool event_loop_queue_push(EventLoopQueue* q, EventLoopQueueElm t);
+
+static inline uint16_t event_loop_queue_capacity(const EventLoopQueue* q)
+{
+    return q->mask + 1;
+}
+
+static inline bool event_loop_queue_stats_pending(const EventLoopQueue* q)
+{
+    return *(const volatile uint16_t *)&q->stats_request != *(const volatile uint16_t *)&q->stats_ack;
+}
+
+static inline uint16_t event_loop_queue_high_water(const EventLoopQueue* q)
+{
+    return event_loop_queue_stats_pending(q) ? 0 : q->high_water;
+}
+
+static inline uint32_t event_loop_queue_dropped(const EventLoopQueue* q)
+{
+    return event_loop_queue_stats_pending(q) ? 0 : q->dropped;
+}
 
 #ifdef __cplusplus
 }
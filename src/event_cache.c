@@ -6,159 +6,185 @@
 #include "event_cache.h"
 #include "event_buffer.h"
 
-EventCacheList g_event_buffer_list;
-static EventCacheListNode event_buffer_list_buffer[EVENT_CACHE_LENGTH];
+#define EVENT_CACHE_SLOT_EMPTY (-1)
+
+EventCacheTable g_event_cache;
+static EventCacheNode event_cache_nodes[EVENT_CACHE_LENGTH];
+static int16_t event_cache_slots[EVENT_CACHE_SLOT_NUM];
 
 static EventLoopQueueElm event_cache_buffers[EVENT_CACHE_BUFFER_LENGTH];
 static EventLoopQueue event_cache_buffer;
 
 void event_cache_init(void)
 {
-    event_forward_list_init(&g_event_buffer_list, event_buffer_list_buffer, EVENT_CACHE_LENGTH);
+    event_cache_table_init(&g_event_cache, event_cache_nodes, EVENT_CACHE_LENGTH, event_cache_slots, EVENT_CACHE_SLOT_NUM);
     event_loop_queue_init(&event_cache_buffer, event_cache_buffers, EVENT_CACHE_BUFFER_LENGTH);
 }
 
 void event_cache_add_buffer(void)
 {
-    EventCacheList * list = &g_event_buffer_list;
-    EventCacheListNode * last_node = &list->data[list->head];
-    UNUSED(last_node);
-    event_loop_queue_foreach(&event_cache_buffer, EventLoopQueueElm, event)
+    EventLoopQueueElm event;
+    while (event_loop_queue_try_pop(&event_cache_buffer, &event))
     {
-        event_cache_push(event->event, (void*)event->tick);
-        event_loop_queue_pop(&event_cache_buffer);
+        event_cache_push(event.event, (void*)event.tick);
     }
-    for (int16_t iterator = list->data[list->head].next; iterator >= 0;)
+    event_cache_table_foreach(&g_event_cache, item)
     {
-        EventCacheListNode* node = &(list->data[iterator]);
-        EventCache *item = &(node->data);
         keyboard_add_buffer(item->event);
-        last_node = node;
-        iterator = list->data[iterator].next;
     }
 }
 
-void event_forward_list_init(EventCacheList* list, EventCacheListNode* data, uint16_t len)
+static inline uint16_t event_cache_hash(const EventCacheTable* table, void* owner, Keycode keycode)
 {
-    list->data = data;
-    list->head = -1;
-    list->tail = 0;
-    list->len = len;
-    for (int i = 0; i < len; i++)
-    {
-        list->data[i].next = i + 1;
-    }
-    list->data[len - 1].next = -1;
-    list->free_node = 0;
-    event_forward_list_push_front(list, (EventCache){MK_EVENT(0,0,NULL),NULL});
+    uint32_t hash = (uint32_t)((uintptr_t)owner >> 2) ^ ((uint32_t)keycode * 0x9E3779B1u);
+    hash ^= hash >> 16;
+    return hash & table->slot_mask;
 }
 
-void event_forward_list_erase_after(EventCacheList* list, EventCacheListNode* data)
+static int16_t event_cache_lookup(EventCacheTable* table, void* owner, Keycode keycode, void* key, bool match_key)
 {
-    int16_t target = 0;
-    target = data->next;
-    data->next = list->data[target].next;
-    list->data[target].next = list->free_node;
-    list->free_node = target;
+    for (uint16_t slot = event_cache_hash(table, owner, keycode);; slot = (slot + 1) & table->slot_mask)
+    {
+        const int16_t index = table->slots[slot];
+        if (index == EVENT_CACHE_SLOT_EMPTY)
+        {
+            return EVENT_CACHE_NONE;
+        }
+        const EventCache *item = &table->nodes[index].data;
+        if (item->owner == owner && item->event.keycode == keycode && (!match_key || item->event.key == key))
+        {
+            return index;
+        }
+    }
 }
 
-void event_forward_list_insert_after(EventCacheList* list, EventCacheListNode* data, EventCache t)
+void event_cache_table_init(EventCacheTable* table, EventCacheNode* nodes, uint16_t len, int16_t* slots, uint16_t slot_num)
 {
-    if (list->free_node == -1)
+    table->nodes = nodes;
+    table->slots = slots;
+    table->len = len;
+    table->slot_mask = slot_num - 1;
+    table->head = EVENT_CACHE_NONE;
+    table->count = 0;
+    table->overflow = 0;
+    for (uint16_t i = 0; i < len; i++)
     {
-        return;
+        nodes[i].next = i + 1 < len ? i + 1 : EVENT_CACHE_NONE;
+    }
+    table->free_node = len ? 0 : EVENT_CACHE_NONE;
+    for (uint16_t i = 0; i < slot_num; i++)
+    {
+        slots[i] = EVENT_CACHE_SLOT_EMPTY;
     }
-    int16_t new_node = list->free_node;
-    list->free_node = list->data[list->free_node].next;
-
-    list->data[new_node].data = t;
-    list->data[new_node].next = data->next;
-
-    data->next = new_node;
 }
 
-void event_forward_list_push_front(EventCacheList* list, EventCache t)
+bool event_cache_table_insert(EventCacheTable* table, EventCache t)
 {
-    if (list->free_node == -1)
+    if (table->free_node == EVENT_CACHE_NONE)
     {
-        return;
+        table->overflow++;
+        return false;
     }
-    int16_t new_node = list->free_node;
-    list->free_node = list->data[list->free_node].next;
+    const int16_t index = table->free_node;
+    EventCacheNode *node = &table->nodes[index];
+    table->free_node = node->next;
 
-    list->data[new_node].data = t;
-    list->data[new_node].next = list->head;
+    uint16_t slot = event_cache_hash(table, t.owner, t.event.keycode);
+    while (table->slots[slot] != EVENT_CACHE_SLOT_EMPTY)
+    {
+        slot = (slot + 1) & table->slot_mask;
+    }
+    table->slots[slot] = index;
+
+    node->data = t;
+    node->slot = slot;
+    node->prev = EVENT_CACHE_NONE;
+    node->next = table->head;
+    if (table->head != EVENT_CACHE_NONE)
+    {
+        table->nodes[table->head].prev = index;
+    }
+    table->head = index;
+    table->count++;
+    return true;
+}
 
-    list->head = new_node;
+int16_t event_cache_table_find(EventCacheTable* table, void* owner, Keycode keycode)
+{
+    return event_cache_lookup(table, owner, keycode, NULL, false);
 }
 
-void event_forward_list_remove_first(EventCacheList* list, EventCache t)
+void event_cache_table_remove(EventCacheTable* table, int16_t index)
 {
-    EventCacheListNode * last_node = &list->data[list->head];
-    for (int16_t iterator = list->data[list->head].next; iterator >= 0;)
+    EventCacheNode *node = &table->nodes[index];
+    // backward-shift deletion keeps probe chains intact without tombstones
+    uint16_t hole = node->slot;
+    for (uint16_t slot = (hole + 1) & table->slot_mask; table->slots[slot] != EVENT_CACHE_SLOT_EMPTY; slot = (slot + 1) & table->slot_mask)
     {
-        EventCacheListNode* node = &(list->data[iterator]);
-        EventCache *item = &(node->data);
-        if (item->event.key == t.event.key && item->event.keycode == t.event.keycode)
+        EventCacheNode *moved = &table->nodes[table->slots[slot]];
+        const uint16_t home = event_cache_hash(table, moved->data.owner, moved->data.event.keycode);
+        if (((slot - home) & table->slot_mask) >= ((slot - hole) & table->slot_mask))
         {
-            event_forward_list_erase_after(list, last_node);
-            return;
+            table->slots[hole] = table->slots[slot];
+            moved->slot = hole;
+            hole = slot;
         }
-        last_node = node;
-        iterator = list->data[iterator].next;
     }
+    table->slots[hole] = EVENT_CACHE_SLOT_EMPTY;
+
+    if (node->prev != EVENT_CACHE_NONE)
+    {
+        table->nodes[node->prev].next = node->next;
+    }
+    else
+    {
+        table->head = node->next;
+    }
+    if (node->next != EVENT_CACHE_NONE)
+    {
+        table->nodes[node->next].prev = node->prev;
+    }
+    node->next = table->free_node;
+    table->free_node = index;
+    table->count--;
 }
 
-void event_forward_list_remove_specific_owner(EventCacheList* list, void* owner)
+void event_cache_table_remove_event(EventCacheTable* table, EventCache t)
 {
-    for (int16_t *iterator_ptr = &list->data[list->head].next; *iterator_ptr >= 0;)
+    const int16_t index = event_cache_lookup(table, t.owner, t.event.keycode, t.event.key, true);
+    if (index != EVENT_CACHE_NONE)
     {
-        EventCacheListNode* node = &(list->data[*iterator_ptr]);
-        EventCache *item = &(node->data);
-        if ((*item).owner == owner)
-        {
-            int16_t free_node = *iterator_ptr;
-            keyboard_event_handler(MK_EVENT(item->event.keycode,KEYBOARD_EVENT_KEY_UP,item->event.key));
-            *iterator_ptr = node->next;
-            node->next = list->free_node;
-            list->free_node = free_node;
-            continue;
-        }
-        iterator_ptr = &list->data[*iterator_ptr].next;
+        event_cache_table_remove(table, index);
     }
 }
 
-bool event_forward_list_exists_keycode(EventCacheList* list, void* owner, Keycode keycode)
+void event_cache_table_remove_owner(EventCacheTable* table, void* owner)
 {
-    int16_t current_idx = list->data[list->head].next;
-    while (current_idx >= 0)
+    for (int16_t index = table->head; index != EVENT_CACHE_NONE;)
     {
-        EventCacheListNode* node = &list->data[current_idx];
-        if (node->data.owner == owner && node->data.event.keycode == keycode)
+        EventCacheNode *node = &table->nodes[index];
+        const int16_t next = node->next;
+        if (node->data.owner == owner)
         {
-            return true;
+            const KeyboardEvent event = node->data.event;
+            event_cache_table_remove(table, index);
+            keyboard_event_handler(MK_EVENT(event.keycode, KEYBOARD_EVENT_KEY_UP, event.key));
         }
-        current_idx = node->next;
+        index = next;
     }
-    return false;
 }
 
-void event_forward_list_remove_first_keycode(EventCacheList* list, void* owner, Keycode keycode)
+bool event_cache_table_exists_keycode(EventCacheTable* table, void* owner, Keycode keycode)
+{
+    return event_cache_table_find(table, owner, keycode) != EVENT_CACHE_NONE;
+}
+
+void event_cache_table_remove_first_keycode(EventCacheTable* table, void* owner, Keycode keycode)
 {
-    for (int16_t *iterator_ptr = &list->data[list->head].next; *iterator_ptr >= 0;)
+    const int16_t index = event_cache_table_find(table, owner, keycode);
+    if (index != EVENT_CACHE_NONE)
     {
-        EventCacheListNode* node = &(list->data[*iterator_ptr]);
-        EventCache *item = &(node->data);
-        if ((*item).owner == owner && item->event.keycode == keycode)
-        {
-            int16_t free_node = *iterator_ptr;
-            //keyboard_event_handler(MK_EVENT(item->event.keycode,KEYBOARD_EVENT_KEY_UP,item->event.key));
-            *iterator_ptr = node->next;
-            node->next = list->free_node;
-            list->free_node = free_node;
-            return;
-        }
-        iterator_ptr = &list->data[*iterator_ptr].next;
+        event_cache_table_remove(table, index);
     }
 }
 
@@ -169,5 +195,5 @@ void event_cache_buffer_push(KeyboardEvent event, void* owner)
 
 void event_cache_push(KeyboardEvent event, void* owner)
 {
-    event_forward_list_insert_after(&g_event_buffer_list, &g_event_buffer_list.data[g_event_buffer_list.head], (EventCache){event, owner});
+    event_cache_table_insert(&g_event_cache, (EventCache){event, owner});
 }
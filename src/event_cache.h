@@ -16,43 +16,67 @@ extern "C" {
 #define EVENT_CACHE_LENGTH 16
 #endif
 
+#ifndef EVENT_CACHE_SLOT_NUM
+#define EVENT_CACHE_SLOT_NUM 32
+#endif
+
+#if (EVENT_CACHE_SLOT_NUM & (EVENT_CACHE_SLOT_NUM - 1)) != 0 || EVENT_CACHE_SLOT_NUM < 2 * EVENT_CACHE_LENGTH
+#error "EVENT_CACHE_SLOT_NUM must be a power of two of at least twice EVENT_CACHE_LENGTH"
+#endif
+
 #ifndef EVENT_CACHE_BUFFER_LENGTH
 #define EVENT_CACHE_BUFFER_LENGTH 4
 #endif
 
+#define EVENT_CACHE_NONE (-1)
+
+#define event_cache_table_foreach(table, item) for (int16_t __index = (table)->head; __index >= 0; __index = (table)->nodes[__index].next)\
+                                              for (EventCache *item = &((table)->nodes[__index].data); item; item = NULL)
+
 typedef struct __EventCache
 {
     KeyboardEvent event;
     void* owner;
 } EventCache;
 
-typedef struct __EventCacheListNode
+typedef struct __EventCacheNode
 {
     EventCache data;
+    int16_t prev;
     int16_t next;
-} EventCacheListNode;
-typedef struct __EventCacheList
+    int16_t slot;
+} EventCacheNode;
+
+/*
+ * Nodes are hashed by (owner, keycode) into open-addressed slots and linked
+ * newest first, so lookups and removals are O(1) while iteration keeps the
+ * order the report has always been filled in.
+ */
+typedef struct __EventCacheTable
 {
-    EventCacheListNode *data;
+    EventCacheNode *nodes;
+    int16_t *slots;
+    uint16_t len;
+    uint16_t slot_mask;
     int16_t head;
-    int16_t tail;
-    int16_t len;
     int16_t free_node;
-} EventCacheList;
+    uint16_t count;
+    uint32_t overflow;
+} EventCacheTable;
 
-extern EventCacheList g_event_buffer_list;
+extern EventCacheTable g_event_cache;
 
 void event_cache_init(void);
 void event_cache_add_buffer(void);
 
-void event_forward_list_init(EventCacheList* list, EventCacheListNode* data, uint16_t len);
-void event_forward_list_erase_after(EventCacheList* list, EventCacheListNode* data);
-void event_forward_list_insert_after(EventCacheList* list, EventCacheListNode* data, EventCache t);
-void event_forward_list_push_front(EventCacheList* list, EventCache t);
-void event_forward_list_remove_first(EventCacheList* list, EventCache t);
-void event_forward_list_remove_specific_owner(EventCacheList* list, void* owner);
-bool event_forward_list_exists_keycode(EventCacheList* list, void* owner, Keycode keycode);
-void event_forward_list_remove_first_keycode(EventCacheList* list, void* owner, Keycode keycode);
+void event_cache_table_init(EventCacheTable* table, EventCacheNode* nodes, uint16_t len, int16_t* slots, uint16_t slot_num);
+bool event_cache_table_insert(EventCacheTable* table, EventCache t);
+int16_t event_cache_table_find(EventCacheTable* table, void* owner, Keycode keycode);
+void event_cache_table_remove(EventCacheTable* table, int16_t index);
+void event_cache_table_remove_event(EventCacheTable* table, EventCache t);
+void event_cache_table_remove_owner(EventCacheTable* table, void* owner);
+bool event_cache_table_exists_keycode(EventCacheTable* table, void* owner, Keycode keycode);
+void event_cache_table_remove_first_keycode(EventCacheTable* table, void* owner, Keycode keycode);
 
 void event_cache_buffer_push(KeyboardEvent event, void* owner);
 void event_cache_push(KeyboardEvent event, void* owner);
@@ -88,6 +88,7 @@ void fs_init_dir(void)
     lfs_mkdir(&_lfs, "profiles");
     lfs_mkdir(&_lfs, "system");
     lfs_mkdir(&_lfs, "scripts");
+    lfs_mkdir(&_lfs, "macros");
 #endif
 }
 
@@ -10,6 +10,7 @@
 #include "packet.h"
 #include "packet_buffer.h"
 #include "analog.h"
+#include "timer_wheel.h"
 
 #include "stdio.h"
 #include "string.h"
@@ -27,6 +28,12 @@
 #ifdef DYNAMICKEY_ENABLE
 #include "dynamic_key.h"
 #endif
+#ifdef COMBO_ENABLE
+#include "combo.h"
+#endif
+#ifdef TAP_DANCE_ENABLE
+#include "tap_dance.h"
+#endif
 #ifdef EXTRAKEY_ENABLE
 #include "extra_key.h"
 #endif
@@ -76,10 +83,22 @@ static Keyboard6KROBuffer keyboard_6kro_buffer;
 
 volatile uint32_t g_keyboard_bitmap[KEY_BITMAP_SIZE];
 
-static uint32_t target_calibration_tick;
+// the wheel fires in keyboard_task, calibration itself runs in keyboard_process
+static TimerWheelNode keyboard_calibration_timer;
+static volatile bool keyboard_calibration_pending;
+
+static void keyboard_calibration_timer_callback(void *context)
+{
+    UNUSED(context);
+    keyboard_calibration_pending = true;
+}
 
-static EventLoopQueue event_buffer;
+EventLoopQueue g_keyboard_event_buffer;
+#ifdef EVENT_TIMESTAMP_ENABLE
+uint32_t g_keyboard_event_timestamp;
+#endif
 static EventLoopQueueElm event_buffers[EVENT_BUFFER_LENGTH];
+static KeyboardEventSubscriberList keyboard_event_subscribers[KEYBOARD_EVENT_CHAIN_NUM];
 
 void keyboard_keycode_event_handler(KeyboardEvent event)
 {
@@ -100,81 +119,248 @@ void keyboard_keycode_event_handler(KeyboardEvent event)
     }
 }
 
-void keyboard_event_handler(KeyboardEvent event)
+KeycodeClass keyboard_get_keycode_class(Keycode keycode)
 {
-    const uint8_t keycode = KEYCODE_GET_MAIN(event.keycode);
+    const uint8_t main = KEYCODE_GET_MAIN(keycode);
+    if (main <= KEY_EXSEL)
+    {
+        return KEYCODE_CLASS_KEYBOARD;
+    }
+    switch (main)
+    {
+#ifdef MOUSE_ENABLE
+    case MOUSE_COLLECTION:
+        return KEYCODE_CLASS_MOUSE;
+#endif
+#ifdef EXTRAKEY_ENABLE
+    case CONSUMER_COLLECTION:
+    case SYSTEM_COLLECTION:
+        return KEYCODE_CLASS_EXTRA_KEY;
+#endif
+#ifdef JOYSTICK_ENABLE
+    case JOYSTICK_COLLECTION:
+        return KEYCODE_CLASS_JOYSTICK;
+#endif
+#ifdef MIDI_ENABLE
+    case MIDI_COLLECTION:
+    case MIDI_NOTE:
+        return KEYCODE_CLASS_MIDI;
+#endif
+#ifdef MACRO_ENABLE
+    case MACRO_COLLECTION:
+        return KEYCODE_CLASS_MACRO;
+#endif
+#ifdef GAMEPAD_ENABLE
+    case GAMEPAD_COLLECTION:
+        return KEYCODE_CLASS_GAMEPAD;
+#endif
 #ifdef DYNAMICKEY_ENABLE
-    if (keycode == DYNAMIC_KEY)
+    case DYNAMIC_KEY:
+        return KEYCODE_CLASS_DYNAMIC_KEY;
+#endif
+#ifdef SCRIPT_ENABLE
+    case SCRIPT_COLLECTION:
+        return KEYCODE_CLASS_SCRIPT;
+#endif
+    case LAYER_CONTROL:
+        return KEYCODE_CLASS_LAYER;
+    case KEYBOARD_OPERATION:
+        return KEYCODE_CLASS_OPERATION;
+    case KEY_USER:
+        return KEYCODE_CLASS_USER;
+    default:
+        return KEYCODE_CLASS_OTHER;
+    }
+}
+
+static inline void keyboard_event_dispatch(KeyboardEventChain chain, KeyboardEvent event, KeycodeClass keycode_class, uint32_t tick)
+{
+    const KeyboardEventSubscriberList *list = &keyboard_event_subscribers[chain];
+    const uint8_t event_bit = KEYBOARD_EVENT_MASK(event.event);
+    if (!(list->event_mask & event_bit))
     {
         return;
     }
-#endif
-    if (EVENT_CHANGED(event.event))
+    const uint16_t id = event.key ? ((Key*)event.key)->id : TOTAL_KEY_NUM;
+    for (uint8_t i = 0; i < list->count; i++)
+    {
+        const KeyboardEventSubscriber *subscriber = &list->subscribers[i];
+        if (!(subscriber->event_mask & event_bit) ||
+            (event.is_virtual && (subscriber->event_mask & KEYBOARD_EVENT_MASK_PHYSICAL)))
+        {
+            continue;
+        }
+        if (!(subscriber->class_mask & BIT(keycode_class)) &&
+            !(subscriber->key_mask && id < TOTAL_KEY_NUM && BIT_GET(subscriber->key_mask[id / 32], id % 32)))
+        {
+            continue;
+        }
+        subscriber->callback(event, tick);
+    }
+}
+
+bool keyboard_event_subscribe(KeyboardEventChain chain, KeyboardEventCallback callback, uint8_t event_mask, uint32_t class_mask, const uint32_t *key_mask)
+{
+    if (chain >= KEYBOARD_EVENT_CHAIN_NUM)
     {
-        event_loop_queue_push(&event_buffer, (EventLoopQueueElm){event, g_keyboard_tick});
+        return false;
     }
-#ifdef SCRIPT_ENABLE
+    KeyboardEventSubscriberList *list = &keyboard_event_subscribers[chain];
+    if (list->count >= KEYBOARD_EVENT_SUBSCRIBER_NUM)
+    {
+        return false;
+    }
+    list->subscribers[list->count++] = (KeyboardEventSubscriber){callback, key_mask, class_mask, event_mask};
+    list->event_mask |= event_mask;
+    return true;
+}
+
+bool keyboard_event_unsubscribe(KeyboardEventChain chain, KeyboardEventCallback callback)
+{
+    if (chain >= KEYBOARD_EVENT_CHAIN_NUM)
+    {
+        return false;
+    }
+    KeyboardEventSubscriberList *list = &keyboard_event_subscribers[chain];
+    bool found = false;
+    list->event_mask = 0;
+    for (uint8_t i = 0; i < list->count;)
+    {
+        if (list->subscribers[i].callback == callback)
+        {
+            memmove(&list->subscribers[i], &list->subscribers[i + 1], (list->count - i - 1) * sizeof(KeyboardEventSubscriber));
+            list->count--;
+            found = true;
+            continue;
+        }
+        list->event_mask |= list->subscribers[i].event_mask;
+        i++;
+    }
+    return found;
+}
+
+static void keyboard_key_event_callback(KeyboardEvent event, uint32_t tick)
+{
+    UNUSED(tick);
+    if (event.event == KEYBOARD_EVENT_KEY_DOWN)
+    {
+        keyboard_key_event_down_callback((Key*)event.key);
+    }
+    else
+    {
+        keyboard_key_event_up_callback((Key*)event.key);
+    }
+}
+
+#if defined(SCRIPT_ENABLE) && !defined(SCRIPT_POLLING)
+static void keyboard_script_event_handler(KeyboardEvent event, uint32_t tick)
+{
+    UNUSED(tick);
     script_event_handler(event);
+}
 #endif
+
 #ifdef MACRO_ENABLE
+static void keyboard_macro_record_handler(KeyboardEvent event, uint32_t tick)
+{
+    UNUSED(tick);
     macro_record_handler(event);
+}
 #endif
-    if (!event.is_virtual)
+
+#ifdef RGB_ENABLE
+static void keyboard_rgb_event_poller(KeyboardEvent event, uint32_t tick)
+{
+    rgb_activate(((Key*)event.key)->id, tick);
+}
+#endif
+
+void keyboard_event_subscriber_init(void)
+{
+    memset(keyboard_event_subscribers, 0, sizeof(keyboard_event_subscribers));
+#ifdef SCRIPT_ENABLE
+#ifdef SCRIPT_POLLING
+    keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_POLLER, script_event_poller, KEYBOARD_EVENT_MASK_CHANGED,
+                             BIT(KEYCODE_CLASS_SCRIPT) | BIT(KEYCODE_CLASS_MACRO), g_script_watcher_mask);
+#else
+    keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_HANDLER, keyboard_script_event_handler, KEYBOARD_EVENT_MASK_CHANGED,
+                             BIT(KEYCODE_CLASS_SCRIPT) | BIT(KEYCODE_CLASS_MACRO), g_script_watcher_mask);
+#endif
+#endif
+#ifdef MACRO_ENABLE
+    keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_HANDLER, keyboard_macro_record_handler, KEYBOARD_EVENT_MASK_CHANGED,
+                             KEYCODE_CLASS_MASK_ALL, NULL);
+#endif
+    keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_HANDLER, keyboard_key_event_callback,
+                             KEYBOARD_EVENT_MASK_CHANGED | KEYBOARD_EVENT_MASK_PHYSICAL, KEYCODE_CLASS_MASK_ALL, NULL);
+#ifdef RGB_ENABLE
+    keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_POLLER, keyboard_rgb_event_poller,
+                             KEYBOARD_EVENT_MASK(KEYBOARD_EVENT_KEY_DOWN) | KEYBOARD_EVENT_MASK_PHYSICAL, KEYCODE_CLASS_MASK_ALL, NULL);
+#endif
+#ifdef KEYBOARD_OPERATION_POLLING
+    keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_POLLER, keyboard_operation_event_poller, KEYBOARD_EVENT_MASK_CHANGED,
+                             BIT(KEYCODE_CLASS_OPERATION), NULL);
+#endif
+    keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_POLLER, keyboard_user_event_poller, KEYBOARD_EVENT_MASK_CHANGED,
+                             BIT(KEYCODE_CLASS_USER), NULL);
+}
+
+static inline void keyboard_class_event_handler(KeyboardEvent event, KeycodeClass keycode_class)
+{
+#ifdef DYNAMICKEY_ENABLE
+    if (keycode_class == KEYCODE_CLASS_DYNAMIC_KEY)
     {
-        layer_lock_handler(event);
+        return;
+    }
+#endif
+    if (EVENT_CHANGED(event.event))
+    {
+        event_loop_queue_push(&g_keyboard_event_buffer, (EventLoopQueueElm){event, g_keyboard_tick});
     }
+    keyboard_event_dispatch(KEYBOARD_EVENT_CHAIN_HANDLER, event, keycode_class, g_keyboard_tick);
     if (!event.is_virtual)
     {
-        if (event.event == KEYBOARD_EVENT_KEY_DOWN)
-        {
-            keyboard_key_event_down_callback((Key*)event.key);
-        }
-        else if (event.event == KEYBOARD_EVENT_KEY_UP)
-        {
-            keyboard_key_event_up_callback((Key*)event.key);
-        }
+        layer_lock_handler(event);
     }
-    switch (keycode)
+    switch (keycode_class)
     {
 #ifdef MOUSE_ENABLE
-    case MOUSE_COLLECTION:
+    case KEYCODE_CLASS_MOUSE:
         mouse_event_handler(event);
         break;
 #endif
 #ifdef EXTRAKEY_ENABLE
-    case CONSUMER_COLLECTION:
-    case SYSTEM_COLLECTION:
+    case KEYCODE_CLASS_EXTRA_KEY:
         extra_key_event_handler(event);
         break;
 #endif
 #ifdef JOYSTICK_ENABLE
-    case JOYSTICK_COLLECTION:
+    case KEYCODE_CLASS_JOYSTICK:
         joystick_event_handler(event);
         break;
 #endif
 #ifdef MIDI_ENABLE
-    case MIDI_COLLECTION:
-    case MIDI_NOTE:
+    case KEYCODE_CLASS_MIDI:
         midi_event_handler(event);
         break;
 #endif
 #ifdef MACRO_ENABLE
-    case MACRO_COLLECTION:
+    case KEYCODE_CLASS_MACRO:
         macro_event_handler(event);
         break;
 #endif
 #ifdef GAMEPAD_ENABLE
-    case GAMEPAD_COLLECTION:
+    case KEYCODE_CLASS_GAMEPAD:
         gamepad_event_handler(event);
         break;
 #endif
-    case LAYER_CONTROL:
+    case KEYCODE_CLASS_LAYER:
         layer_event_handler(event);
         break;
-    case KEYBOARD_OPERATION:
+    case KEYCODE_CLASS_OPERATION:
         keyboard_operation_event_handler(event);
         break;
-    case KEY_USER:
+    case KEYCODE_CLASS_USER:
         keyboard_user_event_handler(event);
         break;
     default:
@@ -183,30 +369,38 @@ void keyboard_event_handler(KeyboardEvent event)
     }
 }
 
-void keyboard_event_poller(KeyboardEvent event, uint32_t tick)
+void keyboard_event_handler(KeyboardEvent event)
 {
-#ifdef SCRIPT_ENABLE
-    script_event_poller(event, tick);
-#endif
-    if (!event.is_virtual && event.event == KEYBOARD_EVENT_KEY_DOWN)
-    {    
-        Key * key = (Key*)event.key;
-#ifdef RGB_ENABLE
-        rgb_activate(key->id, g_keyboard_tick);
+    keyboard_class_event_handler(event, keyboard_get_keycode_class(event.keycode));
+}
+
+static inline void keyboard_key_event_handler(Key *key, bool changed)
+{
+    const KeyboardEvent event = MK_EVENT(layer_cache_get_keycode(key->id), changed | (key->report_state<<1), key);
+#ifdef DYNAMICKEY_ENABLE
+    if (KEYCODE_GET_MAIN(event.keycode) == DYNAMIC_KEY)
+    {
+        dynamic_key_key_update(key);
+    }
 #endif
-        // keyboard_key_event_down_callback((Key*)event.key);
+#ifdef COMBO_ENABLE
+    if (combo_key_event_handler(event))
+    {
+        return;
     }
-    switch (KEYCODE_GET_MAIN(event.keycode))
+#endif
+#ifdef TAP_DANCE_ENABLE
+    if (tap_dance_key_event_handler(event))
     {
-    case KEYBOARD_OPERATION:
-        keyboard_operation_event_poller(event, tick);
-        break;
-    case KEY_USER:
-        keyboard_user_event_poller(event, tick);
-        break;
-    default:
-        break;
+        return;
     }
+#endif
+    keyboard_event_handler(event);
+}
+
+void keyboard_event_poller(KeyboardEvent event, uint32_t tick)
+{
+    keyboard_event_dispatch(KEYBOARD_EVENT_CHAIN_POLLER, event, keyboard_get_keycode_class(event.keycode), tick);
 }
 
 void keyboard_add_buffer(KeyboardEvent event)
@@ -279,7 +473,7 @@ static void keyboard_operation_event_handler_(KeyboardEvent event)
 #if defined(NEXUS_ENABLE) && !NEXUS_IS_SLAVE
             nexus_calibrate();
 #else
-            target_calibration_tick = g_keyboard_tick + KEYBOARD_TIME_TO_TICK(CALIBRATION_DELAY);
+            timer_wheel_schedule(&keyboard_calibration_timer, KEYBOARD_TIME_TO_TICK(CALIBRATION_DELAY));
 #endif
         }
         break;
@@ -520,6 +714,16 @@ void keyboard_init(void)
 {
     g_keyboard_tick = 0;
     g_keyboard_config.enable_report = true;
+    keyboard_event_subscriber_init();
+    timer_wheel_init();
+    timer_wheel_node_init(&keyboard_calibration_timer, keyboard_calibration_timer_callback, NULL);
+    keyboard_calibration_pending = false;
+#ifdef TAP_DANCE_ENABLE
+    tap_dance_init();
+#endif
+#ifdef DYNAMICKEY_ENABLE
+    dynamic_key_init();
+#endif
     for (int i = 0; i < ADVANCED_KEY_NUM; i++)
     {
         g_keyboard_advanced_keys[i].key.id = i;
@@ -547,7 +751,7 @@ void keyboard_init(void)
         keyboard_factory_reset();
     }
 #endif
-    event_loop_queue_init(&event_buffer, event_buffers, EVENT_BUFFER_LENGTH);
+    event_loop_queue_init(&g_keyboard_event_buffer, event_buffers, EVENT_BUFFER_LENGTH);
     keyboard_recovery();
 #ifdef NEXUS_ENABLE
 #if NEXUS_IS_SLAVE
@@ -581,7 +785,16 @@ __WEAK void keyboard_reset_to_default(void)
     rgb_factory_reset();
 #endif
 #ifdef DYNAMICKEY_ENABLE
-    memset(g_dynamic_keys, 0, sizeof(g_dynamic_keys));
+    dynamic_key_clear();
+#endif
+#ifdef COMBO_ENABLE
+    combo_reset();
+#endif
+#ifdef TAP_DANCE_ENABLE
+    tap_dance_reset();
+#endif
+#ifdef MACRO_ENABLE
+    macro_factory_reset();
 #endif
 #ifdef SCRIPT_ENABLE
     script_factory_reset();
@@ -658,13 +871,28 @@ void keyboard_set_profile_index(uint8_t index)
     keyboard_recovery();
 }
 
+#ifndef OPTIMIZE_KEY_BITMAP
+static inline bool keyboard_key_is_held(uint16_t id)
+{
+    bool held = false;
+#ifdef COMBO_ENABLE
+    held = held || combo_key_is_held(id);
+#endif
+#ifdef TAP_DANCE_ENABLE
+    held = held || tap_dance_key_is_held(id);
+#endif
+    UNUSED(id);
+    return held;
+}
+#endif
+
 void keyboard_fill_buffer(void)
 {
 #ifndef OPTIMIZE_KEY_BITMAP
     for (int i = 0; i < ADVANCED_KEY_NUM; i++)
     {
         AdvancedKey*key = &g_keyboard_advanced_keys[i];
-        if (key->key.report_state)
+        if (key->key.report_state && !keyboard_key_is_held(key->key.id))
         {
             keyboard_add_buffer(MK_EVENT(layer_cache_get_keycode(key->key.id), KEYBOARD_EVENT_NO_EVENT, key));
         }
@@ -672,7 +900,7 @@ void keyboard_fill_buffer(void)
     for (int i = 0; i < KEY_NUM; i++)
     {        
         Key*key = &g_keyboard_keys[i];
-        if (key->report_state)
+        if (key->report_state && !keyboard_key_is_held(key->id))
         {
             keyboard_add_buffer(MK_EVENT(layer_cache_get_keycode(key->id), KEYBOARD_EVENT_NO_EVENT, key));
         }
@@ -681,6 +909,12 @@ void keyboard_fill_buffer(void)
     for (uint16_t i = 0; i < KEY_BITMAP_SIZE; i++)
     {
         uint32_t block = g_keyboard_bitmap[i];
+#ifdef COMBO_ENABLE
+        block &= ~g_combo_hold_bitmap[i];
+#endif
+#ifdef TAP_DANCE_ENABLE
+        block &= ~g_tap_dance_hold_bitmap[i];
+#endif
 #ifdef __GNUC__
         while (block != 0)
         {
@@ -709,6 +943,12 @@ void keyboard_fill_buffer(void)
 #ifdef DYNAMICKEY_ENABLE
     dynamic_key_add_buffer();
 #endif
+#ifdef COMBO_ENABLE
+    combo_add_buffer();
+#endif
+#ifdef TAP_DANCE_ENABLE
+    tap_dance_add_buffer();
+#endif
 #if defined(MACRO_ENABLE) || defined(SCRIPT_ENABLE)
     event_cache_add_buffer();
 #endif
@@ -768,8 +1008,18 @@ void keyboard_send_report(void)
 #endif
 }
 
+#if defined(EVENT_TIMESTAMP_ENABLE) || defined(SCRIPT_PROFILE_ENABLE)
+__WEAK uint32_t keyboard_get_timestamp_us(void)
+{
+    return KEYBOARD_TICK_TO_TIME(g_keyboard_tick) * 1000;
+}
+#endif
+
 __WEAK void keyboard_task(void)
 {
+#ifdef EVENT_TIMESTAMP_ENABLE
+    g_keyboard_event_timestamp = keyboard_get_timestamp_us();
+#endif
     keyboard_scan();
 #ifdef ENCODER_ENABLE
     encoder_process();
@@ -799,12 +1049,13 @@ __WEAK void keyboard_task(void)
 #if defined(SCRIPT_ENABLE) && !defined(SCRIPT_POLLING)
     script_process();
 #endif
-#ifdef MACRO_ENABLE
-    macro_process();
-#endif
+    timer_wheel_process();
 #ifdef DYNAMICKEY_ENABLE
     dynamic_key_process();
 #endif
+#ifdef COMBO_ENABLE
+    combo_process();
+#endif
 #ifdef MIDI_ENABLE
     midi_task();
 #endif
@@ -842,17 +1093,17 @@ __WEAK void keyboard_task(void)
 
 void keyboard_process(void)
 {
-    event_loop_queue_foreach(&event_buffer, EventLoopQueueElm, event)
+    EventLoopQueueElm event;
+    while (event_loop_queue_try_pop(&g_keyboard_event_buffer, &event))
     {
-        keyboard_event_poller(event->event, event->tick);
-        event_loop_queue_pop(&event_buffer);
+        keyboard_event_poller(event.event, event.tick);
     }
 #if defined(SCRIPT_ENABLE) && defined(SCRIPT_POLLING)
     script_process();
 #endif
-    if (target_calibration_tick && g_keyboard_tick >= target_calibration_tick)
+    if (keyboard_calibration_pending)
     {
-        target_calibration_tick = 0;
+        keyboard_calibration_pending = false;
         analog_calibrate();
         packet_notify_event(PACKET_EVENT_CONFIG_CHANGED);
     }
@@ -873,7 +1124,7 @@ bool keyboard_key_update(Key *key, bool state)
 {
     bool changed = key_update(key, state);
     changed = keyboard_key_set_report_state(key, keyboard_key_debounce(key));
-    keyboard_event_handler(MK_EVENT(layer_cache_get_keycode(key->id), changed | (key->report_state<<1), key));
+    keyboard_key_event_handler(key, changed);
     return changed;
 }
 
@@ -881,7 +1132,7 @@ bool keyboard_advanced_key_update(AdvancedKey *advanced_key, AnalogValue value)
 {
     bool changed = advanced_key_update(advanced_key, value);
     changed = keyboard_key_set_report_state(&advanced_key->key, keyboard_key_debounce(&advanced_key->key));
-    keyboard_event_handler(MK_EVENT(layer_cache_get_keycode(advanced_key->key.id), changed | (advanced_key->key.report_state<<1), advanced_key));
+    keyboard_key_event_handler(&advanced_key->key, changed);
     return changed;
 }
 
@@ -889,6 +1140,6 @@ bool keyboard_advanced_key_update_raw(AdvancedKey *advanced_key, AnalogRawValue
 {
     bool changed = advanced_key_update_raw(advanced_key, raw);
     changed = keyboard_key_set_report_state(&advanced_key->key, keyboard_key_debounce(&advanced_key->key));
-    keyboard_event_handler(MK_EVENT(layer_cache_get_keycode(advanced_key->key.id), changed | (advanced_key->key.report_state<<1), advanced_key));
+    keyboard_key_event_handler(&advanced_key->key, changed);
     return changed;
 }
@@ -46,6 +46,10 @@ extern "C" {
 #define LAYER_NUM 1
 #endif
 
+#if LAYER_NUM > 32
+#error "LAYER_NUM must not exceed 32"
+#endif
+
 #ifndef POLLING_RATE
 #define POLLING_RATE 1000
 #endif
@@ -151,6 +155,62 @@ typedef union
     };
 } KeyboardReportFlag;
 
+enum
+{
+    KEYCODE_CLASS_OTHER = 0,
+    KEYCODE_CLASS_KEYBOARD,
+    KEYCODE_CLASS_MOUSE,
+    KEYCODE_CLASS_EXTRA_KEY,
+    KEYCODE_CLASS_JOYSTICK,
+    KEYCODE_CLASS_MIDI,
+    KEYCODE_CLASS_MACRO,
+    KEYCODE_CLASS_GAMEPAD,
+    KEYCODE_CLASS_LAYER,
+    KEYCODE_CLASS_OPERATION,
+    KEYCODE_CLASS_USER,
+    KEYCODE_CLASS_DYNAMIC_KEY,
+    KEYCODE_CLASS_SCRIPT,
+    KEYCODE_CLASS_NUM,
+};
+typedef uint8_t KeycodeClass;
+
+#define KEYCODE_CLASS_MASK_ALL 0xFFFFFFFFUL
+
+#ifndef KEYBOARD_EVENT_SUBSCRIBER_NUM
+#define KEYBOARD_EVENT_SUBSCRIBER_NUM 8
+#endif
+
+#define KEYBOARD_EVENT_MASK(event) (1U << (event))
+#define KEYBOARD_EVENT_MASK_CHANGED (KEYBOARD_EVENT_MASK(KEYBOARD_EVENT_KEY_UP) | KEYBOARD_EVENT_MASK(KEYBOARD_EVENT_KEY_DOWN))
+#define KEYBOARD_EVENT_MASK_ALL 0x0F
+// skip virtual events
+#define KEYBOARD_EVENT_MASK_PHYSICAL 0x10
+
+typedef enum
+{
+    KEYBOARD_EVENT_CHAIN_HANDLER = 0,
+    KEYBOARD_EVENT_CHAIN_POLLER,
+    KEYBOARD_EVENT_CHAIN_NUM,
+} KeyboardEventChain;
+
+typedef void (*KeyboardEventCallback)(KeyboardEvent event, uint32_t tick);
+
+typedef struct __KeyboardEventSubscriber
+{
+    KeyboardEventCallback callback;
+    // an event is delivered when its keycode class is in class_mask or its key is in key_mask
+    const uint32_t *key_mask;
+    uint32_t class_mask;
+    uint8_t event_mask;
+} KeyboardEventSubscriber;
+
+typedef struct __KeyboardEventSubscriberList
+{
+    KeyboardEventSubscriber subscribers[KEYBOARD_EVENT_SUBSCRIBER_NUM];
+    uint8_t count;
+    uint8_t event_mask;
+} KeyboardEventSubscriberList;
+
 enum
 {
     KEYBOARD_REPORT_FLAG = 0,
@@ -194,6 +254,7 @@ extern volatile KeyboardReportFlag g_keyboard_report_flags;
 
 extern volatile uint32_t g_keyboard_bitmap[KEY_BITMAP_SIZE];
 
+KeycodeClass keyboard_get_keycode_class(Keycode keycode);
 void keyboard_event_handler(KeyboardEvent event);
 void keyboard_event_poller(KeyboardEvent event, uint32_t tick);
 void keyboard_operation_event_handler(KeyboardEvent event);
@@ -202,6 +263,9 @@ void keyboard_user_event_handler(KeyboardEvent event);
 void keyboard_user_event_poller(KeyboardEvent event, uint32_t tick);
 void keyboard_key_event_down_callback(Key*key);
 void keyboard_key_event_up_callback(Key*key);
+void keyboard_event_subscriber_init(void);
+bool keyboard_event_subscribe(KeyboardEventChain chain, KeyboardEventCallback callback, uint8_t event_mask, uint32_t class_mask, const uint32_t *key_mask);
+bool keyboard_event_unsubscribe(KeyboardEventChain chain, KeyboardEventCallback callback);
 void keyboard_key_event_down_callback_user(Key*key);
 void keyboard_key_event_up_callback_user(Key*key);
 
@@ -233,6 +297,9 @@ void keyboard_recovery(void);
 void keyboard_save(void);
 void keyboard_set_profile_index(uint8_t index);
 void keyboard_task(void);
+#if defined(EVENT_TIMESTAMP_ENABLE) || defined(SCRIPT_PROFILE_ENABLE)
+uint32_t keyboard_get_timestamp_us(void);
+#endif
 void keyboard_process(void);
 void keyboard_delay(uint32_t ms);
 
@@ -7,7 +7,7 @@
 #define KEYBOARD_DEF_H
 
 #define LIBAMP_VERSION_MAJOR 0
-#define LIBAMP_VERSION_MINOR 1
+#define LIBAMP_VERSION_MINOR 3
 #define LIBAMP_VERSION_PATCH 0
 #define LIBAMP_VERSION_INFO  "beta"
 
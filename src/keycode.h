@@ -21,7 +21,10 @@ enum LayerControlKeycode {
   LAYER_TOGGLE = 0x03,
 };
 
-#define LAYER(code,layer) (((code) << 12) | ((layer) << 8) | LAYER_CONTROL)
+// bit 14 carries the fifth layer bit so keycodes of layers 0-15 keep their encoding
+#define LAYER(code,layer) ((((layer) & 0x10) << 10) | (((code) & 0x03) << 12) | (((layer) & 0x0F) << 8) | LAYER_CONTROL)
+#define LAYER_KEYCODE_GET_CONTROL(keycode) (((keycode) >> 12) & 0x03)
+#define LAYER_KEYCODE_GET_LAYER(keycode) ((((keycode) >> 8) & 0x0F) | (((keycode) >> 10) & 0x10))
 
 enum ModifierKeycode
 {
@@ -214,6 +217,7 @@ enum KeycodeEnum {
   MACRO_COLLECTION             = 0xad,
   SCRIPT_COLLECTION            = 0xae,
   GAMEPAD_COLLECTION           = 0xaf,
+  TAP_DANCE_COLLECTION         = 0xb0,
   KEY_USER                     = 0xFD,
   KEYBOARD_OPERATION           = 0xFE,
   KEY_TRANSPARENT              = 0xFF,
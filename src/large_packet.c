@@ -6,6 +6,7 @@
 #include "packet.h"
 #include <string.h> // for memcpy
 
+#include "layer.h"
 #include "script.h"
 #include "storage.h"
 
@@ -59,7 +60,7 @@ uint32_t script_source_handle_large_data(uint8_t code, uint8_t sub_cmd, uint32_t
             {
                 return false;
             }
-            return 0;
+            return len;
 
         case LARGE_DATA_CMD_END:
         case LARGE_DATA_CMD_ABORT:
@@ -68,8 +69,11 @@ uint32_t script_source_handle_large_data(uint8_t code, uint8_t sub_cmd, uint32_t
                 fs_close(&script_file);
                 script_file_open = false;
             }
-#if SCRIPT_RUNTIME_STRATEGY == SCRIPT_JIT
-            //script_init();
+#ifdef SCRIPT_ENABLE
+            if (sub_cmd == LARGE_DATA_CMD_END)
+            {
+                script_reload();
+            }
 #endif
             return 0;
         }
@@ -182,7 +186,7 @@ uint32_t script_bytecode_handle_large_data(uint8_t code, uint8_t sub_cmd, uint32
             {
                 return false;
             }
-            return 0;
+            return len;
 
         case LARGE_DATA_CMD_END:
         case LARGE_DATA_CMD_ABORT:
@@ -191,7 +195,12 @@ uint32_t script_bytecode_handle_large_data(uint8_t code, uint8_t sub_cmd, uint32
                 fs_close(&script_file);
                 script_file_open = false;
             }
-            //script_init();
+#ifdef SCRIPT_ENABLE
+            if (sub_cmd == LARGE_DATA_CMD_END)
+            {
+                script_reload();
+            }
+#endif
             return 0;
         }
     }
@@ -266,10 +275,143 @@ uint32_t script_bytecode_handle_large_data(uint8_t code, uint8_t sub_cmd, uint32
     return 0;
 }
 
+typedef struct
+{
+    uint8_t *data;
+    uint32_t offset;
+    uint16_t length;
+    uint32_t position;
+    uint16_t copied;
+} KeymapWindow;
+
+static size_t keymap_window_writer(void *context, const void *data, size_t size)
+{
+    KeymapWindow *window = (KeymapWindow *)context;
+    const uint8_t *src = (const uint8_t *)data;
+    uint32_t begin = window->position;
+    uint32_t end = begin + size;
+    window->position = end;
+    if (end <= window->offset || begin >= window->offset + window->length)
+    {
+        return size;
+    }
+    uint32_t from = begin < window->offset ? window->offset : begin;
+    uint32_t to = end > window->offset + window->length ? window->offset + window->length : end;
+    memcpy(window->data + (from - window->offset), src + (from - begin), to - from);
+    window->copied += to - from;
+    return size;
+}
+
+uint32_t keymap_handle_large_data(uint8_t code, uint8_t sub_cmd, uint32_t val, uint8_t *data, uint16_t len)
+{
+    static KeymapDecoder decoder;
+    static uint32_t cursor_index = 0;
+    static uint32_t cursor_position = 0;
+#if defined(LFS_ENABLE) && defined(STORAGE_ENABLE)
+    static const char *KEYMAP_STAGING_FILENAME = "system/keymap.tmp";
+    static File staging_file;
+    static bool staging_file_open = false;
+#endif
+    if (code == PACKET_CODE_LARGE_SET)
+    {
+        switch (sub_cmd)
+        {
+        case LARGE_DATA_CMD_START:
+            keymap_decoder_init(&decoder, NULL);
+#if defined(LFS_ENABLE) && defined(STORAGE_ENABLE)
+            if (staging_file_open)
+            {
+                fs_close(&staging_file);
+            }
+            staging_file_open = fs_open(&staging_file, KEYMAP_STAGING_FILENAME, FS_O_WRONLY | FS_O_CREAT | FS_O_TRUNC) >= 0;
+#endif
+            return 0;
+        case LARGE_DATA_CMD_PAYLOAD:
+#if defined(LFS_ENABLE) && defined(STORAGE_ENABLE)
+            if (!staging_file_open ||
+                !keymap_decoder_feed(&decoder, data, len) ||
+                fs_write(&staging_file, data, len) != len)
+            {
+                return 0;
+            }
+            return len;
+#else
+            return 0;
+#endif
+        case LARGE_DATA_CMD_END:
+        case LARGE_DATA_CMD_ABORT:
+        {
+            bool applied = false;
+#if defined(LFS_ENABLE) && defined(STORAGE_ENABLE)
+            if (staging_file_open)
+            {
+                fs_close(&staging_file);
+                staging_file_open = false;
+                if (sub_cmd == LARGE_DATA_CMD_END && keymap_decoder_finish(&decoder))
+                {
+                    applied = storage_load_keymap(KEYMAP_STAGING_FILENAME);
+                }
+            }
+            fs_unlink(KEYMAP_STAGING_FILENAME);
+#endif
+            if (applied)
+            {
+                layer_cache_refresh();
+            }
+            return applied;
+        }
+        }
+    }
+    else if (code == PACKET_CODE_LARGE_GET)
+    {
+        switch (sub_cmd)
+        {
+        case LARGE_DATA_CMD_START:
+            if (val == 0)
+            {
+                cursor_index = 0;
+                cursor_position = 0;
+                return keymap_encode(NULL, NULL);
+            }
+            return 0;
+        case LARGE_DATA_CMD_PAYLOAD:
+        {
+            if (val < cursor_position)
+            {
+                cursor_index = 0;
+                cursor_position = 0;
+            }
+            KeymapWindow window = {
+                .data = data,
+                .offset = val,
+                .length = len,
+                .position = cursor_position,
+            };
+            uint32_t index = cursor_index;
+            while (index < KEYMAP_ENTRY_NUM && window.position < val + len)
+            {
+                keymap_encode_run(&index, keymap_window_writer, &window);
+                if (window.position <= val + len)
+                {
+                    cursor_index = index;
+                    cursor_position = window.position;
+                }
+            }
+            return window.copied;
+        }
+        default:
+            return 0;
+        }
+    }
+    return 0;
+}
+
 uint32_t large_packet_dispatch(uint8_t type, uint8_t code, uint8_t sub_cmd, uint32_t val, uint8_t *data, uint16_t len)
 {
     switch (type)
     {
+    case PACKET_DATA_KEYMAP_SPARSE:
+        return keymap_handle_large_data(code, sub_cmd, val, data, len);
 #ifdef SCRIPT_ENABLE
     case PACKET_DATA_SCRIPT_SCOURCE:
         return script_source_handle_large_data(code, sub_cmd, val, data, len);
@@ -310,7 +452,13 @@ static void process_large_set(PacketLargeData *pkt)
             large_packet_dispatch(type, PACKET_CODE_LARGE_SET, LARGE_DATA_CMD_ABORT, 0, NULL, 0);
             return;
         }
-        large_packet_dispatch(type, PACKET_CODE_LARGE_SET, LARGE_DATA_CMD_PAYLOAD, offset, pkt->payload.data, len);
+        if (large_packet_dispatch(type, PACKET_CODE_LARGE_SET, LARGE_DATA_CMD_PAYLOAD, offset, pkt->payload.data, len) != len)
+        {
+            large_packet_dispatch(type, PACKET_CODE_LARGE_SET, LARGE_DATA_CMD_ABORT, 0, NULL, 0);
+            large_rx_total = 0;
+            large_rx_recv = 0;
+            return;
+        }
         large_rx_recv += len;
         if (large_rx_recv >= large_rx_total)
         {
@@ -8,17 +8,17 @@
 #include "string.h"
 
 uint8_t g_current_layer;
-static uint16_t layer_state;
+static LayerState layer_state;
 __WEAK Keycode g_keymap_cache[TOTAL_KEY_NUM];
 bool g_keymap_lock[TOTAL_KEY_NUM];
 
 void layer_event_handler(KeyboardEvent event)
 {
-    const uint8_t layer = ((event.keycode >> 8) & 0x0F);
+    const uint8_t layer = LAYER_KEYCODE_GET_LAYER(event.keycode);
     switch (event.event)
     {
     case KEYBOARD_EVENT_KEY_DOWN:
-        switch ((event.keycode >> 12) & 0x0F)
+        switch (LAYER_KEYCODE_GET_CONTROL(event.keycode))
         {
         case LAYER_MOMENTARY:
             layer_toggle(layer);
@@ -38,7 +38,7 @@ void layer_event_handler(KeyboardEvent event)
         layer_cache_refresh();
         break;
     case KEYBOARD_EVENT_KEY_UP:
-        switch ((event.keycode >> 12) & 0x0F)
+        switch (LAYER_KEYCODE_GET_CONTROL(event.keycode))
         {
         case LAYER_MOMENTARY:
             layer_toggle(layer);
@@ -60,31 +60,48 @@ uint8_t layer_get(void)
         return 0;
     return 31 - __builtin_clz(layer_state);
 #else
-    for (int i = 15; i > 0; i--)
-    {
-        if (BIT_GET(layer_state,i))
-        {
-            return i;
-        }
-    }
-    return 0;
+    LayerState state = layer_state;
+    uint8_t layer = 0;
+    if (state >> 16) { state >>= 16; layer += 16; }
+    if (state >> 8)  { state >>= 8;  layer += 8; }
+    if (state >> 4)  { state >>= 4;  layer += 4; }
+    if (state >> 2)  { state >>= 2;  layer += 2; }
+    if (state >> 1)  { layer += 1; }
+    return layer;
 #endif
 }
 
+LayerState layer_get_state(void)
+{
+    return layer_state;
+}
+
 void layer_set(uint8_t layer)
 {
+    if (layer >= LAYER_NUM)
+    {
+        return;
+    }
     BIT_SET(layer_state,layer);
     g_current_layer = layer_get();
 }
 
 void layer_reset(uint8_t layer)
 {
+    if (layer >= LAYER_NUM)
+    {
+        return;
+    }
     BIT_RESET(layer_state,layer);
     g_current_layer = layer_get();
 }
 
 void layer_toggle(uint8_t layer)
 {
+    if (layer >= LAYER_NUM)
+    {
+        return;
+    }
     BIT_TOGGLE(layer_state,layer);
     g_current_layer = layer_get();
 }
@@ -107,3 +124,147 @@ Keycode layer_get_keycode(uint16_t id, int8_t layer)
     return KEY_NO_EVENT;
 }
 
+
+enum
+{
+    KEYMAP_DECODER_HEADER,
+    KEYMAP_DECODER_FILL,
+    KEYMAP_DECODER_LITERAL,
+    KEYMAP_DECODER_ERROR,
+};
+
+static inline size_t keymap_emit(KeymapWriter writer, void *context, const void *data, size_t size)
+{
+    if (writer != NULL)
+    {
+        writer(context, data, size);
+    }
+    return size;
+}
+
+static inline uint16_t keymap_run_length(const Keycode *keymap, uint32_t index)
+{
+    uint16_t length = 1;
+    while (index + length < KEYMAP_ENTRY_NUM &&
+           length < KEYMAP_RUN_LENGTH_MASK &&
+           keymap[index + length] == keymap[index])
+    {
+        length++;
+    }
+    return length;
+}
+
+size_t keymap_encode_run(uint32_t *index, KeymapWriter writer, void *context)
+{
+    const Keycode *keymap = &g_keymap[0][0];
+    size_t size = 0;
+    uint32_t begin = *index;
+    uint16_t length = keymap_run_length(keymap, begin);
+    if (length >= KEYMAP_RUN_FILL_MIN)
+    {
+        uint16_t header = KEYMAP_RUN_FILL | length;
+        size += keymap_emit(writer, context, &header, sizeof(header));
+        size += keymap_emit(writer, context, &keymap[begin], sizeof(Keycode));
+        *index = begin + length;
+        return size;
+    }
+    uint32_t end = begin;
+    while (end < KEYMAP_ENTRY_NUM && end - begin < KEYMAP_RUN_LENGTH_MASK)
+    {
+        if (end + KEYMAP_RUN_FILL_MIN <= KEYMAP_ENTRY_NUM &&
+            keymap_run_length(keymap, end) >= KEYMAP_RUN_FILL_MIN)
+        {
+            break;
+        }
+        end++;
+    }
+    uint16_t header = end - begin;
+    size += keymap_emit(writer, context, &header, sizeof(header));
+    size += keymap_emit(writer, context, &keymap[begin], header * sizeof(Keycode));
+    *index = end;
+    return size;
+}
+
+size_t keymap_encode(KeymapWriter writer, void *context)
+{
+    size_t size = 0;
+    uint32_t index = 0;
+    while (index < KEYMAP_ENTRY_NUM)
+    {
+        size += keymap_encode_run(&index, writer, context);
+    }
+    return size;
+}
+
+void keymap_decoder_init(KeymapDecoder *decoder, Keycode *keymap)
+{
+    memset(decoder, 0, sizeof(KeymapDecoder));
+    decoder->keymap = keymap;
+    decoder->stage = KEYMAP_DECODER_HEADER;
+}
+
+bool keymap_decoder_feed(KeymapDecoder *decoder, const uint8_t *data, size_t length)
+{
+    Keycode *keymap = decoder->keymap;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (decoder->stage == KEYMAP_DECODER_ERROR)
+        {
+            return false;
+        }
+        decoder->scratch[decoder->scratch_length++] = data[i];
+        if (decoder->scratch_length < 2)
+        {
+            continue;
+        }
+        decoder->scratch_length = 0;
+        uint16_t word;
+        memcpy(&word, decoder->scratch, sizeof(word));
+        switch (decoder->stage)
+        {
+        case KEYMAP_DECODER_HEADER:
+            decoder->header = word;
+            decoder->remaining = word & KEYMAP_RUN_LENGTH_MASK;
+            if (!decoder->remaining || decoder->index + decoder->remaining > KEYMAP_ENTRY_NUM)
+            {
+                decoder->stage = KEYMAP_DECODER_ERROR;
+                return false;
+            }
+            decoder->stage = (word & KEYMAP_RUN_FILL) ? KEYMAP_DECODER_FILL : KEYMAP_DECODER_LITERAL;
+            break;
+        case KEYMAP_DECODER_FILL:
+            if (keymap != NULL)
+            {
+                for (uint16_t j = 0; j < decoder->remaining; j++)
+                {
+                    keymap[decoder->index + j] = word;
+                }
+            }
+            decoder->index += decoder->remaining;
+            decoder->remaining = 0;
+            decoder->stage = KEYMAP_DECODER_HEADER;
+            break;
+        case KEYMAP_DECODER_LITERAL:
+            if (keymap != NULL)
+            {
+                keymap[decoder->index] = word;
+            }
+            decoder->index++;
+            if (!--decoder->remaining)
+            {
+                decoder->stage = KEYMAP_DECODER_HEADER;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return decoder->stage != KEYMAP_DECODER_ERROR;
+}
+
+bool keymap_decoder_finish(KeymapDecoder *decoder)
+{
+    return decoder->stage == KEYMAP_DECODER_HEADER &&
+           !decoder->scratch_length &&
+           decoder->index == KEYMAP_ENTRY_NUM;
+}
@@ -6,27 +6,74 @@
 #ifndef LAYER_H_
 #define LAYER_H_
 #include "keyboard.h"
+#ifdef DYNAMICKEY_ENABLE
+#include "dynamic_key.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef uint32_t LayerState;
+
+/*
+ * Sparse keymap stream: a sequence of runs over the flattened keymap, each
+ * starting with a uint16_t header. If KEYMAP_RUN_FILL is set, the header is
+ * followed by one keycode repeated (header & KEYMAP_RUN_LENGTH_MASK) times,
+ * otherwise it is followed by that many literal keycodes.
+ */
+#define KEYMAP_RUN_FILL 0x8000
+#define KEYMAP_RUN_LENGTH_MASK 0x7FFF
+#define KEYMAP_RUN_FILL_MIN 3
+#define KEYMAP_ENTRY_NUM (LAYER_NUM * TOTAL_KEY_NUM)
+
+typedef size_t (*KeymapWriter)(void *context, const void *data, size_t size);
+
+typedef struct __KeymapDecoder
+{
+    Keycode *keymap;
+    uint32_t index;
+    uint16_t header;
+    uint16_t remaining;
+    uint8_t stage;
+    uint8_t scratch_length;
+    uint8_t scratch[2];
+} KeymapDecoder;
+
 extern uint8_t g_current_layer;
 extern Keycode g_keymap_cache[TOTAL_KEY_NUM];
 extern bool g_keymap_lock[TOTAL_KEY_NUM];
 
 void layer_event_handler(KeyboardEvent event);
 uint8_t layer_get(void);
+LayerState layer_get_state(void);
 void layer_set(uint8_t layer);
 void layer_reset(uint8_t layer);
 void layer_toggle(uint8_t layer);
 Keycode layer_get_keycode(uint16_t id, int8_t layer);
+size_t keymap_encode(KeymapWriter writer, void *context);
+size_t keymap_encode_run(uint32_t *index, KeymapWriter writer, void *context);
+void keymap_decoder_init(KeymapDecoder *decoder, Keycode *keymap);
+bool keymap_decoder_feed(KeymapDecoder *decoder, const uint8_t *data, size_t length);
+bool keymap_decoder_finish(KeymapDecoder *decoder);
 
 static inline Keycode layer_cache_get_keycode(uint16_t id)
 {
     return g_keymap_cache[id];
 }
 
+static inline void layer_cache_update(uint16_t id)
+{
+    Keycode keycode = layer_get_keycode(id, g_current_layer);
+    g_keymap_cache[id] = keycode;
+#ifdef DYNAMICKEY_ENABLE
+    if (KEYCODE_GET_MAIN(keycode) == DYNAMIC_KEY)
+    {
+        dynamic_key_mark(KEYCODE_GET_SUB(keycode));
+    }
+#endif
+}
+
 static inline void layer_lock(uint16_t id)
 {
     g_keymap_lock[id] = true;
@@ -35,7 +82,7 @@ static inline void layer_lock(uint16_t id)
 static inline void layer_unlock(uint16_t id)
 {
     g_keymap_lock[id] = false;
-    g_keymap_cache[id] = layer_get_keycode(id, g_current_layer);
+    layer_cache_update(id);
 }
 
 static inline void layer_lock_handler(KeyboardEvent event)
@@ -64,7 +111,7 @@ static inline void layer_cache_refresh(void)
     {
         if (!g_keymap_lock[i])
         {
-            g_keymap_cache[i] = layer_get_keycode(i, g_current_layer);
+            layer_cache_update(i);
         }
     }
 }
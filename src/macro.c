@@ -7,20 +7,364 @@
 #include "event_cache.h"
 #include "string.h"
 
+#include "storage.h"
+
+#ifdef LFS_ENABLE
+#include "file_system.h"
+#endif
+
 Macro g_macros[MACRO_NUM];
-static MacroAction actions[MACRO_NUM][MACRO_MAX_ACTIONS];
+
+#ifdef LFS_ENABLE
+/*
+ * Every profile keeps its own macros/profileP_macroN file. Writes go to a
+ * .tmp sibling that only replaces the committed file once the terminator
+ * is flushed, so a power loss mid-recording leaves the old macro intact.
+ */
+#define MACRO_FILE_NAME "macros/profile0_macro0.tmp"
+
+static void macro_file_name(char *name, uint8_t profile, uint8_t index, bool temporary)
+{
+    memcpy(name, MACRO_FILE_NAME, sizeof(MACRO_FILE_NAME));
+    name[14] = "0123456789abcdef"[profile & 0x0F];
+    name[21] = "0123456789abcdef"[index & 0x0F];
+    if (!temporary)
+    {
+        name[22] = '\0';
+    }
+}
+
+static size_t macro_storage_read(uint8_t profile, uint8_t index, uint32_t position, uint8_t *buffer, size_t size)
+{
+    char name[sizeof(MACRO_FILE_NAME)];
+    macro_file_name(name, profile, index, false);
+    File file;
+    if (fs_open(&file, name, FS_O_RDONLY) < 0)
+    {
+        return 0;
+    }
+    size_t length = 0;
+    if (fs_seek(&file, position, FS_SEEK_SET) >= 0)
+    {
+        length = fs_read(&file, buffer, size);
+    }
+    fs_close(&file);
+    return length;
+}
+
+static size_t macro_storage_append(uint8_t profile, uint8_t index, const uint8_t *buffer, size_t size)
+{
+    char name[sizeof(MACRO_FILE_NAME)];
+    macro_file_name(name, profile, index, true);
+    File file;
+    if (fs_open(&file, name, FS_O_WRONLY | FS_O_CREAT | FS_O_APPEND) < 0)
+    {
+        return 0;
+    }
+    size_t length = fs_write(&file, (void *)buffer, size);
+    // data only reaches flash when the close commits it
+    if (fs_close(&file) < 0)
+    {
+        return 0;
+    }
+    return length;
+}
+
+static void macro_storage_clear(uint8_t profile, uint8_t index)
+{
+    char name[sizeof(MACRO_FILE_NAME)];
+    macro_file_name(name, profile, index, true);
+    File file;
+    if (fs_open(&file, name, FS_O_WRONLY | FS_O_CREAT | FS_O_TRUNC) >= 0)
+    {
+        fs_close(&file);
+    }
+}
+
+static void macro_storage_commit(uint8_t profile, uint8_t index)
+{
+    char temporary[sizeof(MACRO_FILE_NAME)];
+    char name[sizeof(MACRO_FILE_NAME)];
+    macro_file_name(temporary, profile, index, true);
+    macro_file_name(name, profile, index, false);
+    fs_rename(temporary, name);
+}
+
+static void macro_storage_remove(uint8_t index)
+{
+    char name[sizeof(MACRO_FILE_NAME)];
+    for (uint8_t profile = 0; profile < STORAGE_PROFILE_FILE_NUM; profile++)
+    {
+        macro_file_name(name, profile, index, false);
+        fs_unlink(name);
+        macro_file_name(name, profile, index, true);
+        fs_unlink(name);
+    }
+}
+#else
+static uint8_t macro_streams[MACRO_NUM][MACRO_STREAM_SIZE];
+static uint32_t macro_stream_sizes[MACRO_NUM];
+
+static size_t macro_storage_read(uint8_t profile, uint8_t index, uint32_t position, uint8_t *buffer, size_t size)
+{
+    UNUSED(profile);
+    if (position >= macro_stream_sizes[index])
+    {
+        return 0;
+    }
+    if (size > macro_stream_sizes[index] - position)
+    {
+        size = macro_stream_sizes[index] - position;
+    }
+    memcpy(buffer, &macro_streams[index][position], size);
+    return size;
+}
+
+static size_t macro_storage_append(uint8_t profile, uint8_t index, const uint8_t *buffer, size_t size)
+{
+    UNUSED(profile);
+    if (size > (size_t)MACRO_STREAM_SIZE - macro_stream_sizes[index])
+    {
+        return 0;
+    }
+    memcpy(&macro_streams[index][macro_stream_sizes[index]], buffer, size);
+    macro_stream_sizes[index] += size;
+    return size;
+}
+
+static void macro_storage_clear(uint8_t profile, uint8_t index)
+{
+    UNUSED(profile);
+    macro_stream_sizes[index] = 0;
+}
+
+static void macro_storage_commit(uint8_t profile, uint8_t index)
+{
+    UNUSED(profile);
+    UNUSED(index);
+}
+
+static void macro_storage_remove(uint8_t index)
+{
+    macro_stream_sizes[index] = 0;
+}
+#endif
+
+static inline uint8_t macro_index(Macro *macro)
+{
+    return macro - g_macros;
+}
+
+static inline size_t macro_varint_encode(uint8_t *buffer, uint32_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80)
+    {
+        buffer[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[length++] = value;
+    return length;
+}
+
+static inline size_t macro_varint_decode(const uint8_t *buffer, size_t size, uint32_t *value)
+{
+    *value = 0;
+    for (size_t i = 0; i < size && i < 5; i++)
+    {
+        *value |= (uint32_t)(buffer[i] & 0x7F) << (7 * i);
+        if (!(buffer[i] & 0x80))
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+size_t macro_action_encode(uint8_t *buffer, const MacroAction *action, uint32_t base)
+{
+    size_t length = macro_varint_encode(buffer, action->delay > base ? action->delay - base : 0);
+    uint8_t flags = action->event.event & MACRO_ACTION_FLAG_EVENT_MASK;
+    if (action->event.is_virtual)
+    {
+        flags |= MACRO_ACTION_FLAG_VIRTUAL;
+    }
+    if (action->event.key)
+    {
+        flags |= MACRO_ACTION_FLAG_KEY;
+    }
+    buffer[length++] = flags;
+    length += macro_varint_encode(buffer + length, action->event.keycode);
+    if (action->event.key)
+    {
+        length += macro_varint_encode(buffer + length, ((Key*)action->event.key)->id);
+    }
+    return length;
+}
+
+size_t macro_action_decode(const uint8_t *buffer, size_t size, MacroAction *action, uint32_t base)
+{
+    uint32_t value;
+    size_t length = macro_varint_decode(buffer, size, &value);
+    if (!length || length >= size)
+    {
+        return 0;
+    }
+    action->delay = base + value;
+    const uint8_t flags = buffer[length++];
+    size_t field = macro_varint_decode(buffer + length, size - length, &value);
+    if (!field)
+    {
+        return 0;
+    }
+    length += field;
+    action->event = MK_EVENT(value, flags & MACRO_ACTION_FLAG_EVENT_MASK, NULL);
+    action->event.is_virtual = (flags & MACRO_ACTION_FLAG_VIRTUAL) != 0;
+    if (flags & MACRO_ACTION_FLAG_KEY)
+    {
+        field = macro_varint_decode(buffer + length, size - length, &value);
+        if (!field)
+        {
+            return 0;
+        }
+        length += field;
+        action->event.key = keyboard_get_key(value);
+    }
+    return length;
+}
+
+void macro_stream_rewind(MacroStream *stream)
+{
+    stream->profile = g_current_profile_index;
+    stream->position = 0;
+    stream->delay = 0;
+    stream->head = 0;
+    stream->tail = 0;
+}
+
+bool macro_stream_read(uint8_t index, MacroStream *stream, MacroAction *action)
+{
+    while (true)
+    {
+        const uint8_t remain = stream->tail - stream->head;
+        const size_t length = macro_action_decode(stream->buffer + stream->head, remain, action, stream->delay);
+        if (length)
+        {
+            stream->head += length;
+            stream->delay = action->delay;
+            return true;
+        }
+        if (remain >= MACRO_ACTION_MAX_ENCODED_SIZE)
+        {
+            return false;
+        }
+        memmove(stream->buffer, stream->buffer + stream->head, remain);
+        stream->head = 0;
+        stream->tail = remain;
+        const size_t read = macro_storage_read(stream->profile, index, stream->position, stream->buffer + remain, MACRO_BUFFER_SIZE - remain);
+        if (!read)
+        {
+            return false;
+        }
+        stream->position += read;
+        stream->tail += read;
+    }
+}
+
+bool macro_read_action(uint8_t index, uint16_t action_index, MacroAction *action)
+{
+    MacroStream stream;
+    macro_stream_rewind(&stream);
+    for (uint16_t i = 0; i <= action_index; i++)
+    {
+        if (!macro_stream_read(index, &stream, action))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void macro_load_action(Macro *macro)
+{
+    if (!macro_stream_read(macro_index(macro), &macro->stream, &macro->action))
+    {
+        // a truncated stream ends where its data ends
+        macro->action.delay = macro->stream.delay;
+        macro->action.event = MK_EVENT(KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, NULL);
+    }
+}
+
+void macro_begin_write(Macro *macro)
+{
+    macro_stream_rewind(&macro->stream);
+    macro_storage_clear(macro->stream.profile, macro_index(macro));
+    macro->length = 0;
+}
+
+bool macro_append(Macro *macro, const MacroAction *action)
+{
+    MacroStream *stream = &macro->stream;
+    if (stream->tail + MACRO_ACTION_MAX_ENCODED_SIZE > MACRO_BUFFER_SIZE)
+    {
+        macro_flush(macro);
+        if (stream->tail)
+        {
+            return false;
+        }
+    }
+    stream->tail += macro_action_encode(stream->buffer + stream->tail, action, stream->delay);
+    stream->delay = action->delay;
+    macro->length++;
+    if (!action->event.keycode)
+    {
+        macro_flush(macro);
+        if (!stream->tail)
+        {
+            macro_storage_commit(stream->profile, macro_index(macro));
+        }
+    }
+    return true;
+}
+
+void macro_flush(Macro *macro)
+{
+    MacroStream *stream = &macro->stream;
+    if (stream->tail && macro_storage_append(stream->profile, macro_index(macro), stream->buffer, stream->tail) == stream->tail)
+    {
+        stream->position += stream->tail;
+        stream->tail = 0;
+    }
+}
+
+static void macro_timer_callback(void *context);
 
 void macro_init(void)
 {
     memset(g_macros, 0, sizeof(g_macros));
-    memset(actions, 0, sizeof(actions));
-    
     for (int i = 0; i < MACRO_NUM; i++)
     {
-        g_macros[i].actions = actions[i];
+        timer_wheel_node_init(&g_macros[i].timer, macro_timer_callback, &g_macros[i]);
     }
 }
 
+void macro_factory_reset(void)
+{
+    for (int i = 0; i < MACRO_NUM; i++)
+    {
+        macro_stop_play(&g_macros[i]);
+        event_cache_table_remove_owner(&g_event_cache, &g_macros[i]);
+        g_macros[i].length = 0;
+        macro_storage_remove(i);
+    }
+}
+
+static void macro_schedule(Macro *macro)
+{
+    const int32_t delay = macro->begin_tick + macro->action.delay - g_keyboard_tick;
+    timer_wheel_schedule(&macro->timer, delay > 0 ? delay : 0);
+}
+
 void macro_event_handler(KeyboardEvent event)
 {
     switch (event.event)
@@ -50,15 +394,17 @@ void macro_event_handler(KeyboardEvent event)
             break;
         case MACRO_PLAYING_START_ONCE_NO_GAP:
             macro_start_play_once(&g_macros[index]);
-            g_macros[index].begin_tick = g_keyboard_tick + g_macros[index].actions[0].delay;
+            g_macros[index].begin_tick = g_keyboard_tick + g_macros[index].action.delay;
+            macro_schedule(&g_macros[index]);
             break;
         case MACRO_PLAYING_START_CIRCULARLY_NO_GAP:
             macro_start_play_circularly(&g_macros[index]);
-            g_macros[index].begin_tick = g_keyboard_tick + g_macros[index].actions[0].delay;
+            g_macros[index].begin_tick = g_keyboard_tick + g_macros[index].action.delay;
+            macro_schedule(&g_macros[index]);
             break;
         case MACRO_PLAYING_STOP:
             macro_stop_play(&g_macros[index]);
-            event_forward_list_remove_specific_owner(&g_event_buffer_list, &g_macros[index]);
+            event_cache_table_remove_owner(&g_event_cache, &g_macros[index]);
             break;
         case MACRO_PLAYING_PAUSE:
             break;
@@ -104,40 +450,50 @@ void macro_start_record(Macro*macro)
     macro->begin_tick = g_keyboard_tick;
     macro->state = MACRO_STATE_RECORDING;
     macro->index = 0;
+    timer_wheel_cancel(&macro->timer);
+    macro_begin_write(macro);
 }
 
 void macro_stop_record(Macro*macro)
 {
-    macro->actions[macro->index].delay = g_keyboard_tick - macro->begin_tick;
-    macro->actions[macro->index].event.keycode = KEY_NO_EVENT;
+    MacroAction action;
+    action.delay = g_keyboard_tick - macro->begin_tick;
+    action.event = MK_EVENT(KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, NULL);
+    macro_append(macro, &action);
+    macro_flush(macro);
     macro->state = MACRO_STATE_IDLE;
     macro->index=0;
 }
 
 void macro_record(Macro*macro,KeyboardEvent event)
 {
-    macro->actions[macro->index].event = event;
-    macro->actions[macro->index].delay = g_keyboard_tick - macro->begin_tick;
-    macro->index++;
-    if (macro->index >= MACRO_MAX_ACTIONS)
+    MacroAction action;
+    action.event = event;
+    action.delay = g_keyboard_tick - macro->begin_tick;
+    if (!macro_append(macro, &action))
     {
-        macro->index--;
         macro_stop_record(macro);
     }
 }
 
-void macro_start_play_once(Macro*macro)
+static void macro_start_play(Macro*macro, uint8_t state)
 {
     macro->begin_tick = g_keyboard_tick;
-    macro->state = MACRO_STATE_PLAYING_ONCE;
+    macro->state = state;
     macro->index = 0;
+    macro_stream_rewind(&macro->stream);
+    macro_load_action(macro);
+    macro_schedule(macro);
+}
+
+void macro_start_play_once(Macro*macro)
+{
+    macro_start_play(macro, MACRO_STATE_PLAYING_ONCE);
 }
 
 void macro_start_play_circularly(Macro*macro)
 {
-    macro->begin_tick = g_keyboard_tick;
-    macro->state = MACRO_STATE_PLAYING_CIRCULARLY;
-    macro->index = 0;
+    macro_start_play(macro, MACRO_STATE_PLAYING_CIRCULARLY);
 }
 
 void macro_stop_play(Macro*macro)
@@ -145,56 +501,50 @@ void macro_stop_play(Macro*macro)
     macro->begin_tick = g_keyboard_tick;
     macro->state = MACRO_STATE_IDLE;
     macro->index = 0;
+    timer_wheel_cancel(&macro->timer);
 }
 
-void macro_process(void)
+static void macro_timer_callback(void *context)
 {
-    for (int i = 0; i < MACRO_NUM; i++)
+    Macro *macro = (Macro *)context;
+    while (macro->action.delay + macro->begin_tick <= g_keyboard_tick)
     {
-        Macro *macro = &g_macros[i];
-        switch (macro->state)
+        KeyboardEvent event = macro->action.event;
+        if (!event.keycode)
         {
-        case MACRO_STATE_RECORDING:
-            break;
-        case MACRO_STATE_PLAYING_ONCE:
-        case MACRO_STATE_PLAYING_CIRCULARLY:
-            while (macro->actions[macro->index].delay + macro->begin_tick <= g_keyboard_tick)
+            if (macro->state == MACRO_STATE_PLAYING_ONCE)
             {
-                KeyboardEvent event = macro->actions[macro->index].event;
-                uint8_t report_state = ((Key*)event.key)->report_state;
-                if (!event.keycode)
-                {
-                    if (macro->state == MACRO_STATE_PLAYING_ONCE)
-                    {
-                        macro_stop_play(macro);
-                    }
-                    else
-                    {
-                        macro_start_play_circularly(macro);
-                        macro->begin_tick = g_keyboard_tick + macro->actions[0].delay;
-                    }
-                    event_forward_list_remove_specific_owner(&g_event_buffer_list, macro);
-                    break;
-                }
-                keyboard_event_handler(macro->actions[macro->index].event);
-                if (!event.is_virtual)
-                {
-                    keyboard_key_set_report_state((Key*)event.key, report_state);//protect key state
-                }
-                if (macro->actions[macro->index].event.event == KEYBOARD_EVENT_KEY_DOWN)
-                {
-                    event_cache_push(event, macro);
-                }
-                else
-                {
-                    event_forward_list_remove_first(&g_event_buffer_list, (EventCache){event,macro});
-                }
-                macro->index++;
+                macro_stop_play(macro);
             }
-            break;
-        
-        default:
-            break;
-        } 
+            else
+            {
+                macro_start_play_circularly(macro);
+                macro->begin_tick = g_keyboard_tick + macro->action.delay;
+                macro_schedule(macro);
+            }
+            event_cache_table_remove_owner(&g_event_cache, macro);
+            return;
+        }
+        uint8_t report_state = event.key ? ((Key*)event.key)->report_state : 0;
+        keyboard_event_handler(event);
+        if (!event.is_virtual && event.key)
+        {
+            keyboard_key_set_report_state((Key*)event.key, report_state);//protect key state
+        }
+        if (event.event == KEYBOARD_EVENT_KEY_DOWN)
+        {
+            event_cache_push(event, macro);
+        }
+        else
+        {
+            event_cache_table_remove_event(&g_event_cache, (EventCache){event,macro});
+        }
+        if (macro->state != MACRO_STATE_PLAYING_ONCE && macro->state != MACRO_STATE_PLAYING_CIRCULARLY)
+        {
+            return;
+        }
+        macro->index++;
+        macro_load_action(macro);
     }
+    macro_schedule(macro);
 }
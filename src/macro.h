@@ -7,6 +7,7 @@
 #define MACRO_H_
 
 #include "keyboard.h"
+#include "timer_wheel.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,10 +17,35 @@ extern "C" {
 #define MACRO_NUM 4
 #endif
 
-#ifndef MACRO_MAX_ACTIONS
-#define MACRO_MAX_ACTIONS 128
+#if MACRO_NUM > 16
+#error "MACRO_NUM must not exceed 16"
 #endif
 
+#ifndef MACRO_BUFFER_SIZE
+#define MACRO_BUFFER_SIZE 32
+#endif
+
+#ifndef LFS_ENABLE
+#ifndef MACRO_STREAM_SIZE
+#define MACRO_STREAM_SIZE 512
+#endif
+#endif
+
+/*
+ * Each action is stored as
+ *   varint delay delta | flags (event, is_virtual, has key) | varint keycode [| varint key id]
+ * and a zero keycode ends the macro, its delay being the total length.
+ */
+#define MACRO_ACTION_MAX_ENCODED_SIZE 12
+
+#if MACRO_BUFFER_SIZE < MACRO_ACTION_MAX_ENCODED_SIZE || MACRO_BUFFER_SIZE > 255
+#error "MACRO_BUFFER_SIZE must hold one encoded action and fit in 8 bits"
+#endif
+
+#define MACRO_ACTION_FLAG_EVENT_MASK 0x03
+#define MACRO_ACTION_FLAG_VIRTUAL    0x04
+#define MACRO_ACTION_FLAG_KEY        0x08
+
 #define MACRO_KEYCODE_GET_INDEX(keycode) (KEYCODE_GET_SUB((keycode)) & 0x0F)
 #define MACRO_KEYCODE_GET_KEYCODE(keycode) ((KEYCODE_GET_SUB((keycode)) & 0xF0) >>4)
 
@@ -52,18 +78,40 @@ typedef struct __MacroAction
     KeyboardEvent event;
 } MacroAction;
 
+typedef struct __MacroStream
+{
+    uint8_t profile;
+    uint32_t position;
+    uint32_t delay;
+    uint8_t head;
+    uint8_t tail;
+    uint8_t buffer[MACRO_BUFFER_SIZE];
+} MacroStream;
+
 typedef struct __Macro
 {
     uint8_t state;
     uint32_t begin_tick;
     uint16_t length;
     uint16_t index;
-    MacroAction* actions;
+    MacroAction action;
+    MacroStream stream;
+    TimerWheelNode timer;
 } Macro;
 
 extern Macro g_macros[MACRO_NUM];
 
 void macro_init(void);
+void macro_factory_reset(void);
+
+size_t macro_action_encode(uint8_t *buffer, const MacroAction *action, uint32_t base);
+size_t macro_action_decode(const uint8_t *buffer, size_t size, MacroAction *action, uint32_t base);
+void macro_stream_rewind(MacroStream *stream);
+bool macro_stream_read(uint8_t index, MacroStream *stream, MacroAction *action);
+bool macro_read_action(uint8_t index, uint16_t action_index, MacroAction *action);
+void macro_begin_write(Macro *macro);
+bool macro_append(Macro *macro, const MacroAction *action);
+void macro_flush(Macro *macro);
 
 void macro_event_handler(KeyboardEvent event);
 void macro_record_handler(KeyboardEvent event);
@@ -73,7 +121,6 @@ void macro_record(Macro*macro,KeyboardEvent event);
 void macro_start_play_once(Macro*macro);
 void macro_start_play_circularly(Macro*macro);
 void macro_stop_play(Macro*macro);
-void macro_process(void);
 
 #ifdef __cplusplus
 }
@@ -9,6 +9,9 @@ static const JSPropDef js_key_proto[] = {
     JS_CGETSET_DEF("id", js_key_get_id, NULL),
     JS_CGETSET_MAGIC_DEF("state", js_key_get_state, NULL, 0),
     JS_CGETSET_MAGIC_DEF("reportState", js_key_get_state, NULL, 1),
+#ifdef EVENT_TIMESTAMP_ENABLE
+    JS_CGETSET_DEF("timestamp", js_key_get_timestamp, NULL),
+#endif
     JS_CFUNC_DEF("emit", 1, js_key_emit ),
     JS_PROP_END,
 };
@@ -59,6 +62,14 @@ static const JSPropDef js_keyboard[] = {
     JS_CFUNC_MAGIC_DEF("release", 1, js_keyboard_press_release,1),
     JS_CFUNC_DEF("tap", 1, js_keyboard_tap),
     JS_CFUNC_DEF("getLayerIndex", 0, js_keyboard_get_layer_index),
+    JS_CFUNC_DEF("getValues", 1, js_keyboard_get_values),
+    JS_CFUNC_DEF("getStates", 1, js_keyboard_get_states),
+#ifdef ANALOG_CURVE_ENABLE
+    JS_CFUNC_DEF("setCurve", 2, js_keyboard_set_curve),
+#endif
+#ifdef SCRIPT_PROFILE_ENABLE
+    JS_CFUNC_DEF("getScriptStats", 1, js_keyboard_get_script_stats),
+#endif
 #ifndef SCRIPT_MINIMAL
     JS_CFUNC_MAGIC_DEF("command", 1, js_keyboard_command, KEYBOARD_CONFIG_BASE),
     JS_CFUNC_MAGIC_DEF("reboot",  0, js_keyboard_command, KEYBOARD_REBOOT),
@@ -78,6 +89,7 @@ static const JSPropDef js_rgb[] = {
     JS_CFUNC_MAGIC_DEF("setRGB", 4, js_rgb_set_led, 0),
     JS_CFUNC_MAGIC_DEF("setHSV", 4, js_rgb_set_led, 1),
     JS_CFUNC_DEF("setMode", 2, js_rgb_set_led_mode),
+    JS_CFUNC_DEF("setBuffer", 1, js_rgb_set_buffer),
     JS_PROP_END,
 };
 static const JSClassDef js_rgb_obj =
@@ -386,10 +386,14 @@ static const JSPropDef js_global_object[] = {
     JS_CFUNC_DEF("load", 1, js_load),
     JS_CFUNC_DEF("setTimeout", 2, js_setTimeout),
     JS_CFUNC_DEF("clearTimeout", 1, js_clearTimeout),
+    JS_CFUNC_DEF("setLoopInterval", 1, js_setLoopInterval),
+    JS_CFUNC_DEF("setLoopWake", 1, js_setLoopWake),
 #else
     JS_PROP_CLASS_DEF("console", &js_console_obj),
     JS_CFUNC_DEF("setTimeout", 2, js_setTimeout),
     JS_CFUNC_DEF("clearTimeout", 1, js_clearTimeout),
+    JS_CFUNC_DEF("setLoopInterval", 1, js_setLoopInterval),
+    JS_CFUNC_DEF("setLoopWake", 1, js_setLoopWake),
 #endif
 #ifdef LIBAMP_CONFIG_CLASS
     JS_PROP_CLASS_DEF("keyboard", &js_keyboard_obj),
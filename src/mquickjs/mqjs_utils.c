@@ -26,6 +26,7 @@
 #include "script.h"
 #include "layer.h"
 #include "event_cache.h"
+#include "timer_wheel.h"
 #include "stdio.h"
 
 #include "cutils.h"
@@ -47,10 +48,203 @@ typedef struct {
     JSGCRef func;
     uint16_t type;
     Keycode keycode;
-    int32_t timeout; /* in ms */
+    uint16_t heap_index;
+    uint32_t sequence;
+    TimerWheelNode node;
 } JSTimer;
 
+#define JS_TIMER_NOT_DUE 0xFFFF
+
 static JSTimer js_timer_list[SCRIPT_MAX_TIMERS];
+static uint16_t js_timer_free_slots[SCRIPT_MAX_TIMERS];
+static uint16_t js_timer_free_count;
+/* expired timers wait here ordered by deadline, script_process runs them */
+static uint16_t js_timer_heap[SCRIPT_MAX_TIMERS];
+static uint16_t js_timer_heap_size;
+static uint32_t js_timer_sequence;
+
+static BOOL js_timer_before(uint16_t a, uint16_t b)
+{
+    const JSTimer *ta = &js_timer_list[a];
+    const JSTimer *tb = &js_timer_list[b];
+    if (ta->node.expire_tick != tb->node.expire_tick)
+        return (int32_t)(ta->node.expire_tick - tb->node.expire_tick) < 0;
+    return (int32_t)(ta->sequence - tb->sequence) < 0;
+}
+
+static void js_timer_heap_set(uint16_t pos, uint16_t index)
+{
+    js_timer_heap[pos] = index;
+    js_timer_list[index].heap_index = pos;
+}
+
+static void js_timer_heap_sift(uint16_t pos)
+{
+    uint16_t index = js_timer_heap[pos];
+    while (pos > 0 && js_timer_before(index, js_timer_heap[(pos - 1) / 2])) {
+        js_timer_heap_set(pos, js_timer_heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    for (;;) {
+        uint16_t child = pos * 2 + 1;
+        if (child >= js_timer_heap_size)
+            break;
+        if (child + 1 < js_timer_heap_size && js_timer_before(js_timer_heap[child + 1], js_timer_heap[child]))
+            child++;
+        if (!js_timer_before(js_timer_heap[child], index))
+            break;
+        js_timer_heap_set(pos, js_timer_heap[child]);
+        pos = child;
+    }
+    js_timer_heap_set(pos, index);
+}
+
+static void js_timer_heap_remove(JSTimer *th)
+{
+    uint16_t pos = th->heap_index;
+    th->heap_index = JS_TIMER_NOT_DUE;
+    js_timer_heap_size--;
+    if (pos < js_timer_heap_size) {
+        js_timer_heap[pos] = js_timer_heap[js_timer_heap_size];
+        js_timer_heap_sift(pos);
+    }
+}
+
+static void js_timer_expired(void *context)
+{
+    JSTimer *th = (JSTimer *)context;
+    js_timer_heap[js_timer_heap_size] = th - js_timer_list;
+    js_timer_heap_size++;
+    js_timer_heap_sift(js_timer_heap_size - 1);
+}
+
+static JSTimer *js_timer_alloc(void)
+{
+    if (!js_timer_free_count)
+        return NULL;
+    return &js_timer_list[js_timer_free_slots[--js_timer_free_count]];
+}
+
+static void js_timer_start(JSTimer *th, int delay_ms)
+{
+    timer_wheel_node_init(&th->node, js_timer_expired, th);
+    th->heap_index = JS_TIMER_NOT_DUE;
+    th->sequence = js_timer_sequence++;
+    th->allocated = TRUE;
+    timer_wheel_schedule(&th->node, delay_ms > 0 ? KEYBOARD_TIME_TO_TICK(delay_ms) : 0);
+}
+
+static void js_timer_free(JSTimer *th)
+{
+    timer_wheel_cancel(&th->node);
+    if (th->heap_index != JS_TIMER_NOT_DUE)
+        js_timer_heap_remove(th);
+    th->allocated = FALSE;
+    js_timer_free_slots[js_timer_free_count++] = th - js_timer_list;
+}
+
+/* drops pending script callbacks started before mark (or from mark on), native timers such as Keyboard.tap keep running */
+static void js_timer_drop_callbacks(JSContext *ctx, uint32_t mark, BOOL before)
+{
+    for (int i = 0; i < SCRIPT_MAX_TIMERS; i++) {
+        JSTimer *th = &js_timer_list[i];
+        if (th->allocated && th->type == TIMER_TYPE_JS_TIMEOUT
+            && ((int32_t)(th->sequence - mark) < 0) == before) {
+            JS_DeleteGCRef(ctx, &th->func);
+            js_timer_free(th);
+        }
+    }
+}
+
+static void js_timer_reset(void)
+{
+    for (int i = 0; i < SCRIPT_MAX_TIMERS; i++) {
+        timer_wheel_cancel(&js_timer_list[i].node);
+    }
+    memset(js_timer_list, 0, sizeof(js_timer_list));
+    js_timer_heap_size = 0;
+    /* hand out low ids first */
+    for (int i = 0; i < SCRIPT_MAX_TIMERS; i++) {
+        js_timer_free_slots[i] = SCRIPT_MAX_TIMERS - 1 - i;
+    }
+    js_timer_free_count = SCRIPT_MAX_TIMERS;
+}
+
+/* loop() runs every pass unless paced by an interval and/or movement of watched keys */
+static uint32_t js_loop_interval;
+static uint32_t js_loop_due;
+static AnalogValue js_loop_threshold;
+static AnalogValue js_loop_values[TOTAL_KEY_NUM];
+
+static void js_loop_snapshot(void)
+{
+    for (uint16_t i = 0; i < KEY_BITMAP_SIZE; i++)
+    {
+        uint32_t block = g_script_watcher_mask[i];
+        while (block)
+        {
+            uint8_t bit_index = ctz32(block);
+            BIT_RESET(block, bit_index);
+            uint16_t id = i * 32 + bit_index;
+            js_loop_values[id] = keyboard_get_key_analog_value(keyboard_get_key(id));
+        }
+    }
+    js_loop_due = g_keyboard_tick + js_loop_interval;
+}
+
+static BOOL js_loop_moved(void)
+{
+    for (uint16_t i = 0; i < KEY_BITMAP_SIZE; i++)
+    {
+        uint32_t block = g_script_watcher_mask[i];
+        while (block)
+        {
+            uint8_t bit_index = ctz32(block);
+            BIT_RESET(block, bit_index);
+            uint16_t id = i * 32 + bit_index;
+            AnalogValue value = keyboard_get_key_analog_value(keyboard_get_key(id));
+            AnalogValue last = js_loop_values[id];
+            if ((value > last ? value - last : last - value) > js_loop_threshold)
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static BOOL js_loop_is_due(void)
+{
+    if (!js_loop_interval && !js_loop_threshold)
+        return TRUE;
+    if (js_loop_interval && (int32_t)(g_keyboard_tick - js_loop_due) >= 0)
+        return TRUE;
+    return js_loop_threshold && js_loop_moved();
+}
+
+static void js_loop_reset(void)
+{
+    js_loop_interval = 0;
+    js_loop_threshold = 0;
+}
+
+static JSValue js_setLoopInterval(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv)
+{
+    int interval;
+    if (JS_ToInt32(ctx, &interval, argv[0]))
+        return JS_EXCEPTION;
+    js_loop_interval = interval > 0 ? KEYBOARD_TIME_TO_TICK(interval) : 0;
+    js_loop_snapshot();
+    return JS_UNDEFINED;
+}
+
+static JSValue js_setLoopWake(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv)
+{
+    int threshold;
+    if (JS_ToInt32(ctx, &threshold, argv[0]))
+        return JS_EXCEPTION;
+    js_loop_threshold = threshold > 0 ? threshold : 0;
+    js_loop_snapshot();
+    return JS_UNDEFINED;
+}
 
 static int64_t get_time_ms(void)
 {
@@ -59,6 +253,35 @@ static int64_t get_time_ms(void)
 
 static AdvancedKey virtual_key;
 
+/* one rooted wrapper per key, created on first use and reused for every event */
+static JSGCRef js_key_refs[TOTAL_KEY_NUM];
+static uint32_t js_key_ref_mask[KEY_BITMAP_SIZE];
+
+#ifdef EVENT_TIMESTAMP_ENABLE
+/* microseconds wrapped to 30 bits so key.timestamp stays a short int, intervals are (b - a) & JS_KEY_TIMESTAMP_MASK */
+#define JS_KEY_TIMESTAMP_MASK 0x3FFFFFFF
+/* stamp of each key's last dispatched event, read through a getter so dispatch allocates nothing */
+static uint32_t js_key_timestamps[TOTAL_KEY_NUM];
+#endif
+
+static JSValue *js_key_instance(JSContext *ctx, Key *key)
+{
+    JSGCRef *ref = &js_key_refs[key->id];
+    if (!BIT_GET(js_key_ref_mask[key->id / 32], key->id % 32))
+    {
+        JSValue *obj = JS_AddGCRef(ctx, ref);
+        *obj = JS_NewObjectClassUser(ctx, IS_ADVANCED_KEY(key) ? JS_CLASS_ADVANCED_KEY : JS_CLASS_KEY);
+        if (JS_IsException(*obj))
+        {
+            JS_DeleteGCRef(ctx, ref);
+            return NULL;
+        }
+        BIT_SET(js_key_ref_mask[key->id / 32], key->id % 32);
+    }
+    JS_SetOpaque(ctx, ref->val, key);
+    return &ref->val;
+}
+
 static JSValue js_key_constructor(JSContext *ctx, JSValue *this_val, int argc,
                                         JSValue *argv)
 {
@@ -103,6 +326,19 @@ static JSValue js_key_get_id(JSContext *ctx, JSValue *this_val, int argc,
     return JS_NewInt32(ctx, key->id);
 }
 
+#ifdef EVENT_TIMESTAMP_ENABLE
+static JSValue js_key_get_timestamp(JSContext *ctx, JSValue *this_val, int argc,
+                                  JSValue *argv)
+{
+    Key *key;
+    int class_id = JS_GetClassID(ctx, *this_val);
+    if (class_id != JS_CLASS_KEY && class_id != JS_CLASS_ADVANCED_KEY)
+        return JS_ThrowTypeError(ctx, "expecting Key class");
+    key = JS_GetOpaque(ctx, *this_val);
+    return JS_NewInt32(ctx, js_key_timestamps[key->id] & JS_KEY_TIMESTAMP_MASK);
+}
+#endif
+
 static JSValue js_key_get_state(JSContext *ctx, JSValue *this_val, int argc,
                                   JSValue *argv, int magic)
 {
@@ -250,14 +486,10 @@ static JSValue js_keyboard_get_key(JSContext *ctx, JSValue *this_val, int argc,
     {
         return JS_ThrowRangeError(ctx, "Key index out of range");
     }
-    if (IS_ADVANCED_KEY(key))
-    {
-        obj = JS_NewObjectClassUser(ctx, JS_CLASS_ADVANCED_KEY);
-    }
-    else
-    {
-        obj = JS_NewObjectClassUser(ctx, JS_CLASS_KEY);
-    }
+    /* a fresh object, scripts holding it never alias the wrapper handed to event hooks */
+    obj = JS_NewObjectClassUser(ctx, IS_ADVANCED_KEY(key) ? JS_CLASS_ADVANCED_KEY : JS_CLASS_KEY);
+    if (JS_IsException(obj))
+        return obj;
     JS_SetOpaque(ctx, obj, key);
     return obj;
 }
@@ -314,7 +546,7 @@ static void js_keyboard_press(JSContext *ctx, Keycode keycode, bool multi_press)
 {
     KeyboardEvent event = MK_VIRTUAL_EVENT(keycode,KEYBOARD_EVENT_KEY_DOWN,&virtual_key);
     keyboard_event_handler(event);
-    if (multi_press || !event_forward_list_exists_keycode(&g_event_buffer_list, ctx, keycode))
+    if (multi_press || !event_cache_table_exists_keycode(&g_event_cache, ctx, keycode))
     {
 #ifdef SCRIPT_POLLING
         event_cache_buffer_push(event, ctx);
@@ -326,7 +558,7 @@ static void js_keyboard_press(JSContext *ctx, Keycode keycode, bool multi_press)
 
 static void js_keyboard_release(JSContext *ctx, Keycode keycode)
 {
-    event_forward_list_remove_first_keycode(&g_event_buffer_list, ctx, keycode);
+    event_cache_table_remove_first_keycode(&g_event_cache, ctx, keycode);
     keyboard_event_handler(MK_VIRTUAL_EVENT(keycode,KEYBOARD_EVENT_KEY_UP,&virtual_key));
 }
 
@@ -359,15 +591,12 @@ static JSValue js_keyboard_tap(JSContext *ctx, JSValue *this_val, int argc, JSVa
     }
     JS_ToInt32(ctx, &duration_ms, argv[1]);
     js_keyboard_press(ctx, keycode, true);
-    for(int i = 0; i < SCRIPT_MAX_TIMERS; i++) {
-        th = &js_timer_list[i];
-        if (!th->allocated) {
-            th->timeout = get_time_ms() + duration_ms;
-            th->type = TIMER_TYPE_JS_RELEASE_KEYCODE;
-            th->keycode = keycode;
-            th->allocated = TRUE;
-            return JS_NewInt32(ctx, i);
-        }
+    th = js_timer_alloc();
+    if (th) {
+        th->type = TIMER_TYPE_JS_RELEASE_KEYCODE;
+        th->keycode = keycode;
+        js_timer_start(th, duration_ms);
+        return JS_NewInt32(ctx, th - js_timer_list);
     }
 
     return JS_UNDEFINED;
@@ -378,6 +607,126 @@ static JSValue js_keyboard_get_layer_index(JSContext *ctx, JSValue *this_val, in
     return JS_NewInt32(ctx, g_current_layer);
 }
 
+static int js_array_length(JSContext *ctx, JSValue arr, int max)
+{
+    int len;
+    if (JS_ToInt32(ctx, &len, JS_GetPropertyStr(ctx, arr, "length")) || len < 0)
+        return 0;
+    return len < max ? len : max;
+}
+
+// fills a caller-provided array (e.g. Uint16Array) with every key's analog value
+static JSValue js_keyboard_get_values(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv)
+{
+    JSGCRef arr_ref;
+    JSValue *arr = JS_PushGCRef(ctx, &arr_ref);
+    *arr = argv[0];
+    int len = js_array_length(ctx, *arr, TOTAL_KEY_NUM);
+    for (int i = 0; i < len; i++)
+    {
+        JS_SetPropertyUint32(ctx, *arr, i, JS_NewInt32(ctx, keyboard_get_key_analog_value(keyboard_get_key(i))));
+    }
+    JS_PopGCRef(ctx, &arr_ref);
+    return JS_NewInt32(ctx, len);
+}
+
+// packs key states 32 per element into a caller-provided array (e.g. Uint32Array)
+static JSValue js_keyboard_get_states(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv)
+{
+    JSGCRef arr_ref;
+    JSValue *arr = JS_PushGCRef(ctx, &arr_ref);
+    *arr = argv[0];
+    int len = js_array_length(ctx, *arr, KEY_BITMAP_SIZE);
+    for (int i = 0; i < len; i++)
+    {
+        uint32_t block = 0;
+        for (uint16_t j = 0; j < 32 && i * 32 + j < TOTAL_KEY_NUM; j++)
+        {
+            if (keyboard_get_key(i * 32 + j)->state)
+                block |= BIT(j);
+        }
+        // as int32 the block stays a short int even with bit 31 set, a Uint32Array stores the same bits
+        JS_SetPropertyUint32(ctx, *arr, i, JS_NewInt32(ctx, (int32_t)block));
+    }
+    JS_PopGCRef(ctx, &arr_ref);
+    return JS_NewInt32(ctx, len);
+}
+
+#ifdef ANALOG_CURVE_ENABLE
+// points are flat x, y pairs of normalized values, an empty array removes the curve
+static JSValue js_keyboard_set_curve(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv)
+{
+    int id;
+    AnalogCurvePoint points[ANALOG_CURVE_POINT_NUM];
+    if (JS_ToInt32(ctx, &id, argv[0]))
+        return JS_EXCEPTION;
+    JSGCRef arr_ref;
+    JSValue *arr = JS_PushGCRef(ctx, &arr_ref);
+    *arr = argv[1];
+    const int len = js_array_length(ctx, *arr, ANALOG_CURVE_POINT_NUM * 2 + 2);
+    if (len & 1)
+    {
+        JS_PopGCRef(ctx, &arr_ref);
+        return JS_ThrowRangeError(ctx, "curve needs x, y pairs");
+    }
+    int count = len / 2;
+    for (int i = 0; i < count && i < ANALOG_CURVE_POINT_NUM; i++)
+    {
+        int x, y;
+        if (JS_ToInt32(ctx, &x, JS_GetPropertyUint32(ctx, *arr, i * 2)) ||
+            JS_ToInt32(ctx, &y, JS_GetPropertyUint32(ctx, *arr, i * 2 + 1)))
+        {
+            JS_PopGCRef(ctx, &arr_ref);
+            return JS_EXCEPTION;
+        }
+        if (x < ANALOG_VALUE_MIN || x > ANALOG_VALUE_MAX || y < ANALOG_VALUE_MIN || y > ANALOG_VALUE_MAX)
+        {
+            JS_PopGCRef(ctx, &arr_ref);
+            return JS_ThrowRangeError(ctx, "curve point out of range");
+        }
+        points[i].x = x;
+        points[i].y = y;
+    }
+    JS_PopGCRef(ctx, &arr_ref);
+    if (id < 0 || !advanced_key_set_curve(id, points, count))
+        return JS_ThrowRangeError(ctx, "invalid curve");
+    return JS_UNDEFINED;
+}
+#endif
+
+#ifdef SCRIPT_PROFILE_ENABLE
+static JSValue js_keyboard_get_script_stats(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv)
+{
+    JSCStringBuf buf;
+    size_t len;
+    const char *name = JS_ToCStringLen(ctx, &len, argv[0], &buf);
+    if (!name)
+        return JS_EXCEPTION;
+    uint8_t hook = 0;
+    while (hook < SCRIPT_HOOK_NUM && strcmp(name, g_script_hook_names[hook]))
+        hook++;
+    if (hook >= SCRIPT_HOOK_NUM)
+        return JS_ThrowRangeError(ctx, "unknown hook");
+
+    const ScriptHookProfile *profile = &g_script_profiles[hook];
+    uint32_t high_water;
+    uint32_t unused;
+    script_heap_usage(&high_water, &unused);
+
+    JSGCRef obj_ref;
+    JSValue *obj = JS_PushGCRef(ctx, &obj_ref);
+    *obj = JS_NewObject(ctx);
+    JS_SetPropertyStr(ctx, *obj, "calls", JS_NewUint32(ctx, profile->calls));
+    JS_SetPropertyStr(ctx, *obj, "min", JS_NewUint32(ctx, profile->min_us));
+    JS_SetPropertyStr(ctx, *obj, "avg", JS_NewUint32(ctx, profile->calls ? (uint32_t)(profile->total_us / profile->calls) : 0));
+    JS_SetPropertyStr(ctx, *obj, "max", JS_NewUint32(ctx, profile->max_us));
+    JS_SetPropertyStr(ctx, *obj, "explicitGc", JS_NewUint32(ctx, g_script_explicit_gc_runs));
+    JS_SetPropertyStr(ctx, *obj, "heapHighWaterEstimate", JS_NewUint32(ctx, high_water));
+    JS_SetPropertyStr(ctx, *obj, "heapUnused", JS_NewUint32(ctx, unused));
+    return JS_PopGCRef(ctx, &obj_ref);
+}
+#endif
+
 static JSValue js_keyboard_command(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv, int magic)
 {
     int keycode = magic;
@@ -471,6 +820,39 @@ static JSValue js_rgb_set_led_mode(JSContext *ctx, JSValue *this_val, int argc,
     g_rgb_configs[g_rgb_inverse_mapping[index]].mode = mode;
     return JS_UNDEFINED;
 }
+
+// r, g, b triples in key order, mapped to LEDs like setRGB, from a caller-provided array (e.g. Uint8Array)
+static JSValue js_rgb_set_buffer(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv)
+{
+    JSGCRef arr_ref;
+    JSValue *arr = JS_PushGCRef(ctx, &arr_ref);
+    *arr = argv[0];
+    int count = js_array_length(ctx, *arr, TOTAL_KEY_NUM * 3) / 3;
+    for (int i = 0; i < count; i++)
+    {
+        const uint16_t index = g_rgb_inverse_mapping[i];
+        if (index >= RGB_NUM)
+        {
+            continue;
+        }
+        int r = 0, g = 0, b = 0;
+        JS_ToInt32(ctx, &r, JS_GetPropertyUint32(ctx, *arr, i * 3));
+        JS_ToInt32(ctx, &g, JS_GetPropertyUint32(ctx, *arr, i * 3 + 1));
+        JS_ToInt32(ctx, &b, JS_GetPropertyUint32(ctx, *arr, i * 3 + 2));
+        RGBConfig* config = &g_rgb_configs[index];
+        // most LEDs keep their colour from frame to frame, skip the HSV conversion for them
+        if (config->rgb.r == (uint8_t)r && config->rgb.g == (uint8_t)g && config->rgb.b == (uint8_t)b)
+        {
+            continue;
+        }
+        config->rgb.r = r;
+        config->rgb.g = g;
+        config->rgb.b = b;
+        rgb_to_hsv(&config->hsv, &config->rgb);
+    }
+    JS_PopGCRef(ctx, &arr_ref);
+    return JS_NewInt32(ctx, count);
+}
 #endif
 
 //static JSValue js_keyboard_suspend(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv)
@@ -504,23 +886,20 @@ static JSValue js_print(JSContext *ctx, JSValue *this_val, int argc, JSValue *ar
 static JSValue js_setTimeout(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv)
 {
     JSTimer *th;
-    int delay, i;
+    int delay;
     JSValue *pfunc;
     
     if (!JS_IsFunction(ctx, argv[0]))
         return JS_ThrowTypeError(ctx, "not a function");
     if (JS_ToInt32(ctx, &delay, argv[1]))
         return JS_EXCEPTION;
-    for(i = 0; i < SCRIPT_MAX_TIMERS; i++) {
-        th = &js_timer_list[i];
-        if (!th->allocated) {
-            pfunc = JS_AddGCRef(ctx, &th->func);
-            *pfunc = argv[0];
-            th->timeout = get_time_ms() + delay;
-            th->type = 0;
-            th->allocated = TRUE;
-            return JS_NewInt32(ctx, i);
-        }
+    th = js_timer_alloc();
+    if (th) {
+        pfunc = JS_AddGCRef(ctx, &th->func);
+        *pfunc = argv[0];
+        th->type = TIMER_TYPE_JS_TIMEOUT;
+        js_timer_start(th, delay);
+        return JS_NewInt32(ctx, th - js_timer_list);
     }
     return JS_ThrowInternalError(ctx, "too many timers");
 }
@@ -536,7 +915,7 @@ static JSValue js_clearTimeout(JSContext *ctx, JSValue *this_val, int argc, JSVa
         th = &js_timer_list[timer_id];
         if (th->allocated) {
             JS_DeleteGCRef(ctx, &th->func);
-            th->allocated = FALSE;
+            js_timer_free(th);
         }
     }
     return JS_UNDEFINED;
@@ -545,6 +924,9 @@ static JSValue js_clearTimeout(JSContext *ctx, JSValue *this_val, int argc, JSVa
 static JSValue js_gc(JSContext *ctx, JSValue *this_val, int argc, JSValue *argv)
 {
     JS_GC(ctx);
+#ifdef SCRIPT_PROFILE_ENABLE
+    g_script_explicit_gc_runs++;
+#endif
     return JS_UNDEFINED;
 }
 
@@ -6,6 +6,7 @@
 #include "packet.h"
 #include "rgb.h"
 #include "layer.h"
+#include "event_buffer.h"
 
 #ifdef NEXUS_ENABLE
 #include "nexus.h"
@@ -16,6 +17,15 @@
 #ifdef MACRO_ENABLE
 #include "macro.h"
 #endif
+#ifdef COMBO_ENABLE
+#include "combo.h"
+#endif
+#ifdef TAP_DANCE_ENABLE
+#include "tap_dance.h"
+#endif
+#if defined(SCRIPT_ENABLE) && defined(SCRIPT_PROFILE_ENABLE)
+#include "script.h"
+#endif
 #include "packet_buffer.h"
 
 #define DEBUG_BUFFER_MAX_LENGTH 5
@@ -62,6 +72,25 @@ void packet_process_buffer(uint8_t *buf, uint16_t len)
             packet_process_macro(packet);
             break;
 #endif
+#ifdef COMBO_ENABLE
+        case PACKET_DATA_COMBO:
+            packet_process_combo(packet);
+            break;
+        case PACKET_DATA_COMBO_HOLD_OFF:
+            packet_process_combo_hold_off(packet);
+            break;
+#endif
+#ifdef TAP_DANCE_ENABLE
+        case PACKET_DATA_TAP_DANCE:
+            packet_process_tap_dance(packet);
+            break;
+#endif
+        case PACKET_DATA_EVENT_QUEUE:
+            packet_process_event_queue(packet);
+            break;
+        case PACKET_DATA_SCRIPT_PROFILE:
+            packet_process_script_profile(packet);
+            break;
         case PACKET_DATA_FEATURE:
             packet_process_feature(packet);
             break;
@@ -109,6 +138,9 @@ void packet_process_buffer(uint8_t *buf, uint16_t len)
                 .event = packet_event->event,
                 .is_virtual = packet_event->is_virtual,
                 .key = key,
+#ifdef EVENT_TIMESTAMP_ENABLE
+                .timestamp = g_keyboard_event_timestamp,
+#endif
             };      
             keyboard_event_handler(event);
             if (key != NULL)
@@ -253,6 +285,10 @@ void packet_process_rgb_config(PacketData*data)
 void packet_process_keymap(PacketData*data)
 {
     PacketKeymap* packet = (PacketKeymap*)data;
+    if (packet->layer >= LAYER_NUM)
+    {
+        return;
+    }
     if (data->code == PACKET_CODE_SET)
     {       
         for (uint16_t i = 0; i < packet->length; i++)
@@ -260,7 +296,7 @@ void packet_process_keymap(PacketData*data)
             g_keymap[packet->layer][packet->start + i] = packet->keymap[i];
             if (!g_keymap_lock[packet->start + i])
             {
-                g_keymap_cache[packet->start + i] = layer_get_keycode(packet->start + i, g_current_layer); 
+                layer_cache_update(packet->start + i);
             }
         }
     }
@@ -280,16 +316,21 @@ void packet_process_dynamic_key(PacketData*data)
     {       
         if (packet->index<DYNAMIC_KEY_NUM)
         {
-            memcpy(&g_dynamic_keys[packet->index], &packet->dynamic_key, sizeof(DynamicKey));
+            dynamic_key_set(packet->index, packet->dynamic_key);
         }
     }
     else if (data->code == PACKET_CODE_GET)
     {
         packet->type = PACKET_DATA_DYNAMIC_KEY;
         uint8_t dk_index = packet->index;
-        if (dk_index < DYNAMIC_KEY_NUM)
+        const DynamicKey *dynamic_key = dynamic_key_get(dk_index);
+        if (dynamic_key)
+        {
+            memcpy(packet->dynamic_key, dynamic_key, dynamic_key_type_size(dynamic_key->type));
+        }
+        else
         {
-            memcpy(&packet->dynamic_key,&g_dynamic_keys[dk_index],sizeof(DynamicKey));
+            memset(packet->dynamic_key, 0, sizeof(uint32_t));
         }
     }
 }
@@ -387,41 +428,43 @@ void packet_process_macro(PacketData*data)
     {
         return;
     }
+    Macro *macro = &g_macros[packet->macro_index];
     if (data->code == PACKET_CODE_SET)
     {
+        // actions are appended in order, index 0 starts a new macro
         for (uint8_t i = 0; i < packet->length; i++)
         {
             uint16_t index = packet->data[i].index;
-            if (index < MACRO_MAX_ACTIONS)
+            if (index == 0)
             {
-                MacroAction *action = &g_macros[packet->macro_index].actions[index];
-                action->delay = packet->data[i].delay;
-                action->event.event = packet->data[i].event;
-                action->event.is_virtual = packet->data[i].is_virtual;
-                action->event.keycode = packet->data[i].keycode;
-                void * key = keyboard_get_key(packet->data[i].key_id);
-                if (key != NULL)
-                {
-                    action->event.key = key;
-                }
+                macro_begin_write(macro);
+            }
+            else if (index != macro->length)
+            {
+                continue;
             }
+            MacroAction action;
+            action.delay = packet->data[i].delay;
+            action.event = MK_EVENT(packet->data[i].keycode, packet->data[i].event, keyboard_get_key(packet->data[i].key_id));
+            action.event.is_virtual = packet->data[i].is_virtual;
+            macro_append(macro, &action);
         }
+        macro_flush(macro);
     }
     else if (data->code == PACKET_CODE_GET)
     {
         for (uint8_t i = 0; i < packet->length; i++)
         {
-            uint8_t index = packet->data[i].index;
-            if (index < MACRO_MAX_ACTIONS)
+            MacroAction action;
+            if (macro_read_action(packet->macro_index, packet->data[i].index, &action))
             {
-                MacroAction *action = &g_macros[packet->macro_index].actions[index];
-                packet->data[i].delay = action->delay;
-                packet->data[i].event = action->event.event;
-                packet->data[i].is_virtual = action->event.is_virtual;
-                packet->data[i].keycode = action->event.keycode;
-                if (action->event.key != NULL)
+                packet->data[i].delay = action.delay;
+                packet->data[i].event = action.event.event;
+                packet->data[i].is_virtual = action.event.is_virtual;
+                packet->data[i].keycode = action.event.keycode;
+                if (action.event.key != NULL)
                 {
-                    packet->data[i].key_id = ((Key*)action->event.key)->id;
+                    packet->data[i].key_id = ((Key*)action.event.key)->id;
                 }
             }
         }
@@ -498,3 +541,117 @@ __WEAK void packet_process_user(uint8_t *buf, uint16_t len)
 {
 
 }
+
+void packet_process_combo(PacketData*data)
+{
+#ifdef COMBO_ENABLE
+    PacketCombo* packet = (PacketCombo*)data;
+    if (packet->index >= COMBO_NUM)
+    {
+        return;
+    }
+    if (data->code == PACKET_CODE_SET)
+    {
+        memcpy(&g_combos[packet->index], packet->combo, sizeof(Combo));
+        combo_init();
+    }
+    else if (data->code == PACKET_CODE_GET)
+    {
+        memcpy(packet->combo, &g_combos[packet->index], sizeof(Combo));
+    }
+#else
+    UNUSED(data);
+#endif
+}
+
+void packet_process_combo_hold_off(PacketData*data)
+{
+#ifdef COMBO_ENABLE
+    PacketComboHoldOff* packet = (PacketComboHoldOff*)data;
+    if (packet->start >= TOTAL_KEY_NUM || packet->length > TOTAL_KEY_NUM - packet->start)
+    {
+        return;
+    }
+    if (data->code == PACKET_CODE_SET)
+    {
+        for (uint16_t i = 0; i < packet->length; i++)
+        {
+            g_combo_hold_off[packet->start + i] = packet->hold_off[i];
+        }
+        combo_init();
+    }
+    else if (data->code == PACKET_CODE_GET)
+    {
+        for (uint16_t i = 0; i < packet->length; i++)
+        {
+            packet->hold_off[i] = g_combo_hold_off[packet->start + i];
+        }
+    }
+#else
+    UNUSED(data);
+#endif
+}
+
+void packet_process_tap_dance(PacketData*data)
+{
+#ifdef TAP_DANCE_ENABLE
+    PacketTapDance* packet = (PacketTapDance*)data;
+    if (packet->index >= TAP_DANCE_NUM)
+    {
+        return;
+    }
+    if (data->code == PACKET_CODE_SET)
+    {
+        memcpy(&g_tap_dances[packet->index], packet->tap_dance, sizeof(TapDance));
+    }
+    else if (data->code == PACKET_CODE_GET)
+    {
+        memcpy(packet->tap_dance, &g_tap_dances[packet->index], sizeof(TapDance));
+    }
+#else
+    UNUSED(data);
+#endif
+}
+
+void packet_process_event_queue(PacketData*data)
+{
+    PacketEventQueue* packet = (PacketEventQueue*)data;
+    EventLoopQueue* queue = &g_keyboard_event_buffer;
+    if (data->code == PACKET_CODE_SET)
+    {
+        event_loop_queue_set_policy(queue, packet->policy);
+        event_loop_queue_reset_stats(queue);
+    }
+    packet->policy = queue->policy;
+    packet->capacity = event_loop_queue_capacity(queue);
+    packet->high_water = event_loop_queue_high_water(queue);
+    packet->dropped = event_loop_queue_dropped(queue);
+}
+
+void packet_process_script_profile(PacketData*data)
+{
+#if defined(SCRIPT_ENABLE) && defined(SCRIPT_PROFILE_ENABLE)
+    PacketScriptProfile* packet = (PacketScriptProfile*)data;
+    uint32_t high_water;
+    uint32_t unused;
+    if (data->code == PACKET_CODE_SET)
+    {
+        script_profile_reset();
+    }
+    if (packet->hook < SCRIPT_HOOK_NUM)
+    {
+        const ScriptHookProfile *profile = &g_script_profiles[packet->hook];
+        packet->calls = profile->calls;
+        packet->min_us = profile->min_us;
+        packet->avg_us = profile->calls ? (uint32_t)(profile->total_us / profile->calls) : 0;
+        packet->max_us = profile->max_us;
+    }
+    packet->explicit_gc_runs = g_script_explicit_gc_runs;
+    packet->heap_size = SCRIPT_MEMORY_SIZE;
+    script_heap_usage(&high_water, &unused);
+    packet->heap_high_water_estimate = high_water;
+    packet->heap_unused = unused;
+#else
+    UNUSED(data);
+#endif
+}
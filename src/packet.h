@@ -39,6 +39,12 @@ enum {
   PACKET_DATA_FEATURE = 0x0B,
   PACKET_DATA_SCRIPT_SCOURCE = 0x0C,
   PACKET_DATA_SCRIPT_BYTECODE = 0x0D,
+  PACKET_DATA_KEYMAP_SPARSE = 0x0E,
+  PACKET_DATA_COMBO = 0x0F,
+  PACKET_DATA_COMBO_HOLD_OFF = 0x10,
+  PACKET_DATA_TAP_DANCE = 0x11,
+  PACKET_DATA_EVENT_QUEUE = 0x12,
+  PACKET_DATA_SCRIPT_PROFILE = 0x13,
 };
 
 typedef struct __PacketBase
@@ -147,6 +153,61 @@ typedef struct __PacketDynamicKey
   uint8_t dynamic_key[];
 } __PACKED PacketDynamicKey;
 
+typedef struct __PacketCombo
+{
+  uint8_t code;
+  uint8_t id;
+  uint8_t type;
+  uint8_t index;
+  uint8_t combo[];
+} __PACKED PacketCombo;
+
+typedef struct __PacketComboHoldOff
+{
+  uint8_t code;
+  uint8_t id;
+  uint8_t type;
+  uint16_t start;
+  uint8_t length;
+  uint16_t hold_off[];
+} __PACKED PacketComboHoldOff;
+
+typedef struct __PacketEventQueue
+{
+  uint8_t code;
+  uint8_t id;
+  uint8_t type;
+  uint8_t policy;
+  uint16_t capacity;
+  uint16_t high_water;
+  uint32_t dropped;
+} __PACKED PacketEventQueue;
+
+typedef struct __PacketScriptProfile
+{
+  uint8_t code;
+  uint8_t id;
+  uint8_t type;
+  uint8_t hook;
+  uint32_t calls;
+  uint32_t min_us;
+  uint32_t avg_us;
+  uint32_t max_us;
+  uint32_t explicit_gc_runs;
+  uint32_t heap_size;
+  uint32_t heap_high_water_estimate;
+  uint32_t heap_unused;
+} __PACKED PacketScriptProfile;
+
+typedef struct __PacketTapDance
+{
+  uint8_t code;
+  uint8_t id;
+  uint8_t type;
+  uint8_t index;
+  uint8_t tap_dance[];
+} __PACKED PacketTapDance;
+
 typedef struct __PacketProfileIndex
 {
   uint8_t code;
@@ -268,6 +329,11 @@ void packet_process_debug(PacketData*data);
 void packet_fill_debug(PacketData*data);
 void packet_process_macro(PacketData*data);
 void packet_process_feature(PacketData*data);
+void packet_process_combo(PacketData*data);
+void packet_process_combo_hold_off(PacketData*data);
+void packet_process_tap_dance(PacketData*data);
+void packet_process_event_queue(PacketData*data);
+void packet_process_script_profile(PacketData*data);
 
 void packet_send_version_packet(void);
 void packet_notify_event(uint8_t packet_event);
@@ -19,6 +19,13 @@ static void script_write_log(const void *buf, size_t buf_len);
 #include "storage.h"
 
 #include "mqjs_stdlib.h"
+
+#if defined(SCRIPT_XIP_ENABLE) && (defined(__unix__) || defined(__APPLE__))
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 static void script_write_log(const void *buf, size_t buf_len)
 {
     if (buf == NULL || buf_len == 0)
@@ -46,7 +53,7 @@ extern const JSSTDLibraryDef js_stdlib;
 #error "SCRIPT_ENABLE requires storage support with LFS_ENABLE"
 #endif
 
-#if SCRIPT_RUNTIME_STRATEGY == SCRIPT_AOT
+#if SCRIPT_RUNTIME_STRATEGY == SCRIPT_AOT || defined(SCRIPT_BYTECODE_CACHE_ENABLE)
 uint8_t g_script_bytecode_buffer[SCRIPT_BYTECODE_BUFFER_SIZE];
 #endif
 #if SCRIPT_RUNTIME_STRATEGY == SCRIPT_JIT
@@ -84,6 +91,179 @@ static void dump_error(JSContext *ctx)
 }
 
 static JSContext *js_ctx;
+
+static uint32_t script_budget;
+static bool script_budget_exceeded;
+static uint8_t script_overruns;
+static uint8_t script_hook_depth;
+
+// state of the enclosing hook, restored when a nested hook returns
+typedef struct __ScriptHookFrame
+{
+    uint32_t budget;
+    uint32_t granted;
+    bool exceeded;
+#ifdef SCRIPT_PROFILE_ENABLE
+    uint32_t begin_us;
+#endif
+} ScriptHookFrame;
+
+// polled by the engine while bytecode runs, a non-zero return aborts the call
+static int script_interrupt_handler(JSContext *ctx, void *opaque)
+{
+    UNUSED(ctx);
+    UNUSED(opaque);
+    if (script_budget)
+    {
+        script_budget--;
+        return 0;
+    }
+    script_budget_exceeded = true;
+    return 1;
+}
+
+const char *const g_script_hook_names[SCRIPT_HOOK_NUM] = {
+    [SCRIPT_HOOK_LOOP] = "loop",
+    [SCRIPT_HOOK_KEY_DOWN] = "onKeyDown",
+    [SCRIPT_HOOK_KEY_UP] = "onKeyUp",
+    [SCRIPT_HOOK_TIMER] = "timer",
+    [SCRIPT_HOOK_EXIT] = "onExit",
+    [SCRIPT_HOOK_MAIN] = "main",
+};
+
+#ifdef SCRIPT_PROFILE_ENABLE
+ScriptHookProfile g_script_profiles[SCRIPT_HOOK_NUM];
+uint32_t g_script_explicit_gc_runs;
+static uint32_t script_profile_begin_us;
+
+void script_profile_reset(void)
+{
+    memset(g_script_profiles, 0, sizeof(g_script_profiles));
+    g_script_explicit_gc_runs = 0;
+}
+
+static void script_profile_end(uint8_t hook)
+{
+    const uint32_t elapsed = keyboard_get_timestamp_us() - script_profile_begin_us;
+    ScriptHookProfile *profile = &g_script_profiles[hook];
+    if (!profile->calls || elapsed < profile->min_us)
+    {
+        profile->min_us = elapsed;
+    }
+    if (elapsed > profile->max_us)
+    {
+        profile->max_us = elapsed;
+    }
+    profile->total_us += elapsed;
+    profile->calls++;
+}
+
+void script_heap_usage(uint32_t *high_water_estimate, uint32_t *unused)
+{
+    // the pool is zeroed on reset, the engine grows the heap up and the stack down;
+    // zero bytes the engine has written look unused, so this is only an estimate
+    uint32_t longest = 0;
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < SCRIPT_MEMORY_SIZE; i++)
+    {
+        run = js_memory_pool[i] ? 0 : run + 1;
+        if (run > longest)
+        {
+            longest = run;
+        }
+    }
+    *high_water_estimate = SCRIPT_MEMORY_SIZE - longest;
+    *unused = longest;
+}
+#endif
+
+#if SCRIPT_RUNTIME_STRATEGY == SCRIPT_JIT
+// number of enumerable globals a fresh context starts with
+static uint32_t script_builtin_globals;
+
+// evaluates an internal helper with the builtin count substituted, and calls the result with arg if given
+static JSValue script_run_helper(JSContext *ctx, const char *format, JSValue *arg)
+{
+    char code[256];
+    const int len = snprintf(code, sizeof(code), format, (unsigned long)script_builtin_globals);
+    // trusted helpers have bounded loops, so they run with the budget lifted
+    const uint32_t budget = script_budget;
+    script_budget = UINT32_MAX;
+    JSValue ret = JS_Eval(ctx, code, len, "<runtime>", 0);
+    if (arg && !JS_IsException(ret))
+    {
+        if (JS_StackCheck(ctx, 3))
+        {
+            ret = JS_EXCEPTION;
+        }
+        else
+        {
+            JS_PushArg(ctx, *arg);
+            JS_PushArg(ctx, ret);
+            JS_PushArg(ctx, JS_NULL); /* this */
+            ret = JS_Call(ctx, 1);
+        }
+    }
+    script_budget = budget;
+    return ret;
+}
+#endif
+
+static void script_hook_begin(ScriptHookFrame *frame)
+{
+    frame->budget = script_budget;
+    frame->exceeded = script_budget_exceeded;
+    // a hook nested in another (Keyboard.press firing onKeyDown) only spends what the outer one has left
+    frame->granted = (script_hook_depth && script_budget < SCRIPT_HOOK_BUDGET) ? script_budget : SCRIPT_HOOK_BUDGET;
+    script_budget = frame->granted;
+    script_budget_exceeded = false;
+    script_hook_depth++;
+#ifdef SCRIPT_PROFILE_ENABLE
+    frame->begin_us = script_profile_begin_us;
+    script_profile_begin_us = keyboard_get_timestamp_us();
+#endif
+}
+
+static void script_hook_end(ScriptHookFrame *frame, uint8_t hook, const char *name)
+{
+#ifdef SCRIPT_PROFILE_ENABLE
+    script_profile_end(hook);
+    script_profile_begin_us = frame->begin_us;
+#else
+    UNUSED(hook);
+#endif
+    const bool exceeded = script_budget_exceeded;
+    if (--script_hook_depth)
+    {
+        script_budget = frame->budget - (frame->granted - script_budget);
+        script_budget_exceeded = frame->exceeded;
+    }
+    if (!exceeded)
+    {
+        if (!script_hook_depth)
+        {
+            script_overruns = 0;
+        }
+        return;
+    }
+    console_printf("script: %s aborted after exceeding its budget\n", name);
+    if (++script_overruns >= SCRIPT_HOOK_MAX_OVERRUNS)
+    {
+        console_printf("script: suspended after %d overruns\n", script_overruns);
+        script_overruns = 0;
+        g_keyboard_enable_script = false;
+    }
+}
+
+static JSValue script_call(JSContext *ctx, int argc, uint8_t hook)
+{
+    ScriptHookFrame frame;
+    script_hook_begin(&frame);
+    JSValue ret = JS_Call(ctx, argc);
+    script_hook_end(&frame, hook, g_script_hook_names[hook]);
+    return ret;
+}
+
 void script_run_function(JSContext *ctx, const char *func_name)
 {
     JSValue global_obj = JS_GetGlobalObject(ctx);
@@ -91,7 +271,10 @@ void script_run_function(JSContext *ctx, const char *func_name)
     if (JS_IsFunction(ctx, func)) {
         JS_PushArg(ctx, func); /* func name */
         JS_PushArg(ctx, JS_NULL); /* this */
+        ScriptHookFrame frame;
+        script_hook_begin(&frame);
         JSValue ret = JS_Call(ctx, 0);
+        script_hook_end(&frame, SCRIPT_HOOK_MAIN, func_name);
         if (JS_IsException(ret)) {
             dump_error(ctx);
         }
@@ -103,32 +286,13 @@ void script_run_function(JSContext *ctx, const char *func_name)
 }
 
 
-static JSValue new_key_instance(JSContext *ctx, Key* key) {
-    int class_id = IS_ADVANCED_KEY(key) ? JS_CLASS_ADVANCED_KEY : JS_CLASS_KEY;
-
-    JSGCRef obj_ref;
-    JSValue *obj = JS_PushGCRef(ctx, &obj_ref);
-
-    *obj = JS_NewObjectClassUser(ctx, class_id);
-    if (JS_IsException(*obj)) {
-        JS_PopGCRef(ctx, &obj_ref);
-        return JS_EXCEPTION;
-    }
-
-    JS_SetOpaque(ctx, *obj, key);
-    JSValue ret = *obj;
-    JS_PopGCRef(ctx, &obj_ref);
-    
-    return ret;
-}
-
 static bool find_function_by_name(JSContext *ctx, JSValue **func_ptr, JSGCRef *func_ref, const char *func_name)
 {   
     JSValue global = JS_GetGlobalObject(ctx);
     JSValue func = JS_GetPropertyStr(ctx, global, func_name);
     
     if (JS_IsFunction(ctx, func)) {
-        *func_ptr = JS_PushGCRef(ctx, func_ref);
+        *func_ptr = JS_AddGCRef(ctx, func_ref);
         **func_ptr = func;
         return true;
     } else {
@@ -137,8 +301,26 @@ static bool find_function_by_name(JSContext *ctx, JSValue **func_ptr, JSGCRef *f
     }
 }
 
+static void release_function(JSContext *ctx, JSValue **func_ptr, JSGCRef *func_ref, bool *func_set)
+{
+    if (*func_set) {
+        JS_DeleteGCRef(ctx, func_ref);
+    }
+    *func_ptr = NULL;
+    *func_set = false;
+}
+
+static void script_release_hooks(JSContext *ctx)
+{
+    release_function(ctx, &loop_func_ptr, &loop_func_ref, &loop_func_set);
+    release_function(ctx, &on_key_down_func_ptr, &on_key_down_func_ref, &on_key_down_func_set);
+    release_function(ctx, &on_key_up_func_ptr, &on_key_up_func_ref, &on_key_up_func_set);
+    release_function(ctx, &on_exit_func_ptr, &on_exit_func_ref, &on_exit_func_set);
+}
+
 static void script_setup_hooks(JSContext *ctx)
 {
+    script_release_hooks(ctx);
     loop_func_set = find_function_by_name(ctx, &loop_func_ptr, &loop_func_ref, "loop");
     on_key_down_func_set = find_function_by_name(ctx, &on_key_down_func_ptr, &on_key_down_func_ref, "onKeyDown");
     on_key_up_func_set = find_function_by_name(ctx, &on_key_up_func_ptr, &on_key_up_func_ref, "onKeyUp");
@@ -149,6 +331,7 @@ void script_factory_reset(void)
 {
     fs_unlink("scripts/main.js");
     fs_unlink("scripts/main.bin");
+    fs_unlink("scripts/cache.bin");
 }
 
 void script_reset_runtime(void)
@@ -159,7 +342,13 @@ void script_reset_runtime(void)
         JS_FreeContext(js_ctx);
         js_ctx = NULL;
     }
-    memset(js_timer_list, 0, sizeof(js_timer_list));
+    js_timer_reset();
+    js_loop_reset();
+#ifdef ANALOG_CURVE_ENABLE
+    advanced_key_reset_curves();
+#endif
+    memset(js_key_refs, 0, sizeof(js_key_refs));
+    memset(js_key_ref_mask, 0, sizeof(js_key_ref_mask));
     memset(js_memory_pool, 0, sizeof(js_memory_pool)); 
 
     loop_func_ptr = NULL;
@@ -178,11 +367,153 @@ void script_reset_runtime(void)
         return;
     }
     JS_SetLogFunc(js_ctx, script_log_func);
+    JS_SetInterruptHandler(js_ctx, script_interrupt_handler);
+    script_overruns = 0;
+    script_hook_depth = 0;
+#if SCRIPT_RUNTIME_STRATEGY == SCRIPT_JIT
+    int count = 0;
+    JSValue ret = script_run_helper(js_ctx, "Object.keys(globalThis).length", NULL);
+    if (JS_IsException(ret) || JS_ToInt32(js_ctx, &count, ret))
+    {
+        dump_error(js_ctx);
+    }
+    script_builtin_globals = count;
+#endif
+}
+
+static void script_run_bytecode(const uint8_t *bytecode_buf, size_t len)
+{
+    if (!js_ctx || !bytecode_buf) return;
+
+    if (!JS_IsBytecode(bytecode_buf, len)) {
+        console_printf("Error: Invalid bytecode format.\n");
+        return;
+    }
+
+    JSValue func = JS_LoadBytecode(js_ctx, bytecode_buf);
+
+    if (JS_IsException(func)) {
+        dump_error(js_ctx);
+        return;
+    }
+
+    ScriptHookFrame frame;
+    script_hook_begin(&frame);
+    JSValue ret = JS_Run(js_ctx, func);
+    script_hook_end(&frame, SCRIPT_HOOK_MAIN, g_script_hook_names[SCRIPT_HOOK_MAIN]);
+
+    if (JS_IsException(ret)) {
+        dump_error(js_ctx);
+    }
+}
+
+#ifdef SCRIPT_XIP_ENABLE
+#if defined(__unix__) || defined(__APPLE__)
+// hosted builds map a file at a fixed address, standing in for flash;
+// it is remapped on every init so a rebuilt image is picked up on reload
+__WEAK const uint8_t *script_flash_map(size_t *size)
+{
+    static void *mapped;
+    static size_t mapped_size;
+    if (mapped)
+    {
+        munmap(mapped, mapped_size);
+        mapped = NULL;
+        mapped_size = 0;
+    }
+    int fd = open(SCRIPT_XIP_HOST_FILE, O_RDONLY);
+    if (fd >= 0)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *addr = mmap((void *)SCRIPT_XIP_HOST_ADDRESS, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == (void *)SCRIPT_XIP_HOST_ADDRESS)
+            {
+                mapped = addr;
+                mapped_size = st.st_size;
+            }
+            else if (addr != MAP_FAILED)
+            {
+                munmap(addr, st.st_size);
+            }
+        }
+        close(fd);
+    }
+    *size = mapped_size;
+    return mapped;
+}
+#else
+__WEAK const uint8_t *script_flash_map(size_t *size)
+{
+    *size = 0;
+    return NULL;
+}
+#endif
+#endif
+
+#ifdef SCRIPT_BYTECODE_CACHE_ENABLE
+static bool script_load_cache(const char *code, size_t len)
+{
+    size_t size = storage_read_script_cache(code, len, g_script_bytecode_buffer, sizeof(g_script_bytecode_buffer));
+    if (!size || !JS_IsBytecode(g_script_bytecode_buffer, size))
+    {
+        return false;
+    }
+    script_update_bytecode(g_script_bytecode_buffer, size);
+    return true;
+}
+
+static void script_compile_cache(const char *code, size_t len)
+{
+    JSValue func = JS_Parse(js_ctx, code, len, "<runtime>", 0);
+    if (JS_IsException(func))
+    {
+        dump_error(js_ctx);
+        return;
+    }
+    JSBytecodeHeader header;
+    const uint8_t *data;
+    uint32_t data_len;
+    JS_PrepareBytecode(js_ctx, &header, &data, &data_len, func);
+    if (sizeof(header) + data_len > sizeof(g_script_bytecode_buffer))
+    {
+        console_printf("script: bytecode exceeds SCRIPT_BYTECODE_BUFFER_SIZE, not cached\n");
+        return;
+    }
+    storage_save_script_cache(code, len, &header, sizeof(header), data, data_len);
+}
+
+static void script_update_source_cached(const char *code, size_t len)
+{
+    if (!js_ctx || script_load_cache(code, len))
+    {
+        return;
+    }
+    // preparing bytecode consumes the context, run the fresh entry in a new one
+    script_compile_cache(code, len);
+    script_reset_runtime();
+    if (js_ctx && !script_load_cache(code, len))
+    {
+        script_update_source(code, len);
+    }
 }
+#endif
 
 void script_init(void)
 {
     script_reset_runtime();
+#ifdef SCRIPT_XIP_ENABLE
+    size_t mapped_size;
+    const uint8_t *mapped = script_flash_map(&mapped_size);
+    if (mapped)
+    {
+        script_run_bytecode(mapped, mapped_size);
+        script_setup_hooks(js_ctx);
+        JS_SetRandomSeed(js_ctx, g_keyboard_tick);
+        return;
+    }
+#endif
     storage_read_script();
     //memset(g_script_bytecode_buffer, 0, sizeof(g_script_bytecode_buffer));
 #if SCRIPT_RUNTIME_STRATEGY == SCRIPT_AOT
@@ -196,7 +527,11 @@ void script_init(void)
     fs_close(&file);
 #endif
 #if SCRIPT_RUNTIME_STRATEGY == SCRIPT_JIT
-    script_update_source((char *)g_script_source_buffer, strlen(g_script_source_buffer));
+#ifdef SCRIPT_BYTECODE_CACHE_ENABLE
+    script_update_source_cached((char *)g_script_source_buffer, strlen((char *)g_script_source_buffer));
+#else
+    script_update_source((char *)g_script_source_buffer, strlen((char *)g_script_source_buffer));
+#endif
 #endif
     JS_SetRandomSeed(js_ctx, g_keyboard_tick);
 }
@@ -205,7 +540,10 @@ void script_eval(const char *code_buf, size_t len, const char *filename)
 {
     if (!js_ctx || !code_buf) return;
 
+    ScriptHookFrame frame;
+    script_hook_begin(&frame);
     JSValue ret = JS_Eval(js_ctx, code_buf, len, filename, 0);
+    script_hook_end(&frame, SCRIPT_HOOK_MAIN, filename);
 
     if (JS_IsException(ret)) {
         dump_error(js_ctx);
@@ -232,18 +570,7 @@ void script_load_bytecode(uint8_t *bytecode_buf, size_t len)
         return;
     }
 
-    JSValue func = JS_LoadBytecode(js_ctx, bytecode_buf);
-
-    if (JS_IsException(func)) {
-        dump_error(js_ctx);
-        return;
-    }
-
-    JSValue ret = JS_Run(js_ctx, func);
-
-    if (JS_IsException(ret)) {
-        dump_error(js_ctx);
-    }
+    script_run_bytecode(bytecode_buf, len);
 }
 
 void script_update_bytecode(uint8_t *bytecode_buf, size_t len)
@@ -254,58 +581,44 @@ void script_update_bytecode(uint8_t *bytecode_buf, size_t len)
 
 static void run_timers(JSContext *ctx)
 {
-    int64_t min_delay, delay, cur_time;
-    BOOL has_timer;
-    int i;
     JSTimer *th;
-    min_delay = 1000;
-    cur_time = get_time_ms();
-    has_timer = FALSE;
-    for(i = 0; i < SCRIPT_MAX_TIMERS; i++) {
-        th = &js_timer_list[i];
-        if (th->allocated) {
-            has_timer = TRUE;
-            delay = th->timeout - cur_time;
-            if (delay <= 0) {
-                JSValue ret;
-                switch (th->type)
-                {
-                case TIMER_TYPE_JS_TIMEOUT:
-                    /* the timer expired */
-                    if (JS_StackCheck(ctx, 2))
-                        goto fail;
-                    JS_PushArg(ctx, th->func.val); /* func name */
-                    JS_PushArg(ctx, JS_NULL); /* this */
-                    
-                    JS_DeleteGCRef(ctx, &th->func);
-                    th->allocated = FALSE;
-                    
-                    ret = JS_Call(ctx, 0);
-                    if (JS_IsException(ret)) {
-                    fail:
-                        dump_error(js_ctx);
-                        return;
-                    }
-                    min_delay = 0;
-                    break;
-                case TIMER_TYPE_JS_RELEASE_KEYCODE:
-                    /* the timer expired */
-                    js_keyboard_release(ctx, th->keycode);
-                    th->allocated = FALSE;
-                    min_delay = 0;
-                    
-                    break;
-                default:
-                    break;
-                }
-                break;
-            } else if (delay < min_delay) {
-                min_delay = delay;
+    int budget = SCRIPT_TIMER_BUDGET;
+    while (js_timer_heap_size && budget-- && g_keyboard_enable_script) {
+        th = &js_timer_list[js_timer_heap[0]];
+        js_timer_heap_remove(th);
+        JSValue ret;
+        switch (th->type)
+        {
+        case TIMER_TYPE_JS_TIMEOUT:
+            /* the timer expired */
+            if (JS_StackCheck(ctx, 2)) {
+                JS_DeleteGCRef(ctx, &th->func);
+                js_timer_free(th);
+                goto fail;
+            }
+            JS_PushArg(ctx, th->func.val); /* func name */
+            JS_PushArg(ctx, JS_NULL); /* this */
+
+            JS_DeleteGCRef(ctx, &th->func);
+            js_timer_free(th);
+
+            ret = script_call(ctx, 0, SCRIPT_HOOK_TIMER);
+            if (JS_IsException(ret)) {
+            fail:
+                dump_error(js_ctx);
+                return;
             }
+            break;
+        case TIMER_TYPE_JS_RELEASE_KEYCODE:
+            /* the timer expired */
+            js_keyboard_release(ctx, th->keycode);
+            js_timer_free(th);
+            break;
+        default:
+            js_timer_free(th);
+            break;
         }
     }
-    if (!has_timer)
-        return;
 }
 
 void script_watch(uint16_t id)
@@ -313,21 +626,35 @@ void script_watch(uint16_t id)
     BIT_SET(g_script_watcher_mask[id / 32], id % 32);
 }
 
+static bool script_reload_pending;
+static void script_hot_swap(void);
+
+void script_reload(void)
+{
+    script_reload_pending = script_is_loaded;
+}
+
 void script_process(void)
 {
+    if (script_reload_pending)
+    {
+        script_reload_pending = false;
+        script_hot_swap();
+    }
     if (!g_keyboard_enable_script)
     {
         return;
     }
-    if (loop_func_set)
+    if (loop_func_set && js_loop_is_due())
     {
+        js_loop_snapshot();
         if (JS_StackCheck(js_ctx, 2))
         {
             goto fail;
         }
         JS_PushArg(js_ctx, *loop_func_ptr); /* func name */
         JS_PushArg(js_ctx, JS_NULL); /* this */
-        JSValue ret = JS_Call(js_ctx, 0);
+        JSValue ret = script_call(js_ctx, 0, SCRIPT_HOOK_LOOP);
         if (JS_IsException(ret)) {
         fail:
             dump_error(js_ctx);
@@ -336,7 +663,7 @@ void script_process(void)
     run_timers(js_ctx);
 }
 
-static void execute_js_hook(JSContext *ctx, JSValue *func_ptr, int argc, JSValue *argv)
+static void execute_js_hook(JSContext *ctx, JSValue *func_ptr, int argc, JSValue *argv, uint8_t hook)
 {
     JSGCRef func_ref;
     JSValue *pfunc = JS_PushGCRef(ctx, &func_ref);
@@ -355,25 +682,155 @@ static void execute_js_hook(JSContext *ctx, JSValue *func_ptr, int argc, JSValue
     JS_PushArg(ctx, *pfunc);     /* func name */
     JS_PushArg(ctx, JS_NULL);    /* this */
     
-    JSValue ret = JS_Call(ctx, argc);
+    JSValue ret = script_call(ctx, argc, hook);
     JS_PopGCRef(ctx, &func_ref);
     
     if (JS_IsException(ret)) {
         dump_error(ctx);
     }
 }
-static void dispatch_js_event(JSContext *ctx, bool is_set, JSValue *func_ptr)
+static void dispatch_js_event(JSContext *ctx, bool is_set, JSValue *func_ptr, uint8_t hook)
 {
     if (!is_set) return; 
     
-    execute_js_hook(ctx, func_ptr, 0, NULL);
+    execute_js_hook(ctx, func_ptr, 0, NULL, hook);
 }
 
-static void dispatch_js_key_event(JSContext *ctx, JSValue *func_ptr, KeyboardEvent event)
+static void dispatch_js_key_event(JSContext *ctx, JSValue *func_ptr, KeyboardEvent event, uint8_t hook)
 {
-    JSValue arg = new_key_instance(ctx, event.key);
-    
-    execute_js_hook(ctx, func_ptr, 1, &arg);
+    JSValue *arg = js_key_instance(ctx, event.key);
+    if (!arg)
+    {
+        dump_error(ctx);
+        return;
+    }
+#ifdef EVENT_TIMESTAMP_ENABLE
+    js_key_timestamps[((Key *)event.key)->id] = event.timestamp;
+#endif
+    execute_js_hook(ctx, func_ptr, 1, arg, hook);
+}
+
+#if SCRIPT_RUNTIME_STRATEGY == SCRIPT_JIT
+// globals past the builtins are moved into an object while the new module runs, so the old ones can be put back
+static const char script_stash_globals[] =
+    "(function(){var k=Object.keys(globalThis),s={};"
+    "for(var i=%lu;i<k.length;i++){s[k[i]]=globalThis[k[i]];if(!delete globalThis[k[i]])globalThis[k[i]]=undefined;}"
+    "return s;})()";
+static const char script_restore_globals[] =
+    "(function(s){var k=Object.keys(globalThis);"
+    "for(var i=%lu;i<k.length;i++)if(!delete globalThis[k[i]])globalThis[k[i]]=undefined;"
+    "k=Object.keys(s);for(i=0;i<k.length;i++)globalThis[k[i]]=s[k[i]];})";
+
+static void script_hot_swap_rollback(JSValue *saved, uint32_t timer_mark, const uint32_t *watcher_mask, uint32_t loop_interval, AnalogValue loop_threshold)
+{
+    js_timer_drop_callbacks(js_ctx, timer_mark, FALSE);
+    JSValue ret = script_run_helper(js_ctx, script_restore_globals, saved);
+    if (JS_IsException(ret))
+    {
+        dump_error(js_ctx);
+    }
+    memcpy(g_script_watcher_mask, watcher_mask, sizeof(g_script_watcher_mask));
+    js_loop_interval = loop_interval;
+    js_loop_threshold = loop_threshold;
+    console_printf("script: reload failed, keeping the running script\n");
+}
+#endif
+
+static void script_hot_swap(void)
+{
+#if SCRIPT_RUNTIME_STRATEGY == SCRIPT_JIT
+    if (!js_ctx)
+    {
+        script_init();
+        return;
+    }
+    memset(g_script_source_buffer, 0, sizeof(g_script_source_buffer));
+    storage_read_script();
+    const char *code = (char *)g_script_source_buffer;
+    const size_t len = strlen(code);
+    // compile first, a script that does not parse leaves the running one untouched
+    JSGCRef module_ref;
+    JSValue *module = JS_PushGCRef(js_ctx, &module_ref);
+    *module = JS_Parse(js_ctx, code, len, "<runtime>", 0);
+    if (JS_IsException(*module))
+    {
+        dump_error(js_ctx);
+        JS_PopGCRef(js_ctx, &module_ref);
+        console_printf("script: reload failed, keeping the running script\n");
+        return;
+    }
+    if (g_keyboard_enable_script)
+    {
+        dispatch_js_event(js_ctx, on_exit_func_set, on_exit_func_ptr, SCRIPT_HOOK_EXIT);
+    }
+    // old hooks stay referenced and old globals stashed until the new module has run;
+    // a bytecode cache is not rebuilt here, preparing bytecode would consume the running
+    // context, the changed source simply misses the cache on the next boot
+    JSGCRef saved_ref;
+    JSValue *saved = JS_PushGCRef(js_ctx, &saved_ref);
+    *saved = script_run_helper(js_ctx, script_stash_globals, NULL);
+    if (JS_IsException(*saved))
+    {
+        dump_error(js_ctx);
+        JS_PopGCRef(js_ctx, &saved_ref);
+        JS_PopGCRef(js_ctx, &module_ref);
+        return;
+    }
+    const uint32_t timer_mark = js_timer_sequence;
+    uint32_t watcher_mask[KEY_BITMAP_SIZE];
+    memcpy(watcher_mask, g_script_watcher_mask, sizeof(watcher_mask));
+    const uint32_t loop_interval = js_loop_interval;
+    const AnalogValue loop_threshold = js_loop_threshold;
+    memset(g_script_watcher_mask, 0, sizeof(g_script_watcher_mask));
+    js_loop_reset();
+#ifdef ANALOG_CURVE_ENABLE
+    advanced_key_reset_curves();
+#endif
+
+    ScriptHookFrame frame;
+    script_hook_begin(&frame);
+    JSValue ret = JS_Run(js_ctx, *module);
+    script_hook_end(&frame, SCRIPT_HOOK_MAIN, g_script_hook_names[SCRIPT_HOOK_MAIN]);
+    if (JS_IsException(ret))
+    {
+        dump_error(js_ctx);
+        script_hot_swap_rollback(saved, timer_mark, watcher_mask, loop_interval, loop_threshold);
+    }
+    else
+    {
+        js_timer_drop_callbacks(js_ctx, timer_mark, TRUE);
+        script_setup_hooks(js_ctx);
+    }
+    JS_PopGCRef(js_ctx, &saved_ref);
+    JS_PopGCRef(js_ctx, &module_ref);
+    // the old module and stashed globals are collected once nothing refers to them
+    JS_GC(js_ctx);
+#ifdef SCRIPT_PROFILE_ENABLE
+    g_script_explicit_gc_runs++;
+#endif
+#else
+    // Not an in-place swap: old functions point into g_script_bytecode_buffer, so AOT still reinitializes the runtime.
+    // Only a stored image with a valid header replaces the running script.
+    File file;
+    uint8_t header[sizeof(JSBytecodeHeader)];
+    bool valid = false;
+    if (fs_open(&file, "scripts/main.bin", FS_O_RDONLY) >= 0)
+    {
+        const size_t size = fs_size(&file);
+        valid = fs_read(&file, header, sizeof(header)) == sizeof(header) && JS_IsBytecode(header, size);
+        fs_close(&file);
+    }
+    if (!valid)
+    {
+        console_printf("Error: Invalid bytecode format.\n");
+        return;
+    }
+    if (g_keyboard_enable_script)
+    {
+        dispatch_js_event(js_ctx, on_exit_func_set, on_exit_func_ptr, SCRIPT_HOOK_EXIT);
+    }
+    script_init();
+#endif
 }
 
 static void script_event_handler_(KeyboardEvent event)
@@ -383,15 +840,11 @@ static void script_event_handler_(KeyboardEvent event)
         switch (KEYCODE_GET_SUB(event.keycode))
         {
         case SCRIPT_RESTART:
-            if (g_keyboard_enable_script || script_is_loaded)
+            if (script_is_loaded)
             {
-                if (g_keyboard_enable_script)
-                {
-                    dispatch_js_event(js_ctx, on_exit_func_set, on_exit_func_ptr);
-                }
-                script_reset_runtime(); 
-                g_keyboard_enable_script = false;
-                script_is_loaded = false;
+                script_reload();
+                g_keyboard_enable_script = true;
+                break;
             }
             /* Fall through */
         case SCRIPT_START:
@@ -422,7 +875,7 @@ static void script_event_handler_(KeyboardEvent event)
             {
                 if (g_keyboard_enable_script)
                 {
-                    dispatch_js_event(js_ctx, on_exit_func_set, on_exit_func_ptr);
+                    dispatch_js_event(js_ctx, on_exit_func_set, on_exit_func_ptr, SCRIPT_HOOK_EXIT);
                 }
                 script_reset_runtime();
                 g_keyboard_enable_script = false;
@@ -442,6 +895,7 @@ static void script_event_handler_(KeyboardEvent event)
     }
     JSGCRef func_ref;
     JSValue *pfunc;
+    // the subscription also passes script control keycodes from any key
     const uint16_t id = ((Key*)event.key)->id;
     if (!(BIT_GET(g_script_watcher_mask[id / 32], id % 32) || KEYCODE_GET_MAIN(event.keycode) == MACRO_COLLECTION))
     {
@@ -452,7 +906,7 @@ static void script_event_handler_(KeyboardEvent event)
     case KEYBOARD_EVENT_KEY_DOWN:
         if (on_key_down_func_set)
         {
-            dispatch_js_key_event(js_ctx, on_key_down_func_ptr, event);
+            dispatch_js_key_event(js_ctx, on_key_down_func_ptr, event, SCRIPT_HOOK_KEY_DOWN);
         }
         else
         {
@@ -462,7 +916,7 @@ static void script_event_handler_(KeyboardEvent event)
     case KEYBOARD_EVENT_KEY_UP:
         if (on_key_up_func_set)
         {
-            dispatch_js_key_event(js_ctx, on_key_up_func_ptr, event);
+            dispatch_js_key_event(js_ctx, on_key_up_func_ptr, event, SCRIPT_HOOK_KEY_UP);
         }
         else
         {
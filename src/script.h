@@ -26,6 +26,38 @@ extern "C" {
 #define SCRIPT_BYTECODE_BUFFER_SIZE  (1 * 1024)
 #endif
 
+/*
+ * SCRIPT_XIP_ENABLE runs AOT bytecode in place from memory-mapped flash
+ * returned by script_flash_map(), so only runtime objects use the JS heap.
+ * The image must already be relocated for the address it is mapped at,
+ * e.g. with `mqjs --base ADDR -o main.bin main.js`.
+ */
+#if defined(SCRIPT_XIP_ENABLE) && SCRIPT_RUNTIME_STRATEGY != SCRIPT_AOT
+#error "SCRIPT_XIP_ENABLE requires SCRIPT_RUNTIME_STRATEGY SCRIPT_AOT"
+#endif
+
+/*
+ * SCRIPT_BYTECODE_CACHE_ENABLE keeps the JIT compiled source in
+ * scripts/cache.bin, keyed by a hash of the source and SCRIPT_ENGINE_VERSION,
+ * and runs it from SCRIPT_BYTECODE_BUFFER_SIZE instead of parsing on boot.
+ */
+#if defined(SCRIPT_BYTECODE_CACHE_ENABLE) && SCRIPT_RUNTIME_STRATEGY != SCRIPT_JIT
+#error "SCRIPT_BYTECODE_CACHE_ENABLE requires SCRIPT_RUNTIME_STRATEGY SCRIPT_JIT"
+#endif
+
+// bump when updating the engine so cached bytecode is rebuilt
+#ifndef SCRIPT_ENGINE_VERSION
+#define SCRIPT_ENGINE_VERSION 1
+#endif
+
+#ifndef SCRIPT_XIP_HOST_FILE
+#define SCRIPT_XIP_HOST_FILE "main.bin"
+#endif
+
+#ifndef SCRIPT_XIP_HOST_ADDRESS
+#define SCRIPT_XIP_HOST_ADDRESS 0x60000000UL
+#endif
+
 #ifndef SCRIPT_MEMORY_SIZE
 #define SCRIPT_MEMORY_SIZE  (4 * 1024)
 #endif
@@ -34,6 +66,57 @@ extern "C" {
 #define SCRIPT_MAX_TIMERS 16
 #endif
 
+#if SCRIPT_MAX_TIMERS > 0xFFFF
+#error "SCRIPT_MAX_TIMERS must not exceed 65535"
+#endif
+
+// expired timers run per script_process, the rest wait for the next tick
+#ifndef SCRIPT_TIMER_BUDGET
+#define SCRIPT_TIMER_BUDGET 8
+#endif
+
+/*
+ * Every hook call gets SCRIPT_HOOK_BUDGET engine interrupt polls before it is
+ * aborted; after SCRIPT_HOOK_MAX_OVERRUNS aborts in a row the script is suspended.
+ */
+#ifndef SCRIPT_HOOK_BUDGET
+#define SCRIPT_HOOK_BUDGET 16
+#endif
+
+#ifndef SCRIPT_HOOK_MAX_OVERRUNS
+#define SCRIPT_HOOK_MAX_OVERRUNS 3
+#endif
+
+typedef enum __ScriptHook
+{
+    SCRIPT_HOOK_LOOP,
+    SCRIPT_HOOK_KEY_DOWN,
+    SCRIPT_HOOK_KEY_UP,
+    SCRIPT_HOOK_TIMER,
+    SCRIPT_HOOK_EXIT,
+    SCRIPT_HOOK_MAIN,
+    SCRIPT_HOOK_NUM,
+} ScriptHook;
+
+extern const char *const g_script_hook_names[SCRIPT_HOOK_NUM];
+
+#ifdef SCRIPT_PROFILE_ENABLE
+typedef struct __ScriptHookProfile
+{
+    uint32_t calls;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+} ScriptHookProfile;
+
+extern ScriptHookProfile g_script_profiles[SCRIPT_HOOK_NUM];
+// only gc() calls and hot swaps, the engine's own collections are not counted
+extern uint32_t g_script_explicit_gc_runs;
+
+void script_profile_reset(void);
+void script_heap_usage(uint32_t *high_water_estimate, uint32_t *unused);
+#endif
+
 void script_init(void);
 void script_factory_reset(void);
 void script_reset_runtime(void);
@@ -41,19 +124,24 @@ void script_eval(const char *code_buf, size_t len, const char *filename);
 void script_update_source(const char *code, size_t len);
 void script_load_bytecode(uint8_t *bytecode_buf, size_t len);
 void script_update_bytecode(uint8_t *bytecode_buf, size_t len);
+#ifdef SCRIPT_XIP_ENABLE
+const uint8_t *script_flash_map(size_t *size);
+#endif
+void script_reload(void);
 void script_watch(uint16_t id);
 
 void script_process(void);
 void script_event_handler(KeyboardEvent event);
 void script_event_poller(KeyboardEvent event, uint32_t tick);
 
-#if SCRIPT_RUNTIME_STRATEGY == SCRIPT_AOT
+#if SCRIPT_RUNTIME_STRATEGY == SCRIPT_AOT || defined(SCRIPT_BYTECODE_CACHE_ENABLE)
 extern uint8_t g_script_bytecode_buffer[SCRIPT_BYTECODE_BUFFER_SIZE];
 #endif
 #if SCRIPT_RUNTIME_STRATEGY == SCRIPT_JIT
 extern uint8_t g_script_source_buffer[SCRIPT_SOURCE_BUFFER_SIZE];
 #endif
 extern volatile bool g_keyboard_enable_script;
+extern uint32_t g_script_watcher_mask[KEY_BITMAP_SIZE];
 
 #ifdef __cplusplus
 }
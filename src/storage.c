@@ -9,8 +9,12 @@
 #ifdef RGB_ENABLE
 #include"rgb.h"
 #endif
-#ifdef SCRIPT_ENABLE
 #include"script.h"
+#ifdef COMBO_ENABLE
+#include"combo.h"
+#endif
+#ifdef TAP_DANCE_ENABLE
+#include"tap_dance.h"
 #endif
 #include "file_system.h"
 #include "string.h"
@@ -33,12 +37,22 @@
 #define STORAGE_RGB_CONFIG_SIZE 0
 #endif
 #ifdef DYNAMICKEY_ENABLE
-#define STORAGE_DYNAMIC_KEY_CONFIG_SIZE (sizeof(g_dynamic_keys))
+#define STORAGE_DYNAMIC_KEY_CONFIG_SIZE (sizeof(uint32_t) + DYNAMIC_KEY_NUM + DYNAMIC_KEY_POOL_SIZE)
 #else
 #define STORAGE_DYNAMIC_KEY_CONFIG_SIZE 0
 #endif
+#ifdef COMBO_ENABLE
+#define STORAGE_COMBO_CONFIG_SIZE (sizeof(g_combos) + sizeof(g_combo_hold_off))
+#else
+#define STORAGE_COMBO_CONFIG_SIZE 0
+#endif
+#ifdef TAP_DANCE_ENABLE
+#define STORAGE_TAP_DANCE_CONFIG_SIZE (sizeof(g_tap_dances))
+#else
+#define STORAGE_TAP_DANCE_CONFIG_SIZE 0
+#endif
 
-#define STORAGE_CONFIG_FILE_SIZE (STORAGE_ADVANCED_KEY_CONFIG_SIZE + STORAGE_KEYMAP_SIZE + STORAGE_RGB_CONFIG_SIZE + STORAGE_DYNAMIC_KEY_CONFIG_SIZE)
+#define STORAGE_CONFIG_FILE_SIZE (STORAGE_ADVANCED_KEY_CONFIG_SIZE + STORAGE_KEYMAP_SIZE + STORAGE_RGB_CONFIG_SIZE + STORAGE_DYNAMIC_KEY_CONFIG_SIZE + STORAGE_COMBO_CONFIG_SIZE + STORAGE_TAP_DANCE_CONFIG_SIZE)
 #define STORAGE_CONFIG_FILE_ADDRESS(n) (STORAGE_FLASH_BASE_ADDRESS + STORAGE_FLASH_RESERVED_SIZE + ((n) * sizeof(STORAGE_CONFIG_FILE_SIZE)))
 
 uint8_t g_current_profile_index = 0;
@@ -54,6 +68,113 @@ static inline void read_advanced_key_config(File *file, AdvancedKey* key)
     advanced_key_set_range(key, key->config.upper_bound, key->config.lower_bound);
 }
 
+static size_t keymap_file_writer(void *context, const void *data, size_t size)
+{
+    return fs_write((File *)context, (void *)data, size);
+}
+
+static inline void save_keymap(File *file)
+{
+    uint32_t size = keymap_encode(NULL, NULL);
+    fs_write(file, &size, sizeof(size));
+    keymap_encode(keymap_file_writer, file);
+}
+
+static bool feed_keymap(File *file, uint32_t size, Keycode *keymap)
+{
+    uint8_t buffer[32];
+    KeymapDecoder decoder;
+    keymap_decoder_init(&decoder, keymap);
+    while (size)
+    {
+        size_t length = size < sizeof(buffer) ? size : sizeof(buffer);
+        if (fs_read(file, buffer, length) != length)
+        {
+            return false;
+        }
+        size -= length;
+        if (!keymap_decoder_feed(&decoder, buffer, length))
+        {
+            return false;
+        }
+    }
+    return keymap_decoder_finish(&decoder);
+}
+
+static bool load_keymap(File *file, uint32_t size)
+{
+    FilePosition begin = fs_tell(file);
+    bool valid = feed_keymap(file, size, NULL);
+    if (valid)
+    {
+        fs_seek(file, begin, FS_SEEK_SET);
+        feed_keymap(file, size, &g_keymap[0][0]);
+    }
+    fs_seek(file, begin + size, FS_SEEK_SET);
+    return valid;
+}
+
+static inline void read_keymap(File *file)
+{
+    uint32_t size = 0;
+    fs_read(file, &size, sizeof(size));
+    load_keymap(file, size);
+}
+
+bool storage_load_keymap(const char *name)
+{
+    File file;
+    if (fs_open(&file, name, FS_O_RDONLY) < 0)
+    {
+        return false;
+    }
+    bool valid = load_keymap(&file, fs_size(&file));
+    fs_close(&file);
+    return valid;
+}
+
+#ifdef DYNAMICKEY_ENABLE
+static inline void save_dynamic_keys(File *file)
+{
+    uint32_t size = dynamic_key_encode(NULL, NULL);
+    fs_write(file, &size, sizeof(size));
+    dynamic_key_encode(keymap_file_writer, file);
+}
+
+static inline void read_dynamic_keys(File *file)
+{
+    DynamicKey buffer;
+    uint32_t size = 0;
+    uint8_t index;
+    dynamic_key_clear();
+    fs_read(file, &size, sizeof(size));
+    while (size > sizeof(index) + sizeof(buffer.type))
+    {
+        if (fs_read(file, &index, sizeof(index)) != sizeof(index) ||
+            fs_read(file, &buffer.type, sizeof(buffer.type)) != sizeof(buffer.type))
+        {
+            return;
+        }
+        size -= sizeof(index) + sizeof(buffer.type);
+        const size_t length = dynamic_key_type_size(buffer.type);
+        if (length < sizeof(buffer.type) || length - sizeof(buffer.type) > size)
+        {
+            break;
+        }
+        if (fs_read(file, (uint8_t *)&buffer + sizeof(buffer.type), length - sizeof(buffer.type)) != length - sizeof(buffer.type))
+        {
+            return;
+        }
+        size -= length - sizeof(buffer.type);
+        dynamic_key_set(index, &buffer);
+    }
+    if (size)
+    {
+        fs_seek(file, size, FS_SEEK_CUR);
+    }
+}
+#endif
+
 int storage_mount(void)
 {
     return fs_init();
@@ -142,7 +263,7 @@ void storage_read_profile(void)
     {
         read_advanced_key_config(&file, &g_keyboard_advanced_keys[i]);
     }
-    fs_read(&file, g_keymap, sizeof(g_keymap));
+    read_keymap(&file);
     layer_cache_refresh();
 #ifdef RGB_ENABLE
     fs_read(&file, &g_rgb_base_config, sizeof(g_rgb_base_config));
@@ -154,7 +275,15 @@ void storage_read_profile(void)
     }
 #endif
 #ifdef DYNAMICKEY_ENABLE
-    fs_read(&file, g_dynamic_keys, sizeof(g_dynamic_keys));
+    read_dynamic_keys(&file);
+#endif
+#ifdef COMBO_ENABLE
+    fs_read(&file, g_combos, sizeof(g_combos));
+    fs_read(&file, g_combo_hold_off, sizeof(g_combo_hold_off));
+    combo_init();
+#endif
+#ifdef TAP_DANCE_ENABLE
+    fs_read(&file, g_tap_dances, sizeof(g_tap_dances));
 #endif
     fs_close(&file);
 }
@@ -164,7 +293,7 @@ void storage_save_profile(void)
     char config_file_name[] = "profiles/profile0";
     config_file_name[sizeof(config_file_name) - 2] = g_current_profile_index + '0';
     File file;
-    int res = fs_open(&file, config_file_name, FS_O_RDWR | FS_O_CREAT);
+    int res = fs_open(&file, config_file_name, FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC);
     if (res < 0)
     {
         return;
@@ -173,13 +302,20 @@ void storage_save_profile(void)
     {
         save_advanced_key_config(&file, &g_keyboard_advanced_keys[i]);
     }
-    fs_write(&file, g_keymap, sizeof(g_keymap));
+    save_keymap(&file);
 #ifdef RGB_ENABLE
     fs_write(&file, &g_rgb_base_config, sizeof(g_rgb_base_config));
     fs_write(&file, g_rgb_configs, sizeof(g_rgb_configs));
 #endif
 #ifdef DYNAMICKEY_ENABLE
-    fs_write(&file, g_dynamic_keys, sizeof(g_dynamic_keys));
+    save_dynamic_keys(&file);
+#endif
+#ifdef COMBO_ENABLE
+    fs_write(&file, g_combos, sizeof(g_combos));
+    fs_write(&file, g_combo_hold_off, sizeof(g_combo_hold_off));
+#endif
+#ifdef TAP_DANCE_ENABLE
+    fs_write(&file, g_tap_dances, sizeof(g_tap_dances));
 #endif
     fs_close(&file);
 }
@@ -242,3 +378,65 @@ void storage_read_script(void)
 #endif
 #endif
 }
+
+#define SCRIPT_CACHE_MAGIC 0x48434A53 // "SJCH"
+
+typedef struct __ScriptCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t source_hash;
+    uint32_t length;
+} ScriptCacheHeader;
+
+static uint32_t script_cache_hash(const char *source, size_t len)
+{
+    // FNV-1a
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ (uint8_t)source[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+size_t storage_read_script_cache(const char *source, size_t source_len, uint8_t *buf, size_t size)
+{
+    ScriptCacheHeader header;
+    File file;
+    size_t len = 0;
+    if (fs_open(&file, "scripts/cache.bin", FS_O_RDONLY) < 0)
+    {
+        return 0;
+    }
+    if (fs_read(&file, &header, sizeof(header)) == sizeof(header)
+        && header.magic == SCRIPT_CACHE_MAGIC
+        && header.version == SCRIPT_ENGINE_VERSION
+        && header.source_hash == script_cache_hash(source, source_len)
+        && header.length <= size
+        && fs_read(&file, buf, header.length) == header.length)
+    {
+        len = header.length;
+    }
+    fs_close(&file);
+    return len;
+}
+
+void storage_save_script_cache(const char *source, size_t source_len, const void *image_header, size_t image_header_len, const void *data, size_t data_len)
+{
+    ScriptCacheHeader header = {
+        .magic = SCRIPT_CACHE_MAGIC,
+        .version = SCRIPT_ENGINE_VERSION,
+        .source_hash = script_cache_hash(source, source_len),
+        .length = image_header_len + data_len,
+    };
+    File file;
+    if (fs_open(&file, "scripts/cache.bin", FS_O_WRONLY | FS_O_CREAT | FS_O_TRUNC) < 0)
+    {
+        return;
+    }
+    fs_write(&file, &header, sizeof(header));
+    fs_write(&file, (void *)image_header, image_header_len);
+    fs_write(&file, (void *)data, data_len);
+    fs_close(&file);
+}
@@ -28,6 +28,9 @@ void storage_read_profile(void);
 void storage_save_profile(void);
 void storage_save_script(void);
 void storage_read_script(void);
+bool storage_load_keymap(const char *name);
+size_t storage_read_script_cache(const char *source, size_t source_len, uint8_t *buf, size_t size);
+void storage_save_script_cache(const char *source, size_t source_len, const void *image_header, size_t image_header_len, const void *data, size_t data_len);
 
 #ifdef __cplusplus
 }
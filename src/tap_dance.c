@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2026 Zhangqi Li (@zhangqili)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "tap_dance.h"
+#include "layer.h"
+
+#include "string.h"
+
+typedef enum __TapDanceState
+{
+    TAP_DANCE_IDLE,
+    TAP_DANCE_PRESSED,
+    TAP_DANCE_RELEASED,
+    TAP_DANCE_HOLDING,
+    TAP_DANCE_TAPPING,
+    TAP_DANCE_TAPPED,
+} TapDanceState;
+
+typedef struct __TapDanceRuntime
+{
+    TimerWheelNode timer;
+    Keycode output;
+    uint16_t key_id;
+    uint8_t state;
+    uint8_t count;
+    bool interrupted;
+} TapDanceRuntime;
+
+typedef struct __TapDanceBufferedEvent
+{
+    uint16_t key_id;
+    uint8_t event;
+} TapDanceBufferedEvent;
+
+TapDance g_tap_dances[TAP_DANCE_NUM];
+uint32_t g_tap_dance_hold_bitmap[KEY_BITMAP_SIZE];
+
+static TapDanceRuntime tap_dance_runtimes[TAP_DANCE_NUM];
+static TapDanceBufferedEvent tap_dance_buffer[TAP_DANCE_BUFFER_SIZE];
+static uint8_t tap_dance_buffer_length;
+static uint16_t tap_dance_replay_taps[TAP_DANCE_BUFFER_SIZE];
+static uint8_t tap_dance_replay_tap_count;
+static TimerWheelNode tap_dance_replay_timer;
+static uint32_t tap_dance_active;
+static uint32_t tap_dance_holding;
+static int8_t tap_dance_pending;
+
+static inline uint8_t tap_dance_ctz(uint32_t value)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(value);
+#else
+    uint8_t bit = 0;
+    while (!(value & 1))
+    {
+        value >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static inline void tap_dance_set_held(uint16_t id, bool held)
+{
+    if (held)
+    {
+        g_tap_dance_hold_bitmap[id / 32] |= BIT(id % 32);
+    }
+    else
+    {
+        g_tap_dance_hold_bitmap[id / 32] &= ~BIT(id % 32);
+    }
+}
+
+static void tap_dance_begin(uint8_t index, Keycode keycode, uint8_t state)
+{
+    TapDanceRuntime *runtime = &tap_dance_runtimes[index];
+    runtime->output = keycode;
+    runtime->state = state;
+    BIT_SET(tap_dance_active, index);
+    if (state == TAP_DANCE_HOLDING)
+    {
+        BIT_SET(tap_dance_holding, index);
+    }
+    keyboard_event_handler(MK_VIRTUAL_EVENT(keycode, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(runtime->key_id)));
+}
+
+static void tap_dance_end(uint8_t index)
+{
+    TapDanceRuntime *runtime = &tap_dance_runtimes[index];
+    timer_wheel_cancel(&runtime->timer);
+    runtime->state = TAP_DANCE_IDLE;
+    BIT_RESET(tap_dance_active, index);
+    BIT_RESET(tap_dance_holding, index);
+    keyboard_event_handler(MK_VIRTUAL_EVENT(runtime->output, KEYBOARD_EVENT_KEY_UP, keyboard_get_key(runtime->key_id)));
+}
+
+static void tap_dance_tap(uint8_t index, Keycode keycode)
+{
+    if (keycode == KEY_NO_EVENT)
+    {
+        tap_dance_runtimes[index].state = TAP_DANCE_IDLE;
+        return;
+    }
+    // reported for one tick, the timer sends the release
+    tap_dance_begin(index, keycode, TAP_DANCE_TAPPED);
+    timer_wheel_schedule(&tap_dance_runtimes[index].timer, 1);
+}
+
+static void tap_dance_interrupt(void)
+{
+    uint32_t holding = tap_dance_holding;
+    while (holding)
+    {
+        uint8_t index = tap_dance_ctz(holding);
+        BIT_RESET(holding, index);
+        tap_dance_runtimes[index].interrupted = true;
+    }
+}
+
+static void tap_dance_flush_replay_tap(uint16_t id)
+{
+    for (uint8_t i = 0; i < tap_dance_replay_tap_count; i++)
+    {
+        if (tap_dance_replay_taps[i] == id)
+        {
+            tap_dance_replay_taps[i] = tap_dance_replay_taps[--tap_dance_replay_tap_count];
+            keyboard_event_handler(MK_EVENT(layer_cache_get_keycode(id), KEYBOARD_EVENT_KEY_UP, keyboard_get_key(id)));
+            return;
+        }
+    }
+}
+
+static void tap_dance_replay(void)
+{
+    for (uint8_t i = 0; i < tap_dance_buffer_length; i++)
+    {
+        const uint16_t id = tap_dance_buffer[i].key_id;
+        if (tap_dance_buffer[i].event == KEYBOARD_EVENT_KEY_DOWN)
+        {
+            tap_dance_flush_replay_tap(id);
+            tap_dance_set_held(id, false);
+            keyboard_event_handler(MK_EVENT(layer_cache_get_keycode(id), KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(id)));
+        }
+        else
+        {
+            // pressed and released inside the decision window: report it once
+            if (tap_dance_replay_tap_count >= TAP_DANCE_BUFFER_SIZE)
+            {
+                tap_dance_flush_replay_tap(tap_dance_replay_taps[0]);
+            }
+            tap_dance_replay_taps[tap_dance_replay_tap_count++] = id;
+            timer_wheel_schedule(&tap_dance_replay_timer, 1);
+        }
+    }
+    tap_dance_buffer_length = 0;
+}
+
+static void tap_dance_resolve(bool hold)
+{
+    const uint8_t index = tap_dance_pending;
+    TapDanceRuntime *runtime = &tap_dance_runtimes[index];
+    const TapDance *tap_dance = &g_tap_dances[index];
+    const uint8_t action = runtime->count - 1;
+    tap_dance_pending = -1;
+    timer_wheel_cancel(&runtime->timer);
+    runtime->interrupted = tap_dance_buffer_length > 0;
+    if (runtime->state == TAP_DANCE_RELEASED)
+    {
+        tap_dance_tap(index, tap_dance->tap[action]);
+    }
+    else if (hold && tap_dance->hold[action] != KEY_NO_EVENT)
+    {
+        tap_dance_begin(index, tap_dance->hold[action], TAP_DANCE_HOLDING);
+    }
+    else if (tap_dance->tap[action] != KEY_NO_EVENT)
+    {
+        tap_dance_begin(index, tap_dance->tap[action], TAP_DANCE_TAPPING);
+    }
+    else
+    {
+        runtime->state = TAP_DANCE_IDLE;
+    }
+    tap_dance_replay();
+}
+
+static inline bool tap_dance_pending_is(uint8_t state, uint8_t flavor)
+{
+    return tap_dance_runtimes[tap_dance_pending].state == state &&
+        g_tap_dances[tap_dance_pending].flavor == flavor;
+}
+
+static void tap_dance_timer_callback(void *context)
+{
+    TapDanceRuntime *runtime = (TapDanceRuntime *)context;
+    const uint8_t index = runtime - tap_dance_runtimes;
+    switch (runtime->state)
+    {
+    case TAP_DANCE_PRESSED:
+    case TAP_DANCE_RELEASED:
+        tap_dance_resolve(true);
+        break;
+    case TAP_DANCE_TAPPED:
+        tap_dance_end(index);
+        break;
+    default:
+        break;
+    }
+}
+
+static void tap_dance_replay_timer_callback(void *context)
+{
+    UNUSED(context);
+    while (tap_dance_replay_tap_count)
+    {
+        tap_dance_flush_replay_tap(tap_dance_replay_taps[0]);
+    }
+}
+
+static bool tap_dance_own_key_event_handler(KeyboardEvent event, uint8_t index)
+{
+    TapDanceRuntime *runtime = &tap_dance_runtimes[index];
+    const TapDance *tap_dance = &g_tap_dances[index];
+    switch (event.event)
+    {
+    case KEYBOARD_EVENT_KEY_DOWN:
+        if (tap_dance_pending >= 0 && tap_dance_pending != index)
+        {
+            // another tap dance is never buffered, it settles the pending one
+            tap_dance_resolve(tap_dance_pending_is(TAP_DANCE_PRESSED, TAP_DANCE_HOLD_ON_OTHER_KEY_PRESS));
+        }
+        tap_dance_interrupt();
+        if (runtime->state == TAP_DANCE_TAPPED)
+        {
+            tap_dance_end(index);
+        }
+        if (tap_dance_pending == index)
+        {
+            runtime->count++;
+        }
+        else
+        {
+            runtime->count = 1;
+            runtime->key_id = ((Key*)event.key)->id;
+            tap_dance_pending = index;
+        }
+        runtime->state = TAP_DANCE_PRESSED;
+        runtime->interrupted = false;
+        timer_wheel_schedule(&runtime->timer, tap_dance->term);
+        break;
+    case KEYBOARD_EVENT_KEY_UP:
+        switch (runtime->state)
+        {
+        case TAP_DANCE_PRESSED:
+            runtime->state = TAP_DANCE_RELEASED;
+            if (!tap_dance_buffer_length && runtime->count < TAP_DANCE_TAP_NUM &&
+                (tap_dance->tap[runtime->count] != KEY_NO_EVENT || tap_dance->hold[runtime->count] != KEY_NO_EVENT))
+            {
+                timer_wheel_schedule(&runtime->timer, tap_dance->term);
+            }
+            else
+            {
+                tap_dance_resolve(false);
+            }
+            break;
+        case TAP_DANCE_HOLDING:
+            tap_dance_end(index);
+            if ((tap_dance->flags & TAP_DANCE_FLAG_RETRO_TAP) && !runtime->interrupted)
+            {
+                tap_dance_tap(index, tap_dance->tap[runtime->count - 1]);
+            }
+            break;
+        case TAP_DANCE_TAPPING:
+            tap_dance_end(index);
+            break;
+        default:
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+static bool tap_dance_other_key_event_handler(KeyboardEvent event, uint16_t id)
+{
+    switch (event.event)
+    {
+    case KEYBOARD_EVENT_KEY_DOWN:
+        tap_dance_flush_replay_tap(id);
+        if (tap_dance_pending >= 0)
+        {
+            if (tap_dance_runtimes[tap_dance_pending].state == TAP_DANCE_PRESSED &&
+                g_tap_dances[tap_dance_pending].flavor != TAP_DANCE_HOLD_ON_OTHER_KEY_PRESS &&
+                tap_dance_buffer_length < TAP_DANCE_BUFFER_SIZE - 1)
+            {
+                tap_dance_buffer[tap_dance_buffer_length].key_id = id;
+                tap_dance_buffer[tap_dance_buffer_length].event = KEYBOARD_EVENT_KEY_DOWN;
+                tap_dance_buffer_length++;
+                tap_dance_set_held(id, true);
+                return true;
+            }
+            tap_dance_resolve(tap_dance_pending_is(TAP_DANCE_PRESSED, TAP_DANCE_HOLD_ON_OTHER_KEY_PRESS));
+        }
+        tap_dance_interrupt();
+        return false;
+    case KEYBOARD_EVENT_KEY_UP:
+        if (!tap_dance_key_is_held(id))
+        {
+            return false;
+        }
+        tap_dance_buffer[tap_dance_buffer_length].key_id = id;
+        tap_dance_buffer[tap_dance_buffer_length].event = KEYBOARD_EVENT_KEY_UP;
+        tap_dance_buffer_length++;
+        if (tap_dance_buffer_length >= TAP_DANCE_BUFFER_SIZE - 1 ||
+            g_tap_dances[tap_dance_pending].flavor == TAP_DANCE_PERMISSIVE_HOLD)
+        {
+            tap_dance_resolve(g_tap_dances[tap_dance_pending].flavor == TAP_DANCE_PERMISSIVE_HOLD);
+        }
+        return true;
+    default:
+        return tap_dance_key_is_held(id);
+    }
+}
+
+void tap_dance_init(void)
+{
+    for (uint8_t i = 0; i < TAP_DANCE_NUM; i++)
+    {
+        TapDanceRuntime *runtime = &tap_dance_runtimes[i];
+        timer_wheel_node_init(&runtime->timer, tap_dance_timer_callback, runtime);
+        runtime->state = TAP_DANCE_IDLE;
+        runtime->count = 0;
+    }
+    timer_wheel_node_init(&tap_dance_replay_timer, tap_dance_replay_timer_callback, NULL);
+    memset(g_tap_dance_hold_bitmap, 0, sizeof(g_tap_dance_hold_bitmap));
+    tap_dance_buffer_length = 0;
+    tap_dance_replay_tap_count = 0;
+    tap_dance_active = 0;
+    tap_dance_holding = 0;
+    tap_dance_pending = -1;
+}
+
+void tap_dance_reset(void)
+{
+    memset(g_tap_dances, 0, sizeof(g_tap_dances));
+    for (uint8_t i = 0; i < TAP_DANCE_NUM; i++)
+    {
+        g_tap_dances[i].term = TAP_DANCE_DEFAULT_TERM;
+    }
+}
+
+bool tap_dance_key_event_handler(KeyboardEvent event)
+{
+    if (KEYCODE_GET_MAIN(event.keycode) == TAP_DANCE_COLLECTION && KEYCODE_GET_SUB(event.keycode) < TAP_DANCE_NUM)
+    {
+        return tap_dance_own_key_event_handler(event, KEYCODE_GET_SUB(event.keycode));
+    }
+    return tap_dance_other_key_event_handler(event, ((Key*)event.key)->id);
+}
+
+void tap_dance_add_buffer(void)
+{
+    uint32_t active = tap_dance_active;
+    while (active)
+    {
+        uint8_t index = tap_dance_ctz(active);
+        BIT_RESET(active, index);
+        const TapDanceRuntime *runtime = &tap_dance_runtimes[index];
+        keyboard_add_buffer(MK_EVENT(runtime->output, KEYBOARD_EVENT_NO_EVENT, keyboard_get_key(runtime->key_id)));
+    }
+    for (uint8_t i = 0; i < tap_dance_replay_tap_count; i++)
+    {
+        const uint16_t id = tap_dance_replay_taps[i];
+        keyboard_add_buffer(MK_EVENT(layer_cache_get_keycode(id), KEYBOARD_EVENT_NO_EVENT, keyboard_get_key(id)));
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2026 Zhangqi Li (@zhangqili)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef TAP_DANCE_H_
+#define TAP_DANCE_H_
+
+#include "keyboard.h"
+#include "timer_wheel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef TAP_DANCE_NUM
+#define TAP_DANCE_NUM 16
+#endif
+
+#if TAP_DANCE_NUM > 32
+#error "TAP_DANCE_NUM must not exceed 32"
+#endif
+
+#ifndef TAP_DANCE_TAP_NUM
+#define TAP_DANCE_TAP_NUM 4
+#endif
+
+#ifndef TAP_DANCE_DEFAULT_TERM
+#define TAP_DANCE_DEFAULT_TERM KEYBOARD_TIME_TO_TICK(200)
+#endif
+
+#ifndef TAP_DANCE_BUFFER_SIZE
+#define TAP_DANCE_BUFFER_SIZE 8
+#endif
+
+typedef enum __TapDanceFlavor
+{
+    TAP_DANCE_TAP_PREFERRED,
+    TAP_DANCE_PERMISSIVE_HOLD,
+    TAP_DANCE_HOLD_ON_OTHER_KEY_PRESS,
+    TAP_DANCE_FLAVOR_NUM
+} TapDanceFlavor;
+
+#define TAP_DANCE_FLAG_RETRO_TAP BIT(0)
+
+/*
+ * tap[n] is sent after n + 1 taps, hold[n] when the (n + 1)th press is held.
+ * A hold-tap is a tap dance that only uses tap[0] and hold[0].
+ */
+typedef struct __TapDance
+{
+    uint8_t flavor;
+    uint8_t flags;
+    uint16_t term;
+    Keycode tap[TAP_DANCE_TAP_NUM];
+    Keycode hold[TAP_DANCE_TAP_NUM];
+} TapDance;
+
+extern TapDance g_tap_dances[TAP_DANCE_NUM];
+extern uint32_t g_tap_dance_hold_bitmap[KEY_BITMAP_SIZE];
+
+void tap_dance_init(void);
+void tap_dance_reset(void);
+bool tap_dance_key_event_handler(KeyboardEvent event);
+void tap_dance_add_buffer(void);
+
+static inline bool tap_dance_key_is_held(uint16_t id)
+{
+    return g_tap_dance_hold_bitmap[id / 32] & BIT(id % 32);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TAP_DANCE_H_ */
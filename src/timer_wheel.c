@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2026 Zhangqi Li (@zhangqili)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "timer_wheel.h"
+
+#include "string.h"
+
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOT_NUM - 1)
+#define TIMER_WHEEL_LEVEL_SHIFT(level) ((level) * TIMER_WHEEL_SLOT_BITS)
+
+static TimerWheelNode *timer_wheel_slots[TIMER_WHEEL_LEVEL_NUM][TIMER_WHEEL_SLOT_NUM];
+// nodes that were already due when placed, fired on the next process
+static TimerWheelNode *timer_wheel_expired;
+static uint32_t timer_wheel_tick;
+static uint32_t timer_wheel_count;
+
+static inline void timer_wheel_insert(TimerWheelNode **head, TimerWheelNode *node)
+{
+    node->next = *head;
+    if (node->next != NULL)
+    {
+        node->next->pprev = &node->next;
+    }
+    node->pprev = head;
+    *head = node;
+}
+
+static void timer_wheel_place(TimerWheelNode *node)
+{
+    uint32_t delta = node->expire_tick - timer_wheel_tick;
+    if ((int32_t)delta <= 0)
+    {
+        timer_wheel_insert(&timer_wheel_expired, node);
+        return;
+    }
+    if (delta >= TIMER_WHEEL_SPAN)
+    {
+        delta = TIMER_WHEEL_SPAN - 1;
+    }
+    uint8_t level = 0;
+    while (level < TIMER_WHEEL_LEVEL_NUM - 1 && delta >= (1UL << TIMER_WHEEL_LEVEL_SHIFT(level + 1)))
+    {
+        level++;
+    }
+    const uint32_t expire = timer_wheel_tick + delta;
+    timer_wheel_insert(&timer_wheel_slots[level][(expire >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_SLOT_MASK], node);
+}
+
+static inline TimerWheelNode *timer_wheel_detach(TimerWheelNode **head)
+{
+    TimerWheelNode *list = *head;
+    *head = NULL;
+    return list;
+}
+
+static void timer_wheel_run(TimerWheelNode *pending)
+{
+    // the detached list is anchored on the stack so callbacks can safely schedule or cancel any node
+    if (pending != NULL)
+    {
+        pending->pprev = &pending;
+    }
+    while (pending != NULL)
+    {
+        TimerWheelNode *node = pending;
+        pending = node->next;
+        if (pending != NULL)
+        {
+            pending->pprev = &pending;
+        }
+        node->next = NULL;
+        node->pprev = NULL;
+        if ((int32_t)(node->expire_tick - timer_wheel_tick) <= 0)
+        {
+            timer_wheel_count--;
+            node->callback(node->context);
+        }
+        else
+        {
+            timer_wheel_place(node);
+        }
+    }
+}
+
+static void timer_wheel_cascade(uint8_t level)
+{
+    TimerWheelNode *list = timer_wheel_detach(
+        &timer_wheel_slots[level][(timer_wheel_tick >> TIMER_WHEEL_LEVEL_SHIFT(level)) & TIMER_WHEEL_SLOT_MASK]);
+    while (list != NULL)
+    {
+        TimerWheelNode *node = list;
+        list = node->next;
+        timer_wheel_place(node);
+    }
+}
+
+// Ticks until the next slot that holds nodes comes round, capped at limit.
+static uint32_t timer_wheel_next_delta(uint32_t limit)
+{
+    uint32_t best = limit;
+    for (uint8_t level = 0; level < TIMER_WHEEL_LEVEL_NUM; level++)
+    {
+        const uint32_t base = timer_wheel_tick >> TIMER_WHEEL_LEVEL_SHIFT(level);
+        for (uint32_t k = 1; k <= TIMER_WHEEL_SLOT_NUM; k++)
+        {
+            const uint32_t delta = ((base + k) << TIMER_WHEEL_LEVEL_SHIFT(level)) - timer_wheel_tick;
+            if (delta >= best)
+            {
+                break;
+            }
+            if (timer_wheel_slots[level][(base + k) & TIMER_WHEEL_SLOT_MASK] != NULL)
+            {
+                best = delta;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+void timer_wheel_init(void)
+{
+    memset(timer_wheel_slots, 0, sizeof(timer_wheel_slots));
+    timer_wheel_expired = NULL;
+    timer_wheel_count = 0;
+    timer_wheel_tick = g_keyboard_tick;
+}
+
+void timer_wheel_node_init(TimerWheelNode *node, TimerWheelCallback callback, void *context)
+{
+    node->next = NULL;
+    node->pprev = NULL;
+    node->expire_tick = 0;
+    node->callback = callback;
+    node->context = context;
+}
+
+void timer_wheel_schedule(TimerWheelNode *node, uint32_t delay)
+{
+    timer_wheel_cancel(node);
+    if (!timer_wheel_count)
+    {
+        timer_wheel_tick = g_keyboard_tick;
+    }
+    node->expire_tick = g_keyboard_tick + delay;
+    timer_wheel_place(node);
+    timer_wheel_count++;
+}
+
+void timer_wheel_cancel(TimerWheelNode *node)
+{
+    if (node->pprev == NULL)
+    {
+        return;
+    }
+    *node->pprev = node->next;
+    if (node->next != NULL)
+    {
+        node->next->pprev = node->pprev;
+    }
+    node->next = NULL;
+    node->pprev = NULL;
+    timer_wheel_count--;
+}
+
+void timer_wheel_process(void)
+{
+    const uint32_t now = g_keyboard_tick;
+    if (!timer_wheel_count)
+    {
+        timer_wheel_tick = now;
+        return;
+    }
+    timer_wheel_run(timer_wheel_detach(&timer_wheel_expired));
+    while ((int32_t)(now - timer_wheel_tick) > 0 && timer_wheel_count)
+    {
+        // after a stall, jump straight to the next tick that cascades or fires something
+        uint32_t step = now - timer_wheel_tick;
+        if (step > 1)
+        {
+            step = timer_wheel_next_delta(step);
+        }
+        timer_wheel_tick += step;
+        for (uint8_t level = TIMER_WHEEL_LEVEL_NUM - 1; level > 0; level--)
+        {
+            if (!(timer_wheel_tick & ((1UL << TIMER_WHEEL_LEVEL_SHIFT(level)) - 1)))
+            {
+                timer_wheel_cascade(level);
+            }
+        }
+        timer_wheel_run(timer_wheel_detach(&timer_wheel_expired));
+        timer_wheel_run(timer_wheel_detach(&timer_wheel_slots[0][timer_wheel_tick & TIMER_WHEEL_SLOT_MASK]));
+    }
+    if (!timer_wheel_count)
+    {
+        timer_wheel_tick = now;
+    }
+}
+
+uint32_t timer_wheel_pending_count(void)
+{
+    return timer_wheel_count;
+}
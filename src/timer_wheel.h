@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2026 Zhangqi Li (@zhangqili)
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include "keyboard.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hierarchical wheel: level n has TIMER_WHEEL_SLOT_NUM slots of
+ * TIMER_WHEEL_SLOT_NUM^n ticks each. Timers cascade one level down when
+ * their slot comes round, so schedule and cancel are O(1) and expiry is
+ * amortized O(1). Delays beyond the top level are re-cascaded until due.
+ * Catching up after a stall skips ticks whose slots are all empty.
+ */
+#ifndef TIMER_WHEEL_SLOT_BITS
+#define TIMER_WHEEL_SLOT_BITS 6
+#endif
+
+#ifndef TIMER_WHEEL_LEVEL_NUM
+#define TIMER_WHEEL_LEVEL_NUM 4
+#endif
+
+#if TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVEL_NUM > 31
+#error "TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVEL_NUM must not exceed 31"
+#endif
+
+#define TIMER_WHEEL_SLOT_NUM (1UL << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SPAN (1UL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVEL_NUM))
+
+typedef void (*TimerWheelCallback)(void *context);
+
+typedef struct __TimerWheelNode
+{
+    struct __TimerWheelNode *next;
+    struct __TimerWheelNode **pprev;
+    uint32_t expire_tick;
+    TimerWheelCallback callback;
+    void *context;
+} TimerWheelNode;
+
+void timer_wheel_init(void);
+void timer_wheel_node_init(TimerWheelNode *node, TimerWheelCallback callback, void *context);
+void timer_wheel_schedule(TimerWheelNode *node, uint32_t delay);
+void timer_wheel_cancel(TimerWheelNode *node);
+void timer_wheel_process(void);
+uint32_t timer_wheel_pending_count(void);
+
+static inline bool timer_wheel_is_pending(const TimerWheelNode *node)
+{
+    return node->pprev != NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMER_WHEEL_H_ */
@@ -184,4 +184,98 @@ TEST(AdvancedKeyTest, Calibration)
         EXPECT_EQ(advanced_key.config.calibration_mode, ADVANCED_KEY_AUTO_CALIBRATION_NEGATIVE);
         EXPECT_EQ(advanced_key.config.lower_bound, default_upper_bound-DEFAULT_ESTIMATED_RANGE-500);
     }
-}
\ No newline at end of file
+}
+#ifdef ANALOG_CURVE_ENABLE
+namespace {
+
+// a port of the script-side reference, which Script.CurveMatchesJavaScriptReference runs in the engine:
+// function curve(points, x) {
+//     if (x <= points[0]) return points[1];
+//     for (let i = 2; i < points.length; i += 2)
+//         if (x < points[i])
+//             return points[i - 1] + (points[i + 1] - points[i - 1]) * (x - points[i - 2]) / (points[i] - points[i - 2]);
+//     return points[points.length - 1];
+// }
+double reference_curve(const AnalogCurvePoint *points, uint8_t length, double x)
+{
+    if (x <= points[0].x)
+    {
+        return points[0].y;
+    }
+    for (uint8_t i = 1; i < length; i++)
+    {
+        if (x < points[i].x)
+        {
+            return points[i - 1].y + (double)(points[i].y - points[i - 1].y) * (x - points[i - 1].x) / (points[i].x - points[i - 1].x);
+        }
+    }
+    return points[length - 1].y;
+}
+
+} // namespace
+
+TEST(AdvancedKeyTest, CurveMatchesReference)
+{
+    const AnalogCurvePoint points[] = {
+        {A_ANTI_NORM(0.05), A_ANTI_NORM(0.00)},
+        {A_ANTI_NORM(0.30), A_ANTI_NORM(0.10)},
+        {A_ANTI_NORM(0.60), A_ANTI_NORM(0.70)},
+        {A_ANTI_NORM(0.60), A_ANTI_NORM(0.75)},
+        {A_ANTI_NORM(0.90), A_ANTI_NORM(0.20)},
+        {A_ANTI_NORM(0.95), A_ANTI_NORM(1.00)},
+    };
+    const uint8_t length = sizeof(points) / sizeof(points[0]);
+    ASSERT_TRUE(advanced_key_set_curve(5, points, length));
+    for (uint32_t x = ANALOG_VALUE_MIN; x <= ANALOG_VALUE_MAX; x += 7)
+    {
+        EXPECT_NEAR(reference_curve(points, length, x), advanced_key_apply_curve(&g_advanced_key_curves[5], x), 1.0) << x;
+    }
+    advanced_key_reset_curves();
+}
+
+TEST(AdvancedKeyTest, CurveRejectsInvalidTables)
+{
+    const AnalogCurvePoint unsorted[] = {{200, 0}, {100, 100}};
+    const AnalogCurvePoint sorted[] = {{100, 0}, {200, 100}};
+    EXPECT_FALSE(advanced_key_set_curve(0, unsorted, 2));
+    EXPECT_FALSE(advanced_key_set_curve(ADVANCED_KEY_NUM, sorted, 2));
+    EXPECT_FALSE(advanced_key_set_curve(0, sorted, ANALOG_CURVE_POINT_NUM + 1));
+    EXPECT_EQ(0, g_advanced_key_curves[0].length);
+    EXPECT_TRUE(advanced_key_set_curve(0, sorted, 2));
+    EXPECT_TRUE(advanced_key_set_curve(0, sorted, 0));
+    EXPECT_EQ(0, g_advanced_key_curves[0].length);
+}
+
+TEST(AdvancedKeyTest, CurveDrivesKeyState)
+{
+    static AdvancedKey advanced_key =
+    {
+        .key = {.id = 3},
+        .config =
+        {
+            .mode = ADVANCED_KEY_ANALOG_NORMAL_MODE,
+            .activation_value = A_ANTI_NORM(0.50),
+            .deactivation_value = A_ANTI_NORM(0.49),
+        },
+    };
+    // threshold table: nothing until 80% travel, then fully pressed
+    const AnalogCurvePoint points[] = {
+        {A_ANTI_NORM(0.80), A_ANTI_NORM(0.00)},
+        {A_ANTI_NORM(0.80), A_ANTI_NORM(1.00)},
+    };
+    ASSERT_TRUE(advanced_key_set_curve(3, points, 2));
+    advanced_key_update(&advanced_key, A_ANTI_NORM(0.70));
+    EXPECT_FALSE(advanced_key.key.state);
+    EXPECT_EQ(A_ANTI_NORM(0.00), advanced_key.value);
+    advanced_key_update(&advanced_key, A_ANTI_NORM(0.85));
+    EXPECT_TRUE(advanced_key.key.state);
+    EXPECT_EQ(A_ANTI_NORM(1.00), advanced_key.value);
+    advanced_key_update(&advanced_key, A_ANTI_NORM(0.60));
+    EXPECT_FALSE(advanced_key.key.state);
+
+    advanced_key_reset_curves();
+    advanced_key_update(&advanced_key, A_ANTI_NORM(0.60));
+    EXPECT_TRUE(advanced_key.key.state);
+    EXPECT_EQ(A_ANTI_NORM(0.60), advanced_key.value);
+}
+#endif
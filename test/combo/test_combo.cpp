@@ -0,0 +1,320 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+#include "combo.h"
+#include "keyboard.h"
+#include "layer.h"
+#include "packet.h"
+#include "storage.h"
+#include "test_fixture.h"
+
+namespace {
+
+void set_combo(uint8_t index, Keycode keycode, uint16_t term, uint16_t key0, uint16_t key1, uint16_t key2 = COMBO_KEY_NONE)
+{
+    g_combos[index].keycode = keycode;
+    g_combos[index].term = term;
+    g_combos[index].key_id[0] = key0;
+    g_combos[index].key_id[1] = key1;
+    g_combos[index].key_id[2] = key2;
+    g_combos[index].key_id[3] = COMBO_KEY_NONE;
+}
+
+void bind_key(uint16_t id, Keycode keycode)
+{
+    g_keymap[0][id] = keycode;
+    layer_cache_update(id);
+}
+
+void press(uint16_t id)
+{
+    keyboard_key_update(keyboard_get_key(id), true);
+}
+
+void release(uint16_t id)
+{
+    Key *key = keyboard_get_key(id);
+    while (key->report_state)
+    {
+        keyboard_key_update(key, false);
+    }
+}
+
+void send_report(void)
+{
+    keyboard_clear_buffer();
+    keyboard_fill_buffer();
+    keyboard_buffer_send();
+}
+
+class ComboTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        g_keyboard_tick = 100;
+        combo_reset();
+        for (uint16_t id = 0; id < 4; id++) {
+            release(id);
+        }
+        bind_key(0, KEY_A);
+        bind_key(1, KEY_B);
+        bind_key(2, KEY_C);
+        bind_key(3, KEY_D);
+        set_combo(0, KEY_ESC, 10, 0, 1);
+        set_combo(1, KEY_TAB, 10, 0, 1, 2);
+        combo_init();
+    }
+
+    void TearDown() override {
+        combo_reset();
+    }
+};
+
+} // namespace
+
+TEST_F(ComboTest, ChordEmitsComboKeycodeInsteadOfKeys)
+{
+    press(0);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    g_keyboard_tick += 3;
+    press(1);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    g_keyboard_tick += 50;
+    combo_process();
+    send_report();
+    EXPECT_EQ(KEY_ESC, keyboard_send_buffer[2]);
+    EXPECT_EQ(0, keyboard_send_buffer[3]);
+
+    g_keyboard_tick += 1;
+    release(0);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    release(1);
+    combo_process();
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(ComboTest, LongerComboWinsWhenAllKeysArrive)
+{
+    press(2);
+    press(0);
+    g_keyboard_tick += 2;
+    press(1);
+    send_report();
+    EXPECT_EQ(KEY_TAB, keyboard_send_buffer[2]);
+    EXPECT_EQ(0, keyboard_send_buffer[3]);
+}
+
+TEST_F(ComboTest, ShorterComboWaitsForLongerComboInPressOrder)
+{
+    press(0);
+    g_keyboard_tick += 1;
+    press(1);
+    combo_process();
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    g_keyboard_tick += 1;
+    combo_process();
+    press(2);
+    send_report();
+    EXPECT_EQ(KEY_TAB, keyboard_send_buffer[2]);
+    EXPECT_EQ(0, keyboard_send_buffer[3]);
+}
+
+TEST_F(ComboTest, ShorterComboFiresWhenLongerComboIsRuledOut)
+{
+    g_combo_hold_off[0] = 30;
+    g_combo_hold_off[1] = 30;
+    combo_init();
+    press(0);
+    press(1);
+    g_keyboard_tick += 10;
+    combo_process();
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    g_keyboard_tick += 1;
+    combo_process();
+    send_report();
+    EXPECT_EQ(KEY_ESC, keyboard_send_buffer[2]);
+    EXPECT_EQ(0, keyboard_send_buffer[3]);
+
+    g_keyboard_tick += 1;
+    press(2);
+    combo_process();
+    send_report();
+    EXPECT_EQ(KEY_ESC, keyboard_send_buffer[2]);
+    EXPECT_NE(KEY_TAB, keyboard_send_buffer[3]);
+}
+
+TEST_F(ComboTest, MemberReleaseFiresPendingCombo)
+{
+    press(0);
+    press(1);
+    g_keyboard_tick += 2;
+    release(1);
+    send_report();
+    EXPECT_EQ(KEY_ESC, keyboard_send_buffer[2]);
+    EXPECT_EQ(0, keyboard_send_buffer[3]);
+
+    g_keyboard_tick += 1;
+    combo_process();
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(ComboTest, HeldKeyIsEmittedAfterHoldOff)
+{
+    press(0);
+    g_keyboard_tick += 5;
+    combo_process();
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    g_keyboard_tick += 5;
+    combo_process();
+    send_report();
+    EXPECT_EQ(KEY_A, keyboard_send_buffer[2]);
+
+    g_keyboard_tick += 5;
+    press(1);
+    send_report();
+    EXPECT_EQ(KEY_A, keyboard_send_buffer[2]);
+    EXPECT_EQ(0, keyboard_send_buffer[3]);
+}
+
+TEST_F(ComboTest, ConfiguredHoldOffOverridesComboWindow)
+{
+    g_combo_hold_off[0] = 3;
+    combo_init();
+    press(0);
+    g_keyboard_tick += 3;
+    combo_process();
+    send_report();
+    EXPECT_EQ(KEY_A, keyboard_send_buffer[2]);
+}
+
+TEST_F(ComboTest, QuickTapIsReplayedAsTap)
+{
+    press(0);
+    g_keyboard_tick += 1;
+    release(0);
+    send_report();
+    EXPECT_EQ(KEY_A, keyboard_send_buffer[2]);
+
+    g_keyboard_tick += 1;
+    combo_process();
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(ComboTest, UnrelatedKeyFlushesHeldKeysInOrder)
+{
+    press(0);
+    g_keyboard_tick += 1;
+    press(3);
+    send_report();
+    EXPECT_EQ(KEY_A, keyboard_send_buffer[2]);
+    EXPECT_EQ(KEY_D, keyboard_send_buffer[3]);
+}
+
+TEST_F(ComboTest, ExpiredWindowDoesNotTrigger)
+{
+    press(0);
+    g_keyboard_tick += 11;
+    press(1);
+    combo_process();
+    send_report();
+    EXPECT_EQ(KEY_A, keyboard_send_buffer[2]);
+    EXPECT_EQ(0, keyboard_send_buffer[3]);
+}
+
+TEST_F(ComboTest, PacketSetAndGet)
+{
+    std::array<uint8_t, 64> buffer = {};
+    PacketCombo *packet = reinterpret_cast<PacketCombo *>(buffer.data());
+    Combo combo = {};
+    combo.keycode = KEY_ENTER;
+    combo.term = 20;
+    combo.key_id[0] = 2;
+    combo.key_id[1] = 3;
+    combo.key_id[2] = COMBO_KEY_NONE;
+    combo.key_id[3] = COMBO_KEY_NONE;
+    packet->code = PACKET_CODE_SET;
+    packet->type = PACKET_DATA_COMBO;
+    packet->index = 2;
+    std::memcpy(packet->combo, &combo, sizeof(combo));
+    packet_process(buffer.data(), offsetof(PacketCombo, combo) + sizeof(Combo));
+
+    press(2);
+    press(3);
+    send_report();
+    EXPECT_EQ(KEY_ENTER, keyboard_send_buffer[2]);
+
+    buffer.fill(0);
+    packet->code = PACKET_CODE_GET;
+    packet->type = PACKET_DATA_COMBO;
+    packet->index = 2;
+    packet_process(buffer.data(), offsetof(PacketCombo, combo) + sizeof(Combo));
+    EXPECT_EQ(0, std::memcmp(packet->combo, &combo, sizeof(combo)));
+}
+
+TEST_F(ComboTest, StoredWithProfile)
+{
+    g_combo_hold_off[5] = 7;
+    storage_save_profile();
+    combo_reset();
+    storage_read_profile();
+
+    EXPECT_EQ(KEY_ESC, g_combos[0].keycode);
+    EXPECT_EQ(KEY_TAB, g_combos[1].keycode);
+    EXPECT_EQ(2, g_combos[1].key_id[2]);
+    EXPECT_EQ(7, g_combo_hold_off[5]);
+
+    press(0);
+    press(1);
+    g_keyboard_tick += 11;
+    combo_process();
+    send_report();
+    EXPECT_EQ(KEY_ESC, keyboard_send_buffer[2]);
+}
+
+static uint32_t combo_releases;
+
+static void count_combo_release(KeyboardEvent event, uint32_t tick)
+{
+    (void)tick;
+    if (event.keycode == KEY_TAB)
+    {
+        combo_releases++;
+    }
+}
+
+TEST_F(ComboTest, ReinitReleasesActiveCombos)
+{
+    combo_releases = 0;
+    ASSERT_TRUE(keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_HANDLER, count_combo_release,
+                                         KEYBOARD_EVENT_MASK(KEYBOARD_EVENT_KEY_UP), KEYCODE_CLASS_MASK_ALL, NULL));
+    press(0);
+    press(1);
+    press(2);
+    send_report();
+    EXPECT_EQ(KEY_TAB, keyboard_send_buffer[2]);
+
+    combo_init();
+    EXPECT_EQ(1u, combo_releases);
+    send_report();
+    for (int i = 2; i < 8; i++) {
+        EXPECT_NE(KEY_TAB, keyboard_send_buffer[i]);
+    }
+    keyboard_event_unsubscribe(KEYBOARD_EVENT_CHAIN_HANDLER, count_combo_release);
+}
@@ -1,9 +1,13 @@
 #include <gtest/gtest.h>
 
+#include <cstring>
+#include <vector>
+
 #include "keyboard.h"
 #include "dynamic_key.h"
 #include "layer.h"
 #include "rgb.h"
+#include "timer_wheel.h"
 #include "math.h"
 #include "test_fixture.h"
 
@@ -27,7 +31,7 @@ void reset_user_poller_capture(void)
 void bind_dynamic_key(uint16_t key_id, uint8_t dynamic_key_id = 0)
 {
     g_keymap[0][key_id] = DYNAMIC_KEY | (dynamic_key_id << 8);
-    g_keymap_cache[key_id] = g_keymap[0][key_id];
+    layer_cache_update(key_id);
 }
 
 Keycode collection_keycode(uint8_t collection, uint8_t subcode)
@@ -64,9 +68,9 @@ TEST(DynamicKey, ModTap)
             .duration = 100,
         }
     };
-    memcpy(&g_dynamic_keys[0],&dynamic_key,sizeof(DynamicKey));
+    dynamic_key_set(0, &dynamic_key);
     g_keymap[0][0] = DYNAMIC_KEY | ((0) << 8);
-    g_keymap_cache[0] = g_keymap[0][0];
+    layer_cache_update(0);
 
     keyboard_advanced_key_update(&g_keyboard_advanced_keys[0], A_ANTI_NORM(1.0));
     dynamic_key_process();
@@ -82,6 +86,7 @@ TEST(DynamicKey, ModTap)
 
 
     keyboard_advanced_key_update(&g_keyboard_advanced_keys[0], A_ANTI_NORM(1.0));
+    timer_wheel_process();
     dynamic_key_process();
     keyboard_clear_buffer();
     dynamic_key_add_buffer();
@@ -124,16 +129,16 @@ TEST(DynamicKey, ToggleKey)
             .key_id = 0,
         }
     };
-    memcpy(&g_dynamic_keys[0],&dynamic_key,sizeof(DynamicKey));
+    dynamic_key_set(0, &dynamic_key);
     g_keymap[0][0] = DYNAMIC_KEY | ((0) << 8);
-    g_keymap_cache[0] = g_keymap[0][0];
+    layer_cache_update(0);
 
     keyboard_advanced_key_update(&g_keyboard_advanced_keys[0], A_ANTI_NORM(1.0));
     dynamic_key_process();
     keyboard_clear_buffer();
     dynamic_key_add_buffer();
     keyboard_buffer_send();
-    EXPECT_EQ(g_dynamic_keys[0].tk.state, true);
+    EXPECT_EQ(dynamic_key_get(0)->tk.state, true);
     EXPECT_EQ(keyboard_send_buffer[2], KEY_A);
 
     keyboard_advanced_key_update(&g_keyboard_advanced_keys[0], A_ANTI_NORM(0.0));
@@ -141,7 +146,7 @@ TEST(DynamicKey, ToggleKey)
     keyboard_clear_buffer();
     dynamic_key_add_buffer();
     keyboard_buffer_send();
-    EXPECT_EQ(g_dynamic_keys[0].tk.state, true);
+    EXPECT_EQ(dynamic_key_get(0)->tk.state, true);
     EXPECT_EQ(keyboard_send_buffer[2], KEY_A);
 
     keyboard_advanced_key_update(&g_keyboard_advanced_keys[0], A_ANTI_NORM(1.0));
@@ -149,7 +154,7 @@ TEST(DynamicKey, ToggleKey)
     keyboard_clear_buffer();
     dynamic_key_add_buffer();
     keyboard_buffer_send();
-    EXPECT_EQ(g_dynamic_keys[0].tk.state, false);
+    EXPECT_EQ(dynamic_key_get(0)->tk.state, false);
     EXPECT_EQ(keyboard_send_buffer[2], KEY_NO_EVENT);
 
     keyboard_advanced_key_update(&g_keyboard_advanced_keys[0], A_ANTI_NORM(0.0));
@@ -157,7 +162,7 @@ TEST(DynamicKey, ToggleKey)
     keyboard_clear_buffer();
     dynamic_key_add_buffer();
     keyboard_buffer_send();
-    EXPECT_EQ(g_dynamic_keys[0].tk.state, false);
+    EXPECT_EQ(dynamic_key_get(0)->tk.state, false);
     EXPECT_EQ(keyboard_send_buffer[2], KEY_NO_EVENT);
 }
 
@@ -182,9 +187,9 @@ TEST(DynamicKey, DynamicKeyStroke)
             .release_fully_distance = A_ANTI_NORM(0.25),
         }
     };
-    memcpy(&g_dynamic_keys[0], &dynamic_key, sizeof(DynamicKey));
+    dynamic_key_set(0, &dynamic_key);
     g_keymap[0][0] = DYNAMIC_KEY | ((0) << 8);
-    g_keymap_cache[0] = g_keymap[0][0];
+    layer_cache_update(0);
 
     keyboard_advanced_key_update(&g_keyboard_advanced_keys[0],A_ANTI_NORM(1));
     keyboard_advanced_key_update(&g_keyboard_advanced_keys[0],A_ANTI_NORM(0));
@@ -291,7 +296,7 @@ TEST(DynamicKey, DerivedEventsRemainPhysicalForPoller)
 {
     reset_user_poller_capture();
     bind_dynamic_key(0);
-    DynamicKey* dynamic_key = &g_dynamic_keys[0];
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_TOGGLE_KEY);
     dynamic_key->tk.type = DYNAMIC_KEY_TOGGLE_KEY;
     dynamic_key->tk.key_binding = KEY_USER;
     dynamic_key->tk.key_id = 0;
@@ -310,7 +315,7 @@ TEST(DynamicKey, DerivedEventsRemainPhysicalForPoller)
 TEST(DynamicKey, DerivedEventsSetReportFlags)
 {
     bind_dynamic_key(0);
-    DynamicKey* dynamic_key = &g_dynamic_keys[0];
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_TOGGLE_KEY);
     dynamic_key->tk.type = DYNAMIC_KEY_TOGGLE_KEY;
     dynamic_key->tk.key_binding = collection_keycode(MOUSE_COLLECTION, MOUSE_LBUTTON);
     dynamic_key->tk.key_id = 0;
@@ -325,7 +330,7 @@ TEST(DynamicKey, DerivedEventsSetReportFlags)
 TEST(DynamicKey, DerivedEventsDoNotRetriggerRgbActivation)
 {
     bind_dynamic_key(0);
-    DynamicKey* dynamic_key = &g_dynamic_keys[0];
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_TOGGLE_KEY);
     dynamic_key->tk.type = DYNAMIC_KEY_TOGGLE_KEY;
     dynamic_key->tk.key_binding = KEY_A;
     dynamic_key->tk.key_id = 0;
@@ -351,7 +356,7 @@ TEST(DynamicKey, DynamicKeyStrokeHysteresisPreventsThresholdNoise)
     bind_dynamic_key(0);
     const AnalogValue threshold = A_ANTI_NORM(0.5f);
     const AnalogValue half_hysteresis = DYNAMIC_KEY_HYSTERESIS / 2;
-    DynamicKey* dynamic_key = &g_dynamic_keys[0];
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_STROKE);
     dynamic_key->dks.type = DYNAMIC_KEY_STROKE;
     dynamic_key->dks.key_binding[0] = KEY_A;
     dynamic_key->dks.key_control[0] = DKS_KEY_CONTROL(DKS_HOLD, DKS_HOLD, DKS_RELEASE, DKS_RELEASE);
@@ -390,9 +395,9 @@ TEST(DynamicKey, MutexDistancePriority)
 {
     g_keymap[0][0] = DYNAMIC_KEY | (0 << 8);
     g_keymap[0][1] = DYNAMIC_KEY | (0 << 8);
-    g_keymap_cache[0] = g_keymap[0][0];
-    g_keymap_cache[1] = g_keymap[0][1];
-    DynamicKey*dynamic_key = &g_dynamic_keys[0];
+    layer_cache_update(0);
+    layer_cache_update(1);
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_MUTEX);
     dynamic_key->m.type = DYNAMIC_KEY_MUTEX;
     dynamic_key->m.mode = DK_MUTEX_DISTANCE_PRIORITY;
     dynamic_key->m.key_binding[0] = KEY_A;
@@ -490,7 +495,7 @@ TEST(DynamicKey, MutexDistancePriorityHysteresisFiltersLosingKeyNoise)
     bind_dynamic_key(1);
     const AnalogValue base = A_ANTI_NORM(0.4f);
     const AnalogValue half_hysteresis = DYNAMIC_KEY_HYSTERESIS / 2;
-    DynamicKey* dynamic_key = &g_dynamic_keys[0];
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_MUTEX);
     dynamic_key->m.type = DYNAMIC_KEY_MUTEX;
     dynamic_key->m.mode = DK_MUTEX_DISTANCE_PRIORITY;
     dynamic_key->m.key_binding[0] = KEY_A;
@@ -523,7 +528,7 @@ TEST(DynamicKey, MutexSimultaneousDeadzoneHysteresisFiltersEdgeNoise)
     const AnalogValue key0_enter_threshold = ANALOG_VALUE_MAX - advanced_key0->config.lower_deadzone;
     const AnalogValue key1_enter_threshold = ANALOG_VALUE_MAX - advanced_key1->config.lower_deadzone;
     const AnalogValue half_hysteresis = DYNAMIC_KEY_HYSTERESIS / 2;
-    DynamicKey* dynamic_key = &g_dynamic_keys[0];
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_MUTEX);
     dynamic_key->m.type = DYNAMIC_KEY_MUTEX;
     dynamic_key->m.mode = DK_MUTEX_DISTANCE_PRIORITY | 0x80;
     dynamic_key->m.key_binding[0] = KEY_A;
@@ -553,9 +558,9 @@ TEST(DynamicKey, MutexLastPriority)
 {
     g_keymap[0][0] = DYNAMIC_KEY | (0 << 8);
     g_keymap[0][1] = DYNAMIC_KEY | (0 << 8);
-    g_keymap_cache[0] = g_keymap[0][0];
-    g_keymap_cache[1] = g_keymap[0][1];
-    DynamicKey*dynamic_key = &g_dynamic_keys[0];
+    layer_cache_update(0);
+    layer_cache_update(1);
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_MUTEX);
     dynamic_key->m.type = DYNAMIC_KEY_MUTEX;
     dynamic_key->m.mode = DK_MUTEX_LAST_PRIORITY;
     dynamic_key->m.key_binding[0] = KEY_A;
@@ -613,9 +618,9 @@ TEST(DynamicKey, MutexKey1Priority)
 {
     g_keymap[0][0] = DYNAMIC_KEY | (0 << 8);
     g_keymap[0][1] = DYNAMIC_KEY | (0 << 8);
-    g_keymap_cache[0] = g_keymap[0][0];
-    g_keymap_cache[1] = g_keymap[0][1];
-    DynamicKey*dynamic_key = &g_dynamic_keys[0];
+    layer_cache_update(0);
+    layer_cache_update(1);
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_MUTEX);
     dynamic_key->m.type = DYNAMIC_KEY_MUTEX;
     dynamic_key->m.mode = DK_MUTEX_KEY1_PRIORITY;
     dynamic_key->m.key_binding[0] = KEY_A;
@@ -673,9 +678,9 @@ TEST(DynamicKey, MutexKey2Priority)
 {
     g_keymap[0][0] = DYNAMIC_KEY | (0 << 8);
     g_keymap[0][1] = DYNAMIC_KEY | (0 << 8);
-    g_keymap_cache[0] = g_keymap[0][0];
-    g_keymap_cache[1] = g_keymap[0][1];
-    DynamicKey*dynamic_key = &g_dynamic_keys[0];
+    layer_cache_update(0);
+    layer_cache_update(1);
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_MUTEX);
     dynamic_key->m.type = DYNAMIC_KEY_MUTEX;
     dynamic_key->m.mode = DK_MUTEX_KEY2_PRIORITY;
     dynamic_key->m.key_binding[0] = KEY_A;
@@ -734,9 +739,9 @@ TEST(DynamicKey, MutexKeyNeural)
 {
     g_keymap[0][0] = DYNAMIC_KEY | (0 << 8);
     g_keymap[0][1] = DYNAMIC_KEY | (0 << 8);
-    g_keymap_cache[0] = g_keymap[0][0];
-    g_keymap_cache[1] = g_keymap[0][1];
-    DynamicKey*dynamic_key = &g_dynamic_keys[0];
+    layer_cache_update(0);
+    layer_cache_update(1);
+    DynamicKey* dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_MUTEX);
     dynamic_key->m.type = DYNAMIC_KEY_MUTEX;
     dynamic_key->m.mode = DK_MUTEX_NEUTRAL;
     dynamic_key->m.key_binding[0] = KEY_A;
@@ -791,3 +796,353 @@ TEST(DynamicKey, MutexKeyNeural)
     EXPECT_TRUE(g_keyboard_advanced_keys[0].key.report_state);
     EXPECT_TRUE(g_keyboard_advanced_keys[1].key.report_state);
 }
+
+namespace {
+
+struct DynamicKeyFrame
+{
+    uint8_t report[8];
+    bool report_state[2];
+
+    bool operator==(const DynamicKeyFrame &other) const
+    {
+        return memcmp(report, other.report, sizeof(report)) == 0 &&
+            report_state[0] == other.report_state[0] &&
+            report_state[1] == other.report_state[1];
+    }
+};
+
+void reset_advanced_keys(uint8_t num)
+{
+    for (uint8_t layer = 0; layer < LAYER_NUM; layer++)
+    {
+        layer_reset(layer);
+    }
+    for (uint8_t i = 0; i < num; i++)
+    {
+        AdvancedKey *advanced_key = &g_keyboard_advanced_keys[i];
+        keyboard_key_set_report_state(&advanced_key->key, false);
+        advanced_key->key.state = false;
+#if DEBOUNCE_PRESS > 0 || DEBOUNCE_RELEASE > 0
+        advanced_key->key.debounce = 0;
+#endif
+        advanced_key->value = ANALOG_VALUE_MIN;
+        advanced_key->extremum = ANALOG_VALUE_MIN;
+    }
+}
+
+std::vector<DynamicKeyFrame> run_dynamic_key_sequence(const DynamicKey &config, bool polling)
+{
+    static const float levels[] = {0.0f, 0.2f, 0.5f, 0.8f, 1.0f};
+    libamp_test_reset_environment();
+    reset_advanced_keys(2);
+    dynamic_key_set(0, &config);
+    bind_dynamic_key(0);
+    bind_dynamic_key(1);
+    uint32_t seed = 12345;
+    uint16_t hold[2] = {0, 0};
+    AnalogValue value[2] = {ANALOG_VALUE_MIN, ANALOG_VALUE_MIN};
+    std::vector<DynamicKeyFrame> frames;
+    g_keyboard_tick = 1000;
+    for (int tick = 0; tick < 2000; tick++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            if (!hold[i])
+            {
+                seed = seed * 1103515245 + 12345;
+                value[i] = A_ANTI_NORM(levels[(seed >> 16) % 5]);
+                hold[i] = 1 + (seed >> 8) % 60;
+            }
+            hold[i]--;
+            keyboard_advanced_key_update(&g_keyboard_advanced_keys[i], value[i]);
+        }
+        if (polling)
+        {
+            dynamic_key_invalidate();
+        }
+        timer_wheel_process();
+        dynamic_key_process();
+        keyboard_clear_buffer();
+        dynamic_key_add_buffer();
+        keyboard_buffer_send();
+        DynamicKeyFrame frame;
+        memcpy(frame.report, keyboard_send_buffer, sizeof(frame.report));
+        frame.report_state[0] = g_keyboard_advanced_keys[0].key.report_state;
+        frame.report_state[1] = g_keyboard_advanced_keys[1].key.report_state;
+        frames.push_back(frame);
+        g_keyboard_tick++;
+    }
+    return frames;
+}
+
+void expect_same_as_polling(const DynamicKey &config)
+{
+    const std::vector<DynamicKeyFrame> polled = run_dynamic_key_sequence(config, true);
+    const std::vector<DynamicKeyFrame> indexed = run_dynamic_key_sequence(config, false);
+    ASSERT_EQ(polled.size(), indexed.size());
+    size_t active_frames = 0;
+    for (size_t i = 0; i < polled.size(); i++)
+    {
+        ASSERT_TRUE(polled[i] == indexed[i]) << "diverged at tick " << i;
+        active_frames += polled[i].report[2] != 0;
+    }
+    EXPECT_GT(active_frames, 0u);
+}
+
+} // namespace
+
+TEST(DynamicKey, ChangeOnlyMatchesPollingForEveryType)
+{
+    DynamicKey config = {};
+    config.mt.type = DYNAMIC_KEY_MOD_TAP;
+    config.mt.key_binding[0] = KEY_A;
+    config.mt.key_binding[1] = KEY_B;
+    config.mt.duration = 20;
+    config.mt.key_id = 0;
+    expect_same_as_polling(config);
+
+    config = {};
+    config.tk.type = DYNAMIC_KEY_TOGGLE_KEY;
+    config.tk.key_binding = KEY_C;
+    config.tk.key_id = 0;
+    expect_same_as_polling(config);
+
+    config = {};
+    config.dks.type = DYNAMIC_KEY_STROKE;
+    config.dks.key_binding[0] = KEY_A;
+    config.dks.key_binding[1] = KEY_B;
+    config.dks.key_binding[2] = KEY_C;
+    config.dks.key_binding[3] = KEY_D;
+    config.dks.key_control[0] = DKS_KEY_CONTROL(DKS_HOLD, DKS_HOLD, DKS_HOLD, DKS_RELEASE);
+    config.dks.key_control[1] = DKS_KEY_CONTROL(DKS_RELEASE, DKS_HOLD, DKS_RELEASE, DKS_RELEASE);
+    config.dks.key_control[2] = DKS_KEY_CONTROL(DKS_RELEASE, DKS_HOLD, DKS_TAP, DKS_HOLD);
+    config.dks.key_control[3] = DKS_KEY_CONTROL(DKS_TAP, DKS_RELEASE, DKS_TAP, DKS_RELEASE);
+    config.dks.press_begin_distance = A_ANTI_NORM(0.25);
+    config.dks.press_fully_distance = A_ANTI_NORM(0.75);
+    config.dks.release_begin_distance = A_ANTI_NORM(0.75);
+    config.dks.release_fully_distance = A_ANTI_NORM(0.25);
+    config.dks.key_id = 0;
+    expect_same_as_polling(config);
+
+    const uint8_t modes[] = {DK_MUTEX_DISTANCE_PRIORITY, DK_MUTEX_LAST_PRIORITY, DK_MUTEX_KEY1_PRIORITY,
+                             DK_MUTEX_KEY2_PRIORITY, DK_MUTEX_NEUTRAL, DK_MUTEX_DISTANCE_PRIORITY | 0x80};
+    for (uint8_t mode : modes)
+    {
+        config = {};
+        config.m.type = DYNAMIC_KEY_MUTEX;
+        config.m.mode = mode;
+        config.m.key_binding[0] = KEY_A;
+        config.m.key_binding[1] = KEY_B;
+        config.m.key_id[0] = 0;
+        config.m.key_id[1] = 1;
+        expect_same_as_polling(config);
+    }
+}
+
+TEST(DynamicKey, IdleEntryIsNotReevaluated)
+{
+    DynamicKey *dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_MOD_TAP);
+    dynamic_key->mt.key_binding[0] = KEY_C;
+    dynamic_key->mt.key_binding[1] = KEY_D;
+    dynamic_key->mt.duration = 100;
+    dynamic_key->mt.key_id = 0;
+    bind_dynamic_key(0);
+    Key *key = &g_keyboard_advanced_keys[0].key;
+
+    keyboard_advanced_key_update(&g_keyboard_advanced_keys[0], ANALOG_VALUE_MIN);
+    dynamic_key_process();
+    EXPECT_FALSE(key->report_state);
+
+    // nothing this entry depends on changed, so the forced state is left alone
+    keyboard_key_set_report_state(key, true);
+    dynamic_key_process();
+    EXPECT_TRUE(key->report_state);
+
+    dynamic_key_mark(0);
+    dynamic_key_process();
+    EXPECT_FALSE(key->report_state);
+}
+
+namespace {
+
+void set_socd(uint8_t mode)
+{
+    reset_advanced_keys(4);
+    DynamicKey *dynamic_key = dynamic_key_emplace(0, DYNAMIC_KEY_SOCD);
+    dynamic_key->socd.mode = mode;
+    dynamic_key->socd.key_num = 4;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        dynamic_key->socd.key_binding[i] = KEY_A + i;
+        dynamic_key->socd.key_id[i] = i;
+        bind_dynamic_key(i);
+    }
+}
+
+void socd_update(uint8_t id, float value)
+{
+    keyboard_advanced_key_update(&g_keyboard_advanced_keys[id], A_ANTI_NORM(value));
+    dynamic_key_process();
+}
+
+} // namespace
+
+TEST(DynamicKey, SOCDLastPriorityFallsBackToPreviousHeld)
+{
+    set_socd(DK_SOCD_LAST_PRIORITY);
+    socd_update(0, 1.0f);
+    expect_dynamic_key_buffer(KEY_A);
+    socd_update(2, 1.0f);
+    expect_dynamic_key_buffer(KEY_C);
+    socd_update(1, 1.0f);
+    expect_dynamic_key_buffer(KEY_B);
+    EXPECT_FALSE(g_keyboard_advanced_keys[0].key.report_state);
+    EXPECT_FALSE(g_keyboard_advanced_keys[2].key.report_state);
+
+    socd_update(1, 0.0f);
+    expect_dynamic_key_buffer(KEY_C);
+    socd_update(2, 0.0f);
+    expect_dynamic_key_buffer(KEY_A);
+    socd_update(0, 0.0f);
+    expect_dynamic_key_buffer(KEY_NO_EVENT);
+}
+
+TEST(DynamicKey, SOCDFirstPriorityKeepsEarliestHeld)
+{
+    set_socd(DK_SOCD_FIRST_PRIORITY);
+    socd_update(3, 1.0f);
+    socd_update(1, 1.0f);
+    socd_update(2, 1.0f);
+    expect_dynamic_key_buffer(KEY_D);
+    socd_update(3, 0.0f);
+    expect_dynamic_key_buffer(KEY_B);
+    socd_update(3, 1.0f);
+    expect_dynamic_key_buffer(KEY_B);
+}
+
+TEST(DynamicKey, SOCDNeutralReportsOnlyALoneKey)
+{
+    set_socd(DK_SOCD_NEUTRAL);
+    socd_update(0, 1.0f);
+    expect_dynamic_key_buffer(KEY_A);
+    socd_update(3, 1.0f);
+    expect_dynamic_key_buffer(KEY_NO_EVENT);
+    socd_update(0, 0.0f);
+    expect_dynamic_key_buffer(KEY_D);
+}
+
+TEST(DynamicKey, SOCDOrderPriorityPrefersLowestMember)
+{
+    set_socd(DK_SOCD_ORDER_PRIORITY);
+    socd_update(2, 1.0f);
+    expect_dynamic_key_buffer(KEY_C);
+    socd_update(1, 1.0f);
+    expect_dynamic_key_buffer(KEY_B);
+    socd_update(3, 1.0f);
+    expect_dynamic_key_buffer(KEY_B);
+    socd_update(1, 0.0f);
+    expect_dynamic_key_buffer(KEY_C);
+}
+
+TEST(DynamicKey, SOCDDistancePriorityUsesDeepestWithHysteresis)
+{
+    set_socd(DK_SOCD_DISTANCE_PRIORITY);
+    socd_update(0, 0.6f);
+    socd_update(1, 0.8f);
+    expect_dynamic_key_buffer(KEY_B);
+
+    keyboard_advanced_key_update(&g_keyboard_advanced_keys[0], A_ANTI_NORM(0.8f) + DYNAMIC_KEY_HYSTERESIS / 2);
+    dynamic_key_process();
+    expect_dynamic_key_buffer(KEY_B);
+
+    keyboard_advanced_key_update(&g_keyboard_advanced_keys[0], A_ANTI_NORM(0.8f) + DYNAMIC_KEY_HYSTERESIS + 1);
+    dynamic_key_process();
+    expect_dynamic_key_buffer(KEY_A);
+
+    socd_update(0, 0.0f);
+    expect_dynamic_key_buffer(KEY_B);
+}
+
+TEST(DynamicKey, SOCDMatchesPollingPath)
+{
+    DynamicKey config = {};
+    config.socd.type = DYNAMIC_KEY_SOCD;
+    config.socd.key_num = 2;
+    config.socd.key_binding[0] = KEY_A;
+    config.socd.key_binding[1] = KEY_B;
+    config.socd.key_id[0] = 0;
+    config.socd.key_id[1] = 1;
+    for (uint8_t mode = DK_SOCD_LAST_PRIORITY; mode <= DK_SOCD_ORDER_PRIORITY; mode++)
+    {
+        config.socd.mode = mode;
+        expect_same_as_polling(config);
+    }
+}
+
+TEST(DynamicKey, PoolPacksEntriesBySize)
+{
+    dynamic_key_clear();
+    for (uint16_t i = 0; i < 4; i++)
+    {
+        ASSERT_NE(nullptr, dynamic_key_emplace(i, DYNAMIC_KEY_TOGGLE_KEY));
+    }
+    EXPECT_EQ(4 * sizeof(DynamicKeyToggleKey), dynamic_key_pool_used());
+    EXPECT_EQ(nullptr, dynamic_key_get(4));
+    dynamic_key_clear();
+    EXPECT_EQ(0u, dynamic_key_pool_used());
+}
+
+TEST(DynamicKey, PoolResizePreservesNeighbours)
+{
+    dynamic_key_clear();
+    for (uint16_t i = 0; i < 3; i++)
+    {
+        DynamicKey *dynamic_key = dynamic_key_emplace(i, DYNAMIC_KEY_TOGGLE_KEY);
+        ASSERT_NE(nullptr, dynamic_key);
+        dynamic_key->tk.key_binding = KEY_A + i;
+    }
+    DynamicKey *dynamic_key = dynamic_key_emplace(1, DYNAMIC_KEY_SOCD);
+    ASSERT_NE(nullptr, dynamic_key);
+    dynamic_key->socd.key_num = 2;
+    EXPECT_EQ(KEY_A, dynamic_key_get(0)->tk.key_binding);
+    EXPECT_EQ(DYNAMIC_KEY_SOCD, dynamic_key_get(1)->type);
+    EXPECT_EQ(KEY_C, dynamic_key_get(2)->tk.key_binding);
+    EXPECT_EQ(2 * sizeof(DynamicKeyToggleKey) + sizeof(DynamicKeySOCD), dynamic_key_pool_used());
+
+    DynamicKey none = {};
+    EXPECT_TRUE(dynamic_key_set(1, &none));
+    EXPECT_EQ(nullptr, dynamic_key_get(1));
+    EXPECT_EQ(KEY_C, dynamic_key_get(2)->tk.key_binding);
+    EXPECT_EQ(2 * sizeof(DynamicKeyToggleKey), dynamic_key_pool_used());
+    dynamic_key_clear();
+}
+
+TEST(DynamicKey, PoolRejectsEntryThatDoesNotFit)
+{
+    dynamic_key_clear();
+    uint16_t count = 0;
+    while (count < DYNAMIC_KEY_NUM && dynamic_key_emplace(count, DYNAMIC_KEY_STROKE))
+    {
+        count++;
+    }
+    const size_t used = dynamic_key_pool_used();
+    if (count < DYNAMIC_KEY_NUM)
+    {
+        EXPECT_EQ(nullptr, dynamic_key_emplace(count, DYNAMIC_KEY_STROKE));
+        EXPECT_EQ(used, dynamic_key_pool_used());
+    }
+    EXPECT_LE(used, (size_t)DYNAMIC_KEY_POOL_SIZE);
+    EXPECT_EQ(nullptr, dynamic_key_emplace(DYNAMIC_KEY_NUM, DYNAMIC_KEY_TOGGLE_KEY));
+    dynamic_key_clear();
+}
+
+TEST(DynamicKey, EncodedSizeFollowsEntrySizes)
+{
+    dynamic_key_clear();
+    dynamic_key_emplace(0, DYNAMIC_KEY_TOGGLE_KEY);
+    dynamic_key_emplace(3, DYNAMIC_KEY_MOD_TAP);
+    EXPECT_EQ(2 + sizeof(DynamicKeyToggleKey) + sizeof(DynamicKeyModTap), dynamic_key_encode(NULL, NULL));
+    EXPECT_LT(dynamic_key_encode(NULL, NULL), sizeof(DynamicKey) * DYNAMIC_KEY_NUM);
+    dynamic_key_clear();
+}
@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <pthread.h>
+#include <sched.h>
+#include <vector>
+
 #include "event_buffer.h"
 #include "event_cache.h"
 
@@ -18,9 +22,9 @@ KeyboardEvent event_with_keycode(Keycode keycode)
 
 TEST(EventBuffer, EmptyPopReturnsZeroEvent)
 {
-    EventLoopQueueElm data[3] = {};
+    EventLoopQueueElm data[4] = {};
     EventLoopQueue queue;
-    event_loop_queue_init(&queue, data, 3);
+    event_loop_queue_init(&queue, data, 4);
 
     const auto popped = event_loop_queue_pop(&queue);
 
@@ -28,6 +32,15 @@ TEST(EventBuffer, EmptyPopReturnsZeroEvent)
     EXPECT_EQ(0, popped.tick);
 }
 
+TEST(EventBuffer, LengthIsRoundedDownToPowerOfTwo)
+{
+    EventLoopQueueElm data[6] = {};
+    EventLoopQueue queue;
+    event_loop_queue_init(&queue, data, 6);
+
+    EXPECT_EQ(4, event_loop_queue_capacity(&queue));
+}
+
 TEST(EventBuffer, PushPopPreservesOrderAcrossWraparound)
 {
     EventLoopQueueElm data[4] = {};
@@ -40,47 +53,287 @@ TEST(EventBuffer, PushPopPreservesOrderAcrossWraparound)
 
     event_loop_queue_push(&queue, {event_with_keycode(KEY_C), 30});
     event_loop_queue_push(&queue, {event_with_keycode(KEY_D), 40});
+    event_loop_queue_push(&queue, {event_with_keycode(KEY_E), 50});
 
     EXPECT_EQ(KEY_B, event_loop_queue_pop(&queue).event.keycode);
     EXPECT_EQ(KEY_C, event_loop_queue_pop(&queue).event.keycode);
     EXPECT_EQ(KEY_D, event_loop_queue_pop(&queue).event.keycode);
+    EXPECT_EQ(KEY_E, event_loop_queue_pop(&queue).event.keycode);
+    EXPECT_EQ(4, queue.high_water);
+    EXPECT_EQ(0u, queue.dropped);
 }
 
 TEST(EventBuffer, FullQueueDropsNewestElement)
 {
-    EventLoopQueueElm data[3] = {};
+    EventLoopQueueElm data[2] = {};
     EventLoopQueue queue;
-    event_loop_queue_init(&queue, data, 3);
+    event_loop_queue_init(&queue, data, 2);
 
-    event_loop_queue_push(&queue, {event_with_keycode(KEY_A), 1});
-    event_loop_queue_push(&queue, {event_with_keycode(KEY_B), 2});
-    event_loop_queue_push(&queue, {event_with_keycode(KEY_C), 3});
+    EXPECT_TRUE(event_loop_queue_push(&queue, {event_with_keycode(KEY_A), 1}));
+    EXPECT_TRUE(event_loop_queue_push(&queue, {event_with_keycode(KEY_B), 2}));
+    EXPECT_FALSE(event_loop_queue_push(&queue, {event_with_keycode(KEY_C), 3}));
 
     EXPECT_EQ(KEY_A, event_loop_queue_pop(&queue).event.keycode);
     EXPECT_EQ(KEY_B, event_loop_queue_pop(&queue).event.keycode);
     EXPECT_EQ(0, event_loop_queue_pop(&queue).event.keycode);
+    EXPECT_EQ(1u, queue.dropped);
+}
+
+TEST(EventBuffer, DropOldestKeepsNewestElements)
+{
+    EventLoopQueueElm data[2] = {};
+    EventLoopQueue queue;
+    event_loop_queue_init(&queue, data, 2);
+    event_loop_queue_set_policy(&queue, EVENT_LOOP_QUEUE_DROP_OLDEST);
+
+    event_loop_queue_push(&queue, {event_with_keycode(KEY_A), 1});
+    event_loop_queue_push(&queue, {event_with_keycode(KEY_B), 2});
+    EXPECT_TRUE(event_loop_queue_push(&queue, {event_with_keycode(KEY_C), 3}));
+
+    EXPECT_EQ(KEY_B, event_loop_queue_pop(&queue).event.keycode);
+    EXPECT_EQ(KEY_C, event_loop_queue_pop(&queue).event.keycode);
+    EXPECT_EQ(1u, queue.dropped);
+}
+
+TEST(EventBuffer, StatsResetIsAppliedByProducer)
+{
+    EventLoopQueueElm data[2] = {};
+    EventLoopQueue queue;
+    event_loop_queue_init(&queue, data, 2);
+
+    event_loop_queue_push(&queue, {event_with_keycode(KEY_A), 1});
+    event_loop_queue_push(&queue, {event_with_keycode(KEY_B), 2});
+    EXPECT_FALSE(event_loop_queue_push(&queue, {event_with_keycode(KEY_C), 3}));
+    EXPECT_EQ(2, event_loop_queue_high_water(&queue));
+    EXPECT_EQ(1u, event_loop_queue_dropped(&queue));
+
+    event_loop_queue_reset_stats(&queue);
+    EXPECT_EQ(0, event_loop_queue_high_water(&queue));
+    EXPECT_EQ(0u, event_loop_queue_dropped(&queue));
+    // the counters themselves are only cleared from the producer side
+    EXPECT_EQ(1u, queue.dropped);
+
+    EXPECT_EQ(KEY_A, event_loop_queue_pop(&queue).event.keycode);
+    EXPECT_TRUE(event_loop_queue_push(&queue, {event_with_keycode(KEY_D), 4}));
+    EXPECT_EQ(2, event_loop_queue_high_water(&queue));
+    EXPECT_EQ(0u, event_loop_queue_dropped(&queue));
+    EXPECT_EQ(0u, queue.dropped);
+}
+
+TEST(EventBuffer, UnknownPolicyIsIgnored)
+{
+    EventLoopQueueElm data[2] = {};
+    EventLoopQueue queue;
+    event_loop_queue_init(&queue, data, 2);
+    event_loop_queue_set_policy(&queue, EVENT_LOOP_QUEUE_POLICY_NUM);
+    EXPECT_EQ(EVENT_BUFFER_POLICY, queue.policy);
+}
+
+namespace {
+
+constexpr uint32_t kStressCount = 100000;
+
+void *stress_producer(void *arg)
+{
+    EventLoopQueue *queue = static_cast<EventLoopQueue *>(arg);
+    for (uint32_t i = 1; i <= kStressCount; i++)
+    {
+        // stay below capacity: spin until the consumer frees a slot
+        while ((uint16_t)(__atomic_load_n(&queue->rear, __ATOMIC_ACQUIRE) -
+                          __atomic_load_n(&queue->front, __ATOMIC_ACQUIRE)) >= event_loop_queue_capacity(queue))
+        {
+            sched_yield();
+        }
+        EventLoopQueueElm elm = {event_with_keycode(KEY_A), i};
+        event_loop_queue_push(queue, elm);
+    }
+    return nullptr;
+}
+
+} // namespace
+
+TEST(EventBuffer, ThreadedProducerConsumerIsLossless)
+{
+    EventLoopQueueElm data[8] = {};
+    EventLoopQueue queue;
+    event_loop_queue_init(&queue, data, 8);
+
+    pthread_t producer;
+    ASSERT_EQ(0, pthread_create(&producer, nullptr, stress_producer, &queue));
+    uintptr_t expected = 1;
+    bool ordered = true;
+    while (expected <= kStressCount)
+    {
+        EventLoopQueueElm elm;
+        if (event_loop_queue_try_pop(&queue, &elm))
+        {
+            ordered = ordered && elm.tick == expected && elm.event.keycode == KEY_A;
+            expected++;
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+    pthread_join(producer, nullptr);
+
+    EXPECT_TRUE(ordered);
+    EXPECT_EQ(0u, queue.dropped);
+    EXPECT_LE(queue.high_water, 8);
+}
+
+TEST(EventBuffer, TimestampSurvivesQueueing)
+{
+    EventLoopQueueElm drained;
+    while (event_loop_queue_try_pop(&g_keyboard_event_buffer, &drained))
+    {
+    }
+
+    g_keyboard_event_timestamp = 123456;
+    keyboard_event_handler(MK_VIRTUAL_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(0)));
+    g_keyboard_event_timestamp = 999999;
+
+    EventLoopQueueElm queued;
+    ASSERT_TRUE(event_loop_queue_try_pop(&g_keyboard_event_buffer, &queued));
+    EXPECT_EQ(KEY_A, queued.event.keycode);
+    EXPECT_EQ(123456u, queued.event.timestamp);
+}
+
+TEST(EventCache, TimestampSurvivesCaching)
+{
+    event_cache_init();
+    g_keyboard_event_timestamp = 42;
+    event_cache_buffer_push(MK_VIRTUAL_EVENT(KEY_B, KEYBOARD_EVENT_KEY_DOWN, NULL), nullptr);
+    g_keyboard_event_timestamp = 43;
+    event_cache_add_buffer();
+
+    const int16_t index = event_cache_table_find(&g_event_cache, nullptr, KEY_B);
+    ASSERT_NE(EVENT_CACHE_NONE, index);
+    EXPECT_EQ(42u, g_event_cache.nodes[index].data.event.timestamp);
+    event_cache_init();
 }
 
 TEST(EventCache, FindsAndRemovesOwnerScopedKeycodes)
 {
-    EventCacheListNode nodes[6] = {};
-    EventCacheList list;
-    event_forward_list_init(&list, nodes, 6);
+    EventCacheNode nodes[6] = {};
+    int16_t slots[16];
+    EventCacheTable table;
+    event_cache_table_init(&table, nodes, 6, slots, 16);
 
     int owner_a;
     int owner_b;
-    event_forward_list_insert_after(&list, &list.data[list.head], {event_with_keycode(KEY_A), &owner_a});
-    event_forward_list_insert_after(&list, &list.data[list.head], {event_with_keycode(KEY_B), &owner_a});
-    event_forward_list_insert_after(&list, &list.data[list.head], {event_with_keycode(KEY_A), &owner_b});
+    event_cache_table_insert(&table, {event_with_keycode(KEY_A), &owner_a});
+    event_cache_table_insert(&table, {event_with_keycode(KEY_B), &owner_a});
+    event_cache_table_insert(&table, {event_with_keycode(KEY_A), &owner_b});
+
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner_a, KEY_A));
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner_b, KEY_A));
+
+    event_cache_table_remove_first_keycode(&table, &owner_a, KEY_A);
+
+    EXPECT_FALSE(event_cache_table_exists_keycode(&table, &owner_a, KEY_A));
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner_a, KEY_B));
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner_b, KEY_A));
+}
+
+TEST(EventCache, IterationKeepsNewestFirstOrderAcrossRemovals)
+{
+    EventCacheNode nodes[4] = {};
+    int16_t slots[8];
+    EventCacheTable table;
+    event_cache_table_init(&table, nodes, 4, slots, 8);
+
+    int owner;
+    event_cache_table_insert(&table, {event_with_keycode(KEY_A), &owner});
+    event_cache_table_insert(&table, {event_with_keycode(KEY_B), &owner});
+    event_cache_table_insert(&table, {event_with_keycode(KEY_C), &owner});
+    event_cache_table_insert(&table, {event_with_keycode(KEY_D), &owner});
+    EXPECT_FALSE(event_cache_table_insert(&table, {event_with_keycode(KEY_E), &owner}));
+    EXPECT_EQ(1u, table.overflow);
+
+    event_cache_table_remove_first_keycode(&table, &owner, KEY_C);
+    event_cache_table_insert(&table, {event_with_keycode(KEY_F), &owner});
+
+    Keycode order[4] = {};
+    size_t count = 0;
+    event_cache_table_foreach(&table, item)
+    {
+        order[count++] = item->event.keycode;
+    }
+    ASSERT_EQ(4u, count);
+    EXPECT_EQ(KEY_F, order[0]);
+    EXPECT_EQ(KEY_D, order[1]);
+    EXPECT_EQ(KEY_B, order[2]);
+    EXPECT_EQ(KEY_A, order[3]);
+}
+
+namespace {
+
+uint16_t event_cache_home_slot(void *owner, Keycode keycode)
+{
+    EventCacheNode node[1] = {};
+    int16_t slots[16];
+    EventCacheTable table;
+    event_cache_table_init(&table, node, 1, slots, 16);
+    event_cache_table_insert(&table, {event_with_keycode(keycode), owner});
+    return node[0].slot;
+}
+
+} // namespace
+
+TEST(EventCache, RemovalKeepsCollidingEntriesReachable)
+{
+    int owner;
+    // pick four keycodes sharing one home slot and one homed right after it
+    std::vector<Keycode> colliding;
+    Keycode displaced = 0;
+    const uint16_t home = event_cache_home_slot(&owner, KEY_A);
+    for (uint32_t keycode = KEY_A; keycode <= 0xFFFF && (colliding.size() < 4 || !displaced); keycode++)
+    {
+        const uint16_t slot = event_cache_home_slot(&owner, static_cast<Keycode>(keycode));
+        if (slot == home && colliding.size() < 4)
+        {
+            colliding.push_back(static_cast<Keycode>(keycode));
+        }
+        else if (slot == ((home + 1) & 15) && !displaced)
+        {
+            displaced = static_cast<Keycode>(keycode);
+        }
+    }
+    ASSERT_EQ(4u, colliding.size());
+    ASSERT_NE(0, displaced);
 
-    EXPECT_TRUE(event_forward_list_exists_keycode(&list, &owner_a, KEY_A));
-    EXPECT_TRUE(event_forward_list_exists_keycode(&list, &owner_b, KEY_A));
+    EventCacheNode nodes[8] = {};
+    int16_t slots[16];
+    EventCacheTable table;
+    event_cache_table_init(&table, nodes, 8, slots, 16);
+    for (Keycode keycode : colliding)
+    {
+        ASSERT_TRUE(event_cache_table_insert(&table, {event_with_keycode(keycode), &owner}));
+    }
+    ASSERT_TRUE(event_cache_table_insert(&table, {event_with_keycode(displaced), &owner}));
+    for (uint16_t i = 0; i < 4; i++)
+    {
+        EXPECT_EQ((home + i) & 15, nodes[event_cache_table_find(&table, &owner, colliding[i])].slot);
+    }
+    EXPECT_EQ((home + 4) & 15, nodes[event_cache_table_find(&table, &owner, displaced)].slot);
 
-    event_forward_list_remove_first_keycode(&list, &owner_a, KEY_A);
+    // removing from the middle of the chain must pull later entries back
+    event_cache_table_remove_first_keycode(&table, &owner, colliding[1]);
+    EXPECT_FALSE(event_cache_table_exists_keycode(&table, &owner, colliding[1]));
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner, colliding[0]));
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner, colliding[2]));
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner, colliding[3]));
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner, displaced));
+    EXPECT_EQ((home + 1) & 15, nodes[event_cache_table_find(&table, &owner, colliding[2])].slot);
+    EXPECT_EQ((home + 3) & 15, nodes[event_cache_table_find(&table, &owner, displaced)].slot);
+    EXPECT_EQ(-1, slots[(home + 4) & 15]);
 
-    EXPECT_FALSE(event_forward_list_exists_keycode(&list, &owner_a, KEY_A));
-    EXPECT_TRUE(event_forward_list_exists_keycode(&list, &owner_a, KEY_B));
-    EXPECT_TRUE(event_forward_list_exists_keycode(&list, &owner_b, KEY_A));
+    event_cache_table_remove_first_keycode(&table, &owner, colliding[0]);
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner, colliding[2]));
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner, colliding[3]));
+    EXPECT_TRUE(event_cache_table_exists_keycode(&table, &owner, displaced));
+    EXPECT_EQ(3, table.count);
 }
 
 TEST(EventCache, BufferKeepsFullWidthOwnerPointer)
@@ -91,5 +344,5 @@ TEST(EventCache, BufferKeepsFullWidthOwnerPointer)
     event_cache_buffer_push(event_with_keycode(KEY_C), &owner);
     event_cache_add_buffer();
 
-    EXPECT_TRUE(event_forward_list_exists_keycode(&g_event_buffer_list, &owner, KEY_C));
+    EXPECT_TRUE(event_cache_table_exists_keycode(&g_event_cache, &owner, KEY_C));
 }
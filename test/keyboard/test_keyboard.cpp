@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <string>
+
 #include "analog.h"
+#include "event_buffer.h"
 #include "keyboard.h"
 #include "layer.h"
 #include "math.h"
@@ -360,3 +364,156 @@ TEST(Keyboard, DebounceRelease)
     EXPECT_FALSE(keyboard_key_debounce(&key));
 #endif
 }
+
+static uint32_t subscriber_calls;
+static uint16_t subscriber_last_id;
+static uint32_t subscriber_last_tick;
+
+static void subscriber_callback(KeyboardEvent event, uint32_t tick)
+{
+    subscriber_calls++;
+    subscriber_last_id = ((Key*)event.key)->id;
+    subscriber_last_tick = tick;
+}
+
+TEST(Keyboard, SubscriberEventAndClassMasks)
+{
+    subscriber_calls = 0;
+    ASSERT_TRUE(keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback,
+                                         KEYBOARD_EVENT_MASK(KEYBOARD_EVENT_KEY_DOWN), BIT(KEYCODE_CLASS_MOUSE), NULL));
+    Key *key = &g_keyboard_advanced_keys[0].key;
+
+    keyboard_event_handler(MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, key));
+    keyboard_event_handler(MK_EVENT(QK_MOUSE_BUTTON_1, KEYBOARD_EVENT_KEY_TRUE, key));
+    keyboard_event_handler(MK_EVENT(QK_MOUSE_BUTTON_1, KEYBOARD_EVENT_KEY_UP, key));
+    EXPECT_EQ(0u, subscriber_calls);
+
+    g_keyboard_tick = 42;
+    keyboard_event_handler(MK_EVENT(QK_MOUSE_BUTTON_1, KEYBOARD_EVENT_KEY_DOWN, key));
+    EXPECT_EQ(1u, subscriber_calls);
+    EXPECT_EQ(42u, subscriber_last_tick);
+
+    EXPECT_TRUE(keyboard_event_unsubscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback));
+    EXPECT_FALSE(keyboard_event_unsubscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback));
+    keyboard_event_handler(MK_EVENT(QK_MOUSE_BUTTON_1, KEYBOARD_EVENT_KEY_DOWN, key));
+    EXPECT_EQ(1u, subscriber_calls);
+}
+
+TEST(Keyboard, SubscriberKeyMaskAndPhysicalFilter)
+{
+    uint32_t key_mask[KEY_BITMAP_SIZE] = {0};
+    BIT_SET(key_mask[3 / 32], 3 % 32);
+    subscriber_calls = 0;
+    ASSERT_TRUE(keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback,
+                                         KEYBOARD_EVENT_MASK_CHANGED | KEYBOARD_EVENT_MASK_PHYSICAL, 0, key_mask));
+
+    keyboard_event_handler(MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(2)));
+    keyboard_event_handler(MK_VIRTUAL_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(3)));
+    EXPECT_EQ(0u, subscriber_calls);
+
+    keyboard_event_handler(MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(3)));
+    keyboard_event_handler(MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_UP, keyboard_get_key(3)));
+    EXPECT_EQ(2u, subscriber_calls);
+    EXPECT_EQ(3, subscriber_last_id);
+    keyboard_event_unsubscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback);
+}
+
+TEST(Keyboard, SubscriberPollerReceivesQueuedTick)
+{
+    subscriber_calls = 0;
+    ASSERT_TRUE(keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_POLLER, subscriber_callback,
+                                         KEYBOARD_EVENT_MASK_CHANGED, KEYCODE_CLASS_MASK_ALL, NULL));
+    g_keyboard_tick = 7;
+    keyboard_event_handler(MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(5)));
+    keyboard_event_handler(MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_TRUE, keyboard_get_key(5)));
+    EXPECT_EQ(0u, subscriber_calls);
+
+    g_keyboard_tick = 9;
+    keyboard_process();
+    EXPECT_EQ(1u, subscriber_calls);
+    EXPECT_EQ(5, subscriber_last_id);
+    EXPECT_EQ(7u, subscriber_last_tick);
+    keyboard_event_unsubscribe(KEYBOARD_EVENT_CHAIN_POLLER, subscriber_callback);
+}
+
+TEST(Keyboard, SubscriberTableIsBounded)
+{
+    int added = 0;
+    while (keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback, 0, 0, NULL))
+    {
+        added++;
+    }
+    EXPECT_GT(added, 0);
+    EXPECT_LT(added, KEYBOARD_EVENT_SUBSCRIBER_NUM + 1);
+    EXPECT_FALSE(keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_NUM, subscriber_callback, 0, 0, NULL));
+    EXPECT_TRUE(keyboard_event_unsubscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback));
+    EXPECT_TRUE(keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback, 0, 0, NULL));
+    EXPECT_TRUE(keyboard_event_unsubscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback));
+}
+
+namespace {
+
+constexpr uint16_t kDispatchKeyNum = 8;
+
+// press and release each key through keyboard_key_update() and drain the poller chain
+double measure_key_dispatch(int rounds)
+{
+    const auto begin = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (uint16_t id = 1; id <= kDispatchKeyNum; id++)
+        {
+            Key *key = keyboard_get_key(id);
+            keyboard_key_update(key, true);
+            while (key->report_state)
+            {
+                keyboard_key_update(key, false);
+            }
+        }
+        keyboard_process();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - begin;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (rounds * kDispatchKeyNum * 2);
+}
+
+} // namespace
+
+TEST(Keyboard, SubscriberDispatchCost)
+{
+    Keycode saved[kDispatchKeyNum];
+    for (uint16_t id = 1; id <= kDispatchKeyNum; id++)
+    {
+        saved[id - 1] = g_keymap[0][id];
+        g_keymap[0][id] = static_cast<Keycode>(KEY_A + id);
+        layer_cache_update(id);
+    }
+    EventLoopQueueElm drained;
+    while (event_loop_queue_try_pop(&g_keyboard_event_buffer, &drained))
+    {
+    }
+    const uint32_t dropped = g_keyboard_event_buffer.dropped;
+    const int rounds = 2000;
+
+    const double baseline = measure_key_dispatch(rounds);
+
+    uint32_t key_mask[KEY_BITMAP_SIZE] = {0};
+    BIT_SET(key_mask[0], 0);
+    subscriber_calls = 0;
+    while (keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback, KEYBOARD_EVENT_MASK_CHANGED, 0, key_mask))
+    {
+    }
+    const double full_table = measure_key_dispatch(rounds);
+    keyboard_event_unsubscribe(KEYBOARD_EVENT_CHAIN_HANDLER, subscriber_callback);
+
+    RecordProperty("ns_per_event", std::to_string(baseline));
+    RecordProperty("ns_per_event_full_table", std::to_string(full_table));
+    EXPECT_EQ(0u, subscriber_calls);
+    EXPECT_EQ(dropped, g_keyboard_event_buffer.dropped);
+
+    for (uint16_t id = 1; id <= kDispatchKeyNum; id++)
+    {
+        g_keymap[0][id] = saved[id - 1];
+        layer_cache_update(id);
+    }
+    keyboard_clear_buffer();
+}
@@ -1,8 +1,11 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <array>
 #include <cstring>
+#include <vector>
 
+#include "layer.h"
 #include "packet.h"
 #include "script.h"
 #include "storage.h"
@@ -22,6 +25,68 @@ PacketLargeData *packet_from(LargePacketBuffer& buffer)
     return reinterpret_cast<PacketLargeData *>(buffer.data());
 }
 
+std::vector<uint8_t> download_keymap(uint16_t chunk)
+{
+    LargePacketBuffer buffer = {};
+    PacketLargeData *packet = packet_from(buffer);
+    packet->code = PACKET_CODE_LARGE_GET;
+    packet->type = PACKET_DATA_KEYMAP_SPARSE;
+    packet->sub_cmd = kLargeDataStart;
+    large_packet_process(packet);
+    const uint32_t total_size = packet->header.total_size;
+
+    std::vector<uint8_t> stream;
+    while (stream.size() < total_size) {
+        buffer.fill(0);
+        packet = packet_from(buffer);
+        packet->code = PACKET_CODE_LARGE_GET;
+        packet->type = PACKET_DATA_KEYMAP_SPARSE;
+        packet->sub_cmd = kLargeDataPayload;
+        packet->payload.offset = stream.size();
+        packet->payload.length = chunk;
+        large_packet_process(packet);
+        if (packet->payload.length == 0) {
+            break;
+        }
+        stream.insert(stream.end(), packet->payload.data, packet->payload.data + packet->payload.length);
+    }
+    return stream;
+}
+
+void upload_keymap(const std::vector<uint8_t>& stream, uint32_t total_size, size_t sent)
+{
+    LargePacketBuffer buffer = {};
+    PacketLargeData *packet = packet_from(buffer);
+    packet->code = PACKET_CODE_LARGE_SET;
+    packet->type = PACKET_DATA_KEYMAP_SPARSE;
+    packet->sub_cmd = kLargeDataStart;
+    packet->header.total_size = total_size;
+    large_packet_process(packet);
+
+    for (size_t offset = 0; offset < sent; offset += 32) {
+        const uint16_t length = static_cast<uint16_t>(std::min<size_t>(32, sent - offset));
+        buffer.fill(0);
+        packet = packet_from(buffer);
+        packet->code = PACKET_CODE_LARGE_SET;
+        packet->type = PACKET_DATA_KEYMAP_SPARSE;
+        packet->sub_cmd = kLargeDataPayload;
+        packet->payload.offset = offset;
+        packet->payload.length = length;
+        std::memcpy(packet->payload.data, stream.data() + offset, length);
+        large_packet_process(packet);
+    }
+}
+
+void fill_sparse_keymap()
+{
+    for (int layer = 0; layer < LAYER_NUM; layer++) {
+        for (int key = 0; key < TOTAL_KEY_NUM; key++) {
+            g_keymap[layer][key] = layer == 0 ? static_cast<Keycode>(KEY_A + (key % 26)) : KEY_TRANSPARENT;
+        }
+    }
+    g_keymap[3][5] = KEY_ESC;
+}
+
 } // namespace
 
 TEST(LargePacket, WritesScriptBytecodePayloadsToStorage)
@@ -136,3 +201,59 @@ TEST(LargePacket, GetsScriptBytecodePayloadsFromStorage)
     GTEST_SKIP() << "Large packet script test currently targets the default AOT bytecode path.";
 #endif
 }
+
+TEST(LargePacket, SparseKeymapRoundTrip)
+{
+    fill_sparse_keymap();
+    std::vector<Keycode> expected(&g_keymap[0][0], &g_keymap[0][0] + LAYER_NUM * TOTAL_KEY_NUM);
+    const uint32_t total_size = keymap_encode(nullptr, nullptr);
+    EXPECT_LT(total_size, sizeof(g_keymap));
+
+    std::vector<uint8_t> stream = download_keymap(32);
+    ASSERT_EQ(total_size, stream.size());
+    std::vector<uint8_t> reference;
+    keymap_encode([](void *context, const void *data, size_t size) -> size_t {
+        auto *out = static_cast<std::vector<uint8_t> *>(context);
+        out->insert(out->end(), static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+        return size;
+    }, &reference);
+    EXPECT_EQ(reference, stream);
+    EXPECT_EQ(reference, download_keymap(7));
+
+    std::memset(g_keymap, 0, sizeof(g_keymap));
+    upload_keymap(stream, total_size, stream.size());
+
+    EXPECT_EQ(0, std::memcmp(expected.data(), g_keymap, sizeof(g_keymap)));
+}
+
+TEST(LargePacket, TruncatedSparseKeymapKeepsCurrentKeymap)
+{
+    fill_sparse_keymap();
+    std::vector<uint8_t> stream = download_keymap(32);
+    ASSERT_GT(stream.size(), 4u);
+
+    for (int key = 0; key < TOTAL_KEY_NUM; key++) {
+        g_keymap[0][key] = KEY_B;
+    }
+    std::vector<Keycode> current(&g_keymap[0][0], &g_keymap[0][0] + LAYER_NUM * TOTAL_KEY_NUM);
+
+    // The host announces fewer bytes than the stream holds, so END arrives
+    // before the decoder has covered every layer.
+    upload_keymap(stream, stream.size() - 4, stream.size() - 4);
+    EXPECT_EQ(0, std::memcmp(current.data(), g_keymap, sizeof(g_keymap)));
+
+    upload_keymap(stream, stream.size(), stream.size() / 2);
+    LargePacketBuffer buffer = {};
+    PacketLargeData *packet = packet_from(buffer);
+    packet->code = PACKET_CODE_LARGE_SET;
+    packet->type = PACKET_DATA_KEYMAP_SPARSE;
+    packet->sub_cmd = kLargeDataAbort;
+    large_packet_process(packet);
+    EXPECT_EQ(0, std::memcmp(current.data(), g_keymap, sizeof(g_keymap)));
+
+    std::vector<uint8_t> corrupt = stream;
+    corrupt[0] = 0;
+    corrupt[1] = 0;
+    upload_keymap(corrupt, corrupt.size(), corrupt.size());
+    EXPECT_EQ(0, std::memcmp(current.data(), g_keymap, sizeof(g_keymap)));
+}
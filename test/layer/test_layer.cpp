@@ -1,12 +1,16 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 #include "layer.h"
 #include "keyboard.h"
 
 class LayerTest : public ::testing::Test {
 protected:
     void SetUp() override {
-        for (int i = 0; i < 16; i++) {
+        for (int i = 0; i < LAYER_NUM; i++) {
             layer_reset(i);
         }
         
@@ -38,6 +42,25 @@ TEST_F(LayerTest, StateManagement) {
     EXPECT_EQ(layer_get(), 0);
 }
 
+TEST_F(LayerTest, StateManagementUpperLayers) {
+    layer_set(17);
+    EXPECT_EQ(layer_get(), 17);
+
+    layer_set(LAYER_NUM - 1);
+    EXPECT_EQ(layer_get(), LAYER_NUM - 1);
+    EXPECT_EQ(layer_get_state(), (LayerState)((1UL << 17) | (1UL << (LAYER_NUM - 1))));
+
+    layer_set(LAYER_NUM);
+    EXPECT_EQ(layer_get(), LAYER_NUM - 1);
+
+    layer_toggle(LAYER_NUM - 1);
+    EXPECT_EQ(layer_get(), 17);
+
+    layer_reset(17);
+    EXPECT_EQ(layer_get(), 0);
+    EXPECT_EQ(layer_get_state(), 0U);
+}
+
 TEST_F(LayerTest, TransparentKeycodeResolution) {
     const uint16_t test_key_id = 5;
     
@@ -50,6 +73,62 @@ TEST_F(LayerTest, TransparentKeycodeResolution) {
     EXPECT_EQ(layer_get_keycode(test_key_id, 2), 0x0005);
 }
 
+TEST_F(LayerTest, TransparentKeycodeResolutionAcrossAllLayers) {
+    const uint16_t test_key_id = 7;
+
+    for (int layer = 0; layer < LAYER_NUM; layer++) {
+        g_keymap[layer][test_key_id] = KEY_TRANSPARENT;
+    }
+    g_keymap[0][test_key_id] = 0x0004;
+    g_keymap[16][test_key_id] = 0x0005;
+    g_keymap[LAYER_NUM - 1][test_key_id] = 0x0006;
+
+    EXPECT_EQ(layer_get_keycode(test_key_id, 15), 0x0004);
+    EXPECT_EQ(layer_get_keycode(test_key_id, 16), 0x0005);
+    EXPECT_EQ(layer_get_keycode(test_key_id, LAYER_NUM - 2), 0x0005);
+    EXPECT_EQ(layer_get_keycode(test_key_id, LAYER_NUM - 1), 0x0006);
+
+    layer_set(LAYER_NUM - 2);
+    layer_cache_refresh();
+    EXPECT_EQ(layer_cache_get_keycode(test_key_id), 0x0005);
+
+    for (int layer = 0; layer < LAYER_NUM; layer++) {
+        g_keymap[layer][test_key_id] = KEY_TRANSPARENT;
+    }
+    EXPECT_EQ(layer_get_keycode(test_key_id, LAYER_NUM - 1), KEY_NO_EVENT);
+}
+
+TEST_F(LayerTest, LayerKeycodeEncoding) {
+    for (int layer = 0; layer < 32; layer++) {
+        Keycode keycode = LAYER(LAYER_TOGGLE, layer);
+        EXPECT_EQ(KEYCODE_GET_MAIN(keycode), LAYER_CONTROL);
+        EXPECT_EQ(LAYER_KEYCODE_GET_LAYER(keycode), layer);
+        EXPECT_EQ(LAYER_KEYCODE_GET_CONTROL(keycode), LAYER_TOGGLE);
+    }
+    EXPECT_EQ(LAYER(LAYER_TURN_ON, 3), (LAYER_TURN_ON << 12) | (3 << 8) | LAYER_CONTROL);
+}
+
+TEST_F(LayerTest, EventHandlerUpperLayer) {
+    KeyboardEvent event;
+    event.is_virtual = true;
+    event.keycode = LAYER(LAYER_MOMENTARY, 20);
+
+    event.event = KEYBOARD_EVENT_KEY_DOWN;
+    layer_event_handler(event);
+    EXPECT_EQ(layer_get(), 20);
+
+    event.event = KEYBOARD_EVENT_KEY_UP;
+    layer_event_handler(event);
+    EXPECT_EQ(layer_get(), 0);
+
+    event.keycode = LAYER(LAYER_TOGGLE, LAYER_NUM - 1);
+    event.event = KEYBOARD_EVENT_KEY_DOWN;
+    layer_event_handler(event);
+    event.event = KEYBOARD_EVENT_KEY_UP;
+    layer_event_handler(event);
+    EXPECT_EQ(layer_get(), LAYER_NUM - 1);
+}
+
 TEST_F(LayerTest, EventHandlerMomentary) {
     KeyboardEvent event;
     event.is_virtual = true;
@@ -95,4 +174,83 @@ TEST_F(LayerTest, CacheAndLock) {
     EXPECT_FALSE(g_keymap_lock[test_key_id]);
 
     EXPECT_EQ(layer_cache_get_keycode(test_key_id), 0x0005);
-}
\ No newline at end of file
+}
+namespace {
+
+size_t append_to_vector(void *context, const void *data, size_t size)
+{
+    auto *stream = static_cast<std::vector<uint8_t> *>(context);
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    stream->insert(stream->end(), bytes, bytes + size);
+    return size;
+}
+
+void fill_sparse_keymap()
+{
+    for (int layer = 0; layer < LAYER_NUM; layer++) {
+        for (int key = 0; key < TOTAL_KEY_NUM; key++) {
+            g_keymap[layer][key] = layer == 0 ? static_cast<Keycode>(KEY_A + (key % 26)) : KEY_TRANSPARENT;
+        }
+    }
+    g_keymap[1][3] = KEY_B;
+    g_keymap[1][4] = KEY_C;
+    g_keymap[2][TOTAL_KEY_NUM - 1] = LAYER(LAYER_MOMENTARY, 17);
+    for (int key = 10; key < 20; key++) {
+        g_keymap[LAYER_NUM - 1][key] = KEY_NO_EVENT;
+    }
+}
+
+} // namespace
+
+TEST_F(LayerTest, SparseKeymapRoundTripMatchesDense) {
+    fill_sparse_keymap();
+    std::vector<Keycode> dense(&g_keymap[0][0], &g_keymap[0][0] + KEYMAP_ENTRY_NUM);
+
+    std::vector<uint8_t> stream;
+    size_t size = keymap_encode(append_to_vector, &stream);
+    EXPECT_EQ(size, stream.size());
+    EXPECT_EQ(size, keymap_encode(nullptr, nullptr));
+    EXPECT_LT(size, sizeof(g_keymap) / 4);
+
+    std::memset(g_keymap, 0x5A, sizeof(g_keymap));
+    KeymapDecoder decoder;
+    keymap_decoder_init(&decoder, &g_keymap[0][0]);
+    for (size_t i = 0; i < stream.size(); i += 7) {
+        size_t length = std::min<size_t>(7, stream.size() - i);
+        ASSERT_TRUE(keymap_decoder_feed(&decoder, stream.data() + i, length));
+    }
+    EXPECT_TRUE(keymap_decoder_finish(&decoder));
+    EXPECT_EQ(0, std::memcmp(dense.data(), g_keymap, sizeof(g_keymap)));
+}
+
+TEST_F(LayerTest, SparseKeymapRejectsOverlongRun) {
+    uint16_t stream[] = {KEYMAP_RUN_FILL | KEYMAP_RUN_LENGTH_MASK, KEY_A};
+    KeymapDecoder decoder;
+    keymap_decoder_init(&decoder, &g_keymap[0][0]);
+    EXPECT_FALSE(keymap_decoder_feed(&decoder, reinterpret_cast<uint8_t *>(stream), sizeof(stream)));
+    EXPECT_FALSE(keymap_decoder_finish(&decoder));
+}
+
+TEST_F(LayerTest, SparseKeymapValidationLeavesKeymapUntouched) {
+    fill_sparse_keymap();
+    std::vector<uint8_t> stream;
+    keymap_encode(append_to_vector, &stream);
+
+    std::memset(g_keymap, 0x5A, sizeof(g_keymap));
+    std::vector<Keycode> current(&g_keymap[0][0], &g_keymap[0][0] + KEYMAP_ENTRY_NUM);
+    KeymapDecoder decoder;
+    keymap_decoder_init(&decoder, nullptr);
+    ASSERT_TRUE(keymap_decoder_feed(&decoder, stream.data(), stream.size() - 2));
+    EXPECT_FALSE(keymap_decoder_finish(&decoder));
+    ASSERT_TRUE(keymap_decoder_feed(&decoder, stream.data() + stream.size() - 2, 2));
+    EXPECT_TRUE(keymap_decoder_finish(&decoder));
+    EXPECT_EQ(0, std::memcmp(current.data(), g_keymap, sizeof(g_keymap)));
+}
+
+TEST_F(LayerTest, KeycodeClassFollowsMainByte) {
+    EXPECT_EQ(KEYCODE_CLASS_KEYBOARD, keyboard_get_keycode_class(KEY_A));
+    EXPECT_EQ(KEYCODE_CLASS_LAYER, keyboard_get_keycode_class(LAYER(LAYER_MOMENTARY, 2)));
+    EXPECT_EQ(KEYCODE_CLASS_OPERATION, keyboard_get_keycode_class(KEYBOARD_OPERATION));
+    EXPECT_EQ(KEYCODE_CLASS_OTHER, keyboard_get_keycode_class(KEY_TRANSPARENT));
+    EXPECT_EQ(KEYCODE_CLASS_DYNAMIC_KEY, keyboard_get_keycode_class(DYNAMIC_KEY | (3 << 8)));
+}
@@ -1,35 +1,150 @@
 #include <gtest/gtest.h>
 
+#include <vector>
+
+#include "file_system.h"
 #include "macro.h"
+#include "storage.h"
+#include "test_fixture.h"
+
+namespace {
+
+struct EmittedEvent
+{
+    uint32_t tick;
+    Keycode keycode;
+    uint8_t event;
+};
+
+std::vector<EmittedEvent> emitted;
+
+void record_emitted(KeyboardEvent event, uint32_t tick)
+{
+    emitted.push_back({tick, event.keycode, event.event});
+}
+
+MacroAction make_action(uint32_t delay, Keycode keycode, uint8_t event, uint16_t key_id)
+{
+    MacroAction action;
+    action.delay = delay;
+    action.event = MK_EVENT(keycode, event, keyboard_get_key(key_id));
+    return action;
+}
+
+void write_macro(Macro *macro, const std::vector<MacroAction> &actions)
+{
+    macro_begin_write(macro);
+    for (const MacroAction &action : actions)
+    {
+        ASSERT_TRUE(macro_append(macro, &action));
+    }
+    macro_flush(macro);
+}
+
+// The fixed-array engine this replaces: absolute delays, zero keycode terminates.
+std::vector<EmittedEvent> reference_playback(const std::vector<MacroAction> &actions, uint32_t begin, uint32_t end)
+{
+    std::vector<EmittedEvent> events;
+    size_t index = 0;
+    for (uint32_t tick = begin; tick <= end; tick++)
+    {
+        while (actions[index].delay + begin <= tick)
+        {
+            if (!actions[index].event.keycode)
+            {
+                return events;
+            }
+            events.push_back({tick, actions[index].event.keycode, actions[index].event.event});
+            index++;
+        }
+    }
+    return events;
+}
+
+} // namespace
 
-TEST(Macro, InitClearsRuntimeStateAndKeepsActionStorage)
+TEST(Macro, InitClearsRuntimeState)
 {
     g_macros[0].state = MACRO_STATE_PLAYING_ONCE;
     g_macros[0].index = 7;
     g_macros[0].length = 3;
+    g_macros[0].stream.position = 9;
 
     macro_init();
 
     EXPECT_EQ(MACRO_STATE_IDLE, g_macros[0].state);
     EXPECT_EQ(0, g_macros[0].index);
     EXPECT_EQ(0, g_macros[0].length);
-    ASSERT_NE(nullptr, g_macros[0].actions);
+    EXPECT_EQ(0u, g_macros[0].stream.position);
+}
+
+TEST(Macro, ActionEncodingRoundTrips)
+{
+    const MacroAction actions[] = {
+        make_action(0, KEY_A, KEYBOARD_EVENT_KEY_DOWN, 0),
+        make_action(127, KEY_B, KEYBOARD_EVENT_KEY_UP, 63),
+        make_action(128, 0xFFFF, KEYBOARD_EVENT_KEY_DOWN, TOTAL_KEY_NUM - 1),
+        make_action(0xFFFFFFFF, KEY_C, KEYBOARD_EVENT_KEY_UP, 1),
+    };
+    uint32_t base = 0;
+    for (MacroAction action : actions)
+    {
+        uint8_t buffer[MACRO_ACTION_MAX_ENCODED_SIZE];
+        const size_t length = macro_action_encode(buffer, &action, base);
+        ASSERT_LE(length, sizeof(buffer));
+
+        MacroAction decoded = {};
+        EXPECT_EQ(length, macro_action_decode(buffer, length, &decoded, base));
+        EXPECT_EQ(action.delay, decoded.delay);
+        EXPECT_EQ(action.event.keycode, decoded.event.keycode);
+        EXPECT_EQ(action.event.event, decoded.event.event);
+        EXPECT_EQ(action.event.key, decoded.event.key);
+        EXPECT_FALSE(decoded.event.is_virtual);
+        base = action.delay;
+    }
+
+    MacroAction action = make_action(5, KEY_D, KEYBOARD_EVENT_KEY_DOWN, 0);
+    action.event = MK_VIRTUAL_EVENT(KEY_D, KEYBOARD_EVENT_KEY_DOWN, NULL);
+    uint8_t buffer[MACRO_ACTION_MAX_ENCODED_SIZE];
+    const size_t length = macro_action_encode(buffer, &action, 0);
+    MacroAction decoded = {};
+    EXPECT_EQ(length, macro_action_decode(buffer, length, &decoded, 0));
+    EXPECT_TRUE(decoded.event.is_virtual);
+    EXPECT_EQ(nullptr, decoded.event.key);
+}
+
+TEST(Macro, TruncatedActionIsNotDecoded)
+{
+    MacroAction action = make_action(300, 0x1234, KEYBOARD_EVENT_KEY_DOWN, 200);
+    uint8_t buffer[MACRO_ACTION_MAX_ENCODED_SIZE];
+    const size_t length = macro_action_encode(buffer, &action, 0);
+    for (size_t size = 0; size < length; size++)
+    {
+        MacroAction decoded;
+        EXPECT_EQ(0u, macro_action_decode(buffer, size, &decoded, 0));
+    }
+}
+
+TEST(Macro, TypicalActionEncodesInFewBytes)
+{
+    MacroAction action = make_action(1040, KEY_A, KEYBOARD_EVENT_KEY_DOWN, 10);
+    uint8_t buffer[MACRO_ACTION_MAX_ENCODED_SIZE];
+    EXPECT_EQ(4u, macro_action_encode(buffer, &action, 1000));
+    EXPECT_LT(macro_action_encode(buffer, &action, 1000), sizeof(MacroAction));
 }
 
 TEST(Macro, RecordWritesTimedActionsAndTerminator)
 {
     Macro *macro = &g_macros[0];
-    Key key = {};
-    key.id = 0;
 
     g_keyboard_tick = 100;
     macro_start_record(macro);
 
-    KeyboardEvent down = MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, &key);
+    KeyboardEvent down = MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(0));
     g_keyboard_tick = 125;
     macro_record(macro, down);
 
-    KeyboardEvent up = MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_UP, &key);
+    KeyboardEvent up = MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_UP, keyboard_get_key(0));
     g_keyboard_tick = 140;
     macro_record(macro, up);
 
@@ -38,33 +153,269 @@ TEST(Macro, RecordWritesTimedActionsAndTerminator)
 
     EXPECT_EQ(MACRO_STATE_IDLE, macro->state);
     EXPECT_EQ(0, macro->index);
-    EXPECT_EQ(25U, macro->actions[0].delay);
-    EXPECT_EQ(KEY_A, macro->actions[0].event.keycode);
-    EXPECT_EQ(KEYBOARD_EVENT_KEY_DOWN, macro->actions[0].event.event);
-    EXPECT_EQ(40U, macro->actions[1].delay);
-    EXPECT_EQ(KEYBOARD_EVENT_KEY_UP, macro->actions[1].event.event);
-    EXPECT_EQ(50U, macro->actions[2].delay);
-    EXPECT_EQ(KEY_NO_EVENT, macro->actions[2].event.keycode);
+    MacroAction action;
+    ASSERT_TRUE(macro_read_action(0, 0, &action));
+    EXPECT_EQ(25U, action.delay);
+    EXPECT_EQ(KEY_A, action.event.keycode);
+    EXPECT_EQ(KEYBOARD_EVENT_KEY_DOWN, action.event.event);
+    ASSERT_TRUE(macro_read_action(0, 1, &action));
+    EXPECT_EQ(40U, action.delay);
+    EXPECT_EQ(KEYBOARD_EVENT_KEY_UP, action.event.event);
+    ASSERT_TRUE(macro_read_action(0, 2, &action));
+    EXPECT_EQ(50U, action.delay);
+    EXPECT_EQ(KEY_NO_EVENT, action.event.keycode);
+    EXPECT_FALSE(macro_read_action(0, 3, &action));
 }
 
 TEST(Macro, PlayOnceReturnsToIdleAtTerminator)
 {
     Macro *macro = &g_macros[0];
-    Key key = {};
-    key.id = 0;
-    macro->actions[0].delay = 5;
-    macro->actions[0].event = MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, &key);
-    macro->actions[1].delay = 10;
-    macro->actions[1].event = MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_UP, &key);
-    macro->actions[2].delay = 15;
-    macro->actions[2].event = MK_EVENT(KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, &key);
+    write_macro(macro, {
+        make_action(5, KEY_A, KEYBOARD_EVENT_KEY_DOWN, 0),
+        make_action(10, KEY_A, KEYBOARD_EVENT_KEY_UP, 0),
+        make_action(15, KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, 0),
+    });
 
     g_keyboard_tick = 100;
     macro_start_play_once(macro);
     g_keyboard_tick = 115;
 
-    macro_process();
+    timer_wheel_process();
 
     EXPECT_EQ(MACRO_STATE_IDLE, macro->state);
     EXPECT_EQ(0, macro->index);
 }
+
+TEST(Macro, LongMacroStreamsThroughSmallBuffer)
+{
+    Macro *macro = &g_macros[1];
+    std::vector<MacroAction> actions;
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+        actions.push_back(make_action(i * 3, KEY_A + (i % 20), (i & 1) ? KEYBOARD_EVENT_KEY_UP : KEYBOARD_EVENT_KEY_DOWN, i % TOTAL_KEY_NUM));
+    }
+    actions.push_back(make_action(3000, KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, 0));
+    write_macro(macro, actions);
+    EXPECT_GT(macro->stream.position, (uint32_t)MACRO_BUFFER_SIZE);
+
+    MacroStream stream;
+    macro_stream_rewind(&stream);
+    for (const MacroAction &expected : actions)
+    {
+        MacroAction action;
+        ASSERT_TRUE(macro_stream_read(1, &stream, &action));
+        EXPECT_EQ(expected.delay, action.delay);
+        EXPECT_EQ(expected.event.keycode, action.event.keycode);
+        EXPECT_EQ(expected.event.key, action.event.key);
+    }
+}
+
+TEST(Macro, PlaybackTimingMatchesReferenceEngine)
+{
+    Macro *macro = &g_macros[2];
+    std::vector<MacroAction> actions;
+    uint32_t delay = 0;
+    for (uint32_t i = 0; i < 200; i++)
+    {
+        delay += (i * 7) % 5;
+        actions.push_back(make_action(delay, KEY_A + (i / 2 % 4), (i & 1) ? KEYBOARD_EVENT_KEY_UP : KEYBOARD_EVENT_KEY_DOWN, i / 2 % 4));
+    }
+    actions.push_back(make_action(delay + 10, KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, 0));
+    write_macro(macro, actions);
+
+    emitted.clear();
+    ASSERT_TRUE(keyboard_event_subscribe(KEYBOARD_EVENT_CHAIN_HANDLER, record_emitted, KEYBOARD_EVENT_MASK_ALL,
+                                         BIT(KEYCODE_CLASS_KEYBOARD), NULL));
+    const uint32_t begin = 1000;
+    const uint32_t end = begin + delay + 20;
+    g_keyboard_tick = begin;
+    macro_start_play_once(macro);
+    for (; g_keyboard_tick <= end; g_keyboard_tick++)
+    {
+        timer_wheel_process();
+    }
+    keyboard_event_unsubscribe(KEYBOARD_EVENT_CHAIN_HANDLER, record_emitted);
+
+    const std::vector<EmittedEvent> expected = reference_playback(actions, begin, end);
+    ASSERT_EQ(expected.size(), emitted.size());
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        EXPECT_EQ(expected[i].tick, emitted[i].tick) << i;
+        EXPECT_EQ(expected[i].keycode, emitted[i].keycode) << i;
+        EXPECT_EQ(expected[i].event, emitted[i].event) << i;
+    }
+    EXPECT_EQ(MACRO_STATE_IDLE, macro->state);
+}
+
+TEST(Macro, PowerLossDuringRecordingKeepsCommittedMacro)
+{
+    Macro *macro = &g_macros[0];
+    g_current_profile_index = 0;
+    write_macro(macro, {
+        make_action(5, KEY_A, KEYBOARD_EVENT_KEY_DOWN, 0),
+        make_action(10, KEY_A, KEYBOARD_EVENT_KEY_UP, 0),
+        make_action(15, KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, 0),
+    });
+
+    // re-record past the write-behind buffer so part of it reaches flash, then lose power
+    g_keyboard_tick = 0;
+    macro_start_record(macro);
+    for (uint32_t i = 0; i < 4 * MACRO_BUFFER_SIZE; i++)
+    {
+        g_keyboard_tick++;
+        macro_record(macro, MK_EVENT(KEY_B, (i & 1) ? KEYBOARD_EVENT_KEY_UP : KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(1)));
+    }
+    macro_init();
+    storage_mount();
+
+    MacroAction action;
+    ASSERT_TRUE(macro_read_action(0, 0, &action));
+    EXPECT_EQ(5u, action.delay);
+    EXPECT_EQ(KEY_A, action.event.keycode);
+    ASSERT_TRUE(macro_read_action(0, 2, &action));
+    EXPECT_EQ(KEY_NO_EVENT, action.event.keycode);
+    EXPECT_FALSE(macro_read_action(0, 3, &action));
+
+    // a finished recording replaces it and survives the next reboot
+    g_keyboard_tick = 0;
+    macro_start_record(macro);
+    g_keyboard_tick = 7;
+    macro_record(macro, MK_EVENT(KEY_C, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(2)));
+    g_keyboard_tick = 9;
+    macro_stop_record(macro);
+    macro_init();
+    storage_mount();
+
+    ASSERT_TRUE(macro_read_action(0, 0, &action));
+    EXPECT_EQ(7u, action.delay);
+    EXPECT_EQ(KEY_C, action.event.keycode);
+}
+
+TEST(Macro, FlashFaultDuringCommitKeepsOneCompleteMacro)
+{
+    Macro *macro = &g_macros[0];
+    g_current_profile_index = 0;
+    const uint32_t recorded = MACRO_BUFFER_SIZE;
+
+    // replay the same record/commit with power cut partway through each program/erase in turn
+    uint32_t operations = 0;
+    bool kept_old = false;
+    bool committed = false;
+    for (int32_t cut = 0; cut <= (int32_t)operations; cut++)
+    {
+        memset(flash_buffer, 0xFF, sizeof(flash_buffer));
+        flash_fault_countdown = -1;
+        macro_init();
+        storage_mount();
+        write_macro(macro, {
+            make_action(5, KEY_A, KEYBOARD_EVENT_KEY_DOWN, 0),
+            make_action(10, KEY_A, KEYBOARD_EVENT_KEY_UP, 0),
+            make_action(15, KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, 0),
+        });
+
+        flash_operation_count = 0;
+        flash_fault_countdown = cut ? cut : -1;
+        g_keyboard_tick = 0;
+        macro_start_record(macro);
+        for (uint32_t i = 0; i < recorded; i++)
+        {
+            g_keyboard_tick++;
+            macro_record(macro, MK_EVENT(KEY_B, (i & 1) ? KEYBOARD_EVENT_KEY_UP : KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(1)));
+        }
+        g_keyboard_tick++;
+        macro_stop_record(macro);
+        if (!cut)
+        {
+            operations = flash_operation_count;
+            ASSERT_GT(operations, 0u);
+        }
+
+        flash_fault_countdown = -1;
+        macro_init();
+        storage_mount();
+
+        MacroAction action;
+        ASSERT_TRUE(macro_read_action(0, 0, &action)) << cut;
+        if (action.event.keycode == KEY_A)
+        {
+            kept_old = true;
+            EXPECT_EQ(5u, action.delay) << cut;
+            ASSERT_TRUE(macro_read_action(0, 2, &action)) << cut;
+            EXPECT_EQ(KEY_NO_EVENT, action.event.keycode) << cut;
+            EXPECT_FALSE(macro_read_action(0, 3, &action)) << cut;
+        }
+        else
+        {
+            committed = true;
+            EXPECT_EQ(KEY_B, action.event.keycode) << cut;
+            EXPECT_EQ(1u, action.delay) << cut;
+            ASSERT_TRUE(macro_read_action(0, recorded, &action)) << cut;
+            EXPECT_EQ(KEY_NO_EVENT, action.event.keycode) << cut;
+            EXPECT_EQ(recorded + 1, action.delay) << cut;
+            EXPECT_FALSE(macro_read_action(0, recorded + 1, &action)) << cut;
+        }
+    }
+    EXPECT_TRUE(kept_old);
+    EXPECT_TRUE(committed);
+}
+
+TEST(Macro, MacrosAreStoredPerProfile)
+{
+    Macro *macro = &g_macros[3];
+    g_current_profile_index = 1;
+    write_macro(macro, {
+        make_action(20, KEY_D, KEYBOARD_EVENT_KEY_DOWN, 0),
+        make_action(30, KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, 0),
+    });
+
+    MacroAction action;
+    g_current_profile_index = 0;
+    EXPECT_FALSE(macro_read_action(3, 0, &action));
+
+    g_keyboard_tick = 100;
+    macro_start_play_once(macro);
+    g_keyboard_tick = 100;
+    timer_wheel_process();
+    EXPECT_EQ(MACRO_STATE_IDLE, macro->state);
+
+    g_current_profile_index = 1;
+    ASSERT_TRUE(macro_read_action(3, 0, &action));
+    EXPECT_EQ(KEY_D, action.event.keycode);
+    g_current_profile_index = 0;
+}
+
+TEST(Macro, FactoryResetRemovesStoredMacros)
+{
+    g_current_profile_index = 2;
+    write_macro(&g_macros[1], {
+        make_action(20, KEY_D, KEYBOARD_EVENT_KEY_DOWN, 0),
+        make_action(30, KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, 0),
+    });
+    g_current_profile_index = 0;
+    write_macro(&g_macros[0], {
+        make_action(5, KEY_A, KEYBOARD_EVENT_KEY_DOWN, 0),
+        make_action(15, KEY_NO_EVENT, KEYBOARD_EVENT_NO_EVENT, 0),
+    });
+
+    // leave an unfinished recording behind as well
+    g_keyboard_tick = 0;
+    macro_start_record(&g_macros[0]);
+    for (uint32_t i = 0; i < 4 * MACRO_BUFFER_SIZE; i++)
+    {
+        g_keyboard_tick++;
+        macro_record(&g_macros[0], MK_EVENT(KEY_B, (i & 1) ? KEYBOARD_EVENT_KEY_UP : KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(1)));
+    }
+
+    keyboard_factory_reset();
+    EXPECT_EQ(MACRO_STATE_IDLE, g_macros[0].state);
+
+    MacroAction action;
+    EXPECT_FALSE(macro_read_action(0, 0, &action));
+    g_current_profile_index = 2;
+    EXPECT_FALSE(macro_read_action(1, 0, &action));
+    g_current_profile_index = 0;
+#ifdef LFS_ENABLE
+    File file;
+    EXPECT_LT(fs_open(&file, "macros/profile0_macro0.tmp", FS_O_RDONLY), 0);
+#endif
+}
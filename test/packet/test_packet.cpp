@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <cstring>
 
+#include "event_buffer.h"
 #include "macro.h"
 #include "packet.h"
 #include "packet_buffer.h"
@@ -311,8 +312,8 @@ TEST(Packet, DynamicKeyUsesExplicitPayloadSize)
 
     packet_process(buffer.data(), dynamic_key_packet_size());
 
-    EXPECT_EQ(DYNAMIC_KEY_STROKE, g_dynamic_keys[1].type);
-    EXPECT_EQ(dynamic_key.dks.press_fully_distance, g_dynamic_keys[1].dks.press_fully_distance);
+    EXPECT_EQ(DYNAMIC_KEY_STROKE, dynamic_key_get(1)->type);
+    EXPECT_EQ(dynamic_key.dks.press_fully_distance, dynamic_key_get(1)->dks.press_fully_distance);
 
     buffer.fill(0);
     packet = packet_as<PacketDynamicKey>(buffer);
@@ -370,6 +371,34 @@ TEST(Packet, SetAndGetKeyboardConfigBits)
     EXPECT_EQ(1, packet->data[1].value);
 }
 
+TEST(Packet, EventQueueStatsAndPolicy)
+{
+    for (uint32_t i = 0; i < EVENT_BUFFER_LENGTH + 3; i++)
+    {
+        event_loop_queue_push(&g_keyboard_event_buffer, {{}, i});
+    }
+
+    PacketBuffer buffer = {};
+    PacketEventQueue *packet = packet_as<PacketEventQueue>(buffer);
+    packet->code = PACKET_CODE_GET;
+    packet->type = PACKET_DATA_EVENT_QUEUE;
+    packet_process(buffer.data(), sizeof(PacketEventQueue));
+
+    EXPECT_EQ(EVENT_LOOP_QUEUE_DROP_NEWEST, packet->policy);
+    EXPECT_EQ(EVENT_BUFFER_LENGTH, packet->capacity);
+    EXPECT_EQ(EVENT_BUFFER_LENGTH, packet->high_water);
+    EXPECT_EQ(3u, packet->dropped);
+
+    packet->code = PACKET_CODE_SET;
+    packet->policy = EVENT_LOOP_QUEUE_DROP_OLDEST;
+    packet_process(buffer.data(), sizeof(PacketEventQueue));
+
+    EXPECT_EQ(EVENT_LOOP_QUEUE_DROP_OLDEST, g_keyboard_event_buffer.policy);
+    EXPECT_EQ(0u, event_loop_queue_dropped(&g_keyboard_event_buffer));
+    EXPECT_EQ(0u, packet->dropped);
+    EXPECT_EQ(0, packet->high_water);
+}
+
 TEST(Packet, EventPhysicalPreservesReportState)
 {
     Key* key = keyboard_get_key(2);
@@ -418,7 +447,7 @@ TEST(Packet, SetAndGetMacroActions)
     packet->code = PACKET_CODE_SET;
     packet->type = PACKET_DATA_MACRO;
     packet->macro_index = 0;
-    packet->length = 2;
+    packet->length = 3;
     packet->data[0].index = 0;
     packet->data[0].delay = 10;
     packet->data[0].key_id = 3;
@@ -431,14 +460,21 @@ TEST(Packet, SetAndGetMacroActions)
     packet->data[1].is_virtual = true;
     packet->data[1].event = KEYBOARD_EVENT_KEY_UP;
     packet->data[1].keycode = KEY_B;
+    // the terminator commits the macro
+    packet->data[2].index = 2;
+    packet->data[2].delay = 30;
+    packet->data[2].keycode = KEY_NO_EVENT;
 
     packet_process(buffer.data(), macro_packet_size(packet->length));
 
-    EXPECT_EQ(10u, g_macros[0].actions[0].delay);
-    EXPECT_EQ(KEY_A, g_macros[0].actions[0].event.keycode);
-    EXPECT_EQ(keyboard_get_key(3), g_macros[0].actions[0].event.key);
-    EXPECT_FALSE(g_macros[0].actions[0].event.is_virtual);
-    EXPECT_TRUE(g_macros[0].actions[1].event.is_virtual);
+    MacroAction action;
+    ASSERT_TRUE(macro_read_action(0, 0, &action));
+    EXPECT_EQ(10u, action.delay);
+    EXPECT_EQ(KEY_A, action.event.keycode);
+    EXPECT_EQ(keyboard_get_key(3), action.event.key);
+    EXPECT_FALSE(action.event.is_virtual);
+    ASSERT_TRUE(macro_read_action(0, 1, &action));
+    EXPECT_TRUE(action.event.is_virtual);
 
     buffer.fill(0);
     packet = packet_as<PacketMacro>(buffer);
@@ -0,0 +1,476 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "file_system.h"
+#include "keyboard.h"
+#include "rgb.h"
+#include "script.h"
+#include "storage.h"
+#include "timer_wheel.h"
+
+#if defined(SCRIPT_ENABLE) && defined(SCRIPT_XIP_ENABLE)
+extern "C" {
+#include "mquickjs.h"
+extern const JSSTDLibraryDef js_stdlib;
+}
+#endif
+
+namespace {
+
+#ifdef SCRIPT_ENABLE
+void load_script(const char *source)
+{
+    script_reset_runtime();
+    script_update_source(source, std::strlen(source));
+    g_keyboard_enable_script = true;
+}
+
+void store_source(const char *source)
+{
+    File file;
+    ASSERT_GE(fs_open(&file, "scripts/main.js", FS_O_WRONLY | FS_O_CREAT | FS_O_TRUNC), 0);
+    fs_write(&file, (void *)source, std::strlen(source));
+    fs_close(&file);
+}
+
+void send_script_keycode(uint8_t command)
+{
+    const Keycode keycode = KEYCODE(SCRIPT_COLLECTION, command);
+    script_event_handler(MK_EVENT(keycode, KEYBOARD_EVENT_KEY_DOWN, NULL));
+}
+
+// average cost of one script_process() pass running loop()
+double measure_loop(int rounds)
+{
+    const auto begin = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        g_keyboard_tick++;
+        script_process();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - begin;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / rounds;
+}
+
+// output of one loop() pass, after any pending reload has been applied
+std::string run_loop(void)
+{
+    g_keyboard_tick++;
+    script_process();
+    testing::internal::CaptureStdout();
+    g_keyboard_tick++;
+    script_process();
+    return testing::internal::GetCapturedStdout();
+}
+
+#ifdef SCRIPT_XIP_ENABLE
+// what `mqjs --base SCRIPT_XIP_HOST_ADDRESS -o SCRIPT_XIP_HOST_FILE` writes
+void write_xip_image(const char *source)
+{
+    static uint8_t memory[256 * 1024];
+    JSContext *ctx = JS_NewContext2(memory, sizeof(memory), &js_stdlib, 1);
+    JSValue func = JS_Parse(ctx, source, std::strlen(source), "<xip>", 0);
+    ASSERT_FALSE(JS_IsException(func));
+    JSBytecodeHeader header;
+    const uint8_t *data;
+    uint32_t data_len;
+    JS_PrepareBytecode(ctx, &header, &data, &data_len, func);
+    JS_RelocateBytecode2(ctx, &header, (uint8_t *)data, data_len,
+                         SCRIPT_XIP_HOST_ADDRESS + sizeof(JSBytecodeHeader), 0);
+    // a fresh file, the previous image may still be mapped
+    std::remove(SCRIPT_XIP_HOST_FILE);
+    FILE *file = std::fopen(SCRIPT_XIP_HOST_FILE, "wb");
+    ASSERT_NE(nullptr, file);
+    std::fwrite(&header, 1, sizeof(header), file);
+    std::fwrite(data, 1, data_len, file);
+    std::fclose(file);
+    JS_FreeContext(ctx);
+}
+#endif
+#endif
+
+} // namespace
+
+TEST(Script, RunawayHookIsSuspendedAfterRepeatedOverruns)
+{
+#ifdef SCRIPT_ENABLE
+    load_script("var calls = 0;\n"
+                "function loop() { calls++; for (;;) {} }\n");
+
+    for (int i = 0; i < SCRIPT_HOOK_MAX_OVERRUNS - 1; i++) {
+        g_keyboard_tick++;
+        script_process();
+        EXPECT_TRUE(g_keyboard_enable_script) << i;
+    }
+    g_keyboard_tick++;
+    script_process();
+    EXPECT_FALSE(g_keyboard_enable_script);
+
+    // each call was interrupted and returned, and a suspended script is no longer polled
+    testing::internal::CaptureStdout();
+    script_eval("print(calls);", 13, "<test>");
+    EXPECT_EQ(std::to_string(SCRIPT_HOOK_MAX_OVERRUNS) + "\n", testing::internal::GetCapturedStdout());
+    g_keyboard_tick++;
+    script_process();
+    testing::internal::CaptureStdout();
+    script_eval("print(calls);", 13, "<test>");
+    EXPECT_EQ(std::to_string(SCRIPT_HOOK_MAX_OVERRUNS) + "\n", testing::internal::GetCapturedStdout());
+    script_reset_runtime();
+#else
+    GTEST_SKIP() << "Script budget requires SCRIPT_ENABLE.";
+#endif
+}
+
+TEST(Script, ReloadKeepsRunningScriptWhenNewSourceFails)
+{
+#if defined(SCRIPT_ENABLE) && SCRIPT_RUNTIME_STRATEGY == SCRIPT_JIT
+    store_source("var name = 'old';\n"
+                 "function loop() { print(name); }\n");
+    g_keyboard_enable_script = false;
+    send_script_keycode(SCRIPT_START);
+    EXPECT_EQ("old\n", run_loop());
+
+    // a syntax error is caught before anything is torn down
+    store_source("function loop() { print('broken');\n");
+    script_reload();
+    EXPECT_EQ("old\n", run_loop());
+
+    // a top-level error rolls the hooks and globals back
+    store_source("var name = 'new';\n"
+                 "function loop() { print('new'); }\n"
+                 "missing();\n");
+    script_reload();
+    EXPECT_EQ("old\n", run_loop());
+
+    // a good reload replaces the hooks and drops the old globals
+    store_source("function loop() { print(typeof name); }\n");
+    script_reload();
+    EXPECT_EQ("undefined\n", run_loop());
+
+    send_script_keycode(SCRIPT_STOP);
+    fs_unlink("scripts/main.js");
+#else
+    GTEST_SKIP() << "Hot reload requires SCRIPT_ENABLE with SCRIPT_JIT.";
+#endif
+}
+
+TEST(Script, KeyEventsDoNotGrowTheHeap)
+{
+#if defined(SCRIPT_ENABLE) && defined(EVENT_TIMESTAMP_ENABLE) && defined(SCRIPT_PROFILE_ENABLE)
+    load_script("var last = 0, held = Keyboard.getKey(0);\n"
+                "function onKeyDown(key) { last = key.timestamp; }\n");
+    Key *key = keyboard_get_key(0);
+    // stamps above 2^30 would need a boxed number on every event
+    g_keyboard_event_timestamp = 0x7FFFFFF0;
+    script_event_handler(MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, key));
+    uint32_t high_water;
+    uint32_t unused;
+    script_heap_usage(&high_water, &unused);
+    for (uint32_t i = 0; i < 1000; i++) {
+        g_keyboard_event_timestamp += 1000003;
+        script_event_handler(MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, key));
+    }
+    uint32_t after;
+    script_heap_usage(&after, &unused);
+    EXPECT_EQ(high_water, after);
+
+    // getKey() hands out its own object, the stamp is shared through the key
+    testing::internal::CaptureStdout();
+    const char check[] = "print(last, held === Keyboard.getKey(0), held.timestamp === last);";
+    script_eval(check, sizeof(check) - 1, "<test>");
+    EXPECT_EQ(std::to_string(g_keyboard_event_timestamp & 0x3FFFFFFF) + " false true\n",
+              testing::internal::GetCapturedStdout());
+    script_reset_runtime();
+#else
+    GTEST_SKIP() << "Key timestamps require SCRIPT_ENABLE, EVENT_TIMESTAMP_ENABLE and SCRIPT_PROFILE_ENABLE.";
+#endif
+}
+
+TEST(Script, BatchKeyAndLedCallCost)
+{
+#if defined(SCRIPT_ENABLE) && defined(RGB_ENABLE)
+    const std::string keys = std::to_string(TOTAL_KEY_NUM);
+    const int rounds = 2000;
+    load_script("function loop() {}\n");
+    const double empty = measure_loop(rounds);
+
+    load_script(("var values = new Uint16Array(" + keys + ");\n"
+                 "function loop() { Keyboard.getValues(values); }\n").c_str());
+    const double get_values = measure_loop(rounds) - empty;
+    AdvancedKey *key = &g_keyboard_advanced_keys[3];
+    const AnalogValue saved = key->value;
+    key->value = 1234;
+    g_keyboard_tick++;
+    script_process();
+    testing::internal::CaptureStdout();
+    const char check_values[] = "print(values[3]);";
+    script_eval(check_values, sizeof(check_values) - 1, "<test>");
+    EXPECT_EQ("1234\n", testing::internal::GetCapturedStdout());
+    // every call writes the whole array, whatever the script did to it
+    const char scribble[] = "values[3] = 7;";
+    script_eval(scribble, sizeof(scribble) - 1, "<test>");
+    g_keyboard_tick++;
+    script_process();
+    testing::internal::CaptureStdout();
+    script_eval(check_values, sizeof(check_values) - 1, "<test>");
+    EXPECT_EQ("1234\n", testing::internal::GetCapturedStdout());
+    key->value = saved;
+
+    load_script(("var states = new Uint32Array(" + std::to_string(KEY_BITMAP_SIZE) + ");\n"
+                 "function loop() { Keyboard.getStates(states); }\n").c_str());
+    const double get_states = measure_loop(rounds) - empty;
+
+    // the buffer is in key order and goes through the same LED mapping as setRGB
+    load_script(("var colors = new Uint8Array(" + keys + " * 3);\n"
+                 "colors[0] = 10; colors[4] = 20;\n"
+                 "function loop() { LED.setBuffer(colors); }\n").c_str());
+    const double set_buffer = measure_loop(rounds) - empty;
+    EXPECT_EQ(10, g_rgb_configs[g_rgb_inverse_mapping[0]].rgb.r);
+    EXPECT_EQ(20, g_rgb_configs[g_rgb_inverse_mapping[1]].rgb.g);
+
+    RecordProperty("ns_per_get_values", std::to_string(get_values));
+    RecordProperty("ns_per_get_states", std::to_string(get_states));
+    RecordProperty("ns_per_set_buffer", std::to_string(set_buffer));
+    script_reset_runtime();
+#else
+    GTEST_SKIP() << "Batch calls require SCRIPT_ENABLE and RGB_ENABLE.";
+#endif
+}
+
+TEST(Script, DueTimersRunInDeadlineOrderWithinBudget)
+{
+#if defined(SCRIPT_ENABLE)
+    static_assert(SCRIPT_TIMER_BUDGET == 8, "expected output assumes the default budget");
+    load_script("function t(delay, name) { setTimeout(function () { print(name); }, delay); }\n"
+                "t(30, 'h'); t(10, 'b'); t(20, 'e'); t(10, 'c'); t(5, 'a');\n"
+                "t(25, 'g'); t(20, 'f'); t(15, 'd'); t(40, 'j'); t(35, 'i');\n");
+
+    // everything falls due in one step, ties keep their creation order
+    g_keyboard_tick += KEYBOARD_TIME_TO_TICK(50);
+    timer_wheel_process();
+    testing::internal::CaptureStdout();
+    script_process();
+    EXPECT_EQ("a\nb\nc\nd\ne\nf\ng\nh\n", testing::internal::GetCapturedStdout());
+
+    // the rest waits for the next pass
+    testing::internal::CaptureStdout();
+    script_process();
+    EXPECT_EQ("i\nj\n", testing::internal::GetCapturedStdout());
+    script_reset_runtime();
+#else
+    GTEST_SKIP() << "Script timers require SCRIPT_ENABLE.";
+#endif
+}
+
+TEST(Script, LoopPacingSkipsPassesUntilDueOrMoved)
+{
+#if defined(SCRIPT_ENABLE)
+    const char busy[] = "var calls = 0;\n"
+                        "function loop() { calls++; for (var i = 0; i < 100; i++) {} }\n";
+    const char check[] = "print(calls);";
+    const int rounds = 1000;
+    load_script(busy);
+    const double unpaced = measure_loop(rounds);
+
+    load_script((std::string(busy) + "setLoopInterval(10);\n").c_str());
+    const double paced = measure_loop(rounds);
+    testing::internal::CaptureStdout();
+    script_eval(check, sizeof(check) - 1, "<test>");
+    EXPECT_EQ(std::to_string(rounds / KEYBOARD_TIME_TO_TICK(10)) + "\n", testing::internal::GetCapturedStdout());
+
+    // a woken loop runs only when a watched key moves past the threshold
+    AdvancedKey *key = &g_keyboard_advanced_keys[0];
+    const AnalogValue saved = key->value;
+    load_script((std::string(busy) + "Keyboard.watch(0);\nsetLoopWake(100);\n").c_str());
+    measure_loop(10);
+    key->value = saved + 50;
+    measure_loop(10);
+    key->value = saved + 200;
+    measure_loop(1);
+    testing::internal::CaptureStdout();
+    script_eval(check, sizeof(check) - 1, "<test>");
+    EXPECT_EQ("1\n", testing::internal::GetCapturedStdout());
+    key->value = saved;
+
+    RecordProperty("ns_per_unpaced_pass", std::to_string(unpaced));
+    RecordProperty("ns_per_paced_pass", std::to_string(paced));
+    script_reset_runtime();
+#else
+    GTEST_SKIP() << "Loop pacing requires SCRIPT_ENABLE.";
+#endif
+}
+
+TEST(Script, ProfileCountsHookCallsAndExplicitGc)
+{
+#if defined(SCRIPT_ENABLE) && defined(SCRIPT_PROFILE_ENABLE)
+    load_script("function loop() { for (var i = 0; i < 100; i++) {} }\n");
+    script_profile_reset();
+    const int rounds = 50;
+    measure_loop(rounds);
+    const ScriptHookProfile *profile = &g_script_profiles[SCRIPT_HOOK_LOOP];
+    EXPECT_EQ((uint32_t)rounds, profile->calls);
+    EXPECT_LE(profile->min_us, profile->max_us);
+    EXPECT_LE((uint64_t)profile->max_us, profile->total_us);
+    EXPECT_EQ(0u, g_script_explicit_gc_runs);
+
+    // only gc() calls from the script are counted
+    const char collect[] = "gc(); gc();";
+    script_eval(collect, sizeof(collect) - 1, "<test>");
+    EXPECT_EQ(2u, g_script_explicit_gc_runs);
+
+    uint32_t high_water_estimate;
+    uint32_t unused;
+    script_heap_usage(&high_water_estimate, &unused);
+    EXPECT_EQ((uint32_t)SCRIPT_MEMORY_SIZE, high_water_estimate + unused);
+
+    testing::internal::CaptureStdout();
+    const char check[] = "var s = Keyboard.getScriptStats('loop');\n"
+                         "print(s.calls, s.explicitGc, s.heapHighWaterEstimate > 0);";
+    script_eval(check, sizeof(check) - 1, "<test>");
+    EXPECT_EQ(std::to_string(rounds) + " 2 true\n", testing::internal::GetCapturedStdout());
+    script_reset_runtime();
+#else
+    GTEST_SKIP() << "Script profiling requires SCRIPT_ENABLE and SCRIPT_PROFILE_ENABLE.";
+#endif
+}
+
+TEST(Script, ControlKeycodesDoNotReachKeyHooks)
+{
+#if defined(SCRIPT_ENABLE) && !defined(SCRIPT_POLLING)
+    load_script("Keyboard.watch(1);\n"
+                "function onKeyDown(key) { print('down'); }\n");
+    const Keycode start = KEYCODE(SCRIPT_COLLECTION, SCRIPT_START);
+
+    // an unwatched key bound to a control keycode goes through the dispatcher only for the switch
+    testing::internal::CaptureStdout();
+    keyboard_event_handler(MK_EVENT(start, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(0)));
+    EXPECT_EQ("", testing::internal::GetCapturedStdout());
+    EXPECT_TRUE(g_keyboard_enable_script);
+
+    testing::internal::CaptureStdout();
+    keyboard_event_handler(MK_EVENT(KEY_A, KEYBOARD_EVENT_KEY_DOWN, keyboard_get_key(1)));
+    EXPECT_EQ("down\n", testing::internal::GetCapturedStdout());
+    script_reset_runtime();
+#else
+    GTEST_SKIP() << "Script key dispatch requires SCRIPT_ENABLE without SCRIPT_POLLING.";
+#endif
+}
+
+TEST(Script, XipImageRunsFromMappedFile)
+{
+#if defined(SCRIPT_ENABLE) && defined(SCRIPT_XIP_ENABLE) && (defined(__unix__) || defined(__APPLE__))
+    write_xip_image("var n = 0;\n"
+                    "function loop() { n++; print('first', n); }\n");
+    script_init();
+    g_keyboard_enable_script = true;
+    EXPECT_EQ("first 2\n", run_loop());
+
+    // a rebuilt image is remapped on the next init
+    write_xip_image("function loop() { print('second'); }\n");
+    script_init();
+    EXPECT_EQ("second\n", run_loop());
+
+    std::remove(SCRIPT_XIP_HOST_FILE);
+    script_init();
+    script_reset_runtime();
+#else
+    GTEST_SKIP() << "Execute in place requires SCRIPT_ENABLE and SCRIPT_XIP_ENABLE on a hosted build.";
+#endif
+}
+
+TEST(Script, BytecodeCacheIsUsedOnBootAndRebuiltAfterEdit)
+{
+#if defined(SCRIPT_ENABLE) && defined(SCRIPT_BYTECODE_CACHE_ENABLE)
+    const char first[] = "function loop() { print('first'); }\n";
+    const char second[] = "function loop() { print('second'); }\n";
+    std::vector<uint8_t> image(SCRIPT_BYTECODE_BUFFER_SIZE);
+    fs_unlink("scripts/cache.bin");
+
+    // a miss compiles the source and stores its image
+    store_source(second);
+    script_init();
+    g_keyboard_enable_script = true;
+    EXPECT_EQ("second\n", run_loop());
+    const size_t second_size = storage_read_script_cache(second, sizeof(second) - 1, image.data(), image.size());
+    ASSERT_GT(second_size, 0u);
+
+    // a hit runs the stored image without parsing: file it under the other source to tell them apart
+    storage_save_script_cache(first, sizeof(first) - 1, image.data(), second_size, NULL, 0);
+    store_source(first);
+    script_init();
+    EXPECT_EQ("second\n", run_loop());
+
+    // an edited source misses, recompiles and replaces the image
+    const char edited[] = "function loop() { print('edited'); }\n";
+    store_source(edited);
+    script_init();
+    EXPECT_EQ("edited\n", run_loop());
+    EXPECT_GT(storage_read_script_cache(edited, sizeof(edited) - 1, image.data(), image.size()), 0u);
+    EXPECT_EQ(0u, storage_read_script_cache(first, sizeof(first) - 1, image.data(), image.size()));
+
+    // a hot swap keeps the running script when the new module throws
+    g_keyboard_enable_script = false;
+    send_script_keycode(SCRIPT_START);
+    EXPECT_EQ("edited\n", run_loop());
+    store_source("function loop() { print('broken'); }\nmissing();\n");
+    script_reload();
+    EXPECT_EQ("edited\n", run_loop());
+
+    send_script_keycode(SCRIPT_STOP);
+    fs_unlink("scripts/main.js");
+    fs_unlink("scripts/cache.bin");
+#else
+    GTEST_SKIP() << "The bytecode cache requires SCRIPT_ENABLE with SCRIPT_BYTECODE_CACHE_ENABLE.";
+#endif
+}
+
+TEST(Script, CurveMatchesJavaScriptReference)
+{
+#if defined(SCRIPT_ENABLE) && defined(ANALOG_CURVE_ENABLE)
+    const double table[][2] = {
+        {0.05, 0.00}, {0.30, 0.10}, {0.60, 0.70}, {0.60, 0.75}, {0.90, 0.20}, {0.95, 1.00},
+    };
+    std::string points;
+    for (const auto &point : table) {
+        points += (points.empty() ? "" : ", ") + std::to_string((int)A_ANTI_NORM(point[0])) + ", " +
+                  std::to_string((int)A_ANTI_NORM(point[1]));
+    }
+    // what a script would otherwise compute per key in onKeyDown/loop
+    load_script(("var points = [" + points + "];\n"
+                 "function curve(points, x) {\n"
+                 "    if (x <= points[0]) return points[1];\n"
+                 "    for (var i = 2; i < points.length; i += 2)\n"
+                 "        if (x < points[i])\n"
+                 "            return points[i - 1] + (points[i + 1] - points[i - 1]) * (x - points[i - 2]) / (points[i] - points[i - 2]);\n"
+                 "    return points[points.length - 1];\n"
+                 "}\n"
+                 "Keyboard.setCurve(5, points);\n").c_str());
+
+    AdvancedKey key = {};
+    key.key.id = 5;
+    key.config.mode = ADVANCED_KEY_ANALOG_NORMAL_MODE;
+    key.config.activation_value = A_ANTI_NORM(0.50);
+    key.config.deactivation_value = A_ANTI_NORM(0.49);
+    for (uint32_t x = ANALOG_VALUE_MIN; x <= ANALOG_VALUE_MAX; x += 257) {
+        advanced_key_update(&key, x);
+        const std::string reference = "print(curve(points, " + std::to_string(x) + "));";
+        testing::internal::CaptureStdout();
+        script_eval(reference.c_str(), reference.size(), "<test>");
+        EXPECT_NEAR(std::stod(testing::internal::GetCapturedStdout()), key.value, 1.0) << x;
+    }
+
+    // malformed tables are rejected instead of truncated or wrapped
+    testing::internal::CaptureStdout();
+    const char probe[] = "function probe(p) { try { Keyboard.setCurve(5, p); return 'ok'; } catch (e) { return e.name; } }\n"
+                         "print(probe([100, 0, 200]), probe([0, 70000]), probe([-1, 0]), probe([0, 0, 100, 100]));";
+    script_eval(probe, sizeof(probe) - 1, "<test>");
+    EXPECT_EQ("RangeError RangeError RangeError ok\n", testing::internal::GetCapturedStdout());
+    script_reset_runtime();
+#else
+    GTEST_SKIP() << "Curves from scripts require SCRIPT_ENABLE and ANALOG_CURVE_ENABLE.";
+#endif
+}
@@ -2,9 +2,11 @@
 
 #include <array>
 #include <cstring>
+#include <vector>
 
 #include "dynamic_key.h"
 #include "file_system.h"
+#include "layer.h"
 #include "rgb.h"
 #include "script.h"
 #include "storage.h"
@@ -74,18 +76,34 @@ void fill_profile(uint16_t seed)
     }
 
     for (uint16_t i = 0; i < DYNAMIC_KEY_NUM; i++) {
-        g_dynamic_keys[i] = {};
-        g_dynamic_keys[i].dks.type = DYNAMIC_KEY_STROKE;
-        g_dynamic_keys[i].dks.key_binding[0] = static_cast<Keycode>(KEY_A + (i % 10));
-        g_dynamic_keys[i].dks.key_binding[1] = static_cast<Keycode>(KEY_B + (i % 10));
-        g_dynamic_keys[i].dks.key_control[0] = DKS_KEY_CONTROL(DKS_HOLD, DKS_TAP, DKS_RELEASE, DKS_HOLD);
-        g_dynamic_keys[i].dks.press_begin_distance = static_cast<AnalogValue>(seed + i + 20);
-        g_dynamic_keys[i].dks.press_fully_distance = static_cast<AnalogValue>(seed + i + 30);
-        g_dynamic_keys[i].dks.release_begin_distance = static_cast<AnalogValue>(seed + i + 40);
-        g_dynamic_keys[i].dks.release_fully_distance = static_cast<AnalogValue>(seed + i + 50);
+        DynamicKey dynamic_key = {};
+        dynamic_key.dks.type = DYNAMIC_KEY_STROKE;
+        dynamic_key.dks.key_binding[0] = static_cast<Keycode>(KEY_A + (i % 10));
+        dynamic_key.dks.key_binding[1] = static_cast<Keycode>(KEY_B + (i % 10));
+        dynamic_key.dks.key_control[0] = DKS_KEY_CONTROL(DKS_HOLD, DKS_TAP, DKS_RELEASE, DKS_HOLD);
+        dynamic_key.dks.press_begin_distance = static_cast<AnalogValue>(seed + i + 20);
+        dynamic_key.dks.press_fully_distance = static_cast<AnalogValue>(seed + i + 30);
+        dynamic_key.dks.release_begin_distance = static_cast<AnalogValue>(seed + i + 40);
+        dynamic_key.dks.release_fully_distance = static_cast<AnalogValue>(seed + i + 50);
+        dynamic_key_set(i, &dynamic_key);
     }
 }
 
+size_t vector_writer(void *ctx, const void *data, size_t size)
+{
+    auto *out = static_cast<std::vector<uint8_t> *>(ctx);
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    out->insert(out->end(), bytes, bytes + size);
+    return size;
+}
+
+std::vector<uint8_t> snapshot_dynamic_keys()
+{
+    std::vector<uint8_t> out;
+    dynamic_key_encode(vector_writer, &out);
+    return out;
+}
+
 template <typename T>
 void expect_memory_eq(const T& expected, const T& actual)
 {
@@ -145,14 +163,13 @@ TEST(Storage, CompleteProfileRoundTrip)
     const RGBBaseConfig expected_rgb_base = g_rgb_base_config;
     std::array<RGBConfig, RGB_NUM> expected_rgb_configs;
     std::memcpy(expected_rgb_configs.data(), g_rgb_configs, sizeof(g_rgb_configs));
-    std::array<DynamicKey, DYNAMIC_KEY_NUM> expected_dynamic_keys;
-    std::memcpy(expected_dynamic_keys.data(), g_dynamic_keys, sizeof(g_dynamic_keys));
+    const std::vector<uint8_t> expected_dynamic_keys = snapshot_dynamic_keys();
 
     storage_save_profile();
 
     std::memset(g_keymap, 0, sizeof(g_keymap));
     std::memset(g_rgb_configs, 0, sizeof(g_rgb_configs));
-    std::memset(g_dynamic_keys, 0, sizeof(g_dynamic_keys));
+    dynamic_key_clear();
     std::memset(&g_rgb_base_config, 0, sizeof(g_rgb_base_config));
     for (auto& key : g_keyboard_advanced_keys) {
         std::memset(&key.config, 0, sizeof(key.config));
@@ -164,7 +181,7 @@ TEST(Storage, CompleteProfileRoundTrip)
         expect_memory_eq(advanced_configs[i], g_keyboard_advanced_keys[i].config);
     }
     EXPECT_EQ(0, std::memcmp(expected_keymap.data(), g_keymap, sizeof(g_keymap)));
-    EXPECT_EQ(0, std::memcmp(expected_dynamic_keys.data(), g_dynamic_keys, sizeof(g_dynamic_keys)));
+    EXPECT_EQ(expected_dynamic_keys, snapshot_dynamic_keys());
 
     auto normalized_rgb_base = expected_rgb_base;
     normalized_rgb_base.begin_tick = 0;
@@ -186,8 +203,7 @@ TEST(Storage, ProfilesAreIsolated)
     storage_save_profile();
     std::array<Keycode, LAYER_NUM * TOTAL_KEY_NUM> profile0_keymap;
     std::memcpy(profile0_keymap.data(), g_keymap, sizeof(g_keymap));
-    std::array<DynamicKey, DYNAMIC_KEY_NUM> profile0_dynamic_keys;
-    std::memcpy(profile0_dynamic_keys.data(), g_dynamic_keys, sizeof(g_dynamic_keys));
+    const std::vector<uint8_t> profile0_dynamic_keys = snapshot_dynamic_keys();
 
     g_current_profile_index = 1;
     fill_profile(70);
@@ -198,7 +214,7 @@ TEST(Storage, ProfilesAreIsolated)
     g_current_profile_index = 0;
     storage_read_profile();
     EXPECT_EQ(0, std::memcmp(profile0_keymap.data(), g_keymap, sizeof(g_keymap)));
-    EXPECT_EQ(0, std::memcmp(profile0_dynamic_keys.data(), g_dynamic_keys, sizeof(g_dynamic_keys)));
+    EXPECT_EQ(profile0_dynamic_keys, snapshot_dynamic_keys());
 
     g_current_profile_index = 1;
     storage_read_profile();
@@ -246,6 +262,73 @@ TEST(Storage, VersionCheckDifferentiatesPatchAndBreakingVersions)
     EXPECT_TRUE(storage_check_version());
 }
 
+TEST(Storage, DenseKeymapReleaseForcesFactoryReset)
+{
+    // 0.2 profiles stored a dense keymap and fixed-size combo, tap dance and dynamic key tables
+    File file;
+    ASSERT_GE(fs_open(&file, "system/version", FS_O_RDWR | FS_O_CREAT), 0);
+    uint32_t dense_keymap_release[3] = {0, 2, KEYBOARD_VERSION_PATCH};
+    ASSERT_EQ(sizeof(dense_keymap_release), fs_write(&file, dense_keymap_release, sizeof(dense_keymap_release)));
+    fs_close(&file);
+    EXPECT_TRUE(storage_check_version());
+    EXPECT_FALSE(storage_check_version());
+}
+
+TEST(Storage, TruncatedKeymapStreamIsRejected)
+{
+    fill_profile(7);
+    std::vector<uint8_t> stream;
+    keymap_encode(vector_writer, &stream);
+    std::array<Keycode, LAYER_NUM * TOTAL_KEY_NUM> expected_keymap;
+    std::memcpy(expected_keymap.data(), g_keymap, sizeof(g_keymap));
+
+    File file;
+    ASSERT_GE(fs_open(&file, "system/keymap.tmp", FS_O_WRONLY | FS_O_CREAT | FS_O_TRUNC), 0);
+    ASSERT_EQ(stream.size() - 2, fs_write(&file, stream.data(), stream.size() - 2));
+    fs_close(&file);
+
+    std::memset(g_keymap, 0, sizeof(g_keymap));
+    EXPECT_FALSE(storage_load_keymap("system/keymap.tmp"));
+    for (uint16_t layer = 0; layer < LAYER_NUM; layer++) {
+        for (uint16_t key = 0; key < TOTAL_KEY_NUM; key++) {
+            EXPECT_EQ(0, g_keymap[layer][key]);
+        }
+    }
+
+    ASSERT_GE(fs_open(&file, "system/keymap.tmp", FS_O_WRONLY | FS_O_CREAT | FS_O_TRUNC), 0);
+    ASSERT_EQ(stream.size(), fs_write(&file, stream.data(), stream.size()));
+    fs_close(&file);
+    EXPECT_TRUE(storage_load_keymap("system/keymap.tmp"));
+    EXPECT_EQ(0, std::memcmp(expected_keymap.data(), g_keymap, sizeof(g_keymap)));
+    fs_unlink("system/keymap.tmp");
+}
+
+TEST(Storage, ScriptCacheInvalidatesOnSourceChange)
+{
+    const char source[] = "function loop() {}";
+    const char edited[] = "function loop() { }";
+    const uint8_t image_header[] = {0xFB, 0xAC, 0x01, 0x00};
+    const uint8_t data[] = {1, 2, 3, 4, 5, 6};
+    std::array<uint8_t, 32> buffer = {};
+
+    storage_save_script_cache(source, sizeof(source) - 1, image_header, sizeof(image_header), data, sizeof(data));
+
+    ASSERT_EQ(sizeof(image_header) + sizeof(data), storage_read_script_cache(source, sizeof(source) - 1, buffer.data(), buffer.size()));
+    EXPECT_EQ(0, std::memcmp(image_header, buffer.data(), sizeof(image_header)));
+    EXPECT_EQ(0, std::memcmp(data, buffer.data() + sizeof(image_header), sizeof(data)));
+
+    EXPECT_EQ(0U, storage_read_script_cache(edited, sizeof(edited) - 1, buffer.data(), buffer.size()));
+    EXPECT_EQ(0U, storage_read_script_cache(source, sizeof(source) - 2, buffer.data(), buffer.size()));
+    EXPECT_EQ(0U, storage_read_script_cache(source, sizeof(source) - 1, buffer.data(), sizeof(image_header)));
+
+    storage_save_script_cache(edited, sizeof(edited) - 1, image_header, sizeof(image_header), data, sizeof(data));
+    EXPECT_EQ(0U, storage_read_script_cache(source, sizeof(source) - 1, buffer.data(), buffer.size()));
+    EXPECT_EQ(sizeof(image_header) + sizeof(data), storage_read_script_cache(edited, sizeof(edited) - 1, buffer.data(), buffer.size()));
+
+    fs_unlink("scripts/cache.bin");
+    EXPECT_EQ(0U, storage_read_script_cache(edited, sizeof(edited) - 1, buffer.data(), buffer.size()));
+}
+
 TEST(Storage, ScriptBytecodeRoundTrip)
 {
 #if defined(SCRIPT_ENABLE) && SCRIPT_RUNTIME_STRATEGY == SCRIPT_AOT
@@ -0,0 +1,324 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+#include "keyboard.h"
+#include "layer.h"
+#include "packet.h"
+#include "storage.h"
+#include "tap_dance.h"
+#include "test_fixture.h"
+
+namespace {
+
+constexpr uint16_t kTerm = 20;
+
+Keycode tap_dance_keycode(uint8_t index)
+{
+    return TAP_DANCE_COLLECTION | (index << 8);
+}
+
+void bind_key(uint16_t id, Keycode keycode)
+{
+    g_keymap[0][id] = keycode;
+    layer_cache_update(id);
+}
+
+void press(uint16_t id)
+{
+    keyboard_key_update(keyboard_get_key(id), true);
+}
+
+void release(uint16_t id)
+{
+    Key *key = keyboard_get_key(id);
+    while (key->report_state)
+    {
+        keyboard_key_update(key, false);
+    }
+}
+
+void advance(uint32_t ticks)
+{
+    while (ticks--)
+    {
+        g_keyboard_tick++;
+        timer_wheel_process();
+    }
+}
+
+void send_report(void)
+{
+    keyboard_clear_buffer();
+    keyboard_fill_buffer();
+    keyboard_buffer_send();
+}
+
+bool reported(uint8_t keycode)
+{
+    for (size_t i = 2; i < 8; i++)
+    {
+        if (keyboard_send_buffer[i] == keycode)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+class TapDanceTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        g_keyboard_tick = 100;
+        for (uint16_t id = 0; id < TOTAL_KEY_NUM; id++) {
+            release(id);
+        }
+        for (uint8_t layer = 0; layer < LAYER_NUM; layer++) {
+            layer_reset(layer);
+        }
+        tap_dance_reset();
+        tap_dance_init();
+        bind_key(0, tap_dance_keycode(0));
+        bind_key(1, KEY_B);
+        bind_key(2, tap_dance_keycode(1));
+        g_tap_dances[0].term = kTerm;
+        g_tap_dances[0].tap[0] = KEY_A;
+        g_tap_dances[0].hold[0] = KEY_C;
+        g_tap_dances[1].term = kTerm;
+        g_tap_dances[1].tap[0] = KEY_A;
+        g_tap_dances[1].tap[1] = KEY_D;
+        g_tap_dances[1].hold[1] = KEY_E;
+    }
+
+    void TearDown() override {
+        for (uint16_t id = 0; id < 3; id++) {
+            release(id);
+        }
+        advance(kTerm + 1);
+    }
+};
+
+} // namespace
+
+TEST_F(TapDanceTest, QuickTapSendsTapKeycode)
+{
+    press(0);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    advance(5);
+    release(0);
+    send_report();
+    EXPECT_EQ(KEY_A, keyboard_send_buffer[2]);
+
+    advance(1);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(TapDanceTest, HoldPastTermSendsHoldKeycode)
+{
+    press(0);
+    advance(kTerm - 1);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    advance(1);
+    send_report();
+    EXPECT_EQ(KEY_C, keyboard_send_buffer[2]);
+
+    release(0);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(TapDanceTest, TapPreferredBuffersNestedKeyUntilRelease)
+{
+    press(0);
+    press(1);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    advance(2);
+    release(1);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    release(0);
+    send_report();
+    EXPECT_TRUE(reported(KEY_A));
+    EXPECT_TRUE(reported(KEY_B));
+
+    advance(1);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(TapDanceTest, PermissiveHoldOnNestedTap)
+{
+    g_tap_dances[0].flavor = TAP_DANCE_PERMISSIVE_HOLD;
+    press(0);
+    press(1);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    release(1);
+    send_report();
+    EXPECT_TRUE(reported(KEY_C));
+    EXPECT_TRUE(reported(KEY_B));
+
+    advance(1);
+    send_report();
+    EXPECT_EQ(KEY_C, keyboard_send_buffer[2]);
+    EXPECT_EQ(0, keyboard_send_buffer[3]);
+
+    release(0);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(TapDanceTest, PermissiveHoldRollResolvesTap)
+{
+    g_tap_dances[0].flavor = TAP_DANCE_PERMISSIVE_HOLD;
+    press(0);
+    press(1);
+    release(0);
+    send_report();
+    EXPECT_TRUE(reported(KEY_A));
+    EXPECT_TRUE(reported(KEY_B));
+
+    advance(1);
+    send_report();
+    EXPECT_EQ(KEY_B, keyboard_send_buffer[2]);
+    EXPECT_EQ(0, keyboard_send_buffer[3]);
+}
+
+TEST_F(TapDanceTest, HoldOnOtherKeyPress)
+{
+    g_tap_dances[0].flavor = TAP_DANCE_HOLD_ON_OTHER_KEY_PRESS;
+    press(0);
+    press(1);
+    send_report();
+    EXPECT_TRUE(reported(KEY_C));
+    EXPECT_TRUE(reported(KEY_B));
+}
+
+TEST_F(TapDanceTest, RetroTapAfterUninterruptedHold)
+{
+    g_tap_dances[0].flags = TAP_DANCE_FLAG_RETRO_TAP;
+    press(0);
+    advance(kTerm);
+    send_report();
+    EXPECT_EQ(KEY_C, keyboard_send_buffer[2]);
+
+    release(0);
+    send_report();
+    EXPECT_EQ(KEY_A, keyboard_send_buffer[2]);
+    EXPECT_EQ(0, keyboard_send_buffer[3]);
+
+    advance(1);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(TapDanceTest, RetroTapSkippedWhenInterrupted)
+{
+    g_tap_dances[0].flags = TAP_DANCE_FLAG_RETRO_TAP;
+    press(0);
+    advance(kTerm);
+    press(1);
+    release(1);
+    release(0);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(TapDanceTest, SingleTapWaitsForTermWhenMoreTapsExist)
+{
+    press(2);
+    release(2);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+
+    advance(kTerm);
+    send_report();
+    EXPECT_EQ(KEY_A, keyboard_send_buffer[2]);
+
+    advance(1);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(TapDanceTest, DoubleTapAndDoubleTapHold)
+{
+    press(2);
+    release(2);
+    advance(3);
+    press(2);
+    release(2);
+    send_report();
+    EXPECT_EQ(KEY_D, keyboard_send_buffer[2]);
+
+    advance(1);
+    press(2);
+    release(2);
+    advance(3);
+    press(2);
+    advance(kTerm);
+    send_report();
+    EXPECT_EQ(KEY_E, keyboard_send_buffer[2]);
+
+    release(2);
+    send_report();
+    EXPECT_EQ(0, keyboard_send_buffer[2]);
+}
+
+TEST_F(TapDanceTest, OtherKeySettlesPendingTapDance)
+{
+    press(2);
+    release(2);
+    press(1);
+    send_report();
+    EXPECT_TRUE(reported(KEY_A));
+    EXPECT_TRUE(reported(KEY_B));
+}
+
+TEST_F(TapDanceTest, PacketSetAndGet)
+{
+    std::array<uint8_t, 64> buffer = {};
+    PacketTapDance *packet = reinterpret_cast<PacketTapDance *>(buffer.data());
+    TapDance tap_dance = {};
+    tap_dance.flavor = TAP_DANCE_HOLD_ON_OTHER_KEY_PRESS;
+    tap_dance.term = 30;
+    tap_dance.tap[0] = KEY_ENTER;
+    tap_dance.hold[0] = KEY_ESC;
+    packet->code = PACKET_CODE_SET;
+    packet->type = PACKET_DATA_TAP_DANCE;
+    packet->index = 3;
+    std::memcpy(packet->tap_dance, &tap_dance, sizeof(tap_dance));
+    packet_process(buffer.data(), offsetof(PacketTapDance, tap_dance) + sizeof(TapDance));
+    EXPECT_EQ(0, std::memcmp(&g_tap_dances[3], &tap_dance, sizeof(tap_dance)));
+
+    buffer.fill(0);
+    packet->code = PACKET_CODE_GET;
+    packet->type = PACKET_DATA_TAP_DANCE;
+    packet->index = 3;
+    packet_process(buffer.data(), offsetof(PacketTapDance, tap_dance) + sizeof(TapDance));
+    EXPECT_EQ(0, std::memcmp(packet->tap_dance, &tap_dance, sizeof(tap_dance)));
+}
+
+TEST_F(TapDanceTest, StoredWithProfile)
+{
+    g_tap_dances[0].flavor = TAP_DANCE_PERMISSIVE_HOLD;
+    g_tap_dances[0].flags = TAP_DANCE_FLAG_RETRO_TAP;
+    storage_save_profile();
+    tap_dance_reset();
+    storage_read_profile();
+
+    EXPECT_EQ(TAP_DANCE_PERMISSIVE_HOLD, g_tap_dances[0].flavor);
+    EXPECT_EQ(TAP_DANCE_FLAG_RETRO_TAP, g_tap_dances[0].flags);
+    EXPECT_EQ(KEY_C, g_tap_dances[0].hold[0]);
+    EXPECT_EQ(KEY_E, g_tap_dances[1].hold[1]);
+}
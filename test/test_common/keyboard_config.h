@@ -9,13 +9,16 @@
 /********************/
 /* Keyboard General */
 /********************/
-#define LAYER_NUM               5
+#define LAYER_NUM               32
 #define ADVANCED_KEY_NUM        64
 #define KEY_NUM                 0
 //#define CONTINUOUS_DEBUG
 #define DEBUG_INTERVAL 1
 #define DYNAMICKEY_ENABLE
 #define MACRO_ENABLE
+#define COMBO_ENABLE
+#define TAP_DANCE_ENABLE
+#define EVENT_TIMESTAMP_ENABLE
 #define SUSPEND_ENABLE
 #define OPTIMIZE_KEY_BITMAP
 #define OPTIMIZE_MOVING_AVERAGE_FOR_RINGBUF
@@ -43,6 +46,7 @@
 /**********/
 #define RING_BUF_LEN            2
 //#define CALIBRATION_LPF_ENABLE
+#define ANALOG_CURVE_ENABLE
 
 /***********/
 /* Storage */
@@ -164,5 +168,13 @@
 /**********/
 #define SCRIPT_ENABLE
 //#define SCRIPT_MINIMAL
+#define SCRIPT_PROFILE_ENABLE
+#ifdef LIBAMP_TEST_SCRIPT_JIT
+#define SCRIPT_RUNTIME_STRATEGY SCRIPT_JIT
+#define SCRIPT_BYTECODE_CACHE_ENABLE
+#else
+#define SCRIPT_XIP_ENABLE
+#define SCRIPT_XIP_HOST_FILE "script_xip_test.bin"
+#endif
 
 #endif /* KEYBOARD_CONFIG_H_ */
@@ -10,6 +10,7 @@
 #include "midi.h"
 #include "audio.h"
 #include "test_fixture.h"
+#include "lfs.h"
 
 uint8_t shared_ep_send_buffer[LIBAMP_TEST_REPORT_BUFFER_SIZE];
 uint8_t keyboard_send_buffer[LIBAMP_TEST_REPORT_BUFFER_SIZE];
@@ -1049,6 +1050,27 @@ int led_flush(void)
 }
 
 uint8_t flash_buffer[LFS_BLOCK_SIZE*LFS_BLOCK_COUNT];
+uint32_t flash_operation_count;
+int32_t flash_fault_countdown = -1;
+
+// Returns how many bytes of the current program/erase reach the array before power is cut.
+static uint32_t flash_fault_apply(uint32_t size)
+{
+    flash_operation_count++;
+    if (flash_fault_countdown < 0)
+    {
+        return size;
+    }
+    if (flash_fault_countdown == 0)
+    {
+        return 0;
+    }
+    if (--flash_fault_countdown == 0)
+    {
+        return size / 2;
+    }
+    return size;
+}
  
 int flash_read(uint32_t addr, uint32_t size, uint8_t *data)
 {
@@ -1058,15 +1080,17 @@ int flash_read(uint32_t addr, uint32_t size, uint8_t *data)
 
 int flash_write(uint32_t addr, uint32_t size, const uint8_t *data)
 {
-    for (uint32_t i = 0; i < size; i++) {
+    uint32_t length = flash_fault_apply(size);
+    for (uint32_t i = 0; i < length; i++) {
         flash_buffer[addr + i] &= data[i];
     }
     //memcpy(flash_buffer + addr, data, size);
-    return 0;
+    return length == size ? 0 : LFS_ERR_IO;
 }
 
 int flash_erase(uint32_t addr, uint32_t size)
 {
-    memset(&flash_buffer[addr], 0xff, size);
-    return 0;
+    uint32_t length = flash_fault_apply(size);
+    memset(&flash_buffer[addr], 0xff, length);
+    return length == size ? 0 : LFS_ERR_IO;
 }
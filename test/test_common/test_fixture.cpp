@@ -6,8 +6,6 @@
 
 extern "C" {
 
-extern uint8_t flash_buffer[LFS_BLOCK_SIZE * LFS_BLOCK_COUNT];
-
 void libamp_test_clear_output_buffers(void)
 {
     std::memset(shared_ep_send_buffer, 0, sizeof(shared_ep_send_buffer));
@@ -30,6 +28,7 @@ void libamp_test_clear_output_buffers(void)
 void libamp_test_reset_environment(void)
 {
     std::memset(flash_buffer, 0xFF, LFS_BLOCK_SIZE * LFS_BLOCK_COUNT);
+    flash_fault_countdown = -1;
     keyboard_init();
     g_keyboard_config.nkro = false;
     g_keyboard_config.enable_report = true;
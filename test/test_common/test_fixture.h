@@ -25,6 +25,10 @@ extern float audio_last_stop_frequency;
 extern uint8_t audio_last_play_velocity;
 extern uint32_t midi_message_callback_count;
 extern MIDIMessage midi_last_message;
+extern uint8_t flash_buffer[LFS_BLOCK_SIZE * LFS_BLOCK_COUNT];
+// Counts emulated flash programs/erases; a positive countdown cuts power partway through that operation.
+extern uint32_t flash_operation_count;
+extern int32_t flash_fault_countdown;
 
 void libamp_test_reset_environment(void);
 void libamp_test_clear_output_buffers(void);
@@ -0,0 +1,228 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "keyboard.h"
+#include "timer_wheel.h"
+
+namespace {
+
+std::vector<int> fired;
+
+struct TimerContext {
+    int id;
+    TimerWheelNode *reschedule;
+    uint32_t delay;
+};
+
+void record(void *context)
+{
+    TimerContext *timer = static_cast<TimerContext *>(context);
+    fired.push_back(timer->id);
+    if (timer->reschedule) {
+        timer_wheel_schedule(timer->reschedule, timer->delay);
+    }
+}
+
+void advance(uint32_t ticks)
+{
+    while (ticks--) {
+        g_keyboard_tick++;
+        timer_wheel_process();
+    }
+}
+
+class TimerWheelTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        g_keyboard_tick = 1000;
+        timer_wheel_init();
+        fired.clear();
+    }
+};
+
+} // namespace
+
+TEST_F(TimerWheelTest, FiresInDeadlineOrder)
+{
+    TimerContext a = {1, nullptr, 0};
+    TimerContext b = {2, nullptr, 0};
+    TimerWheelNode node_a;
+    TimerWheelNode node_b;
+    timer_wheel_node_init(&node_a, record, &a);
+    timer_wheel_node_init(&node_b, record, &b);
+    timer_wheel_schedule(&node_a, 5);
+    timer_wheel_schedule(&node_b, 3);
+
+    advance(2);
+    EXPECT_TRUE(fired.empty());
+    advance(1);
+    ASSERT_EQ(1u, fired.size());
+    EXPECT_EQ(2, fired[0]);
+    EXPECT_FALSE(timer_wheel_is_pending(&node_b));
+    advance(2);
+    ASSERT_EQ(2u, fired.size());
+    EXPECT_EQ(1, fired[1]);
+}
+
+TEST_F(TimerWheelTest, CancelAndReschedule)
+{
+    TimerContext a = {1, nullptr, 0};
+    TimerWheelNode node_a;
+    timer_wheel_node_init(&node_a, record, &a);
+    timer_wheel_schedule(&node_a, 2);
+    timer_wheel_cancel(&node_a);
+    advance(4);
+    EXPECT_TRUE(fired.empty());
+
+    timer_wheel_schedule(&node_a, 2);
+    timer_wheel_schedule(&node_a, 6);
+    advance(5);
+    EXPECT_TRUE(fired.empty());
+    advance(1);
+    EXPECT_EQ(1u, fired.size());
+}
+
+TEST_F(TimerWheelTest, DelayLongerThanWheelSpan)
+{
+    TimerContext a = {1, nullptr, 0};
+    TimerWheelNode node_a;
+    timer_wheel_node_init(&node_a, record, &a);
+    timer_wheel_schedule(&node_a, TIMER_WHEEL_SLOT_NUM * 2 + 3);
+    advance(TIMER_WHEEL_SLOT_NUM * 2 + 2);
+    EXPECT_TRUE(fired.empty());
+    advance(1);
+    EXPECT_EQ(1u, fired.size());
+}
+
+TEST_F(TimerWheelTest, CatchesUpAfterMissedTicks)
+{
+    TimerContext a = {1, nullptr, 0};
+    TimerContext b = {2, nullptr, 0};
+    TimerWheelNode node_a;
+    TimerWheelNode node_b;
+    timer_wheel_node_init(&node_a, record, &a);
+    timer_wheel_node_init(&node_b, record, &b);
+    timer_wheel_schedule(&node_a, 10);
+    timer_wheel_schedule(&node_b, 4);
+    g_keyboard_tick += 200;
+    timer_wheel_process();
+    EXPECT_EQ(2u, fired.size());
+    EXPECT_FALSE(timer_wheel_is_pending(&node_a));
+    EXPECT_FALSE(timer_wheel_is_pending(&node_b));
+}
+
+TEST_F(TimerWheelTest, CallbackMaySchedulePendingNodes)
+{
+    TimerWheelNode node_a;
+    TimerWheelNode node_b;
+    TimerContext b = {2, nullptr, 0};
+    TimerContext a = {1, &node_b, 1};
+    timer_wheel_node_init(&node_a, record, &a);
+    timer_wheel_node_init(&node_b, record, &b);
+    timer_wheel_schedule(&node_b, 3);
+    timer_wheel_schedule(&node_a, 3);
+
+    advance(3);
+    ASSERT_EQ(1u, fired.size());
+    EXPECT_EQ(1, fired[0]);
+    EXPECT_TRUE(timer_wheel_is_pending(&node_b));
+    advance(1);
+    ASSERT_EQ(2u, fired.size());
+    EXPECT_EQ(2, fired[1]);
+}
+
+TEST_F(TimerWheelTest, FiresOnTimeAcrossLevels)
+{
+    const uint32_t delays[] = {1, TIMER_WHEEL_SLOT_NUM - 1, TIMER_WHEEL_SLOT_NUM, TIMER_WHEEL_SLOT_NUM + 1,
+                               TIMER_WHEEL_SLOT_NUM * TIMER_WHEEL_SLOT_NUM - 1, TIMER_WHEEL_SLOT_NUM * TIMER_WHEEL_SLOT_NUM,
+                               5000, 70000};
+    constexpr size_t count = sizeof(delays) / sizeof(delays[0]);
+    TimerContext contexts[count];
+    TimerWheelNode nodes[count];
+    const uint32_t begin = g_keyboard_tick;
+    for (size_t i = 0; i < count; i++) {
+        contexts[i] = {static_cast<int>(i), nullptr, 0};
+        timer_wheel_node_init(&nodes[i], record, &contexts[i]);
+        timer_wheel_schedule(&nodes[i], delays[i]);
+    }
+    EXPECT_EQ(count, timer_wheel_pending_count());
+
+    std::vector<uint32_t> fired_at(count, 0);
+    while (fired.size() < count && g_keyboard_tick - begin <= 70000) {
+        const size_t before = fired.size();
+        advance(1);
+        for (size_t i = before; i < fired.size(); i++) {
+            fired_at[fired[i]] = g_keyboard_tick - begin;
+        }
+    }
+    ASSERT_EQ(count, fired.size());
+    for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ(delays[i], fired_at[i]) << "timer " << i;
+    }
+    EXPECT_EQ(0u, timer_wheel_pending_count());
+}
+
+TEST_F(TimerWheelTest, ZeroDelayFiresOnNextProcess)
+{
+    TimerContext a = {1, nullptr, 0};
+    TimerWheelNode node_a;
+    timer_wheel_node_init(&node_a, record, &a);
+    timer_wheel_schedule(&node_a, 0);
+    timer_wheel_process();
+    EXPECT_EQ(1u, fired.size());
+}
+
+TEST_F(TimerWheelTest, DelayBeyondTopLevel)
+{
+    TimerContext a = {1, nullptr, 0};
+    TimerWheelNode node_a;
+    timer_wheel_node_init(&node_a, record, &a);
+    timer_wheel_schedule(&node_a, TIMER_WHEEL_SPAN + 10);
+    g_keyboard_tick += TIMER_WHEEL_SPAN + 9;
+    timer_wheel_process();
+    EXPECT_TRUE(fired.empty());
+    EXPECT_TRUE(timer_wheel_is_pending(&node_a));
+    advance(1);
+    EXPECT_EQ(1u, fired.size());
+}
+
+TEST_F(TimerWheelTest, LongStallCatchesUpInDeadlineOrder)
+{
+    const uint32_t delays[] = {3 * TIMER_WHEEL_SPAN, 5, 70000, TIMER_WHEEL_SPAN + 10, 300};
+    const int order[] = {2, 5, 3, 4, 1};
+    TimerContext contexts[5];
+    TimerWheelNode nodes[5];
+    for (int i = 0; i < 5; i++) {
+        contexts[i] = {i + 1, nullptr, 0};
+        timer_wheel_node_init(&nodes[i], record, &contexts[i]);
+        timer_wheel_schedule(&nodes[i], delays[i]);
+    }
+    // one process call covering many wheel spans must not walk every elapsed tick
+    g_keyboard_tick += 64 * TIMER_WHEEL_SPAN;
+    timer_wheel_process();
+    ASSERT_EQ(5u, fired.size());
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(order[i], fired[i]);
+    }
+    EXPECT_EQ(0u, timer_wheel_pending_count());
+}
+
+TEST_F(TimerWheelTest, IdleWheelFollowsTickWithoutWalking)
+{
+    EXPECT_EQ(0u, timer_wheel_pending_count());
+    g_keyboard_tick += 1000000;
+    timer_wheel_process();
+
+    TimerContext a = {1, nullptr, 0};
+    TimerWheelNode node_a;
+    timer_wheel_node_init(&node_a, record, &a);
+    timer_wheel_schedule(&node_a, 3);
+    EXPECT_EQ(1u, timer_wheel_pending_count());
+    advance(2);
+    EXPECT_TRUE(fired.empty());
+    advance(1);
+    EXPECT_EQ(1u, fired.size());
+    timer_wheel_cancel(&node_a);
+    EXPECT_EQ(0u, timer_wheel_pending_count());
+}
@@ -284,7 +284,8 @@ static int eval_file(JSContext *ctx, const char *filename,
 }
 
 static void compile_file(const char *filename, const char *outfilename,
-                         size_t mem_size, int dump_memory, int parse_flags, BOOL force_32bit)
+                         size_t mem_size, int dump_memory, int parse_flags, BOOL force_32bit,
+                         uintptr_t base_addr)
 {
     uint8_t *mem_buf;
     JSContext *ctx;
@@ -334,10 +335,12 @@ static void compile_file(const char *filename, const char *outfilename,
         if (dump_memory)
             JS_DumpMemory(ctx, (dump_memory >= 2));
         
-        /* Relocate to zero to have a deterministic
-           output. JS_DumpMemory() cannot work once the heap is relocated,
-           so we relocate after it. */
-        JS_RelocateBytecode2(ctx, &hdr_buf.hdr, (uint8_t *)data_buf, data_len, 0, FALSE);
+        /* Relocate to zero to have a deterministic output, or to the
+           address the data will sit at when the file is mapped at
+           base_addr for execute in place. JS_DumpMemory() cannot work
+           once the heap is relocated, so we relocate after it. */
+        JS_RelocateBytecode2(ctx, &hdr_buf.hdr, (uint8_t *)data_buf, data_len,
+                             base_addr ? base_addr + sizeof(JSBytecodeHeader) : 0, FALSE);
         hdr_len = sizeof(JSBytecodeHeader);
     }
     f = fopen(outfilename, "wb");
@@ -504,6 +507,7 @@ static void help(void)
            "--no-column           no column number in debug information\n"
            "-o FILE               save the bytecode to FILE\n"
            "-m32                  force 32 bit bytecode output (use with -o)\n"
+           "    --base ADDR       relocate the output for a file mapped at ADDR (use with -o)\n"
            "-b  --allow-bytecode  allow bytecode in input file\n");
     exit(1);
 }
@@ -522,12 +526,14 @@ int main(int argc, const char **argv)
     JSContext *ctx;
     int i, parse_flags;
     BOOL force_32bit, allow_bytecode;
+    uintptr_t base_addr;
     
     mem_size = 16 << 20;
     dump_memory = 0;
     parse_flags = 0;
     force_32bit = FALSE;
     allow_bytecode = FALSE;
+    base_addr = 0;
     
     /* cannot use getopt because we want to pass the command line to
        the script */
@@ -590,6 +596,19 @@ int main(int argc, const char **argv)
                 }
                 continue;
             }
+            if (!strcmp(longopt, "base")) {
+                char *p;
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting base address\n");
+                    exit(1);
+                }
+                base_addr = (uintptr_t)strtoull(argv[optind++], &p, 0);
+                if (*p != '\0' || !base_addr) {
+                    fprintf(stderr, "invalid base address\n");
+                    exit(1);
+                }
+                continue;
+            }
             if (opt == 'd' || !strcmp(longopt, "dump")) {
                 dump_memory++;
                 continue;
@@ -650,8 +669,14 @@ int main(int argc, const char **argv)
             fprintf(stderr, "expecting input filename\n");
             exit(1);
         }
+        if (base_addr && force_32bit) {
+            /* the 64 to 32 bit conversion does not take a base address; build
+               mqjs for a 32 bit host to produce relocated 32 bit images */
+            fprintf(stderr, "--base cannot be combined with -m32\n");
+            exit(1);
+        }
         compile_file(argv[optind], out_filename, mem_size, dump_memory,
-                     parse_flags, force_32bit);
+                     parse_flags, force_32bit, base_addr);
     } else {
         mem_buf = malloc(mem_size);
         ctx = JS_NewContext(mem_buf, mem_size, &js_stdlib);